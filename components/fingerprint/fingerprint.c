@@ -1,22 +1,415 @@
-#include "include/fingerprint.h"  // Direct include instead of "include/fingerprint.h"
+// Component log level from Kconfig; must be set before esp_log.h is seen
+#include "sdkconfig.h"
+#define LOG_LOCAL_LEVEL CONFIG_FINGERPRINT_LOG_LEVEL
+
+#include "fingerprint.h"
+#include "fingerprint_matcher.h"
+#include "fingerprint_notepad.h"
 #include "esp_log.h"
 #include "driver/uart.h"
 #include "esp_err.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "driver/gpio.h"
+#include "esp_sleep.h"
+#include "esp_timer.h"
 #include <string.h>
+#include <stdlib.h>
+#if CONFIG_FINGERPRINT_SECURE_CHANNEL
+#include "fingerprint_secure.h"
+#include "esp_random.h"
+#include "mbedtls/aes.h"
+#include "mbedtls/cipher.h"
+#include "mbedtls/cmac.h"
+#include "mbedtls/md.h"
+#include "mbedtls/platform_util.h"
+#endif
 
 #define TAG "FINGERPRINT"
-#define UART_NUM UART_NUM_2  // Change based on your wiring
-#define RX_BUF_SIZE 128  // Adjust based on fingerprint module response
+#define UART_NUM UART_NUM_2  // Port used by fingerprint_init(); change based on your wiring
+#define RX_BUF_SIZE 256  // Adjust based on fingerprint module response (a data packet plus framing must fit)
+
+#define UART_EVENT_QUEUE_SIZE 20   // Depth of the UART driver event queue
+#define FRAME_QUEUE_SIZE 4         // Complete frames buffered between RX task and readers
+#define RX_TASK_STACK_SIZE 3072
+#define RX_TASK_PRIORITY (configMAX_PRIORITIES - 2)
+#define RX_TIMEOUT_SYMBOLS 2       // Idle symbol times before the driver hands over buffered bytes
+#define RX_TASK_STOP UART_EVENT_MAX // Pseudo UART event telling the RX task to exit
+#define RX_TASK_RESYNC (UART_EVENT_MAX + 1) // Pseudo UART event: drop pending input and restart the framer
+#define RX_TASK_DETACH (UART_EVENT_MAX + 2) // Pseudo UART event: a bus member left; forget any frame routed to it
 
+// Settings used by fingerprint_init() for the default instance
 static int tx_pin = DEFAULT_TX_PIN; // Default TX pin
 static int rx_pin = DEFAULT_RX_PIN; // Default RX pin
+static int touch_pin = -1;          // Touch output not wired
 static int baud_rate = DEFAULT_BAUD_RATE; // Default baud rate
 
+/**
+ * @brief A complete, checksum-verified frame as assembled by the RX framer.
+ */
+typedef struct {
+    uint32_t address;                         // Module address from the frame
+    uint8_t packet_id;                        // Packet identifier (0x07 ACK, 0x02/0x08 data, ...)
+    uint16_t length;                          // Length field as received (payload + 2 checksum bytes)
+    uint16_t checksum;                        // Checksum as received
+    int64_t rx_time_us;                       // esp_timer time at which the last byte was parsed
+    uint8_t data[FINGERPRINT_MAX_DATA_LEN];   // Payload (confirmation code + parameters, or raw data)
+} fingerprint_frame_t;
+
+/**
+ * @brief States of the streaming RX framer.
+ */
+typedef enum {
+    RX_STATE_HEADER_HIGH,   // Waiting for 0xEF
+    RX_STATE_HEADER_LOW,    // Waiting for 0x01
+    RX_STATE_ADDRESS,       // Collecting the 4 address bytes
+    RX_STATE_PACKET_ID,     // Packet identifier byte
+    RX_STATE_LENGTH,        // Collecting the 2 length bytes
+    RX_STATE_PAYLOAD,       // Collecting length - 2 payload bytes
+    RX_STATE_CHECKSUM       // Collecting the 2 checksum bytes
+} fingerprint_rx_state_t;
+
+typedef struct {
+    fingerprint_rx_state_t state;
+    uint16_t index;         // Byte index within the current field
+    uint16_t sum;           // Running checksum over packet ID, length and payload
+    uint32_t address;       // Address of the frame being parsed
+    struct fingerprint_dev_t *target; // Instance the frame is routed to; owns the pool of `frame`
+    fingerprint_frame_t *frame; // Pool buffer being filled, NULL until the address is known
+} fingerprint_framer_t;
+
+#define TX_POOL_SIZE 2                          // Concurrent senders served without waiting
+#define RX_POOL_SIZE (FRAME_QUEUE_SIZE + 2)     // Queued frames + one being assembled + one being read
+#define TEMPLATE_POOL_SIZE 2                    // A host probe being searched + a template being promoted
+#define POOL_WAIT_MS 20                         // Bounded wait for a free pool buffer
+#define DEFAULT_PACKET_LEN 128                  // Module's factory data packet size, until PS_ReadSysPara says otherwise
+
+#define WORKER_QUEUE_SIZE 8
+#define WORKER_TASK_STACK_SIZE 4096
+#define WORKER_TASK_PRIORITY (configMAX_PRIORITIES - 3)
+#define MAINTENANCE_PRIORITY (tskIDLE_PRIORITY + 1)  // Worker priority while it runs a batch delete range
+#define IMAGE_TIMEOUT_MS 300       // PS_GetImage / PS_GetEnrollImage image capture
+#define FLASH_OP_TIMEOUT_MS 1000   // Commands that write the module's flash (store, delete)
+#define EXTRACT_TIMEOUT_MS 500     // PS_GenChar feature extraction
+#define SEARCH_TIMEOUT_MS 1000     // PS_Search over the template database
+#define AUTO_STAGE_TIMEOUT_MS 10000 // Gap between progress ACKs of PS_AutoEnroll/PS_Autoldentify (finger placement)
+#define FINGER_WAIT_MS 10000       // Finger placement budget for the manual enroll fallback
+#define FINGER_POLL_MS 50          // PS_GetImage poll interval for the manual enroll fallback
+#define ENROLL_ENTRIES 2           // Captures merged into one template by fingerprint_enroll()
+
+#define TIMEOUT_BY_COMMAND 0       // Reply timeout taken from fingerprint_command_timeout()
+#define TXN_MAX_ATTEMPTS 3         // Sends of one command before a lost or corrupt reply is reported
+#define TXN_BACKOFF_MS 5           // Pause before the first retry, doubled for every further one
+#define CANCEL_TIMEOUT_MS 50       // Wait for the PS_Cancel ACK during recovery
+#define RESYNC_TIMEOUT_MS 50       // Wait for the RX task to drop its pending input
+
+#define DETECT_TASK_STACK_SIZE 3072
+#define DETECT_TASK_PRIORITY (configMAX_PRIORITIES - 3)
+#define DETECT_POLL_MIN_MS 40      // PS_GetImage poll interval right after a touch (no touch line)
+#define DETECT_POLL_MAX_MS 640     // Interval the back-off settles at while the sensor stays idle
+#define POWER_ON_SETTLE_MS 60      // Time the module needs after power-up before it accepts commands
+
+#if CONFIG_FINGERPRINT_PIN_PROTOCOL_TASKS
+#define PROTOCOL_CORE CONFIG_FINGERPRINT_PROTOCOL_CORE // Core of the RX, worker and detection tasks
+#else
+#define PROTOCOL_CORE tskNO_AFFINITY
+#endif
+
+#if CONFIG_FINGERPRINT_EVENT_DISPATCHER
+#define EVENT_TASK_STACK_SIZE 3072
+#define EVENT_RING_SIZE CONFIG_FINGERPRINT_EVENT_RING_SIZE
+#if CONFIG_FINGERPRINT_PIN_PROTOCOL_TASKS
+#define EVENT_CORE CONFIG_FINGERPRINT_EVENT_CORE
+#else
+#define EVENT_CORE tskNO_AFFINITY
+#endif
+#endif
+
+#define DATA_PACKET_TIMEOUT_MS 1000 // Gap between data packets of a bulk transfer
+#define TRANSFER_BUFFER_ID 0x01    // CharBuffer used for template transfers
+
+#define BAUD_UNIT 9600             // Module baud rate = N * 9600
+#define BAUD_MULTIPLIER_MAX 12     // 115200 bps
+#define SYSPARA_REG_BAUD 4         // PS_WriteReg register holding the baud multiplier N
+#define SYSPARA_REG_PACKET_SIZE 6  // PS_WriteReg register holding the data packet size code (32 << code bytes)
+#define SYSPARA_LEN 16             // PS_ReadSysPara parameter bytes after the confirmation code
+#define PACKET_SIZE_CODE_MAX 3     // 256 bytes
+#define BAUD_SWITCH_SETTLE_MS 20   // Time the module needs to reconfigure its UART
+#define BAUD_PROBE_ATTEMPTS 2
+
+// Stage codes carried in the first parameter byte of PS_AutoEnroll/PS_Autoldentify ACKs
+#define AUTO_STAGE_LEGALITY 0x00
+#define AUTO_STAGE_GET_IMAGE 0x01
+#define AUTO_STAGE_GEN_CHAR 0x02
+#define AUTO_STAGE_FINGER_LEAVE 0x03
+#define AUTO_STAGE_MERGE 0x04
+#define AUTO_STAGE_DUPLICATE_CHECK 0x05
+#define AUTO_STAGE_STORE 0x06
+#define AUTO_STAGE_SEARCH 0x05     // PS_Autoldentify reports its search result as stage 0x05
+
+/**
+ * @brief Kinds of jobs handled by the worker task.
+ */
+typedef enum {
+    JOB_COMMAND,    // A single command/response exchange (fingerprint_submit())
+    JOB_IDENTIFY,   // GetImage -> GenChar1 -> Search pipeline (fingerprint_identify_async())
+    JOB_PROMOTE,    // Copy a host template into a hot tier page (fingerprint_dev_identify_host())
+    JOB_NOTEPAD_FLUSH, // Write changed notepad pages back (notepad timer)
+    JOB_BATCH_DELETE, // Delete a page list range by range (fingerprint_batch_delete_async())
+    JOB_STOP,       // Exit the worker task (fingerprint_del())
+} fingerprint_job_type_t;
+
+// Progress of a background batch delete; re-queued with the job whenever it yields.
+typedef struct {
+    uint16_t *pages;        // Sorted copy of the list, freed by the worker
+    size_t count;
+    size_t next;            // First entry not deleted yet
+    size_t deleted;
+    size_t commands;
+    int64_t start_us;
+    fingerprint_batch_delete_callback_t callback;
+    void *user_ctx;
+} fingerprint_batch_delete_job_t;
+
+typedef struct {
+    fingerprint_job_type_t type;
+    union {
+        fingerprint_request_t request;
+        fingerprint_identify_config_t identify;
+        struct {
+            fingerprint_host_db_handle_t db;
+            uint32_t user_id;
+        } promote;
+        fingerprint_batch_delete_job_t batch_delete;
+    };
+} fingerprint_job_t;
+
+#define INDEX_TABLE_BYTES 32       // Bitmap bytes returned by one PS_ReadIndexTable page
+#define INDEX_TABLE_PAGES (FINGERPRINT_INDEX_CAPACITY / (INDEX_TABLE_BYTES * 8))
+
+// One entry of an instance's subscriber table (fingerprint_dev_subscribe()).
+typedef struct {
+    fingerprint_subscriber_t callback;  // NULL = free slot
+    void *user_ctx;
+    uint32_t event_mask;
+} fingerprint_subscription_t;
+
+/**
+ * @brief State of one sensor: its UART link, RX/worker tasks, buffers and template index.
+ *
+ * Instances on different ports share nothing and run fully in parallel. Modules on one
+ * multi-drop bus share the owner's UART and RX task (see bus_owner); everything else,
+ * transaction lock included, stays per instance.
+ */
+typedef struct fingerprint_dev_t {
+    uart_port_t uart_port;
+    int tx_pin;
+    int rx_pin;
+    int baud_rate;                  // Requested rate, negotiated at creation
+    int link_baud;                  // Rate the link is currently running at
+    uint32_t address;               // Module address put into every frame
+    bool uart_installed;
+
+    QueueHandle_t uart_event_queue; // Filled by the UART driver
+    QueueHandle_t frame_queue;      // Complete frames (pointers into rx_pool) for readers
+    TaskHandle_t rx_task;
+    fingerprint_framer_t framer;
+    volatile uint32_t rx_dropped;   // Frames lost to checksum errors or buffer exhaustion
+    SemaphoreHandle_t resync_done;  // Given by the RX task once it has handled RX_TASK_RESYNC or RX_TASK_DETACH
+
+    // Multi-drop bus (fingerprint_config_t::bus): the owner's RX task routes frames by address
+    struct fingerprint_dev_t *bus_owner; // Instance whose UART and RX task this one uses, NULL if it owns them
+    struct fingerprint_dev_t *bus_members[FINGERPRINT_BUS_MAX_MODULES]; // On the owner: the others on its UART
+    portMUX_TYPE bus_lock;
+
+    // Fixed-size buffer pools; the free lists are queues of buffer pointers, so get/put are task-safe.
+    uint8_t tx_pool[TX_POOL_SIZE][FINGERPRINT_MAX_FRAME_LEN];
+    fingerprint_frame_t rx_pool[RX_POOL_SIZE];
+    QueueHandle_t tx_pool_free;
+    QueueHandle_t rx_pool_free;
+    uint8_t template_pool[TEMPLATE_POOL_SIZE][FINGERPRINT_MAX_TEMPLATE_LEN]; // Host probes and promotions
+    QueueHandle_t template_pool_free;
+
+    QueueHandle_t job_queue;
+    TaskHandle_t worker_task;
+    SemaphoreHandle_t txn_mutex;    // Serializes command/response exchanges on the UART
+    uint8_t unsupported[32];        // Bit n set = the module rejected command code n
+    fingerprint_sys_params_t sys_params; // Cached PS_ReadSysPara (fingerprint_dev_read_sys_params())
+    bool sys_params_valid;
+    uint16_t packet_len;            // Data packet payload for downloads
+    uint8_t info_page[FINGERPRINT_INFO_PAGE_LEN];
+    size_t info_page_len;
+    bool txn_retry_off;             // Set while probing baud rates, where silence is an expected answer
+#if CONFIG_FINGERPRINT_SECURE_CHANNEL
+    // Secure channel (fingerprint_secure.h); all under txn_mutex
+    uint8_t secure_key[FINGERPRINT_SECURE_KEY_LEN];
+    bool secure_key_set;
+    bool secure_session;            // The two contexts below hold the session keys
+    mbedtls_aes_context secure_aes; // AES-CTR encryption key schedule
+    mbedtls_cipher_context_t secure_cmac;
+    uint32_t secure_seq;            // Sequence number of the last secure command sealed
+#endif
+
+    // Notepad write-back cache (fingerprint_notepad.h); pages are loaded and written under
+    // txn_mutex, the copy itself changes under notepad_lock only
+    uint8_t notepad[FINGERPRINT_NOTEPAD_LEN];
+    uint16_t notepad_loaded;        // Bit n set = page n holds the module's content
+    uint16_t notepad_dirty;         // Bit n set = page n changed since it was last written
+    portMUX_TYPE notepad_lock;
+    esp_timer_handle_t notepad_timer; // Queues the write-back
+    uint32_t notepad_flush_ms;      // Write-back delay of the profile, 0 = explicit flushes only
+
+    // Finger detection (fingerprint_dev_start_detection())
+    int touch_pin;                  // Module's touch output, -1 if not wired
+    bool touch_active_low;
+    int power_pin;                  // Switch of the module's main supply, -1 if always powered
+    bool powered;
+    TaskHandle_t detect_task;
+    volatile bool detect_stop;
+    bool touch_isr_added;
+
+    // Power/latency profile (fingerprint_dev_set_profile()); changed under txn_mutex
+    fingerprint_profile_t profile;
+    UBaseType_t worker_priority;
+    UBaseType_t detect_priority;
+    volatile uint32_t detect_poll_min_ms;
+    volatile uint32_t detect_poll_max_ms;
+    bool power_gating;              // Power a switched module down between touches
+
+    // Host-side copy of the module's template index; bit n set = page n holds a template
+    uint8_t index_bitmap[FINGERPRINT_INDEX_CAPACITY / 8];
+    uint16_t index_count;
+    uint16_t index_capacity;
+    bool index_valid;
+    portMUX_TYPE index_lock;
+
+    fingerprint_event_handler_t event_handler;
+    fingerprint_subscription_t subscribers[FINGERPRINT_MAX_SUBSCRIBERS];
+    portMUX_TYPE subscriber_lock;
+    fingerprint_stage_times_t stages; // Stage times of the running flow; flows hold txn_mutex
+#if CONFIG_FINGERPRINT_EVENT_DISPATCHER
+    // Lock-free ring between the tasks raising events (worker, detection and calling tasks)
+    // and the dispatcher task. Slot i serves positions i, i + EVENT_RING_SIZE, ...; its sequence
+    // number says whose turn it is: position p is free to fill at p, ready to read at p + 1.
+    fingerprint_event_data_t event_ring[EVENT_RING_SIZE];
+    uint32_t event_seq[EVENT_RING_SIZE];
+    uint32_t event_head;            // Next position to claim; producers advance it by compare-and-swap
+    uint32_t event_tail;            // Next position to hand out; written by the dispatcher only
+    TaskHandle_t event_task;
+    volatile bool event_stop;
+#endif
+
+    // Instrumentation (fingerprint_dev_get_stats()); updated by callers and the RX task alike
+    fingerprint_stats_t stats;
+    portMUX_TYPE stats_lock;
+    bool reply_pending;             // A command went out and its reply has not been accounted yet
+    uint8_t pending_command;
+    int64_t pending_tx_done_us;
+} fingerprint_dev_t;
+
+static fingerprint_dev_t *default_dev = NULL;   // Instance behind the handle-less API
+
+/**
+ * @brief Kinds of trace records.
+ */
+typedef enum {
+    TRACE_SENT,         // Command written, status unused
+    TRACE_REPLY,        // Reply received, status = confirmation code
+    TRACE_TIMEOUT,      // No reply in time
+    TRACE_CHECKSUM,     // Reply failed its checksum
+} fingerprint_trace_kind_t;
+
+#if CONFIG_FINGERPRINT_TRACE
+#define TRACE_TASK_STACK_SIZE 2560
+
+// One command exchange event; formatted by the trace task, never by the caller
+typedef struct {
+    int64_t time_us;
+    uint8_t port;
+    uint8_t kind;
+    uint8_t command;
+    uint8_t status;
+} fingerprint_trace_record_t;
+
+static QueueHandle_t trace_ring = NULL;         // Records waiting to be printed
+static volatile uint32_t trace_dropped = 0;     // Records lost to a full ring
+static bool trace_started = false;
+static portMUX_TYPE trace_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Queues a record without blocking; the caller pays for a copy, not for formatting.
+static void fingerprint_trace(fingerprint_dev_t *dev, fingerprint_trace_kind_t kind, uint8_t command, uint8_t status) {
+    fingerprint_trace_record_t record = {
+        .time_us = esp_timer_get_time(),
+        .port = dev->uart_port,
+        .kind = kind,
+        .command = command,
+        .status = status,
+    };
+
+    if (trace_ring != NULL && xQueueSend(trace_ring, &record, 0) != pdTRUE) {
+        trace_dropped++;
+    }
+}
+
+// Prints the records of the ring passed in `arg` at low priority, whenever nothing more urgent runs.
+static void fingerprint_trace_task(void *arg) {
+    static const char *const kind_names[] = {"sent", "reply", "timeout", "bad checksum"};
+    QueueHandle_t ring = arg;
+    fingerprint_trace_record_t record;
+    uint32_t dropped_reported = 0;
+
+    while (1) {
+        if (xQueueReceive(ring, &record, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+        if (trace_dropped != dropped_reported) {
+            dropped_reported = trace_dropped;
+            ESP_LOGW(TAG, "Trace ring full, %u records dropped so far", (unsigned int)dropped_reported);
+        }
+        if (record.kind == TRACE_REPLY) {
+            ESP_LOGI(TAG, "[%lld us] UART%u cmd 0x%02X reply, status 0x%02X", (long long)record.time_us, record.port, record.command, record.status);
+        } else {
+            ESP_LOGI(TAG, "[%lld us] UART%u cmd 0x%02X %s", (long long)record.time_us, record.port, record.command, kind_names[record.kind]);
+        }
+    }
+}
+
+// Creates the trace ring and its task with the first instance; later calls do nothing.
+static void fingerprint_trace_start(void) {
+    portENTER_CRITICAL(&trace_lock);
+    bool first = !trace_started;
+    trace_started = true;
+    portEXIT_CRITICAL(&trace_lock);
+    if (!first) {
+        return;
+    }
+
+    QueueHandle_t ring = xQueueCreate(CONFIG_FINGERPRINT_TRACE_DEPTH, sizeof(fingerprint_trace_record_t));
+    if (ring == NULL) {
+        ESP_LOGW(TAG, "Command trace unavailable");
+        return;
+    }
+    if (xTaskCreate(fingerprint_trace_task, "fp_trace_task", TRACE_TASK_STACK_SIZE, ring, CONFIG_FINGERPRINT_TRACE_TASK_PRIORITY, NULL) != pdPASS) {
+        ESP_LOGW(TAG, "Command trace unavailable");
+        vQueueDelete(ring);
+        return;
+    }
+    trace_ring = ring;  // Published last, so nothing is queued before the task exists
+}
+#else
+#define fingerprint_trace(dev, kind, command, status) ((void)(dev))
+#define fingerprint_trace_start() ((void)0)
+#endif
+
 // Define the global event handler function pointer
 fingerprint_event_handler_t g_fingerprint_event_handler = NULL;
 
+void fingerprint_set_touch_pin(int touch) {
+    touch_pin = touch;
+}
+
 void fingerprint_set_pins(int tx, int rx) {
     tx_pin = tx;
     rx_pin = rx;
@@ -25,553 +418,4327 @@ void fingerprint_set_baudrate(int baud) {
     baud_rate = baud;
 }
 
-FingerprintPacket PS_GetImage = {
-    .header = 0xEF01,
-    .address = DEFAULT_FINGERPRINT_ADDRESS,
-    .packet_id = 0x01,
-    .length = 0x0003,
-    .command = 0x01, // Get Image
-    .parameters = {0}, // No parameters
-    .checksum = 0x0005 // Hardcoded checksum
-};
+/*
+ * Compile-time command frames.
+ *
+ * CMD_FRAMEn(code, params...) expands to the initializer of a complete, wire-ready command
+ * frame with n parameter bytes addressed to DEFAULT_FINGERPRINT_ADDRESS, and CMD_PACKETn() to
+ * the matching FingerprintPacket. Length field and checksum are folded by the compiler.
+ */
+#define CMD_PARAM_OFFSET 10                     // Header (2) + address (4) + packet ID (1) + length (2) + command (1)
+#define CMD_MAX_PARAMS 5
+#define CMD_LENGTH(n) ((n) + 3)                 // Length field: command byte, parameters, checksum
+#define CMD_FRAME_LEN(n) (FINGERPRINT_FRAME_OVERHEAD + 1 + (n))
+#define CMD_SUM(n, code, param_sum) \
+    ((FINGERPRINT_PID_COMMAND + (CMD_LENGTH(n) >> 8) + (CMD_LENGTH(n) & 0xFF) + (code) + (param_sum)) & 0xFFFF)
 
-FingerprintPacket PS_GenChar1 = {
-    .header = 0xEF01,
-    .address = DEFAULT_FINGERPRINT_ADDRESS,
-    .packet_id = 0x01,
-    .length = 0x0004,
-    .command = 0x02, // Generate Character
-    .parameters = {0x01}, // Buffer ID 1
-    .checksum = 0x0008 // Hardcoded checksum
-};
+#define CMD_FRAME_(n, code, param_sum, ...) {                                               \
+    (FINGERPRINT_HEADER >> 8) & 0xFF, FINGERPRINT_HEADER & 0xFF,                            \
+    (DEFAULT_FINGERPRINT_ADDRESS >> 24) & 0xFF, (DEFAULT_FINGERPRINT_ADDRESS >> 16) & 0xFF, \
+    (DEFAULT_FINGERPRINT_ADDRESS >> 8) & 0xFF, DEFAULT_FINGERPRINT_ADDRESS & 0xFF,          \
+    FINGERPRINT_PID_COMMAND, (CMD_LENGTH(n) >> 8) & 0xFF, CMD_LENGTH(n) & 0xFF,             \
+    (code), __VA_ARGS__                                                                     \
+    (CMD_SUM(n, code, param_sum) >> 8) & 0xFF, CMD_SUM(n, code, param_sum) & 0xFF }
+#define CMD_FRAME0(c) CMD_FRAME_(0, c, 0, )
+#define CMD_FRAME1(c, a) CMD_FRAME_(1, c, (a), a,)
+#define CMD_FRAME2(c, a, b) CMD_FRAME_(2, c, (a) + (b), a, b,)
+#define CMD_FRAME3(c, a, b, d) CMD_FRAME_(3, c, (a) + (b) + (d), a, b, d,)
+#define CMD_FRAME4(c, a, b, d, e) CMD_FRAME_(4, c, (a) + (b) + (d) + (e), a, b, d, e,)
+#define CMD_FRAME5(c, a, b, d, e, f) CMD_FRAME_(5, c, (a) + (b) + (d) + (e) + (f), a, b, d, e, f,)
 
-FingerprintPacket PS_GenChar2 = {
-    .header = 0xEF01,
-    .address = DEFAULT_FINGERPRINT_ADDRESS,
-    .packet_id = 0x01,
-    .length = 0x0004,
-    .command = 0x02, // Generate Character
-    .parameters = {0x02}, // Buffer ID 2
-    .checksum = 0x0009 // Hardcoded checksum
-};
+#define CMD_PACKET_(n, code, param_sum, ...) { \
+    .header = FINGERPRINT_HEADER,              \
+    .address = DEFAULT_FINGERPRINT_ADDRESS,    \
+    .packet_id = FINGERPRINT_PID_COMMAND,      \
+    .length = CMD_LENGTH(n),                   \
+    .command = (code),                         \
+    .parameters = {__VA_ARGS__},               \
+    .checksum = CMD_SUM(n, code, param_sum) }
+#define CMD_PACKET0(c) CMD_PACKET_(0, c, 0, 0)
+#define CMD_PACKET1(c, a) CMD_PACKET_(1, c, (a), a)
+#define CMD_PACKET2(c, a, b) CMD_PACKET_(2, c, (a) + (b), a, b)
+#define CMD_PACKET3(c, a, b, d) CMD_PACKET_(3, c, (a) + (b) + (d), a, b, d)
+#define CMD_PACKET4(c, a, b, d, e) CMD_PACKET_(4, c, (a) + (b) + (d) + (e), a, b, d, e)
+#define CMD_PACKET5(c, a, b, d, e, f) CMD_PACKET_(5, c, (a) + (b) + (d) + (e) + (f), a, b, d, e, f)
 
-FingerprintPacket PS_RegModel = {
-    .header = 0xEF01,
-    .address = DEFAULT_FINGERPRINT_ADDRESS,
-    .packet_id = 0x01,
-    .length = 0x0003,
-    .command = 0x05, // Register Model
-    .parameters = {0}, // No parameters
-    .checksum = 0x0009 // Hardcoded checksum
-};
+// Fails the build if a frame's size disagrees with the parameter count its length field announces
+#define CMD_FRAME_ASSERT(frame, n) \
+    _Static_assert(sizeof(frame) == CMD_FRAME_LEN(n), #frame " does not match its length field")
 
-FingerprintPacket PS_Search = {
-    .header = 0xEF01,
-    .address = DEFAULT_FINGERPRINT_ADDRESS,
-    .packet_id = 0x01,
-    .length = 0x0008,
-    .command = 0x04, // Search
-    .parameters = {0x00, 0x00, 0x00, 0x00, 0x00}, // Buffer ID, Start Page, Number of Pages
-    .checksum = 0x00 // Hardcoded checksum
-};
+_Static_assert(CMD_FRAME_LEN(CMD_MAX_PARAMS) <= FINGERPRINT_MAX_FRAME_LEN, "command frames must fit a TX buffer");
+_Static_assert(CMD_MAX_PARAMS <= sizeof(((FingerprintPacket *)0)->parameters), "FingerprintPacket too small for CMD_MAX_PARAMS");
 
-FingerprintPacket PS_Match = {
-    .header = 0xEF01,
-    .address = DEFAULT_FINGERPRINT_ADDRESS,
-    .packet_id = 0x01,
-    .length = 0x0003,
-    .command = 0x03, // Match
-    .parameters = {0}, // No parameters
-    .checksum = 0x0007 // Hardcoded checksum
-};
+// Fails the build if CMD_SUM() disagrees with a checksum worked out by hand from the ZW111
+// command table (packet ID + length + command + parameters). Every frame and packet below has
+// an entry restating its code and parameters; keep them in step when a template changes.
+#define CMD_SUM_ASSERT(name, n, code, param_sum, ref) \
+    _Static_assert(CMD_SUM(n, code, param_sum) == (ref), #name " checksum differs from the reference")
 
-FingerprintPacket PS_StoreChar = {
-    .header = 0xEF01,
-    .address = DEFAULT_FINGERPRINT_ADDRESS,
-    .packet_id = 0x01,
-    .length = 0x0006,
-    .command = 0x06, // Store Character
-    .parameters = {0x01, 0x00, 0x01}, // Buffer ID, Page ID
-    .checksum = 0x000F // Hardcoded checksum
-};
+// Total size of a frame, read from its length field, and its command code
+#define CMD_WIRE_LEN(frame) (9 + (((frame)[7] << 8) | (frame)[8]))
+#define CMD_CODE(frame) ((frame)[CMD_PARAM_OFFSET - 1])
 
-FingerprintPacket PS_DeletChar = {
-    .header = 0xEF01,
-    .address = DEFAULT_FINGERPRINT_ADDRESS,
-    .packet_id = 0x01,
-    .length = 0x0007,
-    .command = 0x0C, // Delete Fingerprint
-    .parameters = {0x00, 0x01, 0x00, 0x01}, // Page ID, Number of Entries
-    .checksum = 0x0015 // Hardcoded checksum
-};
+// Frames the driver sends itself live in rodata and go out with a single uart_write_bytes().
+// Parameterized ones are templates; see fingerprint_frame_patch().
+static const uint8_t frame_get_image[] = CMD_FRAME0(0x01);
+static const uint8_t frame_gen_char1[] = CMD_FRAME1(0x02, 0x01);
+static const uint8_t frame_gen_char2[] = CMD_FRAME1(0x02, 0x02);
+static const uint8_t frame_reg_model[] = CMD_FRAME0(0x05);
+static const uint8_t frame_search[] = CMD_FRAME5(0x04, 0x01, 0x00, 0x00, 0x00, 0x00);       // Buffer ID, start page, page count
+static const uint8_t frame_load_char[] = CMD_FRAME3(0x07, TRANSFER_BUFFER_ID, 0x00, 0x00);  // Buffer ID, page ID
+static const uint8_t frame_store_char[] = CMD_FRAME3(0x06, TRANSFER_BUFFER_ID, 0x00, 0x00); // Buffer ID, page ID
+static const uint8_t frame_up_char[] = CMD_FRAME1(0x08, TRANSFER_BUFFER_ID);
+static const uint8_t frame_down_char[] = CMD_FRAME1(0x09, TRANSFER_BUFFER_ID);
+static const uint8_t frame_delet_char[] = CMD_FRAME4(0x0C, 0x00, 0x00, 0x00, 0x01);         // Page ID, count
+static const uint8_t frame_empty[] = CMD_FRAME0(0x0D);
+static const uint8_t frame_read_index_table[] = CMD_FRAME1(0x1F, 0x00);                     // Index page
+static const uint8_t frame_write_reg[] = CMD_FRAME2(0x0E, 0x00, 0x00);                      // Register, value
+static const uint8_t frame_auto_enroll[] = CMD_FRAME5(0x31, 0x00, 0x00, 0x00, 0x00, 0x00);  // ID, entries, flags
+static const uint8_t frame_auto_identify[] = CMD_FRAME5(0x32, 0x00, 0xFF, 0xFF, 0x00, 0x00); // Level, ID (0xFFFF = all), flags
+static const uint8_t frame_up_image[] = CMD_FRAME0(0x0A);
+static const uint8_t frame_check_sensor[] = CMD_FRAME0(0x36);
+static const uint8_t frame_cancel[] = CMD_FRAME0(0x30);
+static const uint8_t frame_read_sys_para[] = CMD_FRAME0(0x0F);
+static const uint8_t frame_read_inf_page[] = CMD_FRAME0(0x16);
+static const uint8_t frame_read_notepad[] = CMD_FRAME1(0x19, 0x00);                         // Page
 
-FingerprintPacket PS_Empty = {
-    .header = 0xEF01,
-    .address = DEFAULT_FINGERPRINT_ADDRESS,
-    .packet_id = 0x01,
-    .length = 0x0003,
-    .command = 0x0D, // Clear Database
-    .parameters = {0}, // No parameters
-    .checksum = 0x0011 // Hardcoded checksum
-};
+CMD_FRAME_ASSERT(frame_get_image, 0);
+CMD_FRAME_ASSERT(frame_gen_char1, 1);
+CMD_FRAME_ASSERT(frame_gen_char2, 1);
+CMD_FRAME_ASSERT(frame_reg_model, 0);
+CMD_FRAME_ASSERT(frame_search, 5);
+CMD_FRAME_ASSERT(frame_load_char, 3);
+CMD_FRAME_ASSERT(frame_store_char, 3);
+CMD_FRAME_ASSERT(frame_up_char, 1);
+CMD_FRAME_ASSERT(frame_down_char, 1);
+CMD_FRAME_ASSERT(frame_delet_char, 4);
+CMD_FRAME_ASSERT(frame_empty, 0);
+CMD_FRAME_ASSERT(frame_read_index_table, 1);
+CMD_FRAME_ASSERT(frame_write_reg, 2);
+CMD_FRAME_ASSERT(frame_auto_enroll, 5);
+CMD_FRAME_ASSERT(frame_auto_identify, 5);
+CMD_FRAME_ASSERT(frame_up_image, 0);
+CMD_FRAME_ASSERT(frame_check_sensor, 0);
+CMD_FRAME_ASSERT(frame_cancel, 0);
+CMD_FRAME_ASSERT(frame_read_sys_para, 0);
+CMD_FRAME_ASSERT(frame_read_inf_page, 0);
+CMD_FRAME_ASSERT(frame_read_notepad, 1);
 
-FingerprintPacket PS_ReadSysPara = {
-    .header = 0xEF01,
-    .address = DEFAULT_FINGERPRINT_ADDRESS,
-    .packet_id = 0x01,
-    .length = 0x0003,
-    .command = 0x0F, // Read System Parameters
-    .parameters = {0}, // No parameters
-    .checksum = 0x0013 // Hardcoded checksum
-};
+CMD_SUM_ASSERT(frame_get_image, 0, 0x01, 0, 0x0005);
+CMD_SUM_ASSERT(frame_gen_char1, 1, 0x02, 0x01, 0x0008);
+CMD_SUM_ASSERT(frame_gen_char2, 1, 0x02, 0x02, 0x0009);
+CMD_SUM_ASSERT(frame_reg_model, 0, 0x05, 0, 0x0009);
+CMD_SUM_ASSERT(frame_search, 5, 0x04, 0x01, 0x000E);
+CMD_SUM_ASSERT(frame_load_char, 3, 0x07, TRANSFER_BUFFER_ID, 0x000F);
+CMD_SUM_ASSERT(frame_store_char, 3, 0x06, TRANSFER_BUFFER_ID, 0x000E);
+CMD_SUM_ASSERT(frame_up_char, 1, 0x08, TRANSFER_BUFFER_ID, 0x000E);
+CMD_SUM_ASSERT(frame_down_char, 1, 0x09, TRANSFER_BUFFER_ID, 0x000F);
+CMD_SUM_ASSERT(frame_delet_char, 4, 0x0C, 0x01, 0x0015);
+CMD_SUM_ASSERT(frame_empty, 0, 0x0D, 0, 0x0011);
+CMD_SUM_ASSERT(frame_read_index_table, 1, 0x1F, 0, 0x0024);
+CMD_SUM_ASSERT(frame_write_reg, 2, 0x0E, 0, 0x0014);
+CMD_SUM_ASSERT(frame_auto_enroll, 5, 0x31, 0, 0x003A);
+CMD_SUM_ASSERT(frame_auto_identify, 5, 0x32, 0xFF + 0xFF, 0x0239);
+CMD_SUM_ASSERT(frame_up_image, 0, 0x0A, 0, 0x000E);
+CMD_SUM_ASSERT(frame_check_sensor, 0, 0x36, 0, 0x003A);
+CMD_SUM_ASSERT(frame_cancel, 0, 0x30, 0, 0x0034);
+CMD_SUM_ASSERT(frame_read_sys_para, 0, 0x0F, 0, 0x0013);
+CMD_SUM_ASSERT(frame_read_inf_page, 0, 0x16, 0, 0x001A);
+CMD_SUM_ASSERT(frame_read_notepad, 1, 0x19, 0, 0x001E);
 
-FingerprintPacket PS_SetChipAddr = {
-    .header = 0xEF01,
-    .address = DEFAULT_FINGERPRINT_ADDRESS,
-    .packet_id = 0x01,
-    .length = 0x0007,
-    .command = 0x15, // Set Address
-    .parameters = {0x00, 0x00, 0x00, 0x02}, // New Address (modifiable)
-    .checksum = 0x0020 // Hardcoded checksum
-};
+FingerprintPacket PS_GetImage = CMD_PACKET0(0x01); // Get Image
+FingerprintPacket PS_GenChar1 = CMD_PACKET1(0x02, 0x01); // Generate Character: Buffer ID 1
+FingerprintPacket PS_GenChar2 = CMD_PACKET1(0x02, 0x02); // Generate Character: Buffer ID 2
+FingerprintPacket PS_RegModel = CMD_PACKET0(0x05); // Register Model
+FingerprintPacket PS_Search = CMD_PACKET5(0x04, 0x00, 0x00, 0x00, 0x00, 0x00); // Search: Buffer ID, Start Page, Number of Pages
+FingerprintPacket PS_Match = CMD_PACKET0(0x03); // Match
+FingerprintPacket PS_LoadChar = CMD_PACKET3(0x07, 0x01, 0x00, 0x01); // Load Character: Buffer ID, Page ID
+FingerprintPacket PS_UpChar = CMD_PACKET1(0x08, 0x01); // Upload Character: Buffer ID
+FingerprintPacket PS_DownChar = CMD_PACKET1(0x09, 0x01); // Download Character: Buffer ID
+FingerprintPacket PS_StoreChar = CMD_PACKET3(0x06, 0x01, 0x00, 0x01); // Store Character: Buffer ID, Page ID
+FingerprintPacket PS_DeletChar = CMD_PACKET4(0x0C, 0x00, 0x01, 0x00, 0x01); // Delete Fingerprint: Page ID, Number of Entries
+FingerprintPacket PS_Empty = CMD_PACKET0(0x0D); // Clear Database
+FingerprintPacket PS_ReadIndexTable = CMD_PACKET1(0x1F, 0x00); // Read Index Table: Index page (0-3, 256 templates each)
+FingerprintPacket PS_ReadSysPara = CMD_PACKET0(0x0F); // Read System Parameters
+FingerprintPacket PS_SetChipAddr = CMD_PACKET4(0x15, 0x00, 0x00, 0x00, 0x02); // Set Address: New Address (modifiable)
+FingerprintPacket PS_Cancel = CMD_PACKET0(0x30); // Cancel command
+FingerprintPacket PS_AutoEnroll = CMD_PACKET5(0x31, 0x00, 0x01, 0x02, 0x00, 0x00); // AutoEnroll command: ID number, number of entries, parameter
+FingerprintPacket PS_Autoldentify = CMD_PACKET3(0x32, 0x00, 0x12, 0x00); // AutoIdentify command: Score level, ID number
+FingerprintPacket PS_WriteReg = CMD_PACKET2(0x0E, 0x04, 0x06); // Write System Register: Register number, content (baud multiplier N = 6 -> 57600)
+FingerprintPacket PS_GetKeyt = CMD_PACKET0(0xE0); // Get key pair
+FingerprintPacket PS_SecurityStoreChar = CMD_PACKET3(0xF2, 0x01, 0x00, 0x01); // Secure Store Template: Buffer ID, Page ID
+FingerprintPacket PS_SecuritySearch = CMD_PACKET5(0xF4, 0x01, 0x00, 0x00, 0xFF, 0x00); // Secure Search: Buffer ID, Start Page, Number of Pages
+FingerprintPacket PS_Uplmage = CMD_PACKET0(0x0A); // Upload Image
+FingerprintPacket PS_Downlmage = CMD_PACKET0(0x0B); // Download Image
+FingerprintPacket PS_CheckSensor = CMD_PACKET0(0x36); // Check Sensor
+FingerprintPacket PS_RestSetting = CMD_PACKET0(0x3B); // Restore Factory Settings
+FingerprintPacket PS_ReadINFpage = CMD_PACKET0(0x16); // Read Flash Information Page
+FingerprintPacket PS_BurnCode = CMD_PACKET1(0x1A, 0x01); // Erase Code: Default upgrade mode
+FingerprintPacket PS_SetPwd = CMD_PACKET4(0x12, 0x00, 0x00, 0x00, 0x00); // Set Password: Password (modifiable)
+FingerprintPacket PS_VfyPwd = CMD_PACKET4(0x13, 0x00, 0x00, 0x00, 0x00); // Verify Password: Password
+FingerprintPacket PS_GetRandomCode = CMD_PACKET0(0x14); // Get Random Number
 
-FingerprintPacket PS_Cancel = {
+FingerprintPacket PS_WriteNotepad = {
     .header = 0xEF01,
     .address = DEFAULT_FINGERPRINT_ADDRESS,
     .packet_id = 0x01,
-    .length = 0x0003,
-    .command = 0x30, // Cancel command
-    .parameters = {0}, // No parameters
-    .checksum = 0x0033 // Needs to be recalculated
+    .length = CMD_LENGTH(33), // Page number + 32 bytes data
+    .command = 0x18, // Write Notepad
+    .parameters = {0}, // Page number; the data follows in an ExtendedPacket
+    .checksum = CMD_SUM(33, 0x18, 0) // All-zero page and data
 };
 
-FingerprintPacket PS_AutoEnroll = {
-    .header = 0xEF01,
-    .address = DEFAULT_FINGERPRINT_ADDRESS,
-    .packet_id = 0x01,
-    .length = 0x0008,
-    .command = 0x31, // AutoEnroll command
-    .parameters = {0x00, 0x01, 0x02, 0x00, 0x00}, // ID number, number of entries, parameter
-    .checksum = 0x003A // Needs to be recalculated
-};
+FingerprintPacket PS_ReadNotepad = CMD_PACKET1(0x19, 0x00); // Read Notepad: Page number
 
-FingerprintPacket PS_Autoldentify = {
-    .header = 0xEF01,
-    .address = DEFAULT_FINGERPRINT_ADDRESS,
-    .packet_id = 0x01,
-    .length = 0x0006,
-    .command = 0x32, // AutoIdentify command
-    .parameters = {0x00, 0x12, 0x00}, // Score level, ID number
-    .checksum = 0x003F // Needs to be recalculated
-};
+CMD_SUM_ASSERT(PS_GetImage, 0, 0x01, 0, 0x0005);
+CMD_SUM_ASSERT(PS_GenChar1, 1, 0x02, 0x01, 0x0008);
+CMD_SUM_ASSERT(PS_GenChar2, 1, 0x02, 0x02, 0x0009);
+CMD_SUM_ASSERT(PS_RegModel, 0, 0x05, 0, 0x0009);
+CMD_SUM_ASSERT(PS_Search, 5, 0x04, 0, 0x000D);
+CMD_SUM_ASSERT(PS_Match, 0, 0x03, 0, 0x0007);
+CMD_SUM_ASSERT(PS_LoadChar, 3, 0x07, 0x01 + 0x01, 0x0010);
+CMD_SUM_ASSERT(PS_UpChar, 1, 0x08, 0x01, 0x000E);
+CMD_SUM_ASSERT(PS_DownChar, 1, 0x09, 0x01, 0x000F);
+CMD_SUM_ASSERT(PS_StoreChar, 3, 0x06, 0x01 + 0x01, 0x000F);
+CMD_SUM_ASSERT(PS_DeletChar, 4, 0x0C, 0x01 + 0x01, 0x0016);
+CMD_SUM_ASSERT(PS_Empty, 0, 0x0D, 0, 0x0011);
+CMD_SUM_ASSERT(PS_ReadIndexTable, 1, 0x1F, 0, 0x0024);
+CMD_SUM_ASSERT(PS_ReadSysPara, 0, 0x0F, 0, 0x0013);
+CMD_SUM_ASSERT(PS_SetChipAddr, 4, 0x15, 0x02, 0x001F);
+CMD_SUM_ASSERT(PS_Cancel, 0, 0x30, 0, 0x0034);
+CMD_SUM_ASSERT(PS_AutoEnroll, 5, 0x31, 0x01 + 0x02, 0x003D);
+CMD_SUM_ASSERT(PS_Autoldentify, 3, 0x32, 0x12, 0x004B);
+CMD_SUM_ASSERT(PS_WriteReg, 2, 0x0E, 0x04 + 0x06, 0x001E);
+CMD_SUM_ASSERT(PS_GetKeyt, 0, 0xE0, 0, 0x00E4);
+CMD_SUM_ASSERT(PS_SecurityStoreChar, 3, 0xF2, 0x01 + 0x01, 0x00FB);
+CMD_SUM_ASSERT(PS_SecuritySearch, 5, 0xF4, 0x01 + 0xFF, 0x01FD);
+CMD_SUM_ASSERT(PS_Uplmage, 0, 0x0A, 0, 0x000E);
+CMD_SUM_ASSERT(PS_Downlmage, 0, 0x0B, 0, 0x000F);
+CMD_SUM_ASSERT(PS_CheckSensor, 0, 0x36, 0, 0x003A);
+CMD_SUM_ASSERT(PS_RestSetting, 0, 0x3B, 0, 0x003F);
+CMD_SUM_ASSERT(PS_ReadINFpage, 0, 0x16, 0, 0x001A);
+CMD_SUM_ASSERT(PS_BurnCode, 1, 0x1A, 0x01, 0x0020);
+CMD_SUM_ASSERT(PS_SetPwd, 4, 0x12, 0, 0x001A);
+CMD_SUM_ASSERT(PS_VfyPwd, 4, 0x13, 0, 0x001B);
+CMD_SUM_ASSERT(PS_GetRandomCode, 0, 0x14, 0, 0x0018);
+CMD_SUM_ASSERT(PS_ReadNotepad, 1, 0x19, 0, 0x001E);
+CMD_SUM_ASSERT(PS_WriteNotepad, 33, 0x18, 0, 0x003D);
 
-FingerprintPacket PS_GetKeyt = {
-    .header = 0xEF01,
-    .address = DEFAULT_FINGERPRINT_ADDRESS,
-    .packet_id = 0x01,
-    .length = 0x0003,
-    .command = 0xE0, // Get key pair
-    .parameters = {0}, // No parameters
-    .checksum = 0x00E3 // Needs to be recalculated
-};
 
-FingerprintPacket PS_SecurityStoreChar = {
-    .header = 0xEF01,
-    .address = DEFAULT_FINGERPRINT_ADDRESS,
-    .packet_id = 0x01,
-    .length = 0x0006,
-    .command = 0xF2, // Secure Store Template
-    .parameters = {0x01, 0x00, 0x01}, // Buffer ID, Page ID
-    .checksum = 0x00FB // Needs to be recalculated
-};
+// Creates a free list holding `count` buffers of `elem_size` bytes starting at `base`.
+static QueueHandle_t fingerprint_pool_create(void *base, size_t elem_size, size_t count) {
+    QueueHandle_t free_list = xQueueCreate(count, sizeof(void *));
+    if (free_list == NULL) {
+        return NULL;
+    }
+    for (size_t i = 0; i < count; i++) {
+        void *buf = (uint8_t *)base + i * elem_size;
+        xQueueSend(free_list, &buf, 0);
+    }
+    return free_list;
+}
 
-FingerprintPacket PS_SecuritySearch = {
-    .header = 0xEF01,
-    .address = DEFAULT_FINGERPRINT_ADDRESS,
-    .packet_id = 0x01,
-    .length = 0x0008,
-    .command = 0xF4, // Secure Search
-    .parameters = {0x01, 0x00, 0x00, 0xFF}, // Buffer ID, Start Page, Number of Pages
-    .checksum = 0x00FD // Needs to be recalculated
-};
+static void *fingerprint_pool_get(QueueHandle_t free_list, TickType_t wait) {
+    void *buf = NULL;
+    if (free_list == NULL || xQueueReceive(free_list, &buf, wait) != pdTRUE) {
+        return NULL;
+    }
+    return buf;
+}
 
-FingerprintPacket PS_Uplmage = {
-    .header = 0xEF01,
-    .address = DEFAULT_FINGERPRINT_ADDRESS,
-    .packet_id = 0x01,
-    .length = 0x0003,
-    .command = 0x0A, // Upload Image
-    .parameters = {0}, // No parameters
-    .checksum = 0x000D // Needs to be recalculated
-};
+static void fingerprint_pool_put(QueueHandle_t free_list, void *buf) {
+    if (buf != NULL) {
+        xQueueSend(free_list, &buf, 0);
+    }
+}
 
-FingerprintPacket PS_Downlmage = {
-    .header = 0xEF01,
-    .address = DEFAULT_FINGERPRINT_ADDRESS,
-    .packet_id = 0x01,
-    .length = 0x0003,
-    .command = 0x0B, // Download Image
-    .parameters = {0}, // No parameters
-    .checksum = 0x000E // Needs to be recalculated
-};
+// Adds one duration to a log2 histogram with millisecond buckets.
+static void fingerprint_histogram_add(fingerprint_histogram_t *h, int64_t us) {
+    uint32_t duration = (us > 0) ? (uint32_t)us : 0;
+    uint32_t ms = duration / 1000;
+    size_t bucket = 0;
 
-FingerprintPacket PS_CheckSensor = {
-    .header = 0xEF01,
-    .address = DEFAULT_FINGERPRINT_ADDRESS,
-    .packet_id = 0x01,
-    .length = 0x0003,
-    .command = 0x36, // Check Sensor
-    .parameters = {0}, // No parameters
-    .checksum = 0x0039 // Needs to be recalculated
-};
+    while (ms > 0 && bucket < FINGERPRINT_STATS_BUCKETS - 1) {
+        ms >>= 1;
+        bucket++;
+    }
+    h->count++;
+    h->total_us += duration;
+    if (duration > h->max_us) {
+        h->max_us = duration;
+    }
+    h->buckets[bucket]++;
+}
 
-FingerprintPacket PS_RestSetting = {
-    .header = 0xEF01,
-    .address = DEFAULT_FINGERPRINT_ADDRESS,
-    .packet_id = 0x01,
-    .length = 0x0003,
-    .command = 0x3B, // Restore Factory Settings
-    .parameters = {0}, // No parameters
-    .checksum = 0x003E // Needs to be recalculated
-};
+// Entry of `code` in the per-command table, claimed on first use; NULL once the table is full.
+static fingerprint_command_stats_t *fingerprint_stats_command(fingerprint_dev_t *dev, uint8_t code) {
+    fingerprint_stats_t *stats = &dev->stats;
 
-FingerprintPacket PS_ReadINFpage = {
-    .header = 0xEF01,
-    .address = DEFAULT_FINGERPRINT_ADDRESS,
-    .packet_id = 0x01,
-    .length = 0x0003,
-    .command = 0x16, // Read Flash Information Page
-    .parameters = {0}, // No parameters
-    .checksum = 0x0019 // Needs to be recalculated
-};
+    for (size_t i = 0; i < stats->command_count; i++) {
+        if (stats->commands[i].command == code) {
+            return &stats->commands[i];
+        }
+    }
+    if (stats->command_count == FINGERPRINT_STATS_COMMANDS) {
+        return NULL;
+    }
+    fingerprint_command_stats_t *entry = &stats->commands[stats->command_count++];
+    entry->command = code;
+    return entry;
+}
 
-FingerprintPacket PS_BurnCode = {
-    .header = 0xEF01,
-    .address = DEFAULT_FINGERPRINT_ADDRESS,
-    .packet_id = 0x01,
-    .length = 0x0004,
-    .command = 0x1A, // Erase Code
-    .parameters = {0x01}, // Default upgrade mode
-    .checksum = 0x001F // Needs to be recalculated
-};
+// Accounts a command that has just been written out; its reply is matched by fingerprint_stats_reply().
+static void fingerprint_stats_sent(fingerprint_dev_t *dev, uint8_t code, int64_t start_us, size_t bytes) {
+    int64_t done_us = esp_timer_get_time();
 
-FingerprintPacket PS_SetPwd = {
-    .header = 0xEF01,
-    .address = DEFAULT_FINGERPRINT_ADDRESS,
-    .packet_id = 0x01,
-    .length = 0x0007,
-    .command = 0x12, // Set Password
-    .parameters = {0x00, 0x00, 0x00, 0x00}, // Password (modifiable)
-    .checksum = 0x0019 // Needs to be recalculated
-};
+    portENTER_CRITICAL(&dev->stats_lock);
+    dev->stats.bytes_tx += bytes;
+    dev->stats.frames_tx++;
+    fingerprint_command_stats_t *entry = fingerprint_stats_command(dev, code);
+    if (entry != NULL) {
+        entry->sent++;
+        fingerprint_histogram_add(&entry->send, done_us - start_us);
+    }
+    dev->reply_pending = true;
+    dev->pending_command = code;
+    dev->pending_tx_done_us = done_us;
+    portEXIT_CRITICAL(&dev->stats_lock);
+
+    fingerprint_trace(dev, TRACE_SENT, code, 0);
+}
+
+/**
+ * @brief Accounts the outcome of waiting for the reply to the last command sent.
+ *
+ * The reply's first byte is placed one wire time before its last one was parsed, which
+ * splits the wait into module processing time and RX time (wire time plus hand-over).
+ * The outcome is also traced; replies that follow no command (progress ACKs) are traced
+ * under the last command sent.
+ */
+static void fingerprint_stats_reply(fingerprint_dev_t *dev, esp_err_t err, const fingerprint_frame_t *frame) {
+    int64_t now_us = esp_timer_get_time();
+
+    portENTER_CRITICAL(&dev->stats_lock);
+    if (err == ESP_ERR_TIMEOUT) {
+        dev->stats.timeouts++;
+    }
+    if (dev->reply_pending) {
+        fingerprint_command_stats_t *entry = fingerprint_stats_command(dev, dev->pending_command);
+        if (entry != NULL && err == ESP_OK) {
+            int64_t wire_us = (int64_t)(frame->length + 9) * 10 * 1000000 / dev->link_baud;
+            int64_t start_us = frame->rx_time_us - wire_us;
+            fingerprint_histogram_add(&entry->process, start_us - dev->pending_tx_done_us);
+            fingerprint_histogram_add(&entry->rx, now_us - start_us);
+        } else if (entry != NULL && err == ESP_ERR_TIMEOUT) {
+            entry->timeouts++;
+        } else if (entry != NULL && err == ESP_ERR_INVALID_CRC) {
+            entry->checksum_errors++;
+        }
+        dev->reply_pending = false;
+    }
+    portEXIT_CRITICAL(&dev->stats_lock);
+
+    if (err == ESP_OK) {
+        fingerprint_trace(dev, TRACE_REPLY, dev->pending_command, frame->length > 2 ? frame->data[0] : 0);
+    } else {
+        fingerprint_trace(dev, err == ESP_ERR_TIMEOUT ? TRACE_TIMEOUT : TRACE_CHECKSUM, dev->pending_command, 0);
+    }
+}
+
+// Adds one run of a higher-level flow that started at `start_us`.
+static void fingerprint_stats_flow(fingerprint_dev_t *dev, fingerprint_flow_t flow, int64_t start_us) {
+    int64_t now_us = esp_timer_get_time();
+
+    portENTER_CRITICAL(&dev->stats_lock);
+    fingerprint_histogram_add(&dev->stats.flows[flow], now_us - start_us);
+    portEXIT_CRITICAL(&dev->stats_lock);
+}
+
+// Bumps one of the link-wide counters in `dev->stats`.
+#define STATS_COUNT(dev, counter, n) do {      \
+        portENTER_CRITICAL(&(dev)->stats_lock); \
+        (dev)->stats.counter += (n);            \
+        portEXIT_CRITICAL(&(dev)->stats_lock);  \
+    } while (0)
+
+static void fingerprint_framer_reset(fingerprint_framer_t *f) {
+    f->state = RX_STATE_HEADER_HIGH;
+    f->index = 0;
+    f->sum = 0;
+}
+
+/**
+ * @brief Hands a finished frame to readers, dropping it if the checksum does not match.
+ *
+ * A dropped frame's buffer stays with the framer and is reused for the next frame. In its
+ * place readers get a NULL entry, so a corrupt reply is noticed at once instead of after
+ * the full reply timeout.
+ */
+static void fingerprint_framer_deliver(fingerprint_dev_t *dev) {
+    fingerprint_framer_t *f = &dev->framer;
+    fingerprint_dev_t *target = f->target;  // `dev` itself unless another bus member was addressed
+
+    if (f->frame->checksum != f->sum) {
+        fingerprint_frame_t *corrupt = NULL;
+        ESP_LOGW(TAG, "RX checksum mismatch! Computed: 0x%04X, Received: 0x%04X", f->sum, f->frame->checksum);
+        target->rx_dropped++;
+        STATS_COUNT(target, checksum_errors, 1);
+        xQueueSend(target->frame_queue, &corrupt, 0);
+        return;
+    }
+    f->frame->rx_time_us = esp_timer_get_time();
+    STATS_COUNT(target, frames_rx, 1);
+    if (xQueueSend(target->frame_queue, &f->frame, 0) != pdTRUE) {
+        ESP_LOGW(TAG, "RX frame queue full, dropping frame (packet ID 0x%02X)", f->frame->packet_id);
+        target->rx_dropped++;
+        STATS_COUNT(target, frames_dropped, 1);
+        return;
+    }
+    f->frame = NULL;
+}
+
+// Instance a frame from `address` belongs to: the bus member with that address, else the UART's owner.
+static fingerprint_dev_t *fingerprint_bus_route(fingerprint_dev_t *owner, uint32_t address) {
+    fingerprint_dev_t *target = owner;
+
+    portENTER_CRITICAL(&owner->bus_lock);
+    for (int i = 0; i < FINGERPRINT_BUS_MAX_MODULES; i++) {
+        if (owner->bus_members[i] != NULL && owner->bus_members[i]->address == address) {
+            target = owner->bus_members[i];
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&owner->bus_lock);
+    return target;
+}
+
+/**
+ * @brief Feeds received bytes into the framer.
+ *
+ * Bytes may arrive in arbitrary bursts; the framer keeps its state between calls,
+ * resynchronizes on the 0xEF01 header and rejects frames whose length field cannot be valid.
+ */
+static void fingerprint_framer_feed(fingerprint_dev_t *dev, const uint8_t *bytes, size_t len) {
+    fingerprint_framer_t *f = &dev->framer;
+
+    for (size_t i = 0; i < len; i++) {
+        uint8_t b = bytes[i];
+        switch (f->state) {
+        case RX_STATE_HEADER_HIGH:
+            if (b == ((FINGERPRINT_HEADER >> 8) & 0xFF)) {
+                f->state = RX_STATE_HEADER_LOW;
+            }
+            break;
+        case RX_STATE_HEADER_LOW:
+            if (b == (FINGERPRINT_HEADER & 0xFF)) {
+                f->state = RX_STATE_ADDRESS;
+                f->index = 0;
+                f->address = 0;
+            } else if (b != ((FINGERPRINT_HEADER >> 8) & 0xFF)) {
+                f->state = RX_STATE_HEADER_HIGH;
+            }
+            break;
+        case RX_STATE_ADDRESS: {
+            f->address = (f->address << 8) | b;
+            if (++f->index < 4) {
+                break;
+            }
+            // The frame is assembled in a buffer of the addressed instance, so one module's
+            // bulk transfer cannot starve the others on a bus
+            fingerprint_dev_t *target = fingerprint_bus_route(dev, f->address);
+            if (f->frame != NULL && f->target != target) {
+                fingerprint_pool_put(f->target->rx_pool_free, f->frame);
+                f->frame = NULL;
+            }
+            f->target = target;
+            if (f->frame == NULL) {
+                f->frame = fingerprint_pool_get(target->rx_pool_free, 0);
+                if (f->frame == NULL) {
+                    ESP_LOGW(TAG, "RX pool exhausted, dropping frame");
+                    target->rx_dropped++;
+                    STATS_COUNT(target, frames_dropped, 1);
+                    f->state = RX_STATE_HEADER_HIGH;
+                    break;
+                }
+            }
+            f->frame->address = f->address;
+            f->state = RX_STATE_PACKET_ID;
+            break;
+        }
+        case RX_STATE_PACKET_ID:
+            f->frame->packet_id = b;
+            f->sum = b;
+            f->frame->length = 0;
+            f->index = 0;
+            f->state = RX_STATE_LENGTH;
+            break;
+        case RX_STATE_LENGTH:
+            f->frame->length = (f->frame->length << 8) | b;
+            f->sum += b;
+            if (++f->index == 2) {
+                if (f->frame->length < 2 || f->frame->length > FINGERPRINT_MAX_DATA_LEN + 2) {
+                    ESP_LOGW(TAG, "RX invalid length %u, resyncing", f->frame->length);
+                    fingerprint_framer_reset(f);
+                    break;
+                }
+                f->index = 0;
+                f->frame->checksum = 0;
+                f->state = (f->frame->length == 2) ? RX_STATE_CHECKSUM : RX_STATE_PAYLOAD;
+            }
+            break;
+        case RX_STATE_PAYLOAD: {
+            // Take the whole run of payload bytes in this burst at once
+            size_t run = f->frame->length - 2 - f->index;
+            if (run > len - i) {
+                run = len - i;
+            }
+            memcpy(&f->frame->data[f->index], &bytes[i], run);
+            f->sum = fingerprint_checksum_update(f->sum, &bytes[i], run);
+            f->index += run;
+            i += run - 1;
+            if (f->index == f->frame->length - 2) {
+                f->index = 0;
+                f->state = RX_STATE_CHECKSUM;
+            }
+            break;
+        }
+        case RX_STATE_CHECKSUM:
+            f->frame->checksum = (f->frame->checksum << 8) | b;
+            if (++f->index == 2) {
+                fingerprint_framer_deliver(dev);
+                fingerprint_framer_reset(f);
+            }
+            break;
+        }
+    }
+}
+
+// Drains UART driver events and feeds the received bytes into the framer as soon as they arrive.
+static void fingerprint_rx_task(void *arg) {
+    fingerprint_dev_t *dev = arg;
+    uart_event_t event;
+    uint8_t chunk[RX_BUF_SIZE];
+
+    dev->framer.frame = NULL;
+    dev->framer.target = dev;
+    fingerprint_framer_reset(&dev->framer);
+    while (1) {
+        if (xQueueReceive(dev->uart_event_queue, &event, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+        switch ((int)event.type) {  // Also carries the RX_TASK_* pseudo events
+        case UART_DATA: {
+            size_t remaining = event.size;
+            while (remaining > 0) {
+                size_t want = remaining < sizeof(chunk) ? remaining : sizeof(chunk);
+                int n = uart_read_bytes(dev->uart_port, chunk, want, 0);
+                if (n <= 0) {
+                    break;
+                }
+                fingerprint_framer_feed(dev, chunk, n);
+                STATS_COUNT(dev, bytes_rx, n);
+                remaining -= n;
+            }
+            break;
+        }
+        case UART_FIFO_OVF:
+        case UART_BUFFER_FULL:
+            ESP_LOGW(TAG, "UART RX overflow, flushing input");
+            STATS_COUNT(dev, line_errors, 1);
+            uart_flush_input(dev->uart_port);
+            xQueueReset(dev->uart_event_queue);
+            fingerprint_framer_reset(&dev->framer);
+            break;
+        case UART_FRAME_ERR:
+        case UART_PARITY_ERR:
+            ESP_LOGW(TAG, "UART line error (event %d), resyncing", event.type);
+            STATS_COUNT(dev, line_errors, 1);
+            fingerprint_framer_reset(&dev->framer);
+            break;
+        case RX_TASK_RESYNC:
+            uart_flush_input(dev->uart_port);
+            fingerprint_framer_reset(&dev->framer);
+            xSemaphoreGive(dev->resync_done);
+            break;
+        case RX_TASK_DETACH:
+            // A buffer of the member that left goes away with its pool
+            if (dev->framer.target != dev && fingerprint_bus_route(dev, dev->framer.target->address) != dev->framer.target) {
+                dev->framer.frame = NULL;
+                dev->framer.target = dev;
+                fingerprint_framer_reset(&dev->framer);
+            }
+            xSemaphoreGive(dev->resync_done);
+            break;
+        case RX_TASK_STOP:
+            dev->rx_task = NULL;
+            vTaskDelete(NULL);
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+static bool fingerprint_bus_shared(fingerprint_dev_t *dev);
+
+/**
+ * @brief Takes the serial lines away from the UART and holds them low.
+ *
+ * An idle TX line sits high and would feed the unpowered module through its RX input.
+ */
+static void fingerprint_uart_park(fingerprint_dev_t *dev) {
+    const gpio_config_t tx_config = {
+        .pin_bit_mask = 1ULL << dev->tx_pin,
+        .mode = GPIO_MODE_OUTPUT,
+        .pull_up_en = GPIO_PULLUP_DISABLE,
+        .pull_down_en = GPIO_PULLDOWN_DISABLE,
+        .intr_type = GPIO_INTR_DISABLE,
+    };
+    const gpio_config_t rx_config = {
+        .pin_bit_mask = 1ULL << dev->rx_pin,
+        .mode = GPIO_MODE_INPUT,
+        .pull_up_en = GPIO_PULLUP_DISABLE,
+        .pull_down_en = GPIO_PULLDOWN_ENABLE,
+        .intr_type = GPIO_INTR_DISABLE,
+    };
+
+    uart_wait_tx_done(dev->uart_port, pdMS_TO_TICKS(UART_READ_TIMEOUT));
+    gpio_config(&tx_config);
+    gpio_set_level(dev->tx_pin, 0);
+    gpio_config(&rx_config);
+}
+
+/**
+ * @brief Switches the module's main supply, if it is switched at all.
+ *
+ * Follows the power sequence of the ZW111 datasheet: the serial lines are pulled low before
+ * the supply goes off, and handed back to the UART only once the module has settled after
+ * power-up. Lines shared with other modules on a bus stay with the UART. Callers hold the
+ * transaction lock, so a command never goes out while the module boots.
+ */
+static void fingerprint_power_set(fingerprint_dev_t *dev, bool on) {
+    if (dev->power_pin < 0 || dev->powered == on) {
+        return;
+    }
+    bool park = !fingerprint_bus_shared(dev);
+    if (!on && park) {
+        fingerprint_uart_park(dev);
+    }
+    gpio_set_level(dev->power_pin, on ? 1 : 0);
+    dev->powered = on;
+    if (on) {
+        vTaskDelay(pdMS_TO_TICKS(POWER_ON_SETTLE_MS));
+        if (park) {
+            uart_set_pin(dev->uart_port, dev->tx_pin, dev->rx_pin, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE);
+            uart_flush_input(dev->uart_port);  // The pulled-down RX line read as garbage meanwhile
+        }
+    }
+}
+
+// True while a finger rests on the sensor, as reported by the touch output.
+static bool fingerprint_touch_active(fingerprint_dev_t *dev) {
+    return gpio_get_level(dev->touch_pin) == (dev->touch_active_low ? 0 : 1);
+}
+
+/**
+ * @brief Arms a one-shot interrupt for the touch line reaching the `touched` state.
+ *
+ * Level interrupts are used so that the same condition can wake the chip from light sleep.
+ */
+static void fingerprint_touch_arm(fingerprint_dev_t *dev, bool touched) {
+    gpio_int_type_t type = (touched != dev->touch_active_low) ? GPIO_INTR_HIGH_LEVEL : GPIO_INTR_LOW_LEVEL;
+
+    gpio_set_intr_type(dev->touch_pin, type);
+    gpio_wakeup_enable(dev->touch_pin, type);
+    gpio_intr_enable(dev->touch_pin);
+}
+
+// Hands a touch line change to the detection task; the task re-arms for the opposite level.
+static void fingerprint_touch_isr(void *arg) {
+    fingerprint_dev_t *dev = arg;
+    BaseType_t woken = pdFALSE;
+
+    gpio_intr_disable(dev->touch_pin);
+    if (dev->detect_task != NULL) {
+        vTaskNotifyGiveFromISR(dev->detect_task, &woken);
+    }
+    portYIELD_FROM_ISR(woken);
+}
+
+// Configures the optional power switch and touch output of a new instance.
+static esp_err_t fingerprint_gpio_setup(fingerprint_dev_t *dev) {
+    esp_err_t err;
+
+    if (dev->power_pin >= 0) {
+        gpio_config_t power_config = {
+            .pin_bit_mask = 1ULL << dev->power_pin,
+            .mode = GPIO_MODE_OUTPUT,
+            .pull_up_en = GPIO_PULLUP_DISABLE,
+            .pull_down_en = GPIO_PULLDOWN_DISABLE,
+            .intr_type = GPIO_INTR_DISABLE,
+        };
+        err = gpio_config(&power_config);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to configure power pin %d", dev->power_pin);
+            return err;
+        }
+        dev->powered = false;
+        fingerprint_power_set(dev, true);
+    }
+
+    if (dev->touch_pin >= 0) {
+        gpio_config_t touch_config = {
+            .pin_bit_mask = 1ULL << dev->touch_pin,
+            .mode = GPIO_MODE_INPUT,
+            .pull_up_en = GPIO_PULLUP_DISABLE,
+            .pull_down_en = GPIO_PULLDOWN_DISABLE,
+            .intr_type = GPIO_INTR_DISABLE,
+        };
+        err = gpio_config(&touch_config);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to configure touch pin %d", dev->touch_pin);
+            return err;
+        }
+        // The ISR service is shared with the application and may already be installed
+        err = gpio_install_isr_service(0);
+        if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) {
+            ESP_LOGE(TAG, "Failed to install GPIO ISR service");
+            return err;
+        }
+        err = gpio_isr_handler_add(dev->touch_pin, fingerprint_touch_isr, dev);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to add touch ISR");
+            return err;
+        }
+        dev->touch_isr_added = true;
+        gpio_intr_disable(dev->touch_pin);  // Armed by the detection task only
+    }
+    return ESP_OK;
+}
+
+static void fingerprint_worker_task(void *arg);
+static void fingerprint_notepad_timer(void *arg);
+static void fingerprint_notepad_arm(fingerprint_dev_t *dev);
+static void fingerprint_raise(fingerprint_dev_t *dev, fingerprint_event_t event, fingerprint_status_t status, uint16_t page_id, uint16_t score);
+static void fingerprint_stages_begin(fingerprint_dev_t *dev, int64_t start_us);
+#if CONFIG_FINGERPRINT_EVENT_DISPATCHER
+static void fingerprint_event_task(void *arg);
+#endif
+#if CONFIG_FINGERPRINT_MAX_PACKET_SIZE
+static esp_err_t fingerprint_set_packet_size(fingerprint_dev_t *dev, uint8_t code);
+#endif
+
+// True if the instance's UART carries other modules' frames too.
+static bool fingerprint_bus_shared(fingerprint_dev_t *dev) {
+    if (dev->bus_owner != NULL) {
+        return true;
+    }
+    for (int i = 0; i < FINGERPRINT_BUS_MAX_MODULES; i++) {
+        if (dev->bus_members[i] != NULL) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Adds `dev` to the modules whose frames the owner's RX task routes; addresses must be unique on the bus.
+static esp_err_t fingerprint_bus_attach(fingerprint_dev_t *owner, fingerprint_dev_t *dev) {
+    esp_err_t err = (dev->address == owner->address) ? ESP_ERR_INVALID_ARG : ESP_ERR_NO_MEM;
+    int slot = -1;
+
+    portENTER_CRITICAL(&owner->bus_lock);
+    for (int i = 0; i < FINGERPRINT_BUS_MAX_MODULES && err != ESP_ERR_INVALID_ARG; i++) {
+        if (owner->bus_members[i] == NULL) {
+            slot = (slot < 0) ? i : slot;
+        } else if (owner->bus_members[i]->address == dev->address) {
+            err = ESP_ERR_INVALID_ARG;
+        }
+    }
+    if (err != ESP_ERR_INVALID_ARG && slot >= 0) {
+        owner->bus_members[slot] = dev;
+        dev->bus_owner = owner;
+        err = ESP_OK;
+    }
+    portEXIT_CRITICAL(&owner->bus_lock);
+
+    if (err == ESP_ERR_INVALID_ARG) {
+        ESP_LOGE(TAG, "Address 0x%08X already used on UART%d", (unsigned int)dev->address, owner->uart_port);
+    } else if (err != ESP_OK) {
+        ESP_LOGE(TAG, "UART%d already carries %d modules", owner->uart_port, FINGERPRINT_BUS_MAX_MODULES + 1);
+    }
+    return err;
+}
+
+// Removes `dev` from its bus and waits until the owner's RX task no longer touches its buffers.
+static void fingerprint_bus_detach(fingerprint_dev_t *dev) {
+    fingerprint_dev_t *owner = dev->bus_owner;
+    uart_event_t detach = { .type = RX_TASK_DETACH };
+
+    portENTER_CRITICAL(&owner->bus_lock);
+    for (int i = 0; i < FINGERPRINT_BUS_MAX_MODULES; i++) {
+        if (owner->bus_members[i] == dev) {
+            owner->bus_members[i] = NULL;
+        }
+    }
+    portEXIT_CRITICAL(&owner->bus_lock);
+
+    // resync_done is shared with the owner's link recovery, which runs under its txn_mutex
+    xSemaphoreTakeRecursive(owner->txn_mutex, portMAX_DELAY);
+    xSemaphoreTake(owner->resync_done, 0);
+    xQueueSend(owner->uart_event_queue, &detach, portMAX_DELAY);
+    xSemaphoreTake(owner->resync_done, portMAX_DELAY);
+    xSemaphoreGiveRecursive(owner->txn_mutex);
+    dev->bus_owner = NULL;
+}
+
+/**
+ * @brief Stops the instance's tasks and releases everything it owns.
+ *
+ * Also serves as the error path of fingerprint_new(), so any member may still be unset.
+ */
+static void fingerprint_dev_destroy(fingerprint_dev_t *dev) {
+    if (dev->notepad_timer != NULL) {
+        esp_timer_stop(dev->notepad_timer);
+        esp_timer_delete(dev->notepad_timer);
+        dev->notepad_timer = NULL;
+    }
+    if (dev->notepad_dirty != 0) {
+        fingerprint_dev_notepad_flush(dev);  // Pages only get dirty once the instance is up
+    }
+    fingerprint_dev_stop_detection(dev);
+    if (dev->touch_isr_added) {
+        gpio_intr_disable(dev->touch_pin);
+        gpio_isr_handler_remove(dev->touch_pin);
+    }
+    if (dev->worker_task != NULL) {
+        // Jobs queued before this one still run; the worker exits when it reaches the stop job
+        fingerprint_job_t stop = { .type = JOB_STOP };
+        xQueueSend(dev->job_queue, &stop, portMAX_DELAY);
+        while (dev->worker_task != NULL) {
+            vTaskDelay(1);
+        }
+    }
+    if (dev->bus_owner != NULL) {
+        fingerprint_bus_detach(dev);
+    }
+    if (dev->rx_task != NULL) {
+        uart_event_t stop = { .type = RX_TASK_STOP };
+        xQueueSend(dev->uart_event_queue, &stop, portMAX_DELAY);
+        while (dev->rx_task != NULL) {
+            vTaskDelay(1);
+        }
+    }
+#if CONFIG_FINGERPRINT_EVENT_DISPATCHER
+    if (dev->event_task != NULL) {
+        // Events already queued are still delivered
+        dev->event_stop = true;
+        xTaskNotifyGive(dev->event_task);
+        while (dev->event_task != NULL) {
+            vTaskDelay(1);
+        }
+    }
+#endif
+    if (dev->job_queue != NULL) {
+        vQueueDelete(dev->job_queue);
+    }
+    if (dev->txn_mutex != NULL) {
+        vSemaphoreDelete(dev->txn_mutex);
+    }
+    if (dev->frame_queue != NULL) {
+        vQueueDelete(dev->frame_queue);
+    }
+    if (dev->resync_done != NULL) {
+        vSemaphoreDelete(dev->resync_done);
+    }
+    if (dev->rx_pool_free != NULL) {
+        vQueueDelete(dev->rx_pool_free);
+    }
+    if (dev->tx_pool_free != NULL) {
+        vQueueDelete(dev->tx_pool_free);
+    }
+    if (dev->template_pool_free != NULL) {
+        vQueueDelete(dev->template_pool_free);
+    }
+    if (dev->uart_installed) {
+        uart_driver_delete(dev->uart_port);  // Also deletes the UART event queue
+    }
+#if CONFIG_FINGERPRINT_SECURE_CHANNEL
+    if (dev->secure_session) {
+        mbedtls_aes_free(&dev->secure_aes);
+        mbedtls_cipher_free(&dev->secure_cmac);
+    }
+    mbedtls_platform_zeroize(dev->secure_key, sizeof(dev->secure_key));
+#endif
+    free(dev);
+}
+
+// Installs and configures the UART driver of an instance that owns its port.
+static esp_err_t fingerprint_uart_open(fingerprint_dev_t *dev) {
+    uart_config_t uart_config = {
+        .baud_rate = DEFAULT_BAUD_RATE,  // Module's factory rate; raised by fingerprint_new() if requested
+        .data_bits = UART_DATA_8_BITS,
+        .parity = UART_PARITY_DISABLE,
+        .stop_bits = UART_STOP_BITS_1,
+        .flow_ctrl = UART_HW_FLOWCTRL_DISABLE
+    };
+    esp_err_t err = uart_driver_install(dev->uart_port, RX_BUF_SIZE * 2, 0, UART_EVENT_QUEUE_SIZE, &dev->uart_event_queue, 0);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to install UART driver");
+        return err;
+    }
+    dev->uart_installed = true;
+    err = uart_param_config(dev->uart_port, &uart_config);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to configure UART");
+        return err;
+    }
+    err = uart_set_pin(dev->uart_port, dev->tx_pin, dev->rx_pin, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to set UART pins");
+        return err;
+    }
+    // Hand bytes to the RX task after a short idle gap instead of the default 10 symbols
+    uart_set_rx_timeout(dev->uart_port, RX_TIMEOUT_SYMBOLS);
+    return ESP_OK;
+}
+
+esp_err_t fingerprint_new(const fingerprint_config_t *config, fingerprint_handle_t *ret_handle) {
+    if (config == NULL || ret_handle == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    // Members of a bus all hang off the instance that owns the UART
+    fingerprint_dev_t *owner = config->bus;
+    if (owner != NULL && owner->bus_owner != NULL) {
+        owner = owner->bus_owner;
+    }
+
+    fingerprint_dev_t *dev = calloc(1, sizeof(fingerprint_dev_t));
+    if (dev == NULL) {
+        ESP_LOGE(TAG, "No memory for fingerprint instance");
+        return ESP_ERR_NO_MEM;
+    }
+    dev->uart_port = config->uart_port;
+    dev->tx_pin = config->tx_pin;
+    dev->rx_pin = config->rx_pin;
+    dev->baud_rate = config->baud_rate ? config->baud_rate : DEFAULT_BAUD_RATE;
+    dev->link_baud = DEFAULT_BAUD_RATE;
+    if (owner != NULL) {
+        dev->uart_port = owner->uart_port;
+        dev->tx_pin = owner->tx_pin;
+        dev->rx_pin = owner->rx_pin;
+        dev->baud_rate = owner->link_baud;
+        dev->link_baud = owner->link_baud;
+    }
+    dev->address = config->address;
+    dev->index_capacity = FINGERPRINT_INDEX_CAPACITY;
+    dev->packet_len = DEFAULT_PACKET_LEN;
+    portMUX_INITIALIZE(&dev->bus_lock);
+    portMUX_INITIALIZE(&dev->notepad_lock);
+    portMUX_INITIALIZE(&dev->index_lock);
+    portMUX_INITIALIZE(&dev->stats_lock);
+    portMUX_INITIALIZE(&dev->subscriber_lock);
+    fingerprint_trace_start();
+    dev->event_handler = config->event_handler;
+    dev->touch_pin = config->touch_pin;
+    dev->touch_active_low = config->touch_active_low;
+    dev->power_pin = config->power_pin;
+    dev->powered = true;
+    dev->profile = FINGERPRINT_PROFILE_BALANCED;
+    dev->worker_priority = WORKER_TASK_PRIORITY;
+    dev->detect_priority = DETECT_TASK_PRIORITY;
+    dev->detect_poll_min_ms = DETECT_POLL_MIN_MS;
+    dev->detect_poll_max_ms = DETECT_POLL_MAX_MS;
+    dev->power_gating = true;
+    dev->notepad_flush_ms = CONFIG_FINGERPRINT_NOTEPAD_FLUSH_MS;
+
+    ESP_LOGI(TAG, "Initializing fingerprint scanner on UART%d...", dev->uart_port);
+    esp_err_t err = (owner == NULL) ? fingerprint_uart_open(dev) : ESP_OK;
+    if (err != ESP_OK) {
+        goto fail;
+    }
+
+    err = fingerprint_gpio_setup(dev);
+    if (err != ESP_OK) {
+        goto fail;
+    }
+
+#if CONFIG_FINGERPRINT_EVENT_DISPATCHER
+    // Started first so events raised while the instance comes up are not delivered inline
+    for (uint32_t i = 0; i < EVENT_RING_SIZE; i++) {
+        dev->event_seq[i] = i;
+    }
+    if (xTaskCreatePinnedToCore(fingerprint_event_task, "fp_event_task", EVENT_TASK_STACK_SIZE, dev, CONFIG_FINGERPRINT_EVENT_TASK_PRIORITY, &dev->event_task, EVENT_CORE) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create event dispatcher task");
+        err = ESP_ERR_NO_MEM;
+        goto fail;
+    }
+#endif
+
+    dev->tx_pool_free = fingerprint_pool_create(dev->tx_pool, sizeof(dev->tx_pool[0]), TX_POOL_SIZE);
+    dev->rx_pool_free = fingerprint_pool_create(dev->rx_pool, sizeof(dev->rx_pool[0]), RX_POOL_SIZE);
+    dev->template_pool_free = fingerprint_pool_create(dev->template_pool, sizeof(dev->template_pool[0]), TEMPLATE_POOL_SIZE);
+    dev->frame_queue = xQueueCreate(FRAME_QUEUE_SIZE, sizeof(fingerprint_frame_t *));
+    dev->resync_done = xSemaphoreCreateBinary();
+    if (dev->tx_pool_free == NULL || dev->rx_pool_free == NULL || dev->template_pool_free == NULL ||
+        dev->frame_queue == NULL || dev->resync_done == NULL) {
+        ESP_LOGE(TAG, "Failed to create RX frame queue");
+        err = ESP_ERR_NO_MEM;
+        goto fail;
+    }
+    if (owner != NULL) {
+        // The owner's RX task delivers this module's frames into its queue from here on
+        err = fingerprint_bus_attach(owner, dev);
+        if (err != ESP_OK) {
+            goto fail;
+        }
+    } else if (xTaskCreatePinnedToCore(fingerprint_rx_task, "fp_rx_task", RX_TASK_STACK_SIZE, dev, RX_TASK_PRIORITY, &dev->rx_task, PROTOCOL_CORE) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create RX task");
+        err = ESP_ERR_NO_MEM;
+        goto fail;
+    }
+
+    dev->txn_mutex = xSemaphoreCreateRecursiveMutex();
+    dev->job_queue = xQueueCreate(WORKER_QUEUE_SIZE, sizeof(fingerprint_job_t));
+    if (dev->txn_mutex == NULL || dev->job_queue == NULL) {
+        ESP_LOGE(TAG, "Failed to create worker queue");
+        err = ESP_ERR_NO_MEM;
+        goto fail;
+    }
+    if (xTaskCreatePinnedToCore(fingerprint_worker_task, "fp_worker_task", WORKER_TASK_STACK_SIZE, dev, dev->worker_priority, &dev->worker_task, PROTOCOL_CORE) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create worker task");
+        err = ESP_ERR_NO_MEM;
+        goto fail;
+    }
+    // Created even without a Kconfig delay, since a profile can start write-backs later
+    const esp_timer_create_args_t timer_args = {
+        .callback = fingerprint_notepad_timer,
+        .arg = dev,
+        .name = "fp_notepad",
+    };
+    err = esp_timer_create(&timer_args, &dev->notepad_timer);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create notepad timer");
+        goto fail;
+    }
+
+    // Move the module and the UART to the requested rate; bus members run at the owner's
+    if (owner == NULL && dev->baud_rate != DEFAULT_BAUD_RATE && fingerprint_dev_negotiate_baudrate(dev, dev->baud_rate) != ESP_OK) {
+        ESP_LOGW(TAG, "Staying at %d bps", dev->link_baud);
+    }
+
+    // Capacity and packet size come from the module itself; the index sync below depends on them
+    if (fingerprint_dev_read_sys_params(dev) == ESP_OK) {
+#if CONFIG_FINGERPRINT_MAX_PACKET_SIZE
+        if (dev->sys_params.packet_size < (32 << PACKET_SIZE_CODE_MAX) && fingerprint_set_packet_size(dev, PACKET_SIZE_CODE_MAX) != ESP_OK) {
+            ESP_LOGW(TAG, "Keeping %u-byte data packets", dev->sys_params.packet_size);
+        }
+#endif
+    } else {
+        ESP_LOGW(TAG, "System parameters not read; assuming %u pages and %u-byte packets", dev->index_capacity, dev->packet_len);
+    }
+
+    // Occupancy queries are answered from the host-side index from here on
+    if (fingerprint_dev_index_sync(dev) != ESP_OK) {
+        ESP_LOGW(TAG, "Template index not loaded; call fingerprint_index_sync() to retry");
+    }
+    ESP_LOGI(TAG, "Fingerprint scanner initialized successfully.");
+    *ret_handle = dev;
+    return ESP_OK;
+
+fail:
+    fingerprint_dev_destroy(dev);
+    return err;
+}
+
+esp_err_t fingerprint_del(fingerprint_handle_t dev) {
+    if (dev == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (dev->bus_owner == NULL && fingerprint_bus_shared(dev)) {
+        ESP_LOGE(TAG, "UART%d still carries other modules", dev->uart_port);
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (dev == default_dev) {
+        default_dev = NULL;
+    }
+    fingerprint_dev_destroy(dev);
+    return ESP_OK;
+}
+
+esp_err_t fingerprint_init(void) {
+    if (default_dev != NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // Honor fingerprint_set_pins() and fingerprint_set_baudrate()
+    fingerprint_config_t config = FINGERPRINT_DEFAULT_CONFIG();
+    config.uart_port = UART_NUM;
+    config.tx_pin = tx_pin;
+    config.rx_pin = rx_pin;
+    config.baud_rate = baud_rate;
+    config.touch_pin = touch_pin;
+    return fingerprint_new(&config, &default_dev);
+}
+
+esp_err_t fingerprint_set_command(FingerprintPacket *cmd, uint8_t command, uint8_t *params, uint8_t param_length) {
+    if (cmd == NULL) {
+        return ESP_ERR_INVALID_ARG;  // Null pointer error
+    }
+
+    if (param_length > 5) {  // Allow up to 5 bytes for commands like PS_Search
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    cmd->header = FINGERPRINT_HEADER;
+    cmd->address = DEFAULT_FINGERPRINT_ADDRESS;
+    cmd->packet_id = 0x01;  // Command packet
+    cmd->length = 1 + param_length + 2;  // Corrected length calculation
+    cmd->command = command;
+
+    // Clear parameters and copy only valid ones
+    memset(cmd->parameters, 0, sizeof(cmd->parameters));
+    if (params != NULL && param_length > 0) {
+        memcpy(cmd->parameters, params, param_length);
+    }
+
+    // Compute checksum
+    cmd->checksum = fingerprint_calculate_checksum(cmd);
+
+    return ESP_OK;
+}
+
+ExtendedPacket createExtendedPacket(FingerprintPacket base_packet, uint8_t page_number, const uint8_t *data, size_t data_size) {
+    ExtendedPacket packet;
+    packet.base = base_packet;
+    packet.base.length = 0x24;  // Fixed length for WriteNotepad command
+    packet.base.command = 0x18; // Command for WriteNotepad
+    packet.base.parameters[0] = page_number; // Store page number
+
+    // Ensure data_size is at most 32 bytes
+    if (data_size > 32) {
+        ESP_LOGW(TAG, "Notepad data of %u bytes truncated to 32", (unsigned)data_size);
+        data_size = 32;  // Truncate if larger
+    }
+
+    // Copy provided data and pad with zeros if needed
+    memset(packet.data, 0, 32);  // Zero out entire buffer
+    memcpy(packet.data, data, data_size);  // Copy actual data
+
+    memset(&packet.base.parameters[1], 0, sizeof(packet.base.parameters) - 1);
+
+    // Compute checksum over the page number and the full data block
+    uint16_t checksum = packet.base.packet_id + ((packet.base.length >> 8) & 0xFF) + (packet.base.length & 0xFF) +
+                        packet.base.command + page_number;
+    packet.base.checksum = fingerprint_checksum_update(checksum, packet.data, sizeof(packet.data));
+
+    return packet;
+}
+
+
+uint16_t fingerprint_checksum_update(uint16_t sum, const void *data, size_t len) {
+    const uint8_t *p = data;
+    uint32_t acc = sum;
+
+    // Bytes up to the first word boundary, so the loop below only issues aligned loads
+    while (len > 0 && ((uintptr_t)p & 3) != 0) {
+        acc += *p++;
+        len--;
+    }
+
+    // Four bytes per load, summed as two 16-bit lanes of alternate bytes. A lane gains at
+    // most 2 * 0xFF per word, so blocks of 128 words are folded before a lane can overflow.
+    while (len >= 4) {
+        size_t words = len / 4;
+        if (words > 128) {
+            words = 128;
+        }
+        len -= words * 4;
+
+        uint32_t lanes = 0;
+        while (words-- > 0) {
+            uint32_t w;
+            memcpy(&w, __builtin_assume_aligned(p, 4), sizeof(w));
+            lanes += (w & 0x00FF00FF) + ((w >> 8) & 0x00FF00FF);
+            p += 4;
+        }
+        acc += (lanes & 0xFFFF) + (lanes >> 16);
+    }
+
+    while (len-- > 0) {
+        acc += *p++;
+    }
+    return acc & 0xFFFF;
+}
+
+uint16_t fingerprint_calculate_checksum(const FingerprintPacket *cmd) {
+    // Parameter bytes announced by the length field (command byte and checksum excluded)
+    size_t param_length = cmd->length > 3 ? cmd->length - 3 : 0;
+    if (param_length > sizeof(cmd->parameters)) {
+        param_length = sizeof(cmd->parameters);
+    }
+
+    uint16_t sum = cmd->packet_id + ((cmd->length >> 8) & 0xFF) + (cmd->length & 0xFF) + cmd->command;
+    return fingerprint_checksum_update(sum, cmd->parameters, param_length);
+}
+
+// Serializes `cmd` for `address` into `buffer`, which must hold CMD_FRAME_LEN(CMD_MAX_PARAMS) bytes.
+static esp_err_t fingerprint_serialize_command(const FingerprintPacket *cmd, uint32_t address, uint8_t *buffer) {
+    if (cmd->length < 3 || (size_t)(cmd->length - 3) > CMD_MAX_PARAMS) {
+        ESP_LOGE(TAG, "Invalid command length 0x%04X for command 0x%02X", cmd->length, cmd->command);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    // Compute the checksum
+    uint16_t checksum = fingerprint_calculate_checksum(cmd);
+    
+    // Calculate actual packet size
+    size_t packet_size = cmd->length + 9; // 9 bytes (header, address, packet ID, length) + data
+
+    // Construct the packet
+    buffer[0] = (cmd->header >> 8) & 0xFF;
+    buffer[1] = cmd->header & 0xFF;
+    buffer[2] = (address >> 24) & 0xFF;  // Use function parameter instead of cmd->address
+    buffer[3] = (address >> 16) & 0xFF;
+    buffer[4] = (address >> 8) & 0xFF;
+    buffer[5] = address & 0xFF;
+    buffer[6] = cmd->packet_id;
+    buffer[7] = (cmd->length >> 8) & 0xFF;
+    buffer[8] = cmd->length & 0xFF;
+    buffer[9] = cmd->command;
+    
+    // Copy valid parameters (max 5 bytes)
+    memcpy(&buffer[CMD_PARAM_OFFSET], cmd->parameters, cmd->length - 3);
+
+    // Append checksum
+    buffer[packet_size - 2] = (checksum >> 8) & 0xFF;
+    buffer[packet_size - 1] = checksum & 0xFF;
+    return ESP_OK;
+}
+
+/**
+ * @brief Writes a wire-ready command frame to the instance's UART.
+ *
+ * Frames already addressed to `address` (all rodata frames when the module uses the default
+ * address) go out unchanged with a single uart_write_bytes(). Others are copied to the stack
+ * and re-addressed first; the address is not covered by the checksum.
+ */
+static esp_err_t fingerprint_write_command(fingerprint_dev_t *dev, const uint8_t *cmd, uint32_t address) {
+    uint8_t addressed[CMD_FRAME_LEN(CMD_MAX_PARAMS)];
+    size_t packet_size = CMD_WIRE_LEN(cmd);
+    uint8_t address_bytes[4] = {(address >> 24) & 0xFF, (address >> 16) & 0xFF, (address >> 8) & 0xFF, address & 0xFF};
+
+    if (memcmp(&cmd[2], address_bytes, sizeof(address_bytes)) != 0) {
+        if (packet_size > sizeof(addressed)) {
+            return ESP_ERR_INVALID_SIZE;  // Long frames are built for their address in the first place
+        }
+        memcpy(addressed, cmd, packet_size);
+        memcpy(&addressed[2], address_bytes, sizeof(address_bytes));
+        cmd = addressed;
+    }
+
+    // Send the packet over UART; the send time lasts until the last bit has left the pin
+    int64_t start_us = esp_timer_get_time();
+    if (uart_write_bytes(dev->uart_port, (const char *)cmd, packet_size) != (int)packet_size) {
+        ESP_LOGE(TAG, "Failed to send the complete fingerprint command.");
+        return ESP_FAIL;  // Return failure if not all bytes were written
+    }
+    uart_wait_tx_done(dev->uart_port, pdMS_TO_TICKS(UART_READ_TIMEOUT));
+    fingerprint_stats_sent(dev, CMD_CODE(cmd), start_us, packet_size);
+    return ESP_OK;  // Return success
+}
+
+/**
+ * @brief Overwrites `len` parameter bytes of a command frame, starting at parameter `index`.
+ *
+ * Used on stack copies of the rodata templates. Only the changed bytes are touched and the
+ * checksum is adjusted by their difference instead of being recomputed.
+ */
+static void fingerprint_frame_patch(uint8_t *cmd, size_t index, const uint8_t *bytes, size_t len) {
+    size_t packet_size = CMD_WIRE_LEN(cmd);
+    uint16_t checksum = (cmd[packet_size - 2] << 8) | cmd[packet_size - 1];
+
+    for (size_t i = 0; i < len; i++) {
+        uint8_t *param = &cmd[CMD_PARAM_OFFSET + index + i];
+        checksum += bytes[i] - *param;
+        *param = bytes[i];
+    }
+    cmd[packet_size - 2] = (checksum >> 8) & 0xFF;
+    cmd[packet_size - 1] = checksum & 0xFF;
+}
+
+// Big-endian 16-bit variant of fingerprint_frame_patch() for page IDs and counts.
+static void fingerprint_frame_patch_u16(uint8_t *cmd, size_t index, uint16_t value) {
+    uint8_t bytes[2] = {(value >> 8) & 0xFF, value & 0xFF};
+    fingerprint_frame_patch(cmd, index, bytes, sizeof(bytes));
+}
+
+/**
+ * @brief Serializes `cmd` for `address` and writes it to the instance's UART.
+ *
+ * The checksum is computed into the wire buffer only, so the shared PS_* packets can be
+ * sent from several instances at once.
+ */
+static esp_err_t fingerprint_send_frame(fingerprint_dev_t *dev, const FingerprintPacket *cmd, uint32_t address) {
+    uint8_t buffer[CMD_FRAME_LEN(CMD_MAX_PARAMS)];
+
+    esp_err_t err = fingerprint_serialize_command(cmd, address, buffer);
+    if (err != ESP_OK) {
+        return err;
+    }
+    return fingerprint_write_command(dev, buffer, address);
+}
+
+esp_err_t fingerprint_send_command(FingerprintPacket *cmd, uint32_t address) {
+    if (cmd == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (default_dev == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    cmd->checksum = fingerprint_calculate_checksum(cmd);
+    return fingerprint_send_frame(default_dev, cmd, address);
+}
+
+esp_err_t fingerprint_dev_send_command(fingerprint_handle_t dev, const FingerprintPacket *cmd) {
+    if (cmd == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (dev == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    return fingerprint_send_frame(dev, cmd, dev->address);
+}
+
+// Waits for the next complete frame from the RX task. The frame must be returned with
+// fingerprint_release_frame() once the caller is done with it.
+static esp_err_t fingerprint_receive_frame(fingerprint_dev_t *dev, fingerprint_frame_t **out, TickType_t timeout) {
+    if (xQueueReceive(dev->frame_queue, out, timeout) != pdTRUE) {
+        return ESP_ERR_TIMEOUT;
+    }
+    if (*out == NULL) {
+        return ESP_ERR_INVALID_CRC;  // A frame failed its checksum in the RX task
+    }
+    return ESP_OK;
+}
+
+static void fingerprint_release_frame(fingerprint_dev_t *dev, fingerprint_frame_t *frame) {
+    fingerprint_pool_put(dev->rx_pool_free, frame);
+}
+
+// Copies an ACK frame into the caller's FingerprintPacket layout.
+static void fingerprint_frame_to_packet(const fingerprint_frame_t *frame, FingerprintPacket *packet) {
+    uint16_t payload_len = frame->length - 2;
+
+    memset(packet, 0, sizeof(FingerprintPacket));
+    packet->header = FINGERPRINT_HEADER;
+    packet->address = frame->address;
+    packet->packet_id = frame->packet_id;
+    packet->length = frame->length;
+    if (payload_len > 0) {
+        packet->command = frame->data[0];  // Confirmation code
+        size_t param_len = payload_len - 1;
+        if (param_len > sizeof(packet->parameters)) {
+            param_len = sizeof(packet->parameters);
+        }
+        memcpy(packet->parameters, &frame->data[1], param_len);
+    }
+    packet->checksum = frame->checksum;
+}
+
+esp_err_t fingerprint_dev_read_response_into(fingerprint_handle_t dev, FingerprintPacket *out, uint32_t timeout_ms) {
+    if (out == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (dev == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    fingerprint_frame_t *frame = NULL;
+    esp_err_t err = fingerprint_receive_frame(dev, &frame, pdMS_TO_TICKS(timeout_ms));
+    fingerprint_stats_reply(dev, err, frame);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to read data from UART");
+        return err;
+    }
+
+    fingerprint_frame_to_packet(frame, out);
+    fingerprint_release_frame(dev, frame);
+    return ESP_OK;
+}
+
+esp_err_t fingerprint_read_response_into(FingerprintPacket *out, uint32_t timeout_ms) {
+    return fingerprint_dev_read_response_into(default_dev, out, timeout_ms);
+}
+
+static void fingerprint_index_apply(fingerprint_dev_t *dev, const uint8_t *cmd);
+static void fingerprint_index_mark(fingerprint_dev_t *dev, uint16_t first, uint32_t count, bool used);
+static esp_err_t fingerprint_read_index_page(fingerprint_dev_t *dev, uint8_t page, uint8_t *bitmap);
+
+/**
+ * @brief Reply timeout of a command, by command code.
+ *
+ * Commands that only touch the module's RAM answer within `UART_READ_TIMEOUT`; capture,
+ * feature extraction, search and flash writes take considerably longer. PS_AutoEnroll and
+ * PS_Autoldentify acknowledge their parameter check right away; fingerprint_run_auto()
+ * waits for the later stages with its own timeout.
+ */
+static uint32_t fingerprint_command_timeout(uint8_t code) {
+    switch (code) {
+    case 0x01: // PS_GetImage
+    case 0x29: // PS_GetEnrollImage
+        return IMAGE_TIMEOUT_MS;
+    case 0x02: // PS_GenChar
+    case 0x03: // PS_Match
+    case 0x05: // PS_RegModel
+        return EXTRACT_TIMEOUT_MS;
+    case 0x04: // PS_Search
+    case 0xF4: // PS_SecuritySearch
+        return SEARCH_TIMEOUT_MS;
+    case 0x06: // PS_StoreChar
+    case 0x0C: // PS_DeletChar
+    case 0x0D: // PS_Empty
+    case 0x0E: // PS_WriteReg
+    case 0x12: // PS_SetPwd
+    case 0x15: // PS_SetChipAddr
+    case 0x18: // PS_WriteNotepad
+    case 0x3B: // PS_RestSetting
+    case 0xF2: // PS_SecurityStoreChar
+        return FLASH_OP_TIMEOUT_MS;
+    default:
+        return UART_READ_TIMEOUT;
+    }
+}
+
+/**
+ * @brief Sends `cmd` once and waits for its reply frame; the caller holds the transaction lock.
+ *
+ * Frames left over from an earlier exchange that timed out are discarded first so the
+ * reply read here belongs to `cmd`.
+ */
+static esp_err_t fingerprint_exchange_once(fingerprint_dev_t *dev, const uint8_t *cmd, uint32_t address, fingerprint_frame_t **frame, uint32_t timeout_ms) {
+    fingerprint_frame_t *stale = NULL;
+
+    while (fingerprint_receive_frame(dev, &stale, 0) != ESP_ERR_TIMEOUT) {
+        fingerprint_release_frame(dev, stale);
+    }
+    esp_err_t err = fingerprint_write_command(dev, cmd, address);
+    if (err == ESP_OK) {
+        err = fingerprint_receive_frame(dev, frame, pdMS_TO_TICKS(timeout_ms));
+        fingerprint_stats_reply(dev, err, *frame);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to read data from UART");
+        }
+    }
+    return err;
+}
+
+/**
+ * @brief Brings the link back to a known state after a lost or corrupt reply.
+ *
+ * Sends PS_Cancel in case the module is still busy with the failed command, then has the
+ * RX task drop every pending byte and restart its framer, so the next reply is parsed from
+ * its first byte. The caller holds the transaction lock.
+ */
+static void fingerprint_recover_link(fingerprint_dev_t *dev, uint32_t address) {
+    fingerprint_frame_t *frame = NULL;
+    uart_event_t resync = { .type = RX_TASK_RESYNC };
+
+    STATS_COUNT(dev, resyncs, 1);
+    if (fingerprint_exchange_once(dev, frame_cancel, address, &frame, CANCEL_TIMEOUT_MS) == ESP_OK) {
+        fingerprint_release_frame(dev, frame);
+    }
+    // On a bus the input holds other modules' replies too; the framer resyncs on the next header
+    if (!fingerprint_bus_shared(dev)) {
+        xSemaphoreTake(dev->resync_done, 0);
+        if (xQueueSend(dev->uart_event_queue, &resync, pdMS_TO_TICKS(RESYNC_TIMEOUT_MS)) == pdTRUE) {
+            xSemaphoreTake(dev->resync_done, pdMS_TO_TICKS(RESYNC_TIMEOUT_MS));
+        }
+    }
+    while (fingerprint_receive_frame(dev, &frame, 0) != ESP_ERR_TIMEOUT) {
+        fingerprint_release_frame(dev, frame);
+    }
+}
+
+/**
+ * @brief Runs one command/response exchange and hands back the raw reply frame.
+ *
+ * A reply that does not arrive in time or fails its checksum is retried up to
+ * TXN_MAX_ATTEMPTS times in all, with a back-off doubling from TXN_BACKOFF_MS and the link
+ * recovered before every resend. A `timeout_ms` of TIMEOUT_BY_COMMAND uses the command's
+ * entry in fingerprint_command_timeout(). The caller releases the frame.
+ */
+static esp_err_t fingerprint_transceive_frame(fingerprint_dev_t *dev, const uint8_t *cmd, uint32_t address, fingerprint_frame_t **frame, uint32_t timeout_ms) {
+    esp_err_t err;
+
+    if (timeout_ms == TIMEOUT_BY_COMMAND) {
+        timeout_ms = fingerprint_command_timeout(CMD_CODE(cmd));
+    }
+
+    xSemaphoreTakeRecursive(dev->txn_mutex, portMAX_DELAY);
+    fingerprint_power_set(dev, true);  // Wakes a module powered down between touches
+    for (int attempt = 1;; attempt++) {
+        err = fingerprint_exchange_once(dev, cmd, address, frame, timeout_ms);
+        if ((err != ESP_ERR_TIMEOUT && err != ESP_ERR_INVALID_CRC) || dev->txn_retry_off || attempt == TXN_MAX_ATTEMPTS) {
+            break;
+        }
+        ESP_LOGW(TAG, "No valid reply to command 0x%02X (%s), retry %d", CMD_CODE(cmd), esp_err_to_name(err), attempt);
+        STATS_COUNT(dev, retries, 1);
+        vTaskDelay(pdMS_TO_TICKS(TXN_BACKOFF_MS << (attempt - 1)));
+        fingerprint_recover_link(dev, address);
+    }
+    xSemaphoreGiveRecursive(dev->txn_mutex);
+    return err;
+}
+
+esp_err_t fingerprint_dev_recover(fingerprint_handle_t dev) {
+    if (dev == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xSemaphoreTakeRecursive(dev->txn_mutex, portMAX_DELAY);
+    fingerprint_recover_link(dev, dev->address);
+    xSemaphoreGiveRecursive(dev->txn_mutex);
+    return ESP_OK;
+}
+
+esp_err_t fingerprint_recover(void) {
+    return fingerprint_dev_recover(default_dev);
+}
+
+esp_err_t fingerprint_dev_get_stats(fingerprint_handle_t dev, fingerprint_stats_t *out) {
+    if (out == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (dev == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    portENTER_CRITICAL(&dev->stats_lock);
+    *out = dev->stats;
+    portEXIT_CRITICAL(&dev->stats_lock);
+    out->baud_rate = dev->link_baud;
+    return ESP_OK;
+}
+
+esp_err_t fingerprint_get_stats(fingerprint_stats_t *out) {
+    return fingerprint_dev_get_stats(default_dev, out);
+}
+
+esp_err_t fingerprint_dev_reset_stats(fingerprint_handle_t dev) {
+    if (dev == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    portENTER_CRITICAL(&dev->stats_lock);
+    memset(&dev->stats, 0, sizeof(dev->stats));
+    dev->reply_pending = false;
+    portEXIT_CRITICAL(&dev->stats_lock);
+    return ESP_OK;
+}
+
+esp_err_t fingerprint_reset_stats(void) {
+    return fingerprint_dev_reset_stats(default_dev);
+}
+
+/**
+ * @brief Runs one command/response exchange while holding the transaction lock.
+ *
+ * `cmd` is a complete wire frame (a rodata frame, a patched copy of one, or a serialized
+ * FingerprintPacket). Successful store, delete and empty commands are also applied to the
+ * host-side template index.
+ *
+ * @return ESP_OK if a reply was received (its confirmation code is in `response->command`),
+ *         otherwise the error from sending or reading.
+ */
+static esp_err_t fingerprint_transceive(fingerprint_dev_t *dev, const uint8_t *cmd, uint32_t address, FingerprintPacket *response, uint32_t timeout_ms) {
+    fingerprint_frame_t *frame = NULL;
+
+    esp_err_t err = fingerprint_transceive_frame(dev, cmd, address, &frame, timeout_ms);
+    if (err != ESP_OK) {
+        return err;
+    }
+    fingerprint_frame_to_packet(frame, response);
+    fingerprint_release_frame(dev, frame);
+
+    if (fingerprint_get_status(response) == FINGERPRINT_OK) {
+        fingerprint_index_apply(dev, cmd);
+    }
+    return ESP_OK;
+}
+
+// Maps the outcome of fingerprint_transceive() onto a single status code.
+static fingerprint_status_t fingerprint_exchange_status(esp_err_t err, FingerprintPacket *response) {
+    if (err == ESP_ERR_TIMEOUT) {
+        return FINGERPRINT_TIMEOUT;
+    }
+    if (err != ESP_OK) {
+        return FINGERPRINT_PACKET_ERROR;
+    }
+    return fingerprint_get_status(response);
+}
+
+// Returns true if the module answers PS_CheckSensor at the UART's current rate.
+static bool fingerprint_probe(fingerprint_dev_t *dev) {
+    FingerprintPacket response;
+
+    for (int i = 0; i < BAUD_PROBE_ATTEMPTS; i++) {
+        if (fingerprint_transceive(dev, frame_check_sensor, dev->address, &response, TIMEOUT_BY_COMMAND) == ESP_OK) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Switches the ESP side of the link and drops whatever was received at the old rate.
+static esp_err_t fingerprint_set_uart_baudrate(fingerprint_dev_t *dev, int baud) {
+    esp_err_t err = uart_set_baudrate(dev->uart_port, baud);
+    if (err != ESP_OK) {
+        return err;
+    }
+    vTaskDelay(pdMS_TO_TICKS(BAUD_SWITCH_SETTLE_MS));
+    uart_flush_input(dev->uart_port);
+    return ESP_OK;
+}
+
+esp_err_t fingerprint_dev_negotiate_baudrate(fingerprint_handle_t dev, int target) {
+    uint8_t cmd[sizeof(frame_write_reg)];
+    FingerprintPacket response;
+    int old_baud;
+    esp_err_t err;
+
+    if (target % BAUD_UNIT != 0 || target / BAUD_UNIT < 1 || target / BAUD_UNIT > BAUD_MULTIPLIER_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (dev == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (fingerprint_bus_shared(dev)) {
+        ESP_LOGE(TAG, "UART%d is shared; its rate is fixed", dev->uart_port);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    memcpy(cmd, frame_write_reg, sizeof(cmd));
+    xSemaphoreTakeRecursive(dev->txn_mutex, portMAX_DELAY);
+    old_baud = dev->link_baud;
+    dev->txn_retry_off = true;  // A module at another rate never answers; probing handles that
+
+    if (!fingerprint_probe(dev)) {
+        // The module keeps its baud setting across power cycles; it may already be at the target
+        ESP_LOGW(TAG, "No answer at %d bps, trying %d bps", old_baud, target);
+        err = fingerprint_set_uart_baudrate(dev, target);
+        if (err == ESP_OK && fingerprint_probe(dev)) {
+            dev->link_baud = target;
+            goto done;
+        }
+        fingerprint_set_uart_baudrate(dev, old_baud);
+        err = ESP_ERR_TIMEOUT;
+        goto done;
+    }
+    if (target == old_baud) {
+        err = ESP_OK;
+        goto done;
+    }
+
+    // The ACK still comes back at the old rate; the module switches right after sending it
+    uint8_t params[2] = {SYSPARA_REG_BAUD, target / BAUD_UNIT};
+    fingerprint_frame_patch(cmd, 0, params, sizeof(params));
+    err = fingerprint_transceive(dev, cmd, dev->address, &response, TIMEOUT_BY_COMMAND);
+    if (err == ESP_OK && fingerprint_get_status(&response) != FINGERPRINT_OK) {
+        ESP_LOGE(TAG, "Module refused %d bps (status 0x%02X)", target, response.command);
+        err = ESP_ERR_NOT_SUPPORTED;
+    }
+    if (err != ESP_OK) {
+        goto done;
+    }
+    uart_wait_tx_done(dev->uart_port, pdMS_TO_TICKS(UART_READ_TIMEOUT));
+
+    err = fingerprint_set_uart_baudrate(dev, target);
+    if (err == ESP_OK && fingerprint_probe(dev)) {
+        dev->link_baud = target;
+        ESP_LOGI(TAG, "Baud rate raised from %d to %d bps", old_baud, target);
+        goto done;
+    }
+
+    // Probe failed: go back to the old rate on both ends
+    ESP_LOGW(TAG, "No answer at %d bps, reverting to %d bps", target, old_baud);
+    fingerprint_set_uart_baudrate(dev, old_baud);
+    if (fingerprint_probe(dev)) {
+        err = ESP_FAIL;  // Module never switched
+        goto done;
+    }
+    fingerprint_set_uart_baudrate(dev, target);
+    params[1] = old_baud / BAUD_UNIT;
+    fingerprint_frame_patch(cmd, 0, params, sizeof(params));
+    fingerprint_transceive(dev, cmd, dev->address, &response, TIMEOUT_BY_COMMAND);
+    fingerprint_set_uart_baudrate(dev, old_baud);
+    err = fingerprint_probe(dev) ? ESP_FAIL : ESP_ERR_TIMEOUT;
+
+done:
+    dev->txn_retry_off = false;
+    xSemaphoreGiveRecursive(dev->txn_mutex);
+    return err;
+}
+
+esp_err_t fingerprint_negotiate_baudrate(int target) {
+    return fingerprint_dev_negotiate_baudrate(default_dev, target);
+}
+
+// Receives one data packet payload together with its packet ID (0x02 or 0x08).
+typedef esp_err_t (*fingerprint_packet_sink_t)(uint8_t packet_id, const uint8_t *data, size_t len, void *user_ctx);
+
+/**
+ * @brief Streams the data packets that follow a PS_Uplmage/PS_UpChar ACK to `sink`.
+ *
+ * Each packet is passed on straight from its pool buffer and released right after, so only
+ * a handful of packets are ever held in RAM. Reading continues until the end packet even if
+ * the sink fails, so the link is left in sync.
+ */
+static esp_err_t fingerprint_receive_data(fingerprint_dev_t *dev, fingerprint_packet_sink_t sink, void *user_ctx, size_t *total_len) {
+    uint32_t dropped_before = dev->rx_dropped;
+    esp_err_t sink_err = ESP_OK;
+    size_t total = 0;
+
+    while (1) {
+        fingerprint_frame_t *frame = NULL;
+        esp_err_t err = fingerprint_receive_frame(dev, &frame, pdMS_TO_TICKS(DATA_PACKET_TIMEOUT_MS));
+        if (err == ESP_ERR_INVALID_CRC) {
+            continue;  // Reported once the end packet is in, so the link stays in sync
+        }
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Data transfer stalled after %u bytes", (unsigned int)total);
+            return err;
+        }
+
+        uint8_t packet_id = frame->packet_id;
+        if (packet_id != FINGERPRINT_PID_DATA && packet_id != FINGERPRINT_PID_END) {
+            ESP_LOGE(TAG, "Unexpected packet ID 0x%02X during data transfer", packet_id);
+            fingerprint_release_frame(dev, frame);
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+
+        size_t len = frame->length - 2;
+        if (sink_err == ESP_OK) {
+            sink_err = sink(packet_id, frame->data, len, user_ctx);
+        }
+        total += len;
+        fingerprint_release_frame(dev, frame);
+
+        if (packet_id == FINGERPRINT_PID_END) {
+            break;
+        }
+    }
+
+    if (total_len != NULL) {
+        *total_len = total;
+    }
+    if (dev->rx_dropped != dropped_before) {
+        ESP_LOGE(TAG, "Data packets lost during transfer");
+        return ESP_ERR_INVALID_CRC;
+    }
+    return sink_err;
+}
+
+typedef struct {
+    fingerprint_data_callback_t callback;
+    void *user_ctx;
+} fingerprint_chunk_forward_t;
+
+static esp_err_t fingerprint_forward_chunk(uint8_t packet_id, const uint8_t *data, size_t len, void *user_ctx) {
+    fingerprint_chunk_forward_t *forward = user_ctx;
+    return forward->callback(data, len, forward->user_ctx);
+}
+
+esp_err_t fingerprint_dev_upload_image(fingerprint_handle_t dev, fingerprint_data_callback_t callback, void *user_ctx, size_t *total_len) {
+    FingerprintPacket response;
+    fingerprint_chunk_forward_t forward = {
+        .callback = callback,
+        .user_ctx = user_ctx,
+    };
+    esp_err_t err;
+
+    if (callback == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (dev == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xSemaphoreTakeRecursive(dev->txn_mutex, portMAX_DELAY);
+    int64_t start_us = esp_timer_get_time();
+
+    err = fingerprint_transceive(dev, frame_up_image, dev->address, &response, TIMEOUT_BY_COMMAND);
+    if (err == ESP_OK && fingerprint_get_status(&response) != FINGERPRINT_OK) {
+        ESP_LOGE(TAG, "Image upload refused (status 0x%02X)", response.command);
+        err = ESP_FAIL;
+    }
+    if (err == ESP_OK) {
+        err = fingerprint_receive_data(dev, fingerprint_forward_chunk, &forward, total_len);
+    }
+
+    fingerprint_stats_flow(dev, FINGERPRINT_FLOW_TRANSFER, start_us);
+    xSemaphoreGiveRecursive(dev->txn_mutex);
+    return err;
+}
+
+esp_err_t fingerprint_upload_image(fingerprint_data_callback_t callback, void *user_ctx, size_t *total_len) {
+    return fingerprint_dev_upload_image(default_dev, callback, user_ctx, total_len);
+}
+
+/**
+ * @brief Finishes a data packet whose payload already sits at `buffer + 9` and sends it.
+ *
+ * Lets bulk transfers read payload straight into a TX pool buffer without another copy.
+ */
+static esp_err_t fingerprint_write_data_packet(fingerprint_dev_t *dev, uint8_t *buffer, uint8_t packet_id, size_t len, uint32_t address) {
+    uint16_t length = len + 2;
+    uint16_t sum = fingerprint_checksum_update(packet_id + ((length >> 8) & 0xFF) + (length & 0xFF), &buffer[9], len);
+    size_t packet_size = len + FINGERPRINT_FRAME_OVERHEAD;
+
+    buffer[0] = (FINGERPRINT_HEADER >> 8) & 0xFF;
+    buffer[1] = FINGERPRINT_HEADER & 0xFF;
+    buffer[2] = (address >> 24) & 0xFF;
+    buffer[3] = (address >> 16) & 0xFF;
+    buffer[4] = (address >> 8) & 0xFF;
+    buffer[5] = address & 0xFF;
+    buffer[6] = packet_id;
+    buffer[7] = (length >> 8) & 0xFF;
+    buffer[8] = length & 0xFF;
+    buffer[packet_size - 2] = (sum >> 8) & 0xFF;
+    buffer[packet_size - 1] = sum & 0xFF;
+
+    if (uart_write_bytes(dev->uart_port, (const char *)buffer, packet_size) != (int)packet_size) {
+        return ESP_FAIL;
+    }
+    portENTER_CRITICAL(&dev->stats_lock);
+    dev->stats.bytes_tx += packet_size;
+    dev->stats.frames_tx++;
+    portEXIT_CRITICAL(&dev->stats_lock);
+    return ESP_OK;
+}
+
+// Sends a buffer/page command (frame_load_char, frame_store_char) for `page_id` and checks its ACK.
+static esp_err_t fingerprint_page_command(fingerprint_dev_t *dev, const uint8_t *template, uint16_t page_id, fingerprint_status_t *status) {
+    uint8_t cmd[CMD_FRAME_LEN(3)];
+    FingerprintPacket response;
+
+    memcpy(cmd, template, sizeof(cmd));
+    fingerprint_frame_patch_u16(cmd, 1, page_id);  // Buffer ID stays as in the template
+    esp_err_t err = fingerprint_transceive(dev, cmd, dev->address, &response, TIMEOUT_BY_COMMAND);
+    *status = fingerprint_exchange_status(err, &response);
+    if (err != ESP_OK) {
+        return err;
+    }
+    return (*status == FINGERPRINT_OK) ? ESP_OK : ESP_FAIL;
+}
+
+typedef struct {
+    uint16_t page_id;
+    fingerprint_data_callback_t write;
+    void *user_ctx;
+} fingerprint_export_ctx_t;
+
+// Prefixes every data packet with its record header before handing both to the writer.
+static esp_err_t fingerprint_export_chunk(uint8_t packet_id, const uint8_t *data, size_t len, void *user_ctx) {
+    fingerprint_export_ctx_t *ctx = user_ctx;
+    uint8_t header[FINGERPRINT_TEMPLATE_RECORD_HEADER_LEN] = {
+        (ctx->page_id >> 8) & 0xFF, ctx->page_id & 0xFF,
+        packet_id,
+        (len >> 8) & 0xFF, len & 0xFF,
+    };
+
+    esp_err_t err = ctx->write(header, sizeof(header), ctx->user_ctx);
+    if (err == ESP_OK) {
+        err = ctx->write(data, len, ctx->user_ctx);
+    }
+    return err;
+}
+
+esp_err_t fingerprint_dev_export_templates(fingerprint_handle_t dev, const uint16_t *page_ids, size_t count, fingerprint_data_callback_t write, void *user_ctx, size_t *exported) {
+    FingerprintPacket response;
+    fingerprint_export_ctx_t ctx = {
+        .write = write,
+        .user_ctx = user_ctx,
+    };
+    fingerprint_status_t status;
+    size_t done = 0;
+    esp_err_t err = ESP_OK;
+
+    if (page_ids == NULL || write == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (dev == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // One session for the whole batch: the UART stays ours from the first page to the last
+    xSemaphoreTakeRecursive(dev->txn_mutex, portMAX_DELAY);
+    int64_t start_us = esp_timer_get_time();
+    for (size_t i = 0; i < count; i++) {
+        ctx.page_id = page_ids[i];
+
+        err = fingerprint_page_command(dev, frame_load_char, ctx.page_id, &status);
+        if (err == ESP_FAIL) {
+            ESP_LOGW(TAG, "Skipping page %u (status 0x%02X)", ctx.page_id, status);
+            err = ESP_OK;
+            continue;
+        }
+        if (err != ESP_OK) {
+            break;
+        }
+
+        err = fingerprint_transceive(dev, frame_up_char, dev->address, &response, TIMEOUT_BY_COMMAND);
+        if (err == ESP_OK && fingerprint_get_status(&response) != FINGERPRINT_OK) {
+            ESP_LOGE(TAG, "Template upload refused for page %u (status 0x%02X)", ctx.page_id, response.command);
+            err = ESP_FAIL;
+        }
+        if (err == ESP_OK) {
+            err = fingerprint_receive_data(dev, fingerprint_export_chunk, &ctx, NULL);
+        }
+        if (err != ESP_OK) {
+            break;
+        }
+        done++;
+    }
+    fingerprint_stats_flow(dev, FINGERPRINT_FLOW_TRANSFER, start_us);
+    xSemaphoreGiveRecursive(dev->txn_mutex);
+
+    if (exported != NULL) {
+        *exported = done;
+    }
+    return err;
+}
+
+esp_err_t fingerprint_export_templates(const uint16_t *page_ids, size_t count, fingerprint_data_callback_t write, void *user_ctx, size_t *exported) {
+    return fingerprint_dev_export_templates(default_dev, page_ids, count, write, user_ctx, exported);
+}
+
+// Reads exactly `len` bytes from an import stream. Returns ESP_ERR_NOT_FOUND on a clean end of stream.
+static esp_err_t fingerprint_stream_read_exact(fingerprint_stream_read_t read, void *user_ctx, uint8_t *buf, size_t len) {
+    size_t got = 0;
+
+    while (got < len) {
+        int n = read(buf + got, len - got, user_ctx);
+        if (n < 0) {
+            return ESP_FAIL;
+        }
+        if (n == 0) {
+            return (got == 0) ? ESP_ERR_NOT_FOUND : ESP_ERR_INVALID_SIZE;
+        }
+        got += n;
+    }
+    return ESP_OK;
+}
+
+esp_err_t fingerprint_dev_import_templates(fingerprint_handle_t dev, fingerprint_stream_read_t read, void *user_ctx, size_t *imported) {
+    FingerprintPacket response;
+    uint8_t header[FINGERPRINT_TEMPLATE_RECORD_HEADER_LEN];
+    fingerprint_status_t status;
+    bool in_template = false;
+    uint16_t current_page = 0;
+    size_t done = 0;
+    esp_err_t err;
+
+    if (read == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (dev == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    uint8_t *packet = fingerprint_pool_get(dev->tx_pool_free, pdMS_TO_TICKS(POOL_WAIT_MS));
+    if (packet == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    xSemaphoreTakeRecursive(dev->txn_mutex, portMAX_DELAY);
+    int64_t start_us = esp_timer_get_time();
+    while (1) {
+        err = fingerprint_stream_read_exact(read, user_ctx, header, sizeof(header));
+        if (err == ESP_ERR_NOT_FOUND) {
+            err = in_template ? ESP_ERR_INVALID_SIZE : ESP_OK;  // Stream must end on a record boundary
+            break;
+        }
+        if (err != ESP_OK) {
+            break;
+        }
+
+        uint16_t page_id = (header[0] << 8) | header[1];
+        uint8_t packet_id = header[2];
+        size_t len = (header[3] << 8) | header[4];
+        if ((packet_id != FINGERPRINT_PID_DATA && packet_id != FINGERPRINT_PID_END) ||
+            len > FINGERPRINT_MAX_DATA_LEN || (in_template && page_id != current_page)) {
+            ESP_LOGE(TAG, "Malformed template record (page %u, packet ID 0x%02X, %u bytes)", page_id, packet_id, (unsigned int)len);
+            err = ESP_ERR_INVALID_RESPONSE;
+            break;
+        }
+
+        if (!in_template) {
+            err = fingerprint_transceive(dev, frame_down_char, dev->address, &response, TIMEOUT_BY_COMMAND);
+            if (err == ESP_OK && fingerprint_get_status(&response) != FINGERPRINT_OK) {
+                ESP_LOGE(TAG, "Template download refused (status 0x%02X)", response.command);
+                err = ESP_FAIL;
+            }
+            if (err != ESP_OK) {
+                break;
+            }
+            in_template = true;
+            current_page = page_id;
+        }
+
+        // Payload goes straight into the TX buffer behind the header bytes
+        err = fingerprint_stream_read_exact(read, user_ctx, &packet[9], len);
+        if (err != ESP_OK) {
+            err = (err == ESP_ERR_NOT_FOUND) ? ESP_ERR_INVALID_SIZE : err;
+            break;
+        }
+        err = fingerprint_write_data_packet(dev, packet, packet_id, len, dev->address);
+        if (err != ESP_OK) {
+            break;
+        }
+
+        if (packet_id == FINGERPRINT_PID_END) {
+            err = fingerprint_page_command(dev, frame_store_char, current_page, &status);
+            if (err != ESP_OK) {
+                ESP_LOGE(TAG, "Failed to store template in page %u (status 0x%02X)", current_page, status);
+                break;
+            }
+            in_template = false;
+            done++;
+        }
+    }
+    fingerprint_stats_flow(dev, FINGERPRINT_FLOW_TRANSFER, start_us);
+    xSemaphoreGiveRecursive(dev->txn_mutex);
+    fingerprint_pool_put(dev->tx_pool_free, packet);
+
+    if (imported != NULL) {
+        *imported = done;
+    }
+    return err;
+}
+
+esp_err_t fingerprint_import_templates(fingerprint_stream_read_t read, void *user_ctx, size_t *imported) {
+    return fingerprint_dev_import_templates(default_dev, read, user_ctx, imported);
+}
+
+/**
+ * @brief Downloads `len` bytes of template data into CharBuffer 1; caller holds txn_mutex.
+ *
+ * `packet` is a TX pool buffer; the data is cut into packets of the module's packet size.
+ */
+static esp_err_t fingerprint_download_template(fingerprint_dev_t *dev, uint8_t *packet, const uint8_t *data, size_t len) {
+    FingerprintPacket response;
+
+    esp_err_t err = fingerprint_transceive(dev, frame_down_char, dev->address, &response, TIMEOUT_BY_COMMAND);
+    if (err == ESP_OK && fingerprint_get_status(&response) != FINGERPRINT_OK) {
+        ESP_LOGE(TAG, "Template download refused (status 0x%02X)", response.command);
+        err = ESP_FAIL;
+    }
+    for (size_t sent = 0; err == ESP_OK && sent < len; sent += dev->packet_len) {
+        size_t chunk = (len - sent < dev->packet_len) ? len - sent : dev->packet_len;
+        memcpy(&packet[9], data + sent, chunk);
+        err = fingerprint_write_data_packet(dev, packet, sent + chunk == len ? FINGERPRINT_PID_END : FINGERPRINT_PID_DATA,
+                                            chunk, dev->address);
+    }
+    return err;
+}
+
+// Deletes `count` pages from `first` with one PS_DeletChar.
+static esp_err_t fingerprint_delete_pages(fingerprint_dev_t *dev, uint16_t first, uint16_t count, fingerprint_status_t *status) {
+    uint8_t cmd[sizeof(frame_delet_char)];
+    FingerprintPacket response;
+
+    memcpy(cmd, frame_delet_char, sizeof(cmd));
+    fingerprint_frame_patch_u16(cmd, 0, first);
+    fingerprint_frame_patch_u16(cmd, 2, count);
+    esp_err_t err = fingerprint_transceive(dev, cmd, dev->address, &response, TIMEOUT_BY_COMMAND);
+    *status = fingerprint_exchange_status(err, &response);
+    if (err != ESP_OK) {
+        return err;
+    }
+    return (*status == FINGERPRINT_OK) ? ESP_OK : ESP_FAIL;
+}
+
+/**
+ * @brief Looks a page up in the module's own index, not the host-side copy.
+ *
+ * The index table page holding `page` is read into `table` unless `*table_page` already names
+ * it. Caller holds txn_mutex, so the answer stays true until it lets go.
+ *
+ * @return 1 if the page is used, 0 if it is free, -1 if the index could not be read.
+ */
+static int fingerprint_module_page_used(fingerprint_dev_t *dev, uint32_t page, uint8_t *table, int *table_page) {
+    int wanted = page / (INDEX_TABLE_BYTES * 8);
+    if (wanted != *table_page) {
+        *table_page = (fingerprint_read_index_page(dev, wanted, table) == ESP_OK) ? wanted : -1;
+        if (*table_page < 0) {
+            return -1;
+        }
+    }
+    size_t bit = page % (INDEX_TABLE_BYTES * 8);
+    return (table[bit / 8] & (1 << (bit % 8))) != 0;
+}
+
+static int fingerprint_page_compare(const void *a, const void *b) {
+    return (int)*(const uint16_t *)a - (int)*(const uint16_t *)b;
+}
+
+/**
+ * @brief Deletes the range starting at `pages[*next]` with one PS_DeletChar.
+ *
+ * `pages` is sorted. Following pages join the range while the pages between them are free;
+ * gaps are checked against the module's own index, read while the lock keeps stores out.
+ * One range per lock hold, so a waiting identify gets the link between ranges.
+ *
+ * @param[in,out] next Advanced past the pages the range covered, whether or not it was deleted.
+ * @param[out] requested Requested pages (duplicates counted once) the range covered.
+ */
+static esp_err_t fingerprint_delete_next_range(fingerprint_dev_t *dev, const uint16_t *pages, size_t count, size_t *next, size_t *requested) {
+    fingerprint_status_t status = FINGERPRINT_OK;
+    size_t i = *next;
+    uint16_t first = pages[i];
+    uint16_t last = first;
+    uint8_t fresh[INDEX_TABLE_BYTES];
+    int fresh_page = -1;        // Index table page held in `fresh`, read under this lock hold
+
+    *requested = 1;
+    xSemaphoreTakeRecursive(dev->txn_mutex, portMAX_DELAY);
+    while (++i < count) {
+        if (pages[i] <= last + 1) {
+            *requested += (pages[i] > last);
+            last = pages[i] > last ? pages[i] : last;
+            continue;
+        }
+        bool gap_free = true;
+        for (uint32_t page = last + 1; gap_free && page < pages[i]; page++) {
+            gap_free = fingerprint_module_page_used(dev, page, fresh, &fresh_page) == 0;
+        }
+        if (!gap_free) {
+            break;
+        }
+        (*requested)++;
+        last = pages[i];
+    }
+    esp_err_t err = fingerprint_delete_pages(dev, first, last - first + 1, &status);
+    xSemaphoreGiveRecursive(dev->txn_mutex);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to delete pages %u-%u (status 0x%02X)", first, last, status);
+    }
+    *next = i;
+    return err;
+}
+
+// Returns a sorted copy of a page list for fingerprint_delete_next_range(), NULL without memory.
+static uint16_t *fingerprint_sorted_pages(const uint16_t *page_ids, size_t count) {
+    uint16_t *pages = malloc(count * sizeof(uint16_t));
+    if (pages != NULL) {
+        memcpy(pages, page_ids, count * sizeof(uint16_t));
+        qsort(pages, count, sizeof(uint16_t), fingerprint_page_compare);
+    }
+    return pages;
+}
+
+esp_err_t fingerprint_dev_batch_delete(fingerprint_handle_t dev, const uint16_t *page_ids, size_t count, size_t *commands) {
+    esp_err_t err = ESP_OK;
+    size_t sent = 0;
+
+    if (page_ids == NULL && count > 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (dev == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (commands != NULL) {
+        *commands = 0;
+    }
+    if (count == 0) {
+        return ESP_OK;
+    }
+    uint16_t *pages = fingerprint_sorted_pages(page_ids, count);
+    if (pages == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    int64_t start_us = esp_timer_get_time();
+    size_t deleted = 0;
+    for (size_t i = 0; i < count && err == ESP_OK;) {
+        size_t requested;
+        err = fingerprint_delete_next_range(dev, pages, count, &i, &requested);
+        if (err == ESP_OK) {
+            sent++;
+            deleted += requested;
+        }
+    }
+    fingerprint_stats_flow(dev, FINGERPRINT_FLOW_TRANSFER, start_us);
+    free(pages);
+
+    ESP_LOGI(TAG, "Deleted %u of %u requested pages with %u commands", (unsigned int)deleted, (unsigned int)count, (unsigned int)sent);
+    if (commands != NULL) {
+        *commands = sent;
+    }
+    return err;
+}
+
+esp_err_t fingerprint_batch_delete(const uint16_t *page_ids, size_t count, size_t *commands) {
+    return fingerprint_dev_batch_delete(default_dev, page_ids, count, commands);
+}
+
+esp_err_t fingerprint_dev_batch_delete_async(fingerprint_handle_t dev, const uint16_t *page_ids, size_t count, fingerprint_batch_delete_callback_t callback, void *user_ctx) {
+    if (page_ids == NULL || count == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (dev == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    fingerprint_job_t job = {
+        .type = JOB_BATCH_DELETE,
+        .batch_delete = {
+            .pages = fingerprint_sorted_pages(page_ids, count),
+            .count = count,
+            .start_us = esp_timer_get_time(),
+            .callback = callback,
+            .user_ctx = user_ctx,
+        },
+    };
+    if (job.batch_delete.pages == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (xQueueSend(dev->job_queue, &job, 0) != pdTRUE) {
+        ESP_LOGW(TAG, "Request queue full, rejecting batch delete");
+        free(job.batch_delete.pages);
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+esp_err_t fingerprint_batch_delete_async(const uint16_t *page_ids, size_t count, fingerprint_batch_delete_callback_t callback, void *user_ctx) {
+    return fingerprint_dev_batch_delete_async(default_dev, page_ids, count, callback, user_ctx);
+}
+
+esp_err_t fingerprint_dev_batch_store(fingerprint_handle_t dev, const fingerprint_template_t *templates, size_t count, size_t *stored) {
+    fingerprint_status_t status = FINGERPRINT_OK;
+    esp_err_t err = ESP_OK;
+    size_t done = 0;
+
+    if (templates == NULL && count > 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (dev == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    uint8_t *packet = fingerprint_pool_get(dev->tx_pool_free, pdMS_TO_TICKS(POOL_WAIT_MS));
+    if (packet == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    int64_t start_us = esp_timer_get_time();
+    for (size_t i = 0; i < count && err == ESP_OK; i++) {
+        const fingerprint_template_t *template = &templates[i];
+        if (template->data == NULL || template->len == 0) {
+            err = ESP_ERR_INVALID_ARG;
+            break;
+        }
+        // CharBuffer 1 must survive from download to store, but not from one template to the next
+        xSemaphoreTakeRecursive(dev->txn_mutex, portMAX_DELAY);
+        err = fingerprint_download_template(dev, packet, template->data, template->len);
+        if (err == ESP_OK) {
+            err = fingerprint_page_command(dev, frame_store_char, template->page_id, &status);
+            if (err != ESP_OK) {
+                ESP_LOGE(TAG, "Failed to store template in page %u (status 0x%02X)", template->page_id, status);
+            }
+        }
+        xSemaphoreGiveRecursive(dev->txn_mutex);
+        done += (err == ESP_OK);
+    }
+    fingerprint_stats_flow(dev, FINGERPRINT_FLOW_TRANSFER, start_us);
+    fingerprint_pool_put(dev->tx_pool_free, packet);
+
+    if (stored != NULL) {
+        *stored = done;
+    }
+    return err;
+}
+
+esp_err_t fingerprint_batch_store(const fingerprint_template_t *templates, size_t count, size_t *stored) {
+    return fingerprint_dev_batch_store(default_dev, templates, count, stored);
+}
+
+esp_err_t fingerprint_dev_compact(fingerprint_handle_t dev, uint16_t start_page, uint16_t page_count, fingerprint_page_moved_t moved, void *user_ctx, size_t *moved_count) {
+    fingerprint_status_t status = FINGERPRINT_OK;
+    esp_err_t err = ESP_OK;
+    size_t done = 0;
+
+    if (dev == NULL || !dev->index_valid) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    uint32_t end = (uint32_t)start_page + page_count;
+    if (end > dev->index_capacity) {
+        end = dev->index_capacity;
+    }
+
+    // Fill the lowest free page from the highest used one until they meet
+    int64_t start_us = esp_timer_get_time();
+    uint32_t low = start_page, high = end;
+    while (err == ESP_OK) {
+        while (low < high && fingerprint_dev_index_is_used(dev, low)) {
+            low++;
+        }
+        while (high > low && !fingerprint_dev_index_is_used(dev, high - 1)) {
+            high--;
+        }
+        if (high <= low + 1) {
+            break;
+        }
+        uint16_t from = high - 1, to = low;
+        uint8_t fresh[INDEX_TABLE_BYTES];
+        int fresh_page = -1;
+
+        // Load, store and delete of one template form a single lock hold; identifies run in between
+        xSemaphoreTakeRecursive(dev->txn_mutex, portMAX_DELAY);
+        // The pair was picked from the host index; an enroll may have taken `to` since, or the
+        // index may be stale. Only the module's own index, read under this hold, is trusted.
+        int from_used = fingerprint_module_page_used(dev, from, fresh, &fresh_page);
+        int to_used = fingerprint_module_page_used(dev, to, fresh, &fresh_page);
+        if (from_used < 0 || to_used < 0) {
+            xSemaphoreGiveRecursive(dev->txn_mutex);
+            err = ESP_FAIL;
+            break;
+        }
+        if (!from_used || to_used) {
+            xSemaphoreGiveRecursive(dev->txn_mutex);
+            // Correct the host index and pick the pair again
+            portENTER_CRITICAL(&dev->index_lock);
+            fingerprint_index_mark(dev, from, 1, from_used);
+            fingerprint_index_mark(dev, to, 1, to_used);
+            portEXIT_CRITICAL(&dev->index_lock);
+            continue;
+        }
+        err = fingerprint_page_command(dev, frame_load_char, from, &status);
+        if (err == ESP_OK) {
+            err = fingerprint_page_command(dev, frame_store_char, to, &status);
+        }
+        if (err == ESP_OK) {
+            err = fingerprint_delete_pages(dev, from, 1, &status);
+        }
+        xSemaphoreGiveRecursive(dev->txn_mutex);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to move template %u to page %u (status 0x%02X)", from, to, status);
+            break;
+        }
+        done++;
+        if (moved != NULL) {
+            moved(from, to, user_ctx);
+        }
+    }
+    fingerprint_stats_flow(dev, FINGERPRINT_FLOW_TRANSFER, start_us);
+
+    if (moved_count != NULL) {
+        *moved_count = done;
+    }
+    return err;
+}
+
+esp_err_t fingerprint_compact(uint16_t start_page, uint16_t page_count, fingerprint_page_moved_t moved, void *user_ctx, size_t *moved_count) {
+    return fingerprint_dev_compact(default_dev, start_page, page_count, moved, user_ctx, moved_count);
+}
+
+int fingerprint_dev_get_baudrate(fingerprint_handle_t dev) {
+    if (dev == NULL) {
+        return DEFAULT_BAUD_RATE;
+    }
+    return dev->link_baud;
+}
+
+int fingerprint_get_baudrate(void) {
+    return fingerprint_dev_get_baudrate(default_dev);
+}
+
+static void fingerprint_mark_unsupported(fingerprint_dev_t *dev, uint8_t command) {
+    dev->unsupported[command / 8] |= 1 << (command % 8);
+}
+
+bool fingerprint_dev_command_supported(fingerprint_handle_t dev, uint8_t command) {
+    return dev != NULL && (dev->unsupported[command / 8] & (1 << (command % 8))) == 0;
+}
+
+bool fingerprint_command_supported(uint8_t command) {
+    return fingerprint_dev_command_supported(default_dev, command);
+}
+
+static esp_err_t fingerprint_info_page_chunk(uint8_t packet_id, const uint8_t *data, size_t len, void *user_ctx) {
+    fingerprint_dev_t *dev = user_ctx;
+    size_t room = sizeof(dev->info_page) - dev->info_page_len;
+    size_t n = (len < room) ? len : room;
+
+    memcpy(dev->info_page + dev->info_page_len, data, n);
+    dev->info_page_len += n;
+    return ESP_OK;
+}
+
+esp_err_t fingerprint_dev_read_sys_params(fingerprint_handle_t dev) {
+    fingerprint_frame_t *frame = NULL;
+    FingerprintPacket response;
+    fingerprint_sys_params_t params = {0};
+
+    if (dev == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xSemaphoreTakeRecursive(dev->txn_mutex, portMAX_DELAY);
+    esp_err_t err = fingerprint_transceive_frame(dev, frame_read_sys_para, dev->address, &frame, TIMEOUT_BY_COMMAND);
+    if (err != ESP_OK) {
+        goto done;
+    }
+    if (frame->data[0] != FINGERPRINT_OK || frame->length - 2 < 1 + SYSPARA_LEN) {
+        ESP_LOGE(TAG, "Failed to read system parameters (status 0x%02X, %u bytes)", frame->data[0], frame->length - 2);
+        err = (frame->data[0] != FINGERPRINT_OK) ? ESP_FAIL : ESP_ERR_INVALID_RESPONSE;
+        fingerprint_release_frame(dev, frame);
+        goto done;
+    }
+    const uint8_t *p = &frame->data[1];
+    params.status_register = (p[0] << 8) | p[1];
+    params.system_id = (p[2] << 8) | p[3];
+    params.library_size = (p[4] << 8) | p[5];
+    params.security_level = (p[6] << 8) | p[7];
+    params.address = ((uint32_t)p[8] << 24) | ((uint32_t)p[9] << 16) | (p[10] << 8) | p[11];
+    params.packet_size = 32 << (((p[12] << 8) | p[13]) & 0x03);
+    params.baud_rate = ((p[14] << 8) | p[15]) * BAUD_UNIT;
+    fingerprint_release_frame(dev, frame);
+
+    // Optional; a module without it is remembered and not asked again
+    if (fingerprint_dev_command_supported(dev, CMD_CODE(frame_read_inf_page))) {
+        dev->info_page_len = 0;
+        esp_err_t page_err = fingerprint_transceive(dev, frame_read_inf_page, dev->address, &response, TIMEOUT_BY_COMMAND);
+        if (page_err == ESP_OK && fingerprint_get_status(&response) == FINGERPRINT_OK) {
+            page_err = fingerprint_receive_data(dev, fingerprint_info_page_chunk, dev, NULL);
+            params.info_page = (page_err == ESP_OK);
+        } else if (page_err == ESP_OK) {
+            ESP_LOGW(TAG, "PS_ReadINFpage not supported (status 0x%02X)", response.command);
+            fingerprint_mark_unsupported(dev, CMD_CODE(frame_read_inf_page));
+        }
+    }
+
+    dev->sys_params = params;
+    dev->sys_params_valid = true;
+    dev->packet_len = params.packet_size;
+    if (params.library_size > 0) {
+        dev->index_capacity = (params.library_size < FINGERPRINT_INDEX_CAPACITY) ? params.library_size : FINGERPRINT_INDEX_CAPACITY;
+    }
+    ESP_LOGI(TAG, "Module: %u template pages, security level %u, %u-byte packets, %d bps",
+             params.library_size, params.security_level, params.packet_size, params.baud_rate);
+
+done:
+    xSemaphoreGiveRecursive(dev->txn_mutex);
+    return err;
+}
+
+esp_err_t fingerprint_read_sys_params(void) {
+    return fingerprint_dev_read_sys_params(default_dev);
+}
+
+#if CONFIG_FINGERPRINT_MAX_PACKET_SIZE
+// Switches the module to 32 << `code` byte data packets and re-reads the parameters.
+static esp_err_t fingerprint_set_packet_size(fingerprint_dev_t *dev, uint8_t code) {
+    uint8_t cmd[sizeof(frame_write_reg)];
+    uint8_t params[2] = {SYSPARA_REG_PACKET_SIZE, code};
+    FingerprintPacket response;
+
+    memcpy(cmd, frame_write_reg, sizeof(cmd));
+    fingerprint_frame_patch(cmd, 0, params, sizeof(params));
+    esp_err_t err = fingerprint_transceive(dev, cmd, dev->address, &response, TIMEOUT_BY_COMMAND);
+    if (err == ESP_OK && fingerprint_get_status(&response) != FINGERPRINT_OK) {
+        ESP_LOGE(TAG, "Module refused %u-byte packets (status 0x%02X)", 32 << code, response.command);
+        err = ESP_FAIL;
+    }
+    if (err == ESP_OK) {
+        err = fingerprint_dev_read_sys_params(dev);
+    }
+    return err;
+}
+#endif
+
+esp_err_t fingerprint_dev_get_sys_params(fingerprint_handle_t dev, fingerprint_sys_params_t *out) {
+    if (out == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (dev == NULL || !dev->sys_params_valid) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    *out = dev->sys_params;
+    return ESP_OK;
+}
+
+esp_err_t fingerprint_get_sys_params(fingerprint_sys_params_t *out) {
+    return fingerprint_dev_get_sys_params(default_dev, out);
+}
+
+esp_err_t fingerprint_dev_get_info_page(fingerprint_handle_t dev, uint8_t *buf, size_t len, size_t *out_len) {
+    if (buf == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (dev == NULL || !dev->sys_params.info_page) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    size_t n = (len < dev->info_page_len) ? len : dev->info_page_len;
+    memcpy(buf, dev->info_page, n);
+    if (out_len != NULL) {
+        *out_len = n;
+    }
+    return ESP_OK;
+}
+
+esp_err_t fingerprint_get_info_page(uint8_t *buf, size_t len, size_t *out_len) {
+    return fingerprint_dev_get_info_page(default_dev, buf, len, out_len);
+}
+
+// Function to read the response packet from UART and return the FingerprintPacket structure
+FingerprintPacket* fingerprint_read_response(void) {
+    FingerprintPacket *packet = (FingerprintPacket*)malloc(sizeof(FingerprintPacket));
+    if (!packet) {
+        ESP_LOGE(TAG, "Memory allocation failed!");
+        return NULL;
+    }
+
+    if (fingerprint_read_response_into(packet, UART_READ_TIMEOUT) != ESP_OK) {
+        free(packet);  // Free memory before returning
+        return NULL;
+    }
+    return packet;  // Caller must free this memory after use
+}
+
+
+fingerprint_status_t fingerprint_get_status(FingerprintPacket *packet) {
+    if (!packet) {
+        return FINGERPRINT_ILLEGAL_DATA; // Return a default error if the packet is NULL
+    }
+
+    return (fingerprint_status_t)packet->command; // The command field stores the status code
+}
+
+fingerprint_status_t fingerprint_dev_scan(fingerprint_handle_t dev) {
+    FingerprintPacket response;
+
+    if (dev == NULL) {
+        return FINGERPRINT_PACKET_ERROR;
+    }
+
+    // Send the capture command; the module answers with a single ACK frame
+    esp_err_t err = fingerprint_transceive(dev, frame_get_image, dev->address, &response, TIMEOUT_BY_COMMAND);
+    if (err == ESP_ERR_TIMEOUT) {
+        ESP_LOGW(TAG, "No response from fingerprint module.");
+    } else if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to send fingerprint scan command");
+    }
+    fingerprint_status_t status = fingerprint_exchange_status(err, &response);
+
+    // Log the status for debugging
+    ESP_LOGD(TAG, "Fingerprint scan response: 0x%02X", status);
+
+    return status;
+}
+
+fingerprint_status_t fingerprint_scan(void) {
+    return fingerprint_dev_scan(default_dev);
+}
+
+// Picks the event that tells the application why a stage failed.
+static fingerprint_event_t fingerprint_failure_event(fingerprint_status_t status) {
+    switch (status) {
+    case FINGERPRINT_IMAGE_FAIL:
+    case FINGERPRINT_TOO_DRY:
+    case FINGERPRINT_TOO_WET:
+    case FINGERPRINT_TOO_CHAOTIC:
+    case FINGERPRINT_IMAGE_AREA_SMALL:
+        return EVENT_IMAGE_FAIL;
+    case FINGERPRINT_TOO_FEW_POINTS:
+        return EVENT_FEATURE_EXTRACT_FAIL;
+    case FINGERPRINT_MISMATCH:
+    case FINGERPRINT_NOT_FOUND:
+        return EVENT_MATCH_FAIL;
+    case FINGERPRINT_DB_FULL:
+        return EVENT_DB_FULL;
+    case FINGERPRINT_SENSOR_OP_FAIL:
+        return EVENT_SENSOR_ERROR;
+    default:
+        return EVENT_ERROR;
+    }
+}
+
+/**
+ * @brief Sends a PS_AutoEnroll/PS_Autoldentify command and consumes its progress ACKs.
+ *
+ * Every ACK is turned into an event as soon as it is parsed. Returns when the ACK for
+ * `final_stage` arrives, when a stage fails, or when the module goes quiet. `refused` (may
+ * be NULL) is set if the module answered the command itself with FINGERPRINT_PACKET_ERROR,
+ * i.e. it does not know it; a transport error or a later stage never sets it.
+ */
+static fingerprint_status_t fingerprint_run_auto(fingerprint_dev_t *dev, const uint8_t *cmd, uint8_t final_stage, FingerprintPacket *last, bool *refused) {
+    fingerprint_status_t status;
+    esp_err_t err;
+
+    if (dev == NULL) {
+        return FINGERPRINT_PACKET_ERROR;
+    }
+    xSemaphoreTakeRecursive(dev->txn_mutex, portMAX_DELAY);
+    int64_t start_us = esp_timer_get_time();
+    fingerprint_stages_begin(dev, start_us);
+
+    err = fingerprint_transceive(dev, cmd, dev->address, last, TIMEOUT_BY_COMMAND);
+    if (refused != NULL) {
+        *refused = (err == ESP_OK && fingerprint_get_status(last) == FINGERPRINT_PACKET_ERROR);
+    }
+    while (1) {
+        status = fingerprint_exchange_status(err, last);
+        if (status != FINGERPRINT_OK) {
+            fingerprint_raise(dev, fingerprint_failure_event(status), status, FINGERPRINT_NO_PAGE, 0);
+            break;
+        }
+
+        uint8_t stage = last->parameters[0];
+        if (stage == final_stage) {
+            break;
+        }
+        if (stage == AUTO_STAGE_GET_IMAGE) {
+            fingerprint_raise(dev, EVENT_IMAGE_CAPTURED, status, FINGERPRINT_NO_PAGE, 0);
+        } else if (stage == AUTO_STAGE_GEN_CHAR) {
+            fingerprint_raise(dev, EVENT_FEATURE_EXTRACTED, status, FINGERPRINT_NO_PAGE, 0);
+        }
+        err = fingerprint_dev_read_response_into(dev, last, AUTO_STAGE_TIMEOUT_MS);
+    }
+
+    fingerprint_stats_flow(dev, CMD_CODE(cmd) == 0x32 ? FINGERPRINT_FLOW_IDENTIFY : FINGERPRINT_FLOW_ENROLL, start_us);
+    xSemaphoreGiveRecursive(dev->txn_mutex);
+    return status;
+}
+
+// fingerprint_dev_auto_enroll(), telling fingerprint_dev_enroll() whether to fall back.
+static fingerprint_status_t fingerprint_auto_enroll_run(fingerprint_dev_t *dev, uint16_t id, uint8_t entries, uint16_t flags, bool *refused) {
+    uint8_t cmd[sizeof(frame_auto_enroll)];
+    FingerprintPacket last;
+    // ID number (2 bytes), number of entries (1 byte), parameter (2 bytes)
+    uint8_t params[5] = {(id >> 8) & 0xFF, id & 0xFF, entries, (flags >> 8) & 0xFF, flags & 0xFF};
+
+    memcpy(cmd, frame_auto_enroll, sizeof(cmd));
+    fingerprint_frame_patch(cmd, 0, params, sizeof(params));
+    fingerprint_status_t status = fingerprint_run_auto(dev, cmd, AUTO_STAGE_STORE, &last, refused);
+    if (status == FINGERPRINT_OK) {
+        // Only the AUTO_STAGE_STORE ACK means the page is taken; the first ACK just accepts the parameters
+        portENTER_CRITICAL(&dev->index_lock);
+        fingerprint_index_mark(dev, id, 1, true);
+        portEXIT_CRITICAL(&dev->index_lock);
+        fingerprint_raise(dev, EVENT_ENROLL_SUCCESS, status, id, 0);
+    }
+    return status;
+}
+
+fingerprint_status_t fingerprint_dev_auto_enroll(fingerprint_handle_t dev, uint16_t id, uint8_t entries, uint16_t flags) {
+    return fingerprint_auto_enroll_run(dev, id, entries, flags, NULL);
+}
+
+fingerprint_status_t fingerprint_auto_enroll(uint16_t id, uint8_t entries, uint16_t flags) {
+    return fingerprint_dev_auto_enroll(default_dev, id, entries, flags);
+}
+
+fingerprint_status_t fingerprint_dev_auto_identify(fingerprint_handle_t dev, uint8_t security_level, fingerprint_match_result_t *result) {
+    uint8_t cmd[sizeof(frame_auto_identify)];
+    FingerprintPacket last;
+
+    // Security level (1 byte); the template already searches the whole database (ID 0xFFFF)
+    memcpy(cmd, frame_auto_identify, sizeof(cmd));
+    fingerprint_frame_patch(cmd, 0, &security_level, 1);
+    fingerprint_status_t status = fingerprint_run_auto(dev, cmd, AUTO_STAGE_SEARCH, &last, NULL);
+    uint16_t page_id = (status == FINGERPRINT_OK) ? ((last.parameters[1] << 8) | last.parameters[2]) : 0;
+    uint16_t score = (status == FINGERPRINT_OK) ? ((last.parameters[3] << 8) | last.parameters[4]) : 0;
+    if (status == FINGERPRINT_OK) {
+        fingerprint_raise(dev, EVENT_MATCH_SUCCESS, status, page_id, score);
+    }
+    if (result != NULL) {
+        result->status = status;
+        result->page_id = page_id;
+        result->score = score;
+    }
+    return status;
+}
+
+fingerprint_status_t fingerprint_auto_identify(uint8_t security_level, fingerprint_match_result_t *result) {
+    return fingerprint_dev_auto_identify(default_dev, security_level, result);
+}
+
+// Statuses of a capture that a better-placed finger can fix, so the capture loop tries again.
+static bool fingerprint_capture_retryable(fingerprint_status_t status) {
+    switch (status) {
+    case FINGERPRINT_IMAGE_FAIL:
+    case FINGERPRINT_TOO_DRY:
+    case FINGERPRINT_TOO_WET:
+    case FINGERPRINT_TOO_CHAOTIC:
+    case FINGERPRINT_TOO_FEW_POINTS:
+    case FINGERPRINT_IMAGE_AREA_SMALL:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/**
+ * @brief Captures an image and extracts it into CharBuffer1; caller holds txn_mutex.
+ *
+ * Poor images are captured again back to back, without spending a PS_GenChar1 on an image
+ * the module already rejected, until `attempts` captures were tried or `budget_ms` has
+ * passed since `start_us` (0 selects the Kconfig defaults). Every rejection raises its
+ * failure event. A lifted finger ends the loop without an event.
+ *
+ * @return FINGERPRINT_OK once CharBuffer1 holds the probe, otherwise the last status; the
+ *         transport error of the last command goes to `err_out`.
+ */
+static fingerprint_status_t fingerprint_capture(fingerprint_dev_t *dev, uint32_t address, uint8_t attempts, uint16_t budget_ms, int64_t start_us, esp_err_t *err_out) {
+    FingerprintPacket response;
+    fingerprint_status_t status = FINGERPRINT_PACKET_ERROR;
+    esp_err_t err = ESP_OK;
+
+    attempts = attempts ? attempts : CONFIG_FINGERPRINT_CAPTURE_ATTEMPTS;
+    budget_ms = budget_ms ? budget_ms : CONFIG_FINGERPRINT_CAPTURE_BUDGET_MS;
+    for (uint8_t attempt = 0; attempt < attempts; attempt++) {
+        if (attempt > 0 && budget_ms > 0 && esp_timer_get_time() - start_us >= (int64_t)budget_ms * 1000) {
+            break;
+        }
+
+        err = fingerprint_transceive(dev, frame_get_image, address, &response, TIMEOUT_BY_COMMAND);
+        status = fingerprint_exchange_status(err, &response);
+        if (status == FINGERPRINT_NO_FINGER) {
+            break;  // Nothing (or nothing any more) on the sensor; the result alone reports it
+        }
+        if (status != FINGERPRINT_OK) {
+            fingerprint_raise(dev, err == ESP_OK ? fingerprint_failure_event(status) : EVENT_ERROR, status, FINGERPRINT_NO_PAGE, 0);
+            if (err == ESP_OK && fingerprint_capture_retryable(status)) {
+                continue;
+            }
+            break;
+        }
+        fingerprint_raise(dev, EVENT_IMAGE_CAPTURED, status, FINGERPRINT_NO_PAGE, 0);
+
+        err = fingerprint_transceive(dev, frame_gen_char1, address, &response, TIMEOUT_BY_COMMAND);
+        status = fingerprint_exchange_status(err, &response);
+        if (status == FINGERPRINT_OK) {
+            fingerprint_raise(dev, EVENT_FEATURE_EXTRACTED, status, FINGERPRINT_NO_PAGE, 0);
+            break;
+        }
+        fingerprint_raise(dev, err == ESP_OK ? EVENT_FEATURE_EXTRACT_FAIL : EVENT_ERROR, status, FINGERPRINT_NO_PAGE, 0);
+        if (err != ESP_OK || !fingerprint_capture_retryable(status)) {
+            break;
+        }
+    }
+    *err_out = err;
+    return status;
+}
+
+typedef struct {
+    uint8_t *buf;
+    size_t size;
+    size_t len;
+} fingerprint_probe_buffer_t;
+
+static esp_err_t fingerprint_probe_chunk(uint8_t packet_id, const uint8_t *data, size_t len, void *user_ctx) {
+    fingerprint_probe_buffer_t *probe = user_ctx;
+    if (probe->len + len > probe->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(probe->buf + probe->len, data, len);
+    probe->len += len;
+    return ESP_OK;
+}
+
+esp_err_t fingerprint_dev_identify_host(fingerprint_handle_t dev, fingerprint_host_db_handle_t db, fingerprint_host_match_t *result) {
+    uint8_t search[sizeof(frame_search)];
+    FingerprintPacket response;
+    fingerprint_probe_buffer_t probe = { .size = fingerprint_host_db_template_len(db) };
+    bool search_host = false;
+    esp_err_t err;
+
+    if (db == NULL || result == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (dev == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    *result = (fingerprint_host_match_t){
+        .status = FINGERPRINT_PACKET_ERROR,
+        .page_id = FINGERPRINT_NO_PAGE,
+        .user_id = FINGERPRINT_HOST_NO_USER,
+    };
+    if (probe.size > FINGERPRINT_MAX_TEMPLATE_LEN) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    // Taken before the link, so nothing holding txn_mutex ever waits for a template buffer
+    probe.buf = fingerprint_pool_get(dev->template_pool_free, portMAX_DELAY);
+    memcpy(search, frame_search, sizeof(search));
+    fingerprint_frame_patch_u16(search, 3, dev->index_capacity);
+
+    // CharBuffer1 must still hold this probe when it is uploaded
+    xSemaphoreTakeRecursive(dev->txn_mutex, portMAX_DELAY);
+    int64_t start_us = esp_timer_get_time();
+    fingerprint_stages_begin(dev, start_us);
+
+    result->status = fingerprint_capture(dev, dev->address, 0, 0, start_us, &err);
+    if (result->status != FINGERPRINT_OK) {
+        goto done;
+    }
+
+    // First level: the module's own database
+    err = fingerprint_transceive(dev, search, dev->address, &response, TIMEOUT_BY_COMMAND);
+    result->status = fingerprint_exchange_status(err, &response);
+    if (result->status == FINGERPRINT_OK) {
+        uint16_t page_id = (response.parameters[0] << 8) | response.parameters[1];
+        uint16_t score = (response.parameters[2] << 8) | response.parameters[3];
+        uint32_t user_id;
+        esp_err_t tier = fingerprint_host_db_resident_user(db, page_id, &user_id);
+        if (tier == ESP_OK || tier == ESP_ERR_INVALID_ARG) {
+            // A current hot tier copy names its host user; a page outside the tier has none
+            result->user_id = (tier == ESP_OK) ? user_id : FINGERPRINT_HOST_NO_USER;
+            result->on_module = true;
+            result->page_id = page_id;
+            result->score = score;
+            fingerprint_raise(dev, EVENT_MATCH_SUCCESS, result->status, result->page_id, result->score);
+            goto done;
+        }
+        // A hot tier page whose copy is outdated must not vouch for anyone; ask the host instead
+        result->status = FINGERPRINT_NOT_FOUND;
+    }
+    if (result->status != FINGERPRINT_NOT_FOUND) {
+        fingerprint_raise(dev, err == ESP_OK ? EVENT_MATCH_FAIL : EVENT_ERROR, result->status, FINGERPRINT_NO_PAGE, 0);
+        goto done;
+    }
+
+    // Second level: pull the probe out of CharBuffer1; the host scan runs once the link is free
+    err = fingerprint_transceive(dev, frame_up_char, dev->address, &response, TIMEOUT_BY_COMMAND);
+    result->status = fingerprint_exchange_status(err, &response);
+    if (result->status == FINGERPRINT_OK) {
+        err = fingerprint_receive_data(dev, fingerprint_probe_chunk, &probe, NULL);
+        if (err == ESP_OK && probe.len != probe.size) {
+            ESP_LOGE(TAG, "Probe template has %u bytes, the host database %u", (unsigned int)probe.len, (unsigned int)probe.size);
+            err = ESP_ERR_INVALID_SIZE;
+        }
+    }
+    if (result->status == FINGERPRINT_OK && err == ESP_OK) {
+        search_host = true;
+    } else {
+        fingerprint_raise(dev, EVENT_ERROR, result->status, FINGERPRINT_NO_PAGE, 0);
+    }
+
+done:
+    xSemaphoreGiveRecursive(dev->txn_mutex);
+    if (search_host) {
+        fingerprint_host_db_match_t match;
+        err = fingerprint_host_db_search(db, probe.buf, probe.len, &match);
+        if (err == ESP_OK) {
+            result->user_id = match.user_id;
+            result->score = match.score;
+            fingerprint_raise(dev, EVENT_MATCH_SUCCESS, FINGERPRINT_OK, FINGERPRINT_NO_PAGE, match.score);
+
+            // The caller gets its answer first; the worker moves the user into the hot tier afterwards
+            fingerprint_job_t job = {
+                .type = JOB_PROMOTE,
+                .promote = { db, match.user_id },
+            };
+            if (xQueueSend(dev->job_queue, &job, 0) != pdTRUE) {
+                ESP_LOGW(TAG, "Request queue full, not promoting user %u", (unsigned int)match.user_id);
+            }
+        } else {
+            result->status = FINGERPRINT_NOT_FOUND;
+            fingerprint_raise(dev, EVENT_MATCH_FAIL, result->status, FINGERPRINT_NO_PAGE, 0);
+        }
+    }
+    fingerprint_stats_flow(dev, FINGERPRINT_FLOW_IDENTIFY, start_us);
+    fingerprint_pool_put(dev->template_pool_free, probe.buf);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (result->status == FINGERPRINT_OK) {
+        return ESP_OK;
+    }
+    return result->status == FINGERPRINT_NOT_FOUND ? ESP_ERR_NOT_FOUND : ESP_FAIL;
+}
+
+esp_err_t fingerprint_identify_host(fingerprint_host_db_handle_t db, fingerprint_host_match_t *result) {
+    return fingerprint_dev_identify_host(default_dev, db, result);
+}
+
+#if CONFIG_FINGERPRINT_SECURE_CHANNEL
+// Wire format of the secure commands; see fingerprint_secure.h
+#define SECURE_GET_KEYT_CODE 0xE0
+#define SECURE_STORE_CODE 0xF2
+#define SECURE_SEARCH_CODE 0xF4
+#define SECURE_NONCE_LEN 16             // Host and module nonces of PS_GetKeyt
+#define SECURE_TAG_LEN 16               // AES-CMAC tag closing every authenticated frame
+#define SECURE_SEQ_LEN 4                // Sequence number ahead of the encrypted parameters
+#define SECURE_PARAM_OFFSET (CMD_PARAM_OFFSET + SECURE_SEQ_LEN)
+#define SECURE_SEARCH_REPLY 4           // PS_SecuritySearch: page, score
+#define SECURE_DIR_COMMAND 0x01         // First byte of the CTR counter block
+#define SECURE_DIR_REPLY 0x02
+#define SECURE_KDF_LABEL "ZW111 session"
+
+// Forgets the session; the next secure command starts with a fresh PS_GetKeyt. Caller holds txn_mutex.
+static void fingerprint_secure_drop(fingerprint_dev_t *dev) {
+    if (dev->secure_session) {
+        mbedtls_aes_free(&dev->secure_aes);  // Both zeroize their key material
+        mbedtls_cipher_free(&dev->secure_cmac);
+        dev->secure_session = false;
+    }
+}
+
+// Writes header, address, packet ID, length and code of a command with `payload_len` payload bytes.
+static void fingerprint_secure_frame_begin(fingerprint_dev_t *dev, uint8_t *buf, uint8_t code, size_t payload_len) {
+    uint16_t length = payload_len + 2;
+
+    buf[0] = (FINGERPRINT_HEADER >> 8) & 0xFF;
+    buf[1] = FINGERPRINT_HEADER & 0xFF;
+    buf[2] = (dev->address >> 24) & 0xFF;
+    buf[3] = (dev->address >> 16) & 0xFF;
+    buf[4] = (dev->address >> 8) & 0xFF;
+    buf[5] = dev->address & 0xFF;
+    buf[6] = FINGERPRINT_PID_COMMAND;
+    buf[7] = (length >> 8) & 0xFF;
+    buf[8] = length & 0xFF;
+    buf[9] = code;
+}
+
+// Appends the checksum to a frame whose payload ends at `buf + end`.
+static void fingerprint_secure_frame_end(uint8_t *buf, size_t end) {
+    uint16_t sum = fingerprint_checksum_update(0, &buf[6], end - 6);  // Packet ID through the last data byte
+
+    buf[end] = (sum >> 8) & 0xFF;
+    buf[end + 1] = sum & 0xFF;
+}
+
+// AES-CTR over `len` bytes in place, with the counter block of `dir` and `seq`.
+static int fingerprint_secure_crypt(fingerprint_dev_t *dev, uint8_t dir, uint32_t seq, uint8_t *data, size_t len) {
+    uint8_t counter[16] = { dir, 0, 0, 0, (seq >> 24) & 0xFF, (seq >> 16) & 0xFF, (seq >> 8) & 0xFF, seq & 0xFF };
+    uint8_t stream[16];
+    size_t offset = 0;
+
+    int ret = mbedtls_aes_crypt_ctr(&dev->secure_aes, len, &offset, counter, stream, data, data);
+    mbedtls_platform_zeroize(stream, sizeof(stream));
+    return ret;
+}
+
+/**
+ * @brief AES-CMAC under the session's MAC key, fed from where the bytes already lie.
+ *
+ * Covers `prefix` (SECURE_TAG_LEN bytes, or NULL), the packet ID and length in `head` and
+ * `len` bytes of `body` starting at the confirmation or command code.
+ */
+static int fingerprint_secure_mac(fingerprint_dev_t *dev, const uint8_t *prefix, const uint8_t *head, const uint8_t *body, size_t len, uint8_t *tag) {
+    int ret = mbedtls_cipher_cmac_reset(&dev->secure_cmac);
+
+    if (ret == 0 && prefix != NULL) {
+        ret = mbedtls_cipher_cmac_update(&dev->secure_cmac, prefix, SECURE_TAG_LEN);
+    }
+    if (ret == 0) {
+        ret = mbedtls_cipher_cmac_update(&dev->secure_cmac, head, 3);
+    }
+    if (ret == 0) {
+        ret = mbedtls_cipher_cmac_update(&dev->secure_cmac, body, len);
+    }
+    if (ret == 0) {
+        ret = mbedtls_cipher_cmac_finish(&dev->secure_cmac, tag);
+    }
+    return ret;
+}
+
+// Compares two tags in constant time, so a failed check leaks nothing about the expected tag.
+static bool fingerprint_secure_tag_equal(const uint8_t *a, const uint8_t *b) {
+    uint8_t diff = 0;
+
+    for (size_t i = 0; i < SECURE_TAG_LEN; i++) {
+        diff |= a[i] ^ b[i];
+    }
+    return diff == 0;
+}
+
+// Runs PS_GetKeyt in `buf`, a TX pool buffer, unless a session is up; caller holds txn_mutex.
+static esp_err_t fingerprint_secure_handshake(fingerprint_dev_t *dev, uint8_t *buf) {
+    const size_t label_len = sizeof(SECURE_KDF_LABEL) - 1;
+    uint8_t *host_nonce = &buf[CMD_PARAM_OFFSET];
+    fingerprint_frame_t *frame = NULL;
+    uint8_t material[sizeof(SECURE_KDF_LABEL) - 1 + 2 * SECURE_NONCE_LEN];
+    uint8_t keys[32];
+    uint8_t tag[SECURE_TAG_LEN];
+
+    if (dev->secure_session) {
+        return ESP_OK;
+    }
+    if (!dev->secure_key_set) {
+        ESP_LOGE(TAG, "No secure channel key set");
+        return ESP_ERR_INVALID_STATE;
+    }
+    fingerprint_secure_frame_begin(dev, buf, SECURE_GET_KEYT_CODE, 1 + SECURE_NONCE_LEN);
+    esp_fill_random(host_nonce, SECURE_NONCE_LEN);
+    fingerprint_secure_frame_end(buf, CMD_PARAM_OFFSET + SECURE_NONCE_LEN);
+    esp_err_t err = fingerprint_transceive_frame(dev, buf, dev->address, &frame, TIMEOUT_BY_COMMAND);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (frame->packet_id != FINGERPRINT_PID_ACK || frame->data[0] != FINGERPRINT_OK ||
+        frame->length != 2 + 1 + SECURE_NONCE_LEN + SECURE_TAG_LEN) {
+        ESP_LOGE(TAG, "Secure channel handshake failed (status 0x%02X, %u bytes)", frame->data[0], frame->length - 2);
+        err = (frame->data[0] != FINGERPRINT_OK) ? ESP_FAIL : ESP_ERR_INVALID_RESPONSE;
+        fingerprint_release_frame(dev, frame);
+        return err;
+    }
+
+    // Both nonces go into the keys, so neither side can be fed a recorded session
+    memcpy(material, SECURE_KDF_LABEL, label_len);
+    memcpy(material + label_len, host_nonce, SECURE_NONCE_LEN);
+    memcpy(material + label_len + SECURE_NONCE_LEN, &frame->data[1], SECURE_NONCE_LEN);
+    mbedtls_aes_init(&dev->secure_aes);
+    mbedtls_cipher_init(&dev->secure_cmac);
+    int ret = mbedtls_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), dev->secure_key, sizeof(dev->secure_key),
+                              material, sizeof(material), keys);
+    if (ret == 0) {
+        ret = mbedtls_aes_setkey_enc(&dev->secure_aes, keys, 128);
+    }
+    if (ret == 0) {
+        ret = mbedtls_cipher_setup(&dev->secure_cmac, mbedtls_cipher_info_from_type(MBEDTLS_CIPHER_AES_128_ECB));
+    }
+    if (ret == 0) {
+        ret = mbedtls_cipher_cmac_starts(&dev->secure_cmac, &keys[16], 128);
+    }
+    mbedtls_platform_zeroize(material, sizeof(material));
+    mbedtls_platform_zeroize(keys, sizeof(keys));
+
+    // The module proves it derived the same keys
+    if (ret == 0) {
+        uint8_t head[3] = { frame->packet_id, (frame->length >> 8) & 0xFF, frame->length & 0xFF };
+        ret = fingerprint_secure_mac(dev, host_nonce, head, frame->data, 1 + SECURE_NONCE_LEN, tag);
+    }
+    bool valid = (ret == 0) && fingerprint_secure_tag_equal(tag, &frame->data[1 + SECURE_NONCE_LEN]);
+    fingerprint_release_frame(dev, frame);
+    if (!valid) {
+        mbedtls_aes_free(&dev->secure_aes);
+        mbedtls_cipher_free(&dev->secure_cmac);
+        if (ret != 0) {
+            ESP_LOGE(TAG, "Session key derivation failed (-0x%04X)", (unsigned int)-ret);
+            return ESP_FAIL;
+        }
+        ESP_LOGE(TAG, "Module failed to prove the session key; check the provisioned key");
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    dev->secure_seq = 0;
+    dev->secure_session = true;
+    return ESP_OK;
+}
+
+/**
+ * @brief Sends a secure command and authenticates and decrypts its reply; caller holds txn_mutex.
+ *
+ * The command is built in a TX pool buffer, its parameters encrypted and tagged in place,
+ * and the buffer goes out as it is. Resends inside fingerprint_transceive_frame() repeat the
+ * sequence number, which the module answers with the reply it already sent. The reply is
+ * checked against the command's tag, then decrypted in place in the RX frame; an OK reply
+ * must carry `reply_len` parameter bytes, any other none. A module that lost the session
+ * (a bare `FINGERPRINT_ENCRYPTION_MISMATCH`) gets one new handshake.
+ *
+ * @return ESP_OK with the reply in `*frame_out` (the caller releases it), otherwise the error.
+ */
+static esp_err_t fingerprint_secure_exchange(fingerprint_dev_t *dev, uint8_t code, const uint8_t *params, size_t param_len,
+                                             size_t reply_len, fingerprint_frame_t **frame_out) {
+    uint8_t *cipher_text;
+    uint8_t *cmd_tag;
+    fingerprint_frame_t *frame = NULL;
+    uint8_t tag[SECURE_TAG_LEN];
+    esp_err_t err = ESP_FAIL;
+
+    uint8_t *buf = fingerprint_pool_get(dev->tx_pool_free, pdMS_TO_TICKS(POOL_WAIT_MS));
+    if (buf == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    cipher_text = &buf[SECURE_PARAM_OFFSET];
+    cmd_tag = cipher_text + param_len;
+
+    for (int attempt = 0; attempt < 2; attempt++) {
+        if (dev->secure_seq == UINT32_MAX) {
+            fingerprint_secure_drop(dev);  // A counter block is never used twice
+        }
+        err = fingerprint_secure_handshake(dev, buf);
+        if (err != ESP_OK) {
+            break;
+        }
+
+        uint32_t seq = ++dev->secure_seq;
+        fingerprint_secure_frame_begin(dev, buf, code, 1 + SECURE_SEQ_LEN + param_len + SECURE_TAG_LEN);
+        buf[CMD_PARAM_OFFSET] = (seq >> 24) & 0xFF;
+        buf[CMD_PARAM_OFFSET + 1] = (seq >> 16) & 0xFF;
+        buf[CMD_PARAM_OFFSET + 2] = (seq >> 8) & 0xFF;
+        buf[CMD_PARAM_OFFSET + 3] = seq & 0xFF;
+        memcpy(cipher_text, params, param_len);
+        int ret = fingerprint_secure_crypt(dev, SECURE_DIR_COMMAND, seq, cipher_text, param_len);
+        if (ret == 0) {
+            ret = fingerprint_secure_mac(dev, NULL, &buf[6], &buf[9], 1 + SECURE_SEQ_LEN + param_len, cmd_tag);
+        }
+        if (ret != 0) {
+            ESP_LOGE(TAG, "Failed to seal command 0x%02X (-0x%04X)", code, (unsigned int)-ret);
+            err = ESP_FAIL;
+            break;
+        }
+        fingerprint_secure_frame_end(buf, SECURE_PARAM_OFFSET + param_len + SECURE_TAG_LEN);
+
+        err = fingerprint_transceive_frame(dev, buf, dev->address, &frame, TIMEOUT_BY_COMMAND);
+        if (err != ESP_OK) {
+            break;
+        }
+        size_t payload_len = frame->length - 2;
+        if (frame->packet_id == FINGERPRINT_PID_ACK && payload_len == 1 && frame->data[0] == FINGERPRINT_ENCRYPTION_MISMATCH) {
+            // Untagged, so it can cost a handshake but never stands in for a result
+            fingerprint_release_frame(dev, frame);
+            fingerprint_secure_drop(dev);
+            if (attempt == 1) {
+                ESP_LOGE(TAG, "Module rejects the secure session; check the provisioned key");
+                err = ESP_FAIL;
+                break;
+            }
+            ESP_LOGW(TAG, "Module dropped the secure session, renegotiating");
+            continue;
+        }
+
+        size_t body_len = 1 + (frame->data[0] == FINGERPRINT_OK ? reply_len : 0);
+        bool valid = frame->packet_id == FINGERPRINT_PID_ACK && payload_len == body_len + SECURE_TAG_LEN;
+        if (valid) {
+            uint8_t head[3] = { frame->packet_id, (frame->length >> 8) & 0xFF, frame->length & 0xFF };
+            ret = fingerprint_secure_mac(dev, cmd_tag, head, frame->data, body_len, tag);
+            valid = (ret == 0) && fingerprint_secure_tag_equal(tag, &frame->data[body_len]);
+        }
+        if (valid) {
+            valid = fingerprint_secure_crypt(dev, SECURE_DIR_REPLY, seq, &frame->data[1], body_len - 1) == 0;
+        }
+        if (!valid) {
+            ESP_LOGE(TAG, "Reply to command 0x%02X failed authentication", code);
+            fingerprint_release_frame(dev, frame);
+            fingerprint_secure_drop(dev);
+            err = ESP_ERR_INVALID_RESPONSE;
+            break;
+        }
+        *frame_out = frame;
+        break;
+    }
+    fingerprint_pool_put(dev->tx_pool_free, buf);
+    return err;
+}
+
+esp_err_t fingerprint_dev_secure_set_key(fingerprint_handle_t dev, const uint8_t *key) {
+    if (key == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (dev == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xSemaphoreTakeRecursive(dev->txn_mutex, portMAX_DELAY);
+    fingerprint_secure_drop(dev);
+    memcpy(dev->secure_key, key, FINGERPRINT_SECURE_KEY_LEN);
+    dev->secure_key_set = true;
+    xSemaphoreGiveRecursive(dev->txn_mutex);
+    return ESP_OK;
+}
+
+esp_err_t fingerprint_dev_secure_end(fingerprint_handle_t dev) {
+    if (dev == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xSemaphoreTakeRecursive(dev->txn_mutex, portMAX_DELAY);
+    fingerprint_secure_drop(dev);
+    xSemaphoreGiveRecursive(dev->txn_mutex);
+    return ESP_OK;
+}
+
+esp_err_t fingerprint_dev_secure_search(fingerprint_handle_t dev, uint16_t start_page, uint16_t page_count, fingerprint_match_result_t *result) {
+    // Buffer ID, start page, page count
+    uint8_t params[5] = { 0x01, (start_page >> 8) & 0xFF, start_page & 0xFF, (page_count >> 8) & 0xFF, page_count & 0xFF };
+    fingerprint_frame_t *frame = NULL;
+
+    if (result == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (dev == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    *result = (fingerprint_match_result_t){ .status = FINGERPRINT_PACKET_ERROR };
+
+    xSemaphoreTakeRecursive(dev->txn_mutex, portMAX_DELAY);
+    esp_err_t err = fingerprint_secure_exchange(dev, SECURE_SEARCH_CODE, params, sizeof(params), SECURE_SEARCH_REPLY, &frame);
+    if (err == ESP_OK) {
+        result->status = frame->data[0];
+        if (result->status == FINGERPRINT_OK) {
+            result->page_id = (frame->data[1] << 8) | frame->data[2];
+            result->score = (frame->data[3] << 8) | frame->data[4];
+        }
+        fingerprint_release_frame(dev, frame);
+    }
+    xSemaphoreGiveRecursive(dev->txn_mutex);
+
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (result->status == FINGERPRINT_OK) {
+        return ESP_OK;
+    }
+    return result->status == FINGERPRINT_NOT_FOUND ? ESP_ERR_NOT_FOUND : ESP_FAIL;
+}
+
+esp_err_t fingerprint_dev_secure_identify(fingerprint_handle_t dev, fingerprint_match_result_t *result) {
+    esp_err_t err;
+
+    if (result == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (dev == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // CharBuffer1 must still hold the probe when it is searched
+    xSemaphoreTakeRecursive(dev->txn_mutex, portMAX_DELAY);
+    int64_t start_us = esp_timer_get_time();
+    fingerprint_stages_begin(dev, start_us);
+
+    fingerprint_status_t status = fingerprint_capture(dev, dev->address, 0, 0, start_us, &err);
+    if (status != FINGERPRINT_OK) {
+        *result = (fingerprint_match_result_t){ .status = status };
+        if (err == ESP_OK) {
+            err = ESP_FAIL;
+        }
+    } else {
+        err = fingerprint_dev_secure_search(dev, 0, dev->index_capacity, result);
+        if (err == ESP_OK) {
+            fingerprint_raise(dev, EVENT_MATCH_SUCCESS, result->status, result->page_id, result->score);
+        } else {
+            bool rejected = (err == ESP_ERR_NOT_FOUND || err == ESP_FAIL);
+            fingerprint_raise(dev, rejected ? EVENT_MATCH_FAIL : EVENT_ERROR, result->status, FINGERPRINT_NO_PAGE, 0);
+        }
+    }
+    fingerprint_stats_flow(dev, FINGERPRINT_FLOW_IDENTIFY, start_us);
+    xSemaphoreGiveRecursive(dev->txn_mutex);
+    return err;
+}
+
+esp_err_t fingerprint_dev_secure_store(fingerprint_handle_t dev, uint16_t page_id) {
+    // Buffer ID, page ID
+    uint8_t params[3] = { TRANSFER_BUFFER_ID, (page_id >> 8) & 0xFF, page_id & 0xFF };
+    fingerprint_frame_t *frame = NULL;
+
+    if (dev == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xSemaphoreTakeRecursive(dev->txn_mutex, portMAX_DELAY);
+    esp_err_t err = fingerprint_secure_exchange(dev, SECURE_STORE_CODE, params, sizeof(params), 0, &frame);
+    if (err == ESP_OK) {
+        uint8_t status = frame->data[0];
+        fingerprint_release_frame(dev, frame);
+        if (status == FINGERPRINT_OK) {
+            portENTER_CRITICAL(&dev->index_lock);
+            fingerprint_index_mark(dev, page_id, 1, true);
+            portEXIT_CRITICAL(&dev->index_lock);
+        } else {
+            ESP_LOGE(TAG, "Secure store in page %u failed (status 0x%02X)", page_id, status);
+            err = ESP_FAIL;
+        }
+    }
+    xSemaphoreGiveRecursive(dev->txn_mutex);
+    return err;
+}
+
+esp_err_t fingerprint_secure_set_key(const uint8_t *key) {
+    return fingerprint_dev_secure_set_key(default_dev, key);
+}
+
+esp_err_t fingerprint_secure_end(void) {
+    return fingerprint_dev_secure_end(default_dev);
+}
+
+esp_err_t fingerprint_secure_search(uint16_t start_page, uint16_t page_count, fingerprint_match_result_t *result) {
+    return fingerprint_dev_secure_search(default_dev, start_page, page_count, result);
+}
+
+esp_err_t fingerprint_secure_identify(fingerprint_match_result_t *result) {
+    return fingerprint_dev_secure_identify(default_dev, result);
+}
+
+esp_err_t fingerprint_secure_store(uint16_t page_id) {
+    return fingerprint_dev_secure_store(default_dev, page_id);
+}
+#endif // CONFIG_FINGERPRINT_SECURE_CHANNEL
+
+/**
+ * @brief Polls PS_GetImage until a finger is captured or the budget runs out.
+ *
+ * With the touch output wired, the UART stays quiet until the line reports a finger.
+ */
+static fingerprint_status_t fingerprint_wait_for_image(fingerprint_dev_t *dev, uint32_t budget_ms) {
+    FingerprintPacket response;
+    TickType_t start = xTaskGetTickCount();
+    fingerprint_status_t status;
+
+    do {
+        if (dev->touch_pin >= 0 && !fingerprint_touch_active(dev)) {
+            vTaskDelay(pdMS_TO_TICKS(FINGER_POLL_MS));
+            continue;
+        }
+        status = fingerprint_exchange_status(fingerprint_transceive(dev, frame_get_image, dev->address, &response, TIMEOUT_BY_COMMAND), &response);
+        if (status != FINGERPRINT_NO_FINGER) {
+            return status;
+        }
+        vTaskDelay(pdMS_TO_TICKS(FINGER_POLL_MS));
+    } while ((xTaskGetTickCount() - start) < pdMS_TO_TICKS(budget_ms));
+    return FINGERPRINT_TIMEOUT;
+}
+
+/**
+ * @brief Waits until the finger has left the sensor or the budget runs out.
+ *
+ * Reads the touch output if it is wired and polls PS_GetImage for FINGERPRINT_NO_FINGER otherwise.
+ */
+static fingerprint_status_t fingerprint_wait_for_lift(fingerprint_dev_t *dev, uint32_t budget_ms) {
+    FingerprintPacket response;
+    TickType_t start = xTaskGetTickCount();
+
+    do {
+        if (dev->touch_pin >= 0) {
+            if (!fingerprint_touch_active(dev)) {
+                return FINGERPRINT_OK;
+            }
+        } else {
+            fingerprint_status_t status = fingerprint_exchange_status(fingerprint_transceive(dev, frame_get_image, dev->address, &response, TIMEOUT_BY_COMMAND), &response);
+            if (status == FINGERPRINT_NO_FINGER) {
+                return FINGERPRINT_OK;
+            }
+            if (status == FINGERPRINT_TIMEOUT || status == FINGERPRINT_PACKET_ERROR) {
+                return status;
+            }
+        }
+        vTaskDelay(pdMS_TO_TICKS(FINGER_POLL_MS));
+    } while ((xTaskGetTickCount() - start) < pdMS_TO_TICKS(budget_ms));
+    return FINGERPRINT_TIMEOUT;
+}
+
+// Host-driven enroll for modules without PS_AutoEnroll: two presses, merge, store.
+static fingerprint_status_t fingerprint_manual_enroll(fingerprint_dev_t *dev, uint16_t id) {
+    FingerprintPacket response;
+    const uint8_t *gen_char[ENROLL_ENTRIES] = {frame_gen_char1, frame_gen_char2};
+    fingerprint_status_t status;
+
+    for (int i = 0; i < ENROLL_ENTRIES; i++) {
+        if (i > 0) {
+            // A second capture of the same press adds nothing to the merged template
+            status = fingerprint_wait_for_lift(dev, FINGER_WAIT_MS);
+            if (status != FINGERPRINT_OK) {
+                return status;
+            }
+        }
+        status = fingerprint_wait_for_image(dev, FINGER_WAIT_MS);
+        if (status != FINGERPRINT_OK) {
+            return status;
+        }
+        fingerprint_raise(dev, EVENT_IMAGE_CAPTURED, status, FINGERPRINT_NO_PAGE, 0);
+        status = fingerprint_exchange_status(fingerprint_transceive(dev, gen_char[i], dev->address, &response, TIMEOUT_BY_COMMAND), &response);
+        if (status != FINGERPRINT_OK) {
+            return status;
+        }
+        fingerprint_raise(dev, EVENT_FEATURE_EXTRACTED, status, FINGERPRINT_NO_PAGE, 0);
+    }
+
+    status = fingerprint_exchange_status(fingerprint_transceive(dev, frame_reg_model, dev->address, &response, TIMEOUT_BY_COMMAND), &response);
+    if (status != FINGERPRINT_OK) {
+        return status;
+    }
+
+    // The merged template sits in buffer 1, which is the buffer frame_store_char stores from
+    fingerprint_page_command(dev, frame_store_char, id, &status);
+    return status;
+}
+
+esp_err_t fingerprint_dev_enroll(fingerprint_handle_t dev, int id) {
+    if (dev == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    ESP_LOGI(TAG, "Enrolling fingerprint with ID %d...", id);
+
+    if (id < 0 || id > 0xFFFF) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    fingerprint_status_t status = FINGERPRINT_PACKET_ERROR;
+    if (fingerprint_dev_command_supported(dev, CMD_CODE(frame_auto_enroll))) {
+        bool refused = false;
+        status = fingerprint_auto_enroll_run(dev, id, ENROLL_ENTRIES, 0, &refused);
+        if (refused) {
+            // The module did not understand PS_AutoEnroll; drive the enroll from the host from now on
+            ESP_LOGW(TAG, "PS_AutoEnroll not supported, falling back to host-driven enroll");
+            fingerprint_mark_unsupported(dev, CMD_CODE(frame_auto_enroll));
+        }
+    }
+    if (!fingerprint_dev_command_supported(dev, CMD_CODE(frame_auto_enroll))) {
+        // Both captures have to land in the same module session, so hold the link throughout
+        xSemaphoreTakeRecursive(dev->txn_mutex, portMAX_DELAY);
+        int64_t start_us = esp_timer_get_time();
+        fingerprint_stages_begin(dev, start_us);
+        status = fingerprint_manual_enroll(dev, id);
+        fingerprint_stats_flow(dev, FINGERPRINT_FLOW_ENROLL, start_us);
+        xSemaphoreGiveRecursive(dev->txn_mutex);
+        if (status == FINGERPRINT_OK) {
+            fingerprint_raise(dev, EVENT_ENROLL_SUCCESS, status, id, 0);
+        } else {
+            fingerprint_raise(dev, fingerprint_failure_event(status), status, FINGERPRINT_NO_PAGE, 0);
+        }
+    }
+
+    if (status != FINGERPRINT_OK) {
+        ESP_LOGE(TAG, "Fingerprint enrollment failed for ID %d (status 0x%02X)", id, status);
+        return (status == FINGERPRINT_TIMEOUT) ? ESP_ERR_TIMEOUT : ESP_FAIL;
+    }
+
+    ESP_LOGI(TAG, "Fingerprint enrollment successful for ID %d", id);
+    return ESP_OK;
+}
+
+esp_err_t fingerprint_enroll(int id) {
+    return fingerprint_dev_enroll(default_dev, id);
+}
+
+esp_err_t fingerprint_dev_delete(fingerprint_handle_t dev, int id) {
+    if (dev == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    ESP_LOGI(TAG, "Deleting fingerprint ID %d...", id);
+
+    if (id < 0 || id > 0xFFFF) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // PS_DeletChar: Page ID (2 bytes), Number of Entries (2 bytes)
+    uint8_t cmd[sizeof(frame_delet_char)];
+    FingerprintPacket response;
+    memcpy(cmd, frame_delet_char, sizeof(cmd));
+    fingerprint_frame_patch_u16(cmd, 0, id);  // Number of entries stays 1
+
+    // Wait for the module's ACK instead of sleeping for a fixed time
+    esp_err_t err = fingerprint_transceive(dev, cmd, dev->address, &response, TIMEOUT_BY_COMMAND);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to send delete command");
+        return err;
+    }
+    if (fingerprint_get_status(&response) != FINGERPRINT_OK) {
+        ESP_LOGE(TAG, "Failed to delete fingerprint ID %d (status 0x%02X)", id, response.command);
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(TAG, "Fingerprint ID %d deleted successfully", id);
+    return ESP_OK;
+}
+
+esp_err_t fingerprint_delete(int id) {
+    return fingerprint_dev_delete(default_dev, id);
+}
+
+// Waits for the detection task's next wake-up; false once it has been asked to stop.
+static bool fingerprint_detect_wait(fingerprint_dev_t *dev, TickType_t ticks) {
+    ulTaskNotifyTake(pdTRUE, ticks);
+    return !dev->detect_stop;
+}
+
+/**
+ * @brief Raises EVENT_FINGER_DETECTED from the touch output.
+ *
+ * The task sleeps on a level interrupt between touches. A switched module is powered up as
+ * soon as the line goes active and powered down again once the finger has left and no
+ * command holds the link.
+ */
+static void fingerprint_detect_touch(fingerprint_dev_t *dev) {
+    for (;;) {
+        fingerprint_touch_arm(dev, true);
+        if (!fingerprint_detect_wait(dev, portMAX_DELAY)) {
+            break;
+        }
+        xSemaphoreTakeRecursive(dev->txn_mutex, portMAX_DELAY);
+        fingerprint_power_set(dev, true);
+        xSemaphoreGiveRecursive(dev->txn_mutex);
+        fingerprint_dev_trigger_event(dev, EVENT_FINGER_DETECTED);
+
+        fingerprint_touch_arm(dev, false);
+        if (!fingerprint_detect_wait(dev, portMAX_DELAY)) {
+            break;
+        }
+        xSemaphoreTakeRecursive(dev->txn_mutex, portMAX_DELAY);
+        if (dev->power_pin >= 0 && dev->power_gating) {
+            fingerprint_dev_notepad_flush(dev);  // The cache outlives the module's supply, its changes would not
+            fingerprint_power_set(dev, false);
+        }
+        xSemaphoreGiveRecursive(dev->txn_mutex);
+    }
+    gpio_intr_disable(dev->touch_pin);
+}
+
+/**
+ * @brief Raises EVENT_FINGER_DETECTED by polling PS_GetImage.
+ *
+ * The interval doubles from the profile's minimum up to its maximum while the sensor stays
+ * empty and drops back to the minimum as soon as a finger shows up. Both are read on every
+ * round, so a profile change applies from the next poll on.
+ */
+static void fingerprint_detect_poll(fingerprint_dev_t *dev) {
+    FingerprintPacket response;
+    uint32_t interval_ms = dev->detect_poll_min_ms;
+    bool touched = false;
+
+    do {
+        fingerprint_status_t status = fingerprint_exchange_status(fingerprint_transceive(dev, frame_get_image, dev->address, &response, TIMEOUT_BY_COMMAND), &response);
+        if (status == FINGERPRINT_NO_FINGER) {
+            touched = false;
+            uint32_t max_ms = dev->detect_poll_max_ms;
+            interval_ms = (interval_ms * 2 > max_ms) ? max_ms : interval_ms * 2;
+        } else {
+            if (status == FINGERPRINT_OK && !touched) {
+                touched = true;
+                fingerprint_dev_trigger_event(dev, EVENT_FINGER_DETECTED);
+            }
+            interval_ms = dev->detect_poll_min_ms;
+        }
+    } while (fingerprint_detect_wait(dev, pdMS_TO_TICKS(interval_ms)));
+}
+
+static void fingerprint_detect_task(void *arg) {
+    fingerprint_dev_t *dev = arg;
+
+    if (dev->touch_pin >= 0) {
+        fingerprint_detect_touch(dev);
+    } else {
+        fingerprint_detect_poll(dev);
+    }
+    dev->detect_task = NULL;
+    vTaskDelete(NULL);
+}
+
+esp_err_t fingerprint_dev_start_detection(fingerprint_handle_t dev) {
+    if (dev == NULL || dev->detect_task != NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (dev->touch_pin >= 0) {
+        // Lets a touch end automatic or explicit light sleep
+        esp_sleep_enable_gpio_wakeup();
+    } else if (dev->power_pin >= 0) {
+        ESP_LOGW(TAG, "No touch pin; the module stays powered while polling");
+    }
+
+    dev->detect_stop = false;
+    if (xTaskCreatePinnedToCore(fingerprint_detect_task, "fp_detect_task", DETECT_TASK_STACK_SIZE, dev, dev->detect_priority, &dev->detect_task, PROTOCOL_CORE) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create detection task");
+        return ESP_ERR_NO_MEM;
+    }
+    ESP_LOGI(TAG, "Finger detection started (%s)", dev->touch_pin >= 0 ? "touch interrupt" : "polling");
+    return ESP_OK;
+}
+
+esp_err_t fingerprint_start_detection(void) {
+    return fingerprint_dev_start_detection(default_dev);
+}
+
+esp_err_t fingerprint_dev_stop_detection(fingerprint_handle_t dev) {
+    if (dev == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    TaskHandle_t task = dev->detect_task;
+    if (task == NULL) {
+        return ESP_OK;
+    }
+    dev->detect_stop = true;
+    xTaskNotifyGive(task);
+    while (dev->detect_task != NULL) {
+        vTaskDelay(1);
+    }
+
+    // Commands may follow at any time once nothing powers the module up on touch
+    xSemaphoreTakeRecursive(dev->txn_mutex, portMAX_DELAY);
+    fingerprint_power_set(dev, true);
+    xSemaphoreGiveRecursive(dev->txn_mutex);
+    return ESP_OK;
+}
+
+esp_err_t fingerprint_stop_detection(void) {
+    return fingerprint_dev_stop_detection(default_dev);
+}
+
+/**
+ * @brief Settings behind each fingerprint_profile_t.
+ *
+ * The RX task keeps RX_TASK_PRIORITY in every profile: it only runs when the UART driver
+ * reports input, and dropping it below the worker would only delay replies.
+ */
+typedef struct {
+    int baud;                       // Link rate, 0 = the rate the instance was created with
+    UBaseType_t worker_priority;
+    UBaseType_t detect_priority;
+    uint32_t poll_min_ms;
+    uint32_t poll_max_ms;
+    bool power_gating;
+    uint32_t notepad_flush_ms;
+} fingerprint_profile_params_t;
+
+static const fingerprint_profile_params_t fingerprint_profiles[] = {
+    [FINGERPRINT_PROFILE_PERFORMANCE] = {
+        .baud = BAUD_UNIT * BAUD_MULTIPLIER_MAX,
+        .worker_priority = WORKER_TASK_PRIORITY,
+        .detect_priority = DETECT_TASK_PRIORITY,
+        .poll_min_ms = 20,
+        .poll_max_ms = 80,
+        .power_gating = false,          // No power-up settle in front of the first command
+        .notepad_flush_ms = 1000,
+    },
+    [FINGERPRINT_PROFILE_BALANCED] = {
+        .baud = 0,
+        .worker_priority = WORKER_TASK_PRIORITY,
+        .detect_priority = DETECT_TASK_PRIORITY,
+        .poll_min_ms = DETECT_POLL_MIN_MS,
+        .poll_max_ms = DETECT_POLL_MAX_MS,
+        .power_gating = true,
+        .notepad_flush_ms = CONFIG_FINGERPRINT_NOTEPAD_FLUSH_MS,
+    },
+    [FINGERPRINT_PROFILE_LOW_POWER] = {
+        .baud = DEFAULT_BAUD_RATE,
+        .worker_priority = tskIDLE_PRIORITY + 2,
+        .detect_priority = tskIDLE_PRIORITY + 1,
+        .poll_min_ms = 160,
+        .poll_max_ms = 2560,
+        .power_gating = true,
+        .notepad_flush_ms = 60000,      // Batches counter updates into few flash writes
+    },
+};
+
+esp_err_t fingerprint_dev_set_profile(fingerprint_handle_t dev, fingerprint_profile_t profile) {
+    if ((unsigned)profile >= sizeof(fingerprint_profiles) / sizeof(fingerprint_profiles[0])) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (dev == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    const fingerprint_profile_params_t *params = &fingerprint_profiles[profile];
+    int baud = params->baud ? params->baud : dev->baud_rate;
+    esp_err_t err = ESP_OK;
+
+    // Held throughout, so no exchange runs while the link or the supply changes under it
+    xSemaphoreTakeRecursive(dev->txn_mutex, portMAX_DELAY);
+    dev->profile = profile;
+    dev->worker_priority = params->worker_priority;
+    dev->detect_priority = params->detect_priority;
+    vTaskPrioritySet(dev->worker_task, params->worker_priority);
+    TaskHandle_t detect_task = dev->detect_task;
+    if (detect_task != NULL) {
+        vTaskPrioritySet(detect_task, params->detect_priority);
+    }
+    dev->detect_poll_min_ms = params->poll_min_ms;
+    dev->detect_poll_max_ms = params->poll_max_ms;
+    dev->power_gating = params->power_gating;
+    if (!dev->power_gating) {
+        fingerprint_power_set(dev, true);
+    }
+    dev->notepad_flush_ms = params->notepad_flush_ms;
+    if (params->notepad_flush_ms == 0) {
+        esp_timer_stop(dev->notepad_timer);
+    } else if (dev->notepad_dirty != 0 && !esp_timer_is_active(dev->notepad_timer)) {
+        fingerprint_notepad_arm(dev);
+    }
+
+    if (fingerprint_bus_shared(dev)) {
+        ESP_LOGW(TAG, "UART%d is shared; staying at %d bps", dev->uart_port, dev->link_baud);
+    } else if (baud != dev->link_baud) {
+        err = fingerprint_dev_negotiate_baudrate(dev, baud);
+    }
+    xSemaphoreGiveRecursive(dev->txn_mutex);
+    ESP_LOGI(TAG, "Profile %d active at %d bps", (int)profile, dev->link_baud);
+    return err;
+}
+
+esp_err_t fingerprint_set_profile(fingerprint_profile_t profile) {
+    return fingerprint_dev_set_profile(default_dev, profile);
+}
+
+fingerprint_profile_t fingerprint_dev_get_profile(fingerprint_handle_t dev) {
+    return dev != NULL ? dev->profile : FINGERPRINT_PROFILE_BALANCED;
+}
+
+fingerprint_profile_t fingerprint_get_profile(void) {
+    return fingerprint_dev_get_profile(default_dev);
+}
+
+// Delivers the result of an asynchronous request to its submitter.
+static void fingerprint_complete_request(const fingerprint_request_t *request, fingerprint_status_t status, const FingerprintPacket *response) {
+    if (request->callback != NULL) {
+        request->callback(status, response, request->user_ctx);
+    }
+    if (request->notify_task != NULL) {
+        xTaskNotify(request->notify_task, (uint32_t)status, eSetValueWithOverwrite);
+    }
+}
+
+static void fingerprint_run_request(fingerprint_dev_t *dev, fingerprint_request_t *request) {
+    uint8_t cmd[CMD_FRAME_LEN(CMD_MAX_PARAMS)];
+    FingerprintPacket response;
+    uint32_t timeout_ms = request->timeout_ms ? request->timeout_ms : TIMEOUT_BY_COMMAND;
+
+    esp_err_t err = fingerprint_serialize_command(&request->command, request->address, cmd);
+    if (err == ESP_OK) {
+        err = fingerprint_transceive(dev, cmd, request->address, &response, timeout_ms);
+    }
+    fingerprint_complete_request(request, fingerprint_exchange_status(err, &response), (err == ESP_OK) ? &response : NULL);
+}
+
+static void fingerprint_complete_identify(const fingerprint_identify_config_t *config, const fingerprint_match_result_t *result) {
+    if (config->callback != NULL) {
+        config->callback(result, config->user_ctx);
+    }
+    if (config->notify_task != NULL) {
+        xTaskNotify(config->notify_task, (uint32_t)result->status, eSetValueWithOverwrite);
+    }
+}
+
+/**
+ * @brief Runs GetImage -> GenChar1 -> Search back to back.
+ *
+ * All three frames are ready before the first one goes out (only the Search page range is
+ * patched into its template) and the transaction lock is held for the whole chain, so each
+ * stage is sent as soon as the previous ACK has been parsed.
+ */
+static void fingerprint_run_identify(fingerprint_dev_t *dev, fingerprint_identify_config_t *config) {
+    uint8_t search[sizeof(frame_search)];
+    FingerprintPacket response;
+    fingerprint_match_result_t result = {
+        .status = FINGERPRINT_PACKET_ERROR,
+        .page_id = 0,
+        .score = 0,
+    };
+    esp_err_t err;
+
+    // Buffer ID 1 comes with the template; only the page range is patched in
+    memcpy(search, frame_search, sizeof(search));
+    fingerprint_frame_patch_u16(search, 1, config->start_page);
+    fingerprint_frame_patch_u16(search, 3, config->page_count);
+
+    xSemaphoreTakeRecursive(dev->txn_mutex, portMAX_DELAY);
+    int64_t start_us = esp_timer_get_time();
+    fingerprint_stages_begin(dev, start_us);
+
+    result.status = fingerprint_capture(dev, config->address, config->capture_attempts, config->capture_budget_ms, start_us, &err);
+    if (result.status != FINGERPRINT_OK) {
+        goto done;
+    }
+
+    err = fingerprint_transceive(dev, search, config->address, &response, TIMEOUT_BY_COMMAND);
+    result.status = fingerprint_exchange_status(err, &response);
+    if (result.status == FINGERPRINT_OK) {
+        result.page_id = (response.parameters[0] << 8) | response.parameters[1];
+        result.score = (response.parameters[2] << 8) | response.parameters[3];
+        fingerprint_raise(dev, EVENT_MATCH_SUCCESS, result.status, result.page_id, result.score);
+    } else {
+        fingerprint_raise(dev, err == ESP_OK ? EVENT_MATCH_FAIL : EVENT_ERROR, result.status, FINGERPRINT_NO_PAGE, 0);
+    }
+
+done:
+    fingerprint_stats_flow(dev, FINGERPRINT_FLOW_IDENTIFY, start_us);
+    xSemaphoreGiveRecursive(dev->txn_mutex);
+    fingerprint_complete_identify(config, &result);
+}
+
+/**
+ * @brief Copies a host template into the least recently used hot tier page.
+ *
+ * PS_StoreChar overwrites the page, so the old copy needs no PS_DeletChar; it stops being
+ * trusted as soon as the page is reserved.
+ */
+static void fingerprint_run_promote(fingerprint_dev_t *dev, fingerprint_host_db_handle_t db, uint32_t user_id) {
+    fingerprint_status_t status = FINGERPRINT_PACKET_ERROR;
+    size_t len = fingerprint_host_db_template_len(db);
+    uint16_t page_id;
+    esp_err_t err;
+
+    if (len > FINGERPRINT_MAX_TEMPLATE_LEN) {
+        return;  // Refused by fingerprint_host_db_new(); guards the pool buffer all the same
+    }
+    uint8_t *data = fingerprint_pool_get(dev->template_pool_free, portMAX_DELAY);
+    err = fingerprint_host_db_promote_begin(db, user_id, data, &page_id);
+    if (err != ESP_OK) {
+        fingerprint_pool_put(dev->template_pool_free, data);  // Already resident, removed meanwhile, or no tier configured
+        return;
+    }
+    uint8_t *packet = fingerprint_pool_get(dev->tx_pool_free, pdMS_TO_TICKS(POOL_WAIT_MS));
+    if (packet == NULL) {
+        fingerprint_host_db_promote_end(db, page_id, false);
+        fingerprint_pool_put(dev->template_pool_free, data);
+        return;
+    }
+
+    xSemaphoreTakeRecursive(dev->txn_mutex, portMAX_DELAY);
+    int64_t start_us = esp_timer_get_time();
+    err = fingerprint_download_template(dev, packet, data, len);
+    if (err == ESP_OK) {
+        err = fingerprint_page_command(dev, frame_store_char, page_id, &status);
+    }
+    fingerprint_stats_flow(dev, FINGERPRINT_FLOW_TRANSFER, start_us);
+    xSemaphoreGiveRecursive(dev->txn_mutex);
+    fingerprint_pool_put(dev->tx_pool_free, packet);
+    fingerprint_pool_put(dev->template_pool_free, data);
+
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to promote user %u into page %u (status 0x%02X)", (unsigned int)user_id, page_id, status);
+    } else {
+        ESP_LOGD(TAG, "Promoted user %u into page %u", (unsigned int)user_id, page_id);
+    }
+    fingerprint_host_db_promote_end(db, page_id, err == ESP_OK);
+}
+
+/**
+ * @brief Runs a background batch delete until another job is waiting, then queues the rest.
+ *
+ * Ranges run at MAINTENANCE_PRIORITY; a caller waiting for the link lifts the worker through
+ * txn_mutex's priority inheritance. After each range the rest of the batch goes back behind
+ * whatever was queued meanwhile, so an identify waits for one range at most. `may_yield` is
+ * false once the worker is stopping, and the batch then finishes in one go.
+ */
+static void fingerprint_run_batch_delete(fingerprint_dev_t *dev, fingerprint_job_t *job, bool may_yield) {
+    fingerprint_batch_delete_job_t *batch = &job->batch_delete;
+    esp_err_t err = ESP_OK;
+
+    vTaskPrioritySet(NULL, MAINTENANCE_PRIORITY);
+    while (batch->next < batch->count) {
+        size_t requested;
+        err = fingerprint_delete_next_range(dev, batch->pages, batch->count, &batch->next, &requested);
+        if (err != ESP_OK) {
+            break;
+        }
+        batch->commands++;
+        batch->deleted += requested;
+        if (batch->next < batch->count && may_yield && uxQueueMessagesWaiting(dev->job_queue) > 0 &&
+            xQueueSend(dev->job_queue, job, 0) == pdTRUE) {
+            vTaskPrioritySet(NULL, dev->worker_priority);
+            return;
+        }
+    }
+    vTaskPrioritySet(NULL, dev->worker_priority);
+
+    fingerprint_stats_flow(dev, FINGERPRINT_FLOW_TRANSFER, batch->start_us);
+    ESP_LOGI(TAG, "Deleted %u of %u requested pages with %u commands", (unsigned int)batch->deleted, (unsigned int)batch->count, (unsigned int)batch->commands);
+    if (batch->callback != NULL) {
+        batch->callback(err, batch->deleted, batch->commands, batch->user_ctx);
+    }
+    free(batch->pages);
+}
 
-FingerprintPacket PS_VfyPwd = {
-    .header = 0xEF01,
-    .address = DEFAULT_FINGERPRINT_ADDRESS,
-    .packet_id = 0x01,
-    .length = 0x0007,
-    .command = 0x13, // Verify Password
-    .parameters = {0x00, 0x00, 0x00, 0x00}, // Password
-    .checksum = 0x001A // Needs to be recalculated
-};
+// Executes queued jobs one at a time so callers never wait on the sensor themselves.
+static void fingerprint_worker_task(void *arg) {
+    fingerprint_dev_t *dev = arg;
+    fingerprint_job_t job;
 
-FingerprintPacket PS_GetRandomCode = {
-    .header = 0xEF01,
-    .address = DEFAULT_FINGERPRINT_ADDRESS,
-    .packet_id = 0x01,
-    .length = 0x0003,
-    .command = 0x14, // Get Random Number
-    .parameters = {0}, // No parameters
-    .checksum = 0x0017 // Needs to be recalculated
-};
+    while (1) {
+        if (xQueueReceive(dev->job_queue, &job, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+        switch (job.type) {
+        case JOB_COMMAND:
+            fingerprint_run_request(dev, &job.request);
+            break;
+        case JOB_IDENTIFY:
+            fingerprint_run_identify(dev, &job.identify);
+            break;
+        case JOB_PROMOTE:
+            fingerprint_run_promote(dev, job.promote.db, job.promote.user_id);
+            break;
+        case JOB_NOTEPAD_FLUSH:
+            fingerprint_dev_notepad_flush(dev);
+            break;
+        case JOB_BATCH_DELETE:
+            fingerprint_run_batch_delete(dev, &job, true);
+            break;
+        case JOB_STOP:
+            // Only a batch delete that yielded to the stop job can be queued behind it
+            while (xQueueReceive(dev->job_queue, &job, 0) == pdTRUE) {
+                if (job.type == JOB_BATCH_DELETE) {
+                    fingerprint_run_batch_delete(dev, &job, false);
+                }
+            }
+            dev->worker_task = NULL;
+            vTaskDelete(NULL);
+            break;
+        }
+    }
+}
 
-FingerprintPacket PS_WriteNotepad = {
-    .header = 0xEF01,
-    .address = DEFAULT_FINGERPRINT_ADDRESS,
-    .packet_id = 0x01,
-    .length = 0x0023, // 32 bytes data
-    .command = 0x18, // Write Notepad
-    .parameters = {0}, // Data to write (to be filled)
-    .checksum = 0x003B // Needs to be recalculated
-};
+esp_err_t fingerprint_dev_submit(fingerprint_handle_t dev, const fingerprint_request_t *request) {
+    if (request == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (dev == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
 
-FingerprintPacket PS_ReadNotepad = {
-    .header = 0xEF01,
-    .address = DEFAULT_FINGERPRINT_ADDRESS,
-    .packet_id = 0x01,
-    .length = 0x0004,
-    .command = 0x19, // Read Notepad
-    .parameters = {0x00}, // Page number
-    .checksum = 0x001E // Needs to be recalculated
-};
+    fingerprint_job_t job = {
+        .type = JOB_COMMAND,
+        .request = *request,
+    };
+    if (xQueueSend(dev->job_queue, &job, 0) != pdTRUE) {
+        ESP_LOGW(TAG, "Request queue full, rejecting command 0x%02X", request->command.command);
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
 
+esp_err_t fingerprint_submit(const fingerprint_request_t *request) {
+    return fingerprint_dev_submit(default_dev, request);
+}
 
-esp_err_t fingerprint_init(void) {
-    ESP_LOGI(TAG, "Initializing fingerprint scanner...");
-    uart_config_t uart_config = {
-        .baud_rate = 57600,  // Adjust based on your fingerprint module
-        .data_bits = UART_DATA_8_BITS,
-        .parity = UART_PARITY_DISABLE,
-        .stop_bits = UART_STOP_BITS_1,
-        .flow_ctrl = UART_HW_FLOWCTRL_DISABLE
+esp_err_t fingerprint_dev_identify_async(fingerprint_handle_t dev, const fingerprint_identify_config_t *config) {
+    if (config == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (dev == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    fingerprint_job_t job = {
+        .type = JOB_IDENTIFY,
+        .identify = *config,
     };
-    esp_err_t err; 
-    err = uart_driver_install(UART_NUM, RX_BUF_SIZE * 2, 0, 0, NULL, 0);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to install UART driver");
-        return err;
+    if (xQueueSend(dev->job_queue, &job, 0) != pdTRUE) {
+        ESP_LOGW(TAG, "Request queue full, rejecting identify");
+        return ESP_ERR_NO_MEM;
     }
-    err = uart_param_config(UART_NUM, &uart_config);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to configure UART");
-        return err;
+    return ESP_OK;
+}
+
+esp_err_t fingerprint_identify_async(const fingerprint_identify_config_t *config) {
+    return fingerprint_dev_identify_async(default_dev, config);
+}
+
+esp_err_t fingerprint_dev_empty(fingerprint_handle_t dev) {
+    FingerprintPacket response;
+
+    if (dev == NULL) {
+        return ESP_ERR_INVALID_STATE;
     }
-    err = uart_set_pin(UART_NUM, tx_pin, rx_pin, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE);
+
+    esp_err_t err = fingerprint_transceive(dev, frame_empty, dev->address, &response, TIMEOUT_BY_COMMAND);
     if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to set UART pins");
+        ESP_LOGE(TAG, "Failed to send empty command");
         return err;
     }
-    ESP_LOGI(TAG, "Fingerprint scanner initialized successfully.");
+    if (fingerprint_get_status(&response) != FINGERPRINT_OK) {
+        ESP_LOGE(TAG, "Failed to clear database (status 0x%02X)", response.command);
+        return ESP_FAIL;
+    }
     return ESP_OK;
 }
 
-esp_err_t fingerprint_set_command(FingerprintPacket *cmd, uint8_t command, uint8_t *params, uint8_t param_length) {
-    if (cmd == NULL) {
-        return ESP_ERR_INVALID_ARG;  // Null pointer error
-    }
+esp_err_t fingerprint_empty(void) {
+    return fingerprint_dev_empty(default_dev);
+}
 
-    if (param_length > 5) {  // Allow up to 5 bytes for commands like PS_Search
-        return ESP_ERR_INVALID_SIZE;
+// Sets or clears `count` index bits starting at `first`; caller holds dev->index_lock.
+static void fingerprint_index_mark(fingerprint_dev_t *dev, uint16_t first, uint32_t count, bool used) {
+    for (uint32_t page = first; page < (uint32_t)first + count && page < FINGERPRINT_INDEX_CAPACITY; page++) {
+        uint8_t mask = 1 << (page % 8);
+        bool was_used = (dev->index_bitmap[page / 8] & mask) != 0;
+        if (used && !was_used) {
+            dev->index_bitmap[page / 8] |= mask;
+            dev->index_count++;
+        } else if (!used && was_used) {
+            dev->index_bitmap[page / 8] &= ~mask;
+            dev->index_count--;
+        }
     }
+}
 
-    cmd->header = FINGERPRINT_HEADER;
-    cmd->address = DEFAULT_FINGERPRINT_ADDRESS;
-    cmd->packet_id = 0x01;  // Command packet
-    cmd->length = 1 + param_length + 2;  // Corrected length calculation
-    cmd->command = command;
+// Mirrors a successfully executed database command in the host-side index.
+static void fingerprint_index_apply(fingerprint_dev_t *dev, const uint8_t *cmd) {
+    const uint8_t *params = &cmd[CMD_PARAM_OFFSET];
+    uint8_t code = CMD_CODE(cmd);
 
-    // Clear parameters and copy only valid ones
-    memset(cmd->parameters, 0, sizeof(cmd->parameters));
-    if (params != NULL && param_length > 0) {
-        memcpy(cmd->parameters, params, param_length);
+    portENTER_CRITICAL(&dev->index_lock);
+    if (code == CMD_CODE(frame_store_char)) {
+        fingerprint_index_mark(dev, (params[1] << 8) | params[2], 1, true);
+    } else if (code == CMD_CODE(frame_delet_char)) {
+        fingerprint_index_mark(dev, (params[0] << 8) | params[1], (params[2] << 8) | params[3], false);
+    } else if (code == CMD_CODE(frame_empty)) {
+        memset(dev->index_bitmap, 0, sizeof(dev->index_bitmap));
+        dev->index_count = 0;
     }
+    portEXIT_CRITICAL(&dev->index_lock);
+}
 
-    // Compute checksum
-    cmd->checksum = fingerprint_calculate_checksum(cmd);
+// Reads one PS_ReadIndexTable page (INDEX_TABLE_BYTES bitmap bytes) from the module.
+static esp_err_t fingerprint_read_index_page(fingerprint_dev_t *dev, uint8_t page, uint8_t *bitmap) {
+    uint8_t cmd[sizeof(frame_read_index_table)];
+    fingerprint_frame_t *frame = NULL;
 
-    return ESP_OK;
+    memcpy(cmd, frame_read_index_table, sizeof(cmd));
+    fingerprint_frame_patch(cmd, 0, &page, 1);
+    esp_err_t err = fingerprint_transceive_frame(dev, cmd, dev->address, &frame, TIMEOUT_BY_COMMAND);
+    if (err != ESP_OK) {
+        return err;
+    }
+    // Payload: confirmation code followed by 32 bitmap bytes
+    if (frame->length - 2 < 1 + INDEX_TABLE_BYTES || frame->data[0] != FINGERPRINT_OK) {
+        ESP_LOGE(TAG, "Failed to read index table page %u", page);
+        err = ESP_FAIL;
+    } else {
+        memcpy(bitmap, &frame->data[1], INDEX_TABLE_BYTES);
+    }
+    fingerprint_release_frame(dev, frame);
+    return err;
 }
 
-ExtendedPacket createExtendedPacket(FingerprintPacket base_packet, uint8_t page_number, const uint8_t *data, size_t data_size) {
-    ExtendedPacket packet;
-    packet.base = base_packet;
-    packet.base.length = 0x24;  // Fixed length for WriteNotepad command
-    packet.base.command = 0x18; // Command for WriteNotepad
-    packet.base.parameters[0] = page_number; // Store page number
+esp_err_t fingerprint_dev_index_sync(fingerprint_handle_t dev) {
+    uint8_t bitmap[sizeof(dev->index_bitmap)] = {0};
+    esp_err_t err = ESP_OK;
 
-    // Ensure data_size is at most 32 bytes
-    if (data_size > 32) {
-        printf("Warning: Data exceeds 32 bytes, truncating...\n");
-        data_size = 32;  // Truncate if larger
+    if (dev == NULL) {
+        return ESP_ERR_INVALID_STATE;
     }
 
-    // Copy provided data and pad with zeros if needed
-    memset(packet.data, 0, 32);  // Zero out entire buffer
-    memcpy(packet.data, data, data_size);  // Copy actual data
-
-    // Compute checksum
-    uint16_t checksum = packet.base.packet_id + packet.base.length + packet.base.command + page_number;
-    for (int i = 0; i < 32; i++) {
-        checksum += packet.data[i];
+    // Hold the lock across all pages so no store/delete slips in between reads
+    xSemaphoreTakeRecursive(dev->txn_mutex, portMAX_DELAY);
+    for (uint8_t page = 0; page < INDEX_TABLE_PAGES && page * INDEX_TABLE_BYTES * 8 < dev->index_capacity; page++) {
+        err = fingerprint_read_index_page(dev, page, &bitmap[page * INDEX_TABLE_BYTES]);
+        if (err != ESP_OK) {
+            break;
+        }
     }
-    packet.base.checksum = checksum;
 
-    return packet;
+    if (err == ESP_OK) {
+        uint16_t count = 0;
+        for (size_t i = 0; i < sizeof(bitmap); i++) {
+            count += __builtin_popcount(bitmap[i]);
+        }
+        portENTER_CRITICAL(&dev->index_lock);
+        memcpy(dev->index_bitmap, bitmap, sizeof(dev->index_bitmap));
+        dev->index_count = count;
+        dev->index_valid = true;
+        portEXIT_CRITICAL(&dev->index_lock);
+        ESP_LOGI(TAG, "Template index loaded: %u pages in use", count);
+    }
+    xSemaphoreGiveRecursive(dev->txn_mutex);
+    return err;
 }
 
+esp_err_t fingerprint_index_sync(void) {
+    return fingerprint_dev_index_sync(default_dev);
+}
 
-uint16_t fingerprint_calculate_checksum(FingerprintPacket *cmd) {
-    uint16_t sum = 0;
-    sum += cmd->packet_id;
-    sum += (cmd->length >> 8) & 0xFF; // High byte of length
-    sum += cmd->length & 0xFF;        // Low byte of length
-    sum += cmd->command;
-    for (int i = 0; i < 4; i++) {
-        sum += cmd->parameters[i]; // Sum all parameters
+bool fingerprint_dev_index_is_used(fingerprint_handle_t dev, uint16_t page_id) {
+    if (dev == NULL || page_id >= FINGERPRINT_INDEX_CAPACITY) {
+        return false;
     }
-    return sum;
+    return (dev->index_bitmap[page_id / 8] & (1 << (page_id % 8))) != 0;
 }
 
-esp_err_t fingerprint_send_command(FingerprintPacket *cmd, uint32_t address) {
-    // Compute the checksum
-    cmd->checksum = fingerprint_calculate_checksum(cmd);
-    
-    // Calculate actual packet size
-    size_t packet_size = cmd->length + 9; // 9 bytes (header, address, packet ID, length) + data
-    
-    // Dynamically allocate buffer
-    uint8_t *buffer = (uint8_t *)malloc(packet_size);
-    if (!buffer) {
-        ESP_LOGE(TAG, "Memory allocation failed for fingerprint command.");
-        return ESP_ERR_NO_MEM;  // Return memory allocation error
-    }
+bool fingerprint_index_is_used(uint16_t page_id) {
+    return fingerprint_dev_index_is_used(default_dev, page_id);
+}
 
-    // Construct the packet
-    buffer[0] = (cmd->header >> 8) & 0xFF;
-    buffer[1] = cmd->header & 0xFF;
-    buffer[2] = (address >> 24) & 0xFF;  // Use function parameter instead of cmd->address
-    buffer[3] = (address >> 16) & 0xFF;
-    buffer[4] = (address >> 8) & 0xFF;
-    buffer[5] = address & 0xFF;
-    buffer[6] = cmd->packet_id;
-    buffer[7] = (cmd->length >> 8) & 0xFF;
-    buffer[8] = cmd->length & 0xFF;
-    buffer[9] = cmd->command;
-    
-    // Copy valid parameters (max 4 bytes)
-    memcpy(&buffer[10], cmd->parameters, cmd->length - 3);
+uint16_t fingerprint_dev_index_count(fingerprint_handle_t dev) {
+    if (dev == NULL) {
+        return 0;
+    }
+    return dev->index_count;
+}
 
-    // Append checksum
-    buffer[packet_size - 2] = (cmd->checksum >> 8) & 0xFF;
-    buffer[packet_size - 1] = cmd->checksum & 0xFF;
+uint16_t fingerprint_index_count(void) {
+    return fingerprint_dev_index_count(default_dev);
+}
 
-    // Send the packet over UART
-    int bytes_written = uart_write_bytes(UART_NUM, (const char *)buffer, packet_size);
-    if (bytes_written != packet_size) {
-        ESP_LOGE(TAG, "Failed to send the complete fingerprint command.");
-        free(buffer);
-        return ESP_FAIL;  // Return failure if not all bytes were written
+int fingerprint_dev_index_next_free(fingerprint_handle_t dev, uint16_t start) {
+    if (dev == NULL || !dev->index_valid) {
+        return -1;
+    }
+    for (uint32_t page = start; page < dev->index_capacity; page++) {
+        if (page % 8 == 0 && dev->index_bitmap[page / 8] == 0xFF) {
+            page += 7;  // Whole byte occupied
+            continue;
+        }
+        if (!fingerprint_dev_index_is_used(dev, page)) {
+            return page;
+        }
     }
+    return -1;
+}
 
-    // Debug logging
-    ESP_LOGI(TAG, "Sent fingerprint command: 0x%02X to address 0x%08X", cmd->command, (unsigned int)address);
+int fingerprint_index_next_free(uint16_t start) {
+    return fingerprint_dev_index_next_free(default_dev, start);
+}
 
-    // Free the allocated buffer
-    free(buffer);
-    
-    return ESP_OK;  // Return success
+bool fingerprint_dev_index_is_valid(fingerprint_handle_t dev) {
+    return dev != NULL && dev->index_valid;
 }
 
-// Function to read the response packet from UART and return the FingerprintPacket structure
-FingerprintPacket* fingerprint_read_response(void) {
-    FingerprintPacket *packet = (FingerprintPacket*)malloc(sizeof(FingerprintPacket));
-    if (!packet) {
-        ESP_LOGE("Fingerprint", "Memory allocation failed!");
-        return NULL;
-    }
+bool fingerprint_index_is_valid(void) {
+    return fingerprint_dev_index_is_valid(default_dev);
+}
 
-    uint8_t buffer[16];  // Adjust buffer size based on expected packet length
-    int length = 0;
+#define NOTEPAD_WRITE_CODE 0x18    // PS_WriteNotepad: page, 32 bytes
+#define NOTEPAD_PAGE_BIT(offset) (1u << ((offset) / FINGERPRINT_NOTEPAD_PAGE_LEN))
 
-    memset(packet, 0, sizeof(FingerprintPacket));  // Initialize allocated memory
+// Starts the write-back delay; a delay already running covers the new change too.
+static void fingerprint_notepad_arm(fingerprint_dev_t *dev) {
+    uint32_t delay_ms = dev->notepad_flush_ms;
 
-    // Read response packet from UART (waiting until timeout)
-    length = uart_read_bytes(UART_NUM, buffer, sizeof(buffer), UART_READ_TIMEOUT);
-    
-    if (length <= 0) {
-        ESP_LOGE("Fingerprint", "Failed to read data from UART");
-        free(packet);  // Free memory before returning
-        return NULL;
+    if (dev->notepad_timer != NULL && delay_ms > 0) {
+        esp_timer_start_once(dev->notepad_timer, (uint64_t)delay_ms * 1000);
     }
+}
 
-    // Assuming the buffer contains a full packet, copy data to FingerprintPacket struct
-    packet->header = (buffer[0] << 8) | buffer[1];
-    packet->address = (buffer[2] << 24) | (buffer[3] << 16) | (buffer[4] << 8) | buffer[5];
-    packet->packet_id = buffer[6];
-    packet->length = (buffer[7] << 8) | buffer[8];
-    packet->command = buffer[9];
-    memcpy(packet->parameters, &buffer[10], sizeof(packet->parameters));
-    packet->checksum = (buffer[length - 2] << 8) | buffer[length - 1];
+// Runs on the esp_timer task, which must not wait on the UART; the worker writes the pages.
+static void fingerprint_notepad_timer(void *arg) {
+    fingerprint_dev_t *dev = arg;
+    fingerprint_job_t job = { .type = JOB_NOTEPAD_FLUSH };
 
-    // Verify the checksum (optional but recommended)
-    uint16_t computed_checksum = fingerprint_calculate_checksum(packet);
-    if (computed_checksum != packet->checksum) {
-        ESP_LOGE("Fingerprint", "Checksum mismatch! Computed: 0x%04X, Received: 0x%04X", computed_checksum, packet->checksum);
-        free(packet);  // Free memory before returning
-        return NULL;
+    if (xQueueSend(dev->job_queue, &job, 0) != pdTRUE) {
+        fingerprint_notepad_arm(dev);  // Busy; try again after another delay
     }
+}
 
-    ESP_LOGI("Fingerprint", "Response read successfully: Command 0x%02X", packet->command);
-    return packet;  // Caller must free this memory after use
+// Checks that [offset, offset + len) lies within the notepad.
+static bool fingerprint_notepad_range_valid(size_t offset, size_t len) {
+    return offset <= FINGERPRINT_NOTEPAD_LEN && len <= FINGERPRINT_NOTEPAD_LEN - offset;
 }
 
+// Reads the pages covering [offset, offset + len) that are not cached yet; `len` must not be 0.
+static esp_err_t fingerprint_notepad_load(fingerprint_dev_t *dev, size_t offset, size_t len) {
+    esp_err_t err = ESP_OK;
 
-fingerprint_status_t fingerprint_get_status(FingerprintPacket *packet) {
-    if (!packet) {
-        return FINGERPRINT_ILLEGAL_DATA; // Return a default error if the packet is NULL
-    }
+    for (size_t page = offset / FINGERPRINT_NOTEPAD_PAGE_LEN; page <= (offset + len - 1) / FINGERPRINT_NOTEPAD_PAGE_LEN && err == ESP_OK; page++) {
+        uint8_t cmd[sizeof(frame_read_notepad)];
+        uint8_t page_byte = page;
+        fingerprint_frame_t *frame = NULL;
 
-    return (fingerprint_status_t)packet->command; // The command field stores the status code
+        if (dev->notepad_loaded & (1u << page)) {
+            continue;
+        }
+        memcpy(cmd, frame_read_notepad, sizeof(cmd));
+        fingerprint_frame_patch(cmd, 0, &page_byte, 1);
+
+        xSemaphoreTakeRecursive(dev->txn_mutex, portMAX_DELAY);
+        if ((dev->notepad_loaded & (1u << page)) == 0) {  // Another task may have loaded it meanwhile
+            err = fingerprint_transceive_frame(dev, cmd, dev->address, &frame, TIMEOUT_BY_COMMAND);
+            if (err == ESP_OK) {
+                if (frame->data[0] != FINGERPRINT_OK || frame->length < 2 + 1 + FINGERPRINT_NOTEPAD_PAGE_LEN) {
+                    ESP_LOGE(TAG, "Failed to read notepad page %u (status 0x%02X, %u bytes)", (unsigned int)page, frame->data[0], frame->length - 2);
+                    err = (frame->data[0] != FINGERPRINT_OK) ? ESP_FAIL : ESP_ERR_INVALID_RESPONSE;
+                } else {
+                    // Unloaded pages are never changed, so the copy cannot overwrite an update
+                    portENTER_CRITICAL(&dev->notepad_lock);
+                    memcpy(&dev->notepad[page * FINGERPRINT_NOTEPAD_PAGE_LEN], &frame->data[1], FINGERPRINT_NOTEPAD_PAGE_LEN);
+                    dev->notepad_loaded |= 1u << page;
+                    portEXIT_CRITICAL(&dev->notepad_lock);
+                }
+                fingerprint_release_frame(dev, frame);
+            }
+        }
+        xSemaphoreGiveRecursive(dev->txn_mutex);
+    }
+    return err;
 }
 
-fingerprint_status_t fingerprint_scan(void) {
-    uint8_t command[] = {0x55, 0xAA, 0x01, 0x00, 0x01, 0x00};  // Example scan command
-    uint8_t response[RX_BUF_SIZE];
+/**
+ * @brief Fills in a PS_WriteNotepad frame around the page data already at its parameter offset + 1.
+ *
+ * The frame is longer than any rodata template, so it is built for the instance's address
+ * right away and fingerprint_write_command() sends it as it is.
+ */
+static void fingerprint_notepad_frame(fingerprint_dev_t *dev, uint8_t *cmd, uint8_t page) {
+    const size_t len = CMD_FRAME_LEN(1 + FINGERPRINT_NOTEPAD_PAGE_LEN);
 
-    // Send the scan command
-    esp_err_t err = uart_write_bytes(UART_NUM, (const char*)command, sizeof(command));
-    if (err < 0) {
-        ESP_LOGE(TAG, "Failed to send fingerprint scan command");
-        return FINGERPRINT_PACKET_ERROR;
+    cmd[0] = (FINGERPRINT_HEADER >> 8) & 0xFF;
+    cmd[1] = FINGERPRINT_HEADER & 0xFF;
+    cmd[2] = (dev->address >> 24) & 0xFF;
+    cmd[3] = (dev->address >> 16) & 0xFF;
+    cmd[4] = (dev->address >> 8) & 0xFF;
+    cmd[5] = dev->address & 0xFF;
+    cmd[6] = FINGERPRINT_PID_COMMAND;
+    cmd[7] = (CMD_LENGTH(1 + FINGERPRINT_NOTEPAD_PAGE_LEN) >> 8) & 0xFF;
+    cmd[8] = CMD_LENGTH(1 + FINGERPRINT_NOTEPAD_PAGE_LEN) & 0xFF;
+    cmd[9] = NOTEPAD_WRITE_CODE;
+    cmd[CMD_PARAM_OFFSET] = page;
+    uint16_t sum = fingerprint_checksum_update(0, &cmd[6], len - 8);  // Packet ID through the last data byte
+    cmd[len - 2] = (sum >> 8) & 0xFF;
+    cmd[len - 1] = sum & 0xFF;
+}
+
+esp_err_t fingerprint_dev_notepad_read(fingerprint_handle_t dev, size_t offset, void *buf, size_t len) {
+    if (buf == NULL || !fingerprint_notepad_range_valid(offset, len)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (dev == NULL) {
+        return ESP_ERR_INVALID_STATE;
     }
+    if (len == 0) {
+        return ESP_OK;
+    }
+    esp_err_t err = fingerprint_notepad_load(dev, offset, len);
+    if (err == ESP_OK) {
+        portENTER_CRITICAL(&dev->notepad_lock);
+        memcpy(buf, &dev->notepad[offset], len);
+        portEXIT_CRITICAL(&dev->notepad_lock);
+    }
+    return err;
+}
+
+esp_err_t fingerprint_notepad_read(size_t offset, void *buf, size_t len) {
+    return fingerprint_dev_notepad_read(default_dev, offset, buf, len);
+}
 
-    memset(response, 0, RX_BUF_SIZE);
+esp_err_t fingerprint_dev_notepad_write(fingerprint_handle_t dev, size_t offset, const void *data, size_t len) {
+    const uint8_t *bytes = data;
 
-    // Read response from fingerprint module
-    int len = uart_read_bytes(UART_NUM, response, RX_BUF_SIZE, 1000 / portTICK_PERIOD_MS);
-    if (len <= 0) {
-        ESP_LOGW(TAG, "No response from fingerprint module.");
-        return FINGERPRINT_TIMEOUT;
+    if (data == NULL || !fingerprint_notepad_range_valid(offset, len)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (dev == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (len == 0) {
+        return ESP_OK;
+    }
+    esp_err_t err = fingerprint_notepad_load(dev, offset, len);
+    if (err != ESP_OK) {
+        return err;
     }
 
-    // Ensure the response is valid
-    if (len < 9) {  // Adjust this based on your fingerprint module's protocol
-        ESP_LOGE(TAG, "Invalid response length: %d", len);
-        return FINGERPRINT_PACKET_ERROR;
+    // Only bytes that actually change make their page dirty
+    portENTER_CRITICAL(&dev->notepad_lock);
+    uint16_t was_dirty = dev->notepad_dirty;
+    for (size_t i = 0; i < len; i++) {
+        if (dev->notepad[offset + i] != bytes[i]) {
+            dev->notepad[offset + i] = bytes[i];
+            dev->notepad_dirty |= NOTEPAD_PAGE_BIT(offset + i);
+        }
     }
+    bool arm = (was_dirty == 0 && dev->notepad_dirty != 0);
+    portEXIT_CRITICAL(&dev->notepad_lock);
 
-    // Extract status code from response (adjust based on protocol format)
-    uint8_t status_code = response[6];
+    if (arm) {
+        fingerprint_notepad_arm(dev);
+    }
+    return ESP_OK;
+}
 
-    // Map the received status code to fingerprint_status_t
-    fingerprint_status_t status = (fingerprint_status_t)status_code;
+esp_err_t fingerprint_notepad_write(size_t offset, const void *data, size_t len) {
+    return fingerprint_dev_notepad_write(default_dev, offset, data, len);
+}
 
-    // Log the status for debugging
-    ESP_LOGI(TAG, "Fingerprint scan response: 0x%02X", status_code);
+esp_err_t fingerprint_dev_notepad_get_u32(fingerprint_handle_t dev, uint8_t slot, uint32_t *value) {
+    uint8_t bytes[4];
 
-    return status;
+    if (value == NULL || slot >= FINGERPRINT_NOTEPAD_SLOTS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t err = fingerprint_dev_notepad_read(dev, slot * 4, bytes, sizeof(bytes));
+    if (err == ESP_OK) {
+        *value = ((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) | (bytes[2] << 8) | bytes[3];
+    }
+    return err;
 }
 
-esp_err_t fingerprint_enroll(int id) {
-    ESP_LOGI(TAG, "Enrolling fingerprint with ID %d...", id);
+esp_err_t fingerprint_notepad_get_u32(uint8_t slot, uint32_t *value) {
+    return fingerprint_dev_notepad_get_u32(default_dev, slot, value);
+}
 
-    uint8_t enroll_command[] = {0x55, 0xAA, 0x02, id, 0x01, 0x00};  // Example command
-    esp_err_t err = uart_write_bytes(UART_NUM, (const char*)enroll_command, sizeof(enroll_command));
-    if (err < 0) {
-        ESP_LOGE(TAG, "Failed to send enroll command");
-        return ESP_FAIL;
+esp_err_t fingerprint_dev_notepad_set_u32(fingerprint_handle_t dev, uint8_t slot, uint32_t value) {
+    uint8_t bytes[4] = {(value >> 24) & 0xFF, (value >> 16) & 0xFF, (value >> 8) & 0xFF, value & 0xFF};
+
+    if (slot >= FINGERPRINT_NOTEPAD_SLOTS) {
+        return ESP_ERR_INVALID_ARG;
     }
+    return fingerprint_dev_notepad_write(dev, slot * 4, bytes, sizeof(bytes));
+}
+
+esp_err_t fingerprint_notepad_set_u32(uint8_t slot, uint32_t value) {
+    return fingerprint_dev_notepad_set_u32(default_dev, slot, value);
+}
 
-    vTaskDelay(pdMS_TO_TICKS(500));  // Simulate processing delay
+esp_err_t fingerprint_dev_notepad_add_u32(fingerprint_handle_t dev, uint8_t slot, int32_t delta, uint32_t *value) {
+    if (slot >= FINGERPRINT_NOTEPAD_SLOTS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (dev == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_err_t err = fingerprint_notepad_load(dev, slot * 4, 4);
+    if (err != ESP_OK) {
+        return err;
+    }
 
-    ESP_LOGI(TAG, "Fingerprint enrollment successful for ID %d", id);
+    // Read, add and store in one critical section, so concurrent increments are not lost
+    uint8_t *bytes = &dev->notepad[slot * 4];
+    portENTER_CRITICAL(&dev->notepad_lock);
+    uint16_t was_dirty = dev->notepad_dirty;
+    uint32_t sum = (((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) | (bytes[2] << 8) | bytes[3]) + (uint32_t)delta;
+    if (delta != 0) {
+        bytes[0] = (sum >> 24) & 0xFF;
+        bytes[1] = (sum >> 16) & 0xFF;
+        bytes[2] = (sum >> 8) & 0xFF;
+        bytes[3] = sum & 0xFF;
+        dev->notepad_dirty |= NOTEPAD_PAGE_BIT(slot * 4);
+    }
+    bool arm = (was_dirty == 0 && dev->notepad_dirty != 0);
+    portEXIT_CRITICAL(&dev->notepad_lock);
+
+    if (arm) {
+        fingerprint_notepad_arm(dev);
+    }
+    if (value != NULL) {
+        *value = sum;
+    }
     return ESP_OK;
 }
 
-esp_err_t fingerprint_delete(int id) {
-    ESP_LOGI(TAG, "Deleting fingerprint ID %d...", id);
+esp_err_t fingerprint_notepad_add_u32(uint8_t slot, int32_t delta, uint32_t *value) {
+    return fingerprint_dev_notepad_add_u32(default_dev, slot, delta, value);
+}
 
-    uint8_t delete_command[] = {0x55, 0xAA, 0x03, id, 0x01, 0x00};  // Example command
-    esp_err_t err = uart_write_bytes(UART_NUM, (const char*)delete_command, sizeof(delete_command));
-    if (err < 0) {
-        ESP_LOGE(TAG, "Failed to send delete command");
-        return ESP_FAIL;
+esp_err_t fingerprint_dev_notepad_flush(fingerprint_handle_t dev) {
+    esp_err_t err = ESP_OK;
+
+    if (dev == NULL) {
+        return ESP_ERR_INVALID_STATE;
     }
 
-    vTaskDelay(pdMS_TO_TICKS(300));  // Simulate processing delay
+    xSemaphoreTakeRecursive(dev->txn_mutex, portMAX_DELAY);
+    for (uint8_t page = 0; page < FINGERPRINT_NOTEPAD_PAGES && err == ESP_OK; page++) {
+        uint8_t cmd[CMD_FRAME_LEN(1 + FINGERPRINT_NOTEPAD_PAGE_LEN)];
+        FingerprintPacket response;
+        bool dirty;
 
-    ESP_LOGI(TAG, "Fingerprint ID %d deleted successfully", id);
-    return ESP_OK;
+        // The page is marked clean before it goes out, so an update made meanwhile is written next time
+        portENTER_CRITICAL(&dev->notepad_lock);
+        dirty = (dev->notepad_dirty & (1u << page)) != 0;
+        if (dirty) {
+            memcpy(&cmd[CMD_PARAM_OFFSET + 1], &dev->notepad[page * FINGERPRINT_NOTEPAD_PAGE_LEN], FINGERPRINT_NOTEPAD_PAGE_LEN);
+            dev->notepad_dirty &= ~(1u << page);
+        }
+        portEXIT_CRITICAL(&dev->notepad_lock);
+        if (!dirty) {
+            continue;
+        }
+
+        fingerprint_notepad_frame(dev, cmd, page);
+        err = fingerprint_transceive(dev, cmd, dev->address, &response, TIMEOUT_BY_COMMAND);
+        if (err == ESP_OK && fingerprint_get_status(&response) != FINGERPRINT_OK) {
+            ESP_LOGE(TAG, "Failed to write notepad page %u (status 0x%02X)", page, response.command);
+            err = ESP_FAIL;
+        }
+        if (err != ESP_OK) {
+            portENTER_CRITICAL(&dev->notepad_lock);
+            dev->notepad_dirty |= 1u << page;
+            portEXIT_CRITICAL(&dev->notepad_lock);
+        }
+    }
+    xSemaphoreGiveRecursive(dev->txn_mutex);
+
+    if (err != ESP_OK) {
+        fingerprint_notepad_arm(dev);  // The changes stay cached; the timer tries again
+    }
+    return err;
+}
+
+esp_err_t fingerprint_notepad_flush(void) {
+    return fingerprint_dev_notepad_flush(default_dev);
 }
 
 // Function to register the event handler
@@ -579,13 +4746,206 @@ void register_fingerprint_event_handler(fingerprint_event_handler_t handler) {
     g_fingerprint_event_handler = handler;
 }
 
+void fingerprint_dev_register_event_handler(fingerprint_handle_t dev, fingerprint_event_handler_t handler) {
+    if (dev != NULL) {
+        dev->event_handler = handler;
+    }
+}
+
 // Function to trigger the event (you can call this inside your fingerprint processing flow)
-void trigger_fingerprint_event(fingerprint_event_t event) {
-    if (g_fingerprint_event_handler != NULL) {
+// Calls the matching subscribers, then the instance's handler (or the global one for the default instance).
+static void fingerprint_event_deliver(fingerprint_dev_t *dev, const fingerprint_event_data_t *data) {
+    fingerprint_event_handler_t handler = (dev != NULL) ? dev->event_handler : NULL;
+    bool delivered = false;
+
+    if (dev != NULL) {
+        // Callbacks run on a copy, so they may subscribe or unsubscribe themselves
+        fingerprint_subscription_t subscribers[FINGERPRINT_MAX_SUBSCRIBERS];
+        portENTER_CRITICAL(&dev->subscriber_lock);
+        memcpy(subscribers, dev->subscribers, sizeof(subscribers));
+        portEXIT_CRITICAL(&dev->subscriber_lock);
+        for (int i = 0; i < FINGERPRINT_MAX_SUBSCRIBERS; i++) {
+            if (subscribers[i].callback != NULL && (subscribers[i].event_mask & FINGERPRINT_EVENT_BIT(data->event))) {
+                subscribers[i].callback(data, subscribers[i].user_ctx);
+                delivered = true;
+            }
+        }
+    }
+
+    if (handler == NULL && dev == default_dev) {
+        handler = g_fingerprint_event_handler;  // Handle-less API registers globally
+    }
+    if (handler != NULL) {
         // Call the registered event handler
-        g_fingerprint_event_handler(event);
-    } else {
+        handler(data->event);
+    } else if (!delivered) {
         // No handler registered, handle error or provide default behavior
-        ESP_LOGE("Fingerprint", "No event handler registered.");
+        ESP_LOGE(TAG, "No event handler registered.");
+    }
+}
+
+#if CONFIG_FINGERPRINT_EVENT_DISPATCHER
+/**
+ * @brief Queues an event for the dispatcher; false if the ring is full.
+ *
+ * Several tasks on both cores raise events, so a producer first claims a position by
+ * moving event_head on with a compare-and-swap, then fills the slot and publishes it
+ * through the slot's sequence number. No producer waits for another: one preempted
+ * between claim and publish only holds back the dispatcher, which picks the event up on
+ * the producer's own notification.
+ */
+static bool fingerprint_event_push(fingerprint_dev_t *dev, const fingerprint_event_data_t *data) {
+    uint32_t pos = __atomic_load_n(&dev->event_head, __ATOMIC_RELAXED);
+
+    for (;;) {
+        uint32_t slot = pos % EVENT_RING_SIZE;
+        int32_t lag = (int32_t)(__atomic_load_n(&dev->event_seq[slot], __ATOMIC_ACQUIRE) - pos);
+        if (lag < 0) {
+            return false;  // Slot still holds the event from one lap earlier
+        }
+        if (lag == 0 && __atomic_compare_exchange_n(&dev->event_head, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            dev->event_ring[slot] = *data;
+            __atomic_store_n(&dev->event_seq[slot], pos + 1, __ATOMIC_RELEASE);
+            return true;
+        }
+        if (lag > 0) {
+            pos = __atomic_load_n(&dev->event_head, __ATOMIC_RELAXED);  // Another producer took it
+        }
+        // A failed compare-and-swap has loaded the current head into pos
+    }
+}
+
+/**
+ * @brief Hands queued events to the event handler.
+ *
+ * The only reader of the ring, so it takes events without a lock. The ring is drained
+ * before a stop request is honoured.
+ */
+static void fingerprint_event_task(void *arg) {
+    fingerprint_dev_t *dev = arg;
+
+    do {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        uint32_t tail = dev->event_tail;
+        for (;;) {
+            uint32_t slot = tail % EVENT_RING_SIZE;
+            if (__atomic_load_n(&dev->event_seq[slot], __ATOMIC_ACQUIRE) != tail + 1) {
+                break;  // Not published yet
+            }
+            fingerprint_event_data_t data = dev->event_ring[slot];
+            __atomic_store_n(&dev->event_seq[slot], tail + EVENT_RING_SIZE, __ATOMIC_RELEASE);
+            tail++;
+            dev->event_tail = tail;
+            fingerprint_event_deliver(dev, &data);
+        }
+    } while (!dev->event_stop);
+
+    dev->event_task = NULL;
+    vTaskDelete(NULL);
+}
+#endif
+
+/**
+ * @brief Raises an event with its payload.
+ *
+ * Image capture, feature extraction and the final stage of a flow stamp the flow's stage
+ * times, so every event carries the stages reached so far.
+ */
+static void fingerprint_raise(fingerprint_dev_t *dev, fingerprint_event_t event, fingerprint_status_t status, uint16_t page_id, uint16_t score) {
+    fingerprint_event_data_t data = {
+        .dev = dev,
+        .event = event,
+        .status = status,
+        .page_id = page_id,
+        .score = score,
+        .timestamp_us = esp_timer_get_time(),
+    };
+
+    if (dev != NULL) {
+        switch (event) {
+        case EVENT_FINGER_DETECTED:
+            break;
+        case EVENT_IMAGE_CAPTURED:
+            dev->stages.captured_us = data.timestamp_us;
+            break;
+        case EVENT_FEATURE_EXTRACTED:
+            dev->stages.extracted_us = data.timestamp_us;
+            break;
+        default:
+            dev->stages.finished_us = data.timestamp_us;
+            break;
+        }
+        data.stages = dev->stages;
+    }
+#if CONFIG_FINGERPRINT_EVENT_DISPATCHER
+    if (dev != NULL && dev->event_task != NULL) {
+        if (fingerprint_event_push(dev, &data)) {
+            xTaskNotifyGive(dev->event_task);
+        } else {
+            STATS_COUNT(dev, events_dropped, 1);
+        }
+        return;
+    }
+#endif
+    fingerprint_event_deliver(dev, &data);
+}
+
+// Starts the stage times of an identify or enroll flow; caller holds txn_mutex.
+static void fingerprint_stages_begin(fingerprint_dev_t *dev, int64_t start_us) {
+    dev->stages = (fingerprint_stage_times_t){ .started_us = start_us };
+}
+
+void fingerprint_dev_trigger_event(fingerprint_handle_t dev, fingerprint_event_t event) {
+    fingerprint_raise(dev, event, FINGERPRINT_OK, FINGERPRINT_NO_PAGE, 0);
+}
+
+esp_err_t fingerprint_dev_subscribe(fingerprint_handle_t dev, uint32_t event_mask, fingerprint_subscriber_t callback, void *user_ctx) {
+    esp_err_t err = ESP_ERR_NO_MEM;
+
+    if (callback == NULL || event_mask == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (dev == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    portENTER_CRITICAL(&dev->subscriber_lock);
+    for (int i = 0; i < FINGERPRINT_MAX_SUBSCRIBERS; i++) {
+        if (dev->subscribers[i].callback == NULL) {
+            dev->subscribers[i] = (fingerprint_subscription_t){ callback, user_ctx, event_mask };
+            err = ESP_OK;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&dev->subscriber_lock);
+    return err;
+}
+
+esp_err_t fingerprint_dev_unsubscribe(fingerprint_handle_t dev, fingerprint_subscriber_t callback, void *user_ctx) {
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+
+    if (dev == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    portENTER_CRITICAL(&dev->subscriber_lock);
+    for (int i = 0; i < FINGERPRINT_MAX_SUBSCRIBERS; i++) {
+        if (dev->subscribers[i].callback == callback && dev->subscribers[i].user_ctx == user_ctx) {
+            dev->subscribers[i].callback = NULL;
+            err = ESP_OK;
+            break;
+        }
     }
-}
\ No newline at end of file
+    portEXIT_CRITICAL(&dev->subscriber_lock);
+    return err;
+}
+
+esp_err_t fingerprint_subscribe(uint32_t event_mask, fingerprint_subscriber_t callback, void *user_ctx) {
+    return fingerprint_dev_subscribe(default_dev, event_mask, callback, user_ctx);
+}
+
+esp_err_t fingerprint_unsubscribe(fingerprint_subscriber_t callback, void *user_ctx) {
+    return fingerprint_dev_unsubscribe(default_dev, callback, user_ctx);
+}
+
+void trigger_fingerprint_event(fingerprint_event_t event) {
+    fingerprint_dev_trigger_event(default_dev, event);
+}
@@ -0,0 +1,746 @@
+#include "fingerprint_emulator.h"
+#include "esp_log.h"
+#include "driver/uart.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include <string.h>
+#include <stdlib.h>
+#if CONFIG_FINGERPRINT_SECURE_CHANNEL
+#include "fingerprint_secure.h"
+#include "mbedtls/aes.h"
+#include "mbedtls/cipher.h"
+#include "mbedtls/cmac.h"
+#include "mbedtls/md.h"
+#include "mbedtls/platform_util.h"
+#endif
+
+#define TAG "FINGERPRINT_EMU"
+
+#define EMU_RX_BUF_SIZE 512
+#define EMU_READ_CHUNK 64
+#define EMU_READ_TIMEOUT_MS 20     // Poll interval of the UART task (bounds the stop latency)
+#define EMU_TASK_STACK_SIZE 3072
+#define EMU_TASK_PRIORITY (configMAX_PRIORITIES - 2)
+#define EMU_MAX_PAYLOAD 64         // Longest command payload accepted (PS_WriteNotepad is 33)
+#define EMU_MAX_NOISE 8            // Random bytes injected ahead of a reply
+#define EMU_INDEX_TABLE_BYTES 32   // Bitmap bytes per PS_ReadIndexTable page
+#define EMU_REPLY_PARAMS 33        // Longest reply parameter block (index table page + code)
+#define EMU_BAUD_UNIT 9600
+#define EMU_REG_BAUD 4
+#define EMU_REG_PACKET_SIZE 6      // Data packet size code, 32 << code bytes
+#define EMU_PACKET_SIZE_CODE 2     // 128 bytes, the module's default
+#define EMU_SECURITY_LEVEL 3
+#define EMU_NOTEPAD_PAGES 16
+#define EMU_NOTEPAD_PAGE_LEN 32
+#define EMU_SECURE_GET_KEYT 0xE0
+#define EMU_SECURE_STORE 0xF2
+#define EMU_SECURE_SEARCH 0xF4
+#define EMU_SECURE_NONCE_LEN 16
+#define EMU_SECURE_TAG_LEN 16
+#define EMU_SECURE_SEQ_LEN 4
+#define EMU_SECURE_DIR_COMMAND 0x01     // First byte of the CTR counter block
+#define EMU_SECURE_DIR_REPLY 0x02
+#define EMU_SECURE_KDF_LABEL "ZW111 session"
+
+#define PID_COMMAND 0x01
+#define PID_ACK 0x07
+
+typedef enum {
+    EMU_STATE_HEADER_HIGH,
+    EMU_STATE_HEADER_LOW,
+    EMU_STATE_ADDRESS,
+    EMU_STATE_PACKET_ID,
+    EMU_STATE_LENGTH,
+    EMU_STATE_PAYLOAD,
+    EMU_STATE_CHECKSUM
+} emu_rx_state_t;
+
+typedef struct fingerprint_emulator_t {
+    fingerprint_emulator_config_t config;
+
+    // Command framer
+    emu_rx_state_t state;
+    uint16_t index;
+    uint32_t address;
+    uint8_t packet_id;
+    uint16_t length;
+    uint16_t checksum;
+    uint8_t payload[EMU_MAX_PAYLOAD];
+
+    // Sensor state
+    portMUX_TYPE lock;                          // Guards the fields set from the application
+    bool finger;
+    bool image_valid;
+    bool char_valid[2];
+    uint8_t index_bitmap[FINGERPRINT_INDEX_CAPACITY / 8];
+    uint32_t rng;
+    int pending_baud;                           // Rate to switch to once the WriteReg ACK is out
+    int baud_rate;                              // Rate reported by PS_ReadSysPara
+    uint8_t packet_size_code;
+    uint8_t notepad[EMU_NOTEPAD_PAGES][EMU_NOTEPAD_PAGE_LEN];
+    fingerprint_emulator_counters_t counters;
+
+#if CONFIG_FINGERPRINT_SECURE_CHANNEL
+    // Secure channel (fingerprint_secure.h)
+    uint8_t secure_key[FINGERPRINT_SECURE_KEY_LEN];
+    bool secure_session;
+    mbedtls_aes_context secure_aes;
+    mbedtls_cipher_context_t secure_cmac;
+    uint32_t secure_seq;                        // Last sequence number executed
+    uint8_t secure_reply_code;                  // Its reply, sent again for a repeat of the number
+    uint8_t secure_reply[EMU_REPLY_PARAMS];
+    size_t secure_reply_len;
+#endif
+
+    // UART binding
+    TaskHandle_t task;
+    SemaphoreHandle_t stopped;
+    volatile bool stop;
+} fingerprint_emulator_t;
+
+static uint32_t emu_random(fingerprint_emulator_t *emu) {
+    // xorshift32: cheap and reproducible from the configured seed
+    uint32_t x = emu->rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    emu->rng = x;
+    return x;
+}
+
+static bool emu_chance(fingerprint_emulator_t *emu, uint16_t permille) {
+    return permille != 0 && emu_random(emu) % 1000 < permille;
+}
+
+static bool emu_page_used(fingerprint_emulator_t *emu, uint16_t page) {
+    return (emu->index_bitmap[page / 8] >> (page % 8)) & 1;
+}
+
+static void emu_page_set(fingerprint_emulator_t *emu, uint16_t page, bool used) {
+    if (used) {
+        emu->index_bitmap[page / 8] |= 1 << (page % 8);
+    } else {
+        emu->index_bitmap[page / 8] &= ~(1 << (page % 8));
+    }
+}
+
+// Builds the reply, applies fault injection and hands it to the transport.
+static void emu_reply(fingerprint_emulator_t *emu, uint8_t code, const uint8_t *params, size_t param_len,
+                      fingerprint_emulator_write_t write, void *user_ctx) {
+    uint8_t frame[9 + 1 + EMU_REPLY_PARAMS + 2];
+    size_t payload_len = 1 + param_len;
+    size_t pos = 0;
+
+    frame[pos++] = 0xEF;
+    frame[pos++] = 0x01;
+    frame[pos++] = emu->config.address >> 24;
+    frame[pos++] = emu->config.address >> 16;
+    frame[pos++] = emu->config.address >> 8;
+    frame[pos++] = emu->config.address;
+    frame[pos++] = PID_ACK;
+    frame[pos++] = (payload_len + 2) >> 8;
+    frame[pos++] = (payload_len + 2);
+    frame[pos++] = code;
+    memcpy(&frame[pos], params, param_len);
+    pos += param_len;
+    uint16_t sum = fingerprint_checksum_update(0, &frame[6], pos - 6);
+    frame[pos++] = sum >> 8;
+    frame[pos++] = sum;
+
+    // One consistent set of rates per reply, however fingerprint_emulator_set_faults() races it
+    portENTER_CRITICAL(&emu->lock);
+    uint16_t drop_permille = emu->config.drop_permille;
+    uint16_t noise_permille = emu->config.noise_permille;
+    uint16_t corrupt_permille = emu->config.corrupt_permille;
+    portEXIT_CRITICAL(&emu->lock);
+
+    if (emu_chance(emu, drop_permille)) {
+        emu->counters.dropped++;
+        return;
+    }
+    if (emu_chance(emu, noise_permille)) {
+        uint8_t noise[EMU_MAX_NOISE];
+        size_t n = 1 + emu_random(emu) % EMU_MAX_NOISE;
+        for (size_t i = 0; i < n; i++) {
+            noise[i] = emu_random(emu);
+        }
+        write(noise, n, user_ctx);
+        emu->counters.noise++;
+    }
+    if (emu_chance(emu, corrupt_permille)) {
+        frame[emu_random(emu) % pos] ^= 1 << (emu_random(emu) % 8);
+        emu->counters.corrupted++;
+    }
+    write(frame, pos, user_ctx);
+    emu->counters.replies++;
+}
+
+static void emu_delay(uint32_t ms) {
+    if (ms > 0) {
+        vTaskDelay(pdMS_TO_TICKS(ms));
+    }
+}
+
+// Runs one command (`p` = command code + parameters) and returns its confirmation code.
+static uint8_t emu_run(fingerprint_emulator_t *emu, const uint8_t *p, size_t len, uint8_t *params, size_t *param_len) {
+    uint8_t code = FINGERPRINT_OK;
+    uint16_t capacity = emu->config.capacity;
+
+    portENTER_CRITICAL(&emu->lock);
+    bool finger = emu->finger;
+    portEXIT_CRITICAL(&emu->lock);
+
+    switch (p[0]) {
+    case 0x01: // PS_GetImage
+    case 0x29: // PS_GetEnrollImage
+        emu_delay(emu->config.image_latency_ms);
+        emu->image_valid = finger;
+        code = finger ? FINGERPRINT_OK : FINGERPRINT_NO_FINGER;
+        break;
+    case 0x02: // PS_GenChar
+        emu_delay(emu->config.extract_latency_ms);
+        if (len < 2 || p[1] < 1 || p[1] > 2) {
+            code = FINGERPRINT_PACKET_ERROR;
+        } else if (!emu->image_valid) {
+            code = FINGERPRINT_NO_VALID_IMAGE;
+        } else {
+            emu->char_valid[p[1] - 1] = true;
+        }
+        break;
+    case 0x05: // PS_RegModel
+        emu_delay(emu->config.extract_latency_ms);
+        code = (emu->char_valid[0] && emu->char_valid[1]) ? FINGERPRINT_OK : FINGERPRINT_MERGE_FAIL;
+        break;
+    case 0x04: { // PS_Search: buffer, start page, page count
+        emu_delay(emu->config.search_latency_ms);
+        if (len < 6) {
+            code = FINGERPRINT_PACKET_ERROR;
+            break;
+        }
+        uint16_t start = (p[2] << 8) | p[3];
+        uint16_t count = (p[4] << 8) | p[5];
+        int match = emu->config.match_page;
+        portENTER_CRITICAL(&emu->lock);
+        bool stored = match >= 0 && match < capacity && emu_page_used(emu, match);
+        portEXIT_CRITICAL(&emu->lock);
+        if (!emu->char_valid[0]) {
+            code = FINGERPRINT_NO_VALID_IMAGE;
+        } else if (!stored || match < start || match >= start + count) {
+            code = FINGERPRINT_NOT_FOUND;
+        } else {
+            params[0] = match >> 8;
+            params[1] = match;
+            params[2] = emu->config.match_score >> 8;
+            params[3] = emu->config.match_score;
+            *param_len = 4;
+        }
+        break;
+    }
+    case 0x06: { // PS_StoreChar: buffer, page
+        emu_delay(emu->config.flash_latency_ms);
+        uint16_t page = len < 4 ? capacity : (p[2] << 8) | p[3];
+        if (page >= capacity) {
+            code = FINGERPRINT_DB_RANGE_ERROR;
+        } else {
+            portENTER_CRITICAL(&emu->lock);
+            emu_page_set(emu, page, true);
+            portEXIT_CRITICAL(&emu->lock);
+        }
+        break;
+    }
+    case 0x0C: { // PS_DeletChar: page, count
+        emu_delay(emu->config.flash_latency_ms);
+        uint16_t page = len < 5 ? capacity : (p[1] << 8) | p[2];
+        uint16_t count = len < 5 ? 0 : (p[3] << 8) | p[4];
+        if (page >= capacity || count == 0 || page + count > capacity) {
+            code = FINGERPRINT_DB_RANGE_ERROR;
+            break;
+        }
+        portENTER_CRITICAL(&emu->lock);
+        for (uint16_t i = 0; i < count; i++) {
+            emu_page_set(emu, page + i, false);
+        }
+        portEXIT_CRITICAL(&emu->lock);
+        break;
+    }
+    case 0x0D: // PS_Empty
+        emu_delay(emu->config.flash_latency_ms);
+        portENTER_CRITICAL(&emu->lock);
+        memset(emu->index_bitmap, 0, sizeof(emu->index_bitmap));
+        portEXIT_CRITICAL(&emu->lock);
+        break;
+    case 0x1F: { // PS_ReadIndexTable: index page
+        uint8_t page = len < 2 ? 0xFF : p[1];
+        if (page * EMU_INDEX_TABLE_BYTES >= sizeof(emu->index_bitmap)) {
+            code = FINGERPRINT_PACKET_ERROR;
+            break;
+        }
+        portENTER_CRITICAL(&emu->lock);
+        memcpy(params, &emu->index_bitmap[page * EMU_INDEX_TABLE_BYTES], EMU_INDEX_TABLE_BYTES);
+        portEXIT_CRITICAL(&emu->lock);
+        *param_len = EMU_INDEX_TABLE_BYTES;
+        break;
+    }
+    case 0x1D: { // PS_ValidTempleteNum
+        uint16_t count = 0;
+        portENTER_CRITICAL(&emu->lock);
+        for (size_t i = 0; i < sizeof(emu->index_bitmap); i++) {
+            count += __builtin_popcount(emu->index_bitmap[i]);
+        }
+        portEXIT_CRITICAL(&emu->lock);
+        params[0] = count >> 8;
+        params[1] = count;
+        *param_len = 2;
+        break;
+    }
+    case 0x0E: // PS_WriteReg: register, value
+        emu_delay(emu->config.flash_latency_ms);
+        if (len < 3) {
+            code = FINGERPRINT_PACKET_ERROR;
+        } else if (p[1] == EMU_REG_BAUD) {
+            if (p[2] < 1 || p[2] > 12) {
+                code = FINGERPRINT_REGISTER_SETTING_ERROR;
+            } else {
+                emu->pending_baud = p[2] * EMU_BAUD_UNIT;
+                emu->baud_rate = emu->pending_baud;
+            }
+        } else if (p[1] == EMU_REG_PACKET_SIZE) {
+            if (p[2] > 3) {
+                code = FINGERPRINT_REGISTER_SETTING_ERROR;
+            } else {
+                emu->packet_size_code = p[2];
+            }
+        }
+        break;
+    case 0x0F: { // PS_ReadSysPara
+        uint16_t words[] = { 0, 0x0009, capacity, EMU_SECURITY_LEVEL,
+                             emu->config.address >> 16, emu->config.address & 0xFFFF,
+                             emu->packet_size_code, emu->baud_rate / EMU_BAUD_UNIT };
+        for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); i++) {
+            params[2 * i] = words[i] >> 8;
+            params[2 * i + 1] = words[i];
+        }
+        *param_len = sizeof(words);
+        break;
+    }
+    case 0x18: // PS_WriteNotepad: page, 32 bytes
+        emu_delay(emu->config.flash_latency_ms);
+        if (len < 2 + EMU_NOTEPAD_PAGE_LEN || p[1] >= EMU_NOTEPAD_PAGES) {
+            code = FINGERPRINT_PACKET_ERROR;
+            break;
+        }
+        memcpy(emu->notepad[p[1]], &p[2], EMU_NOTEPAD_PAGE_LEN);
+        emu->counters.notepad_writes++;
+        break;
+    case 0x19: // PS_ReadNotepad: page
+        if (len < 2 || p[1] >= EMU_NOTEPAD_PAGES) {
+            code = FINGERPRINT_PACKET_ERROR;
+            break;
+        }
+        memcpy(params, emu->notepad[p[1]], EMU_NOTEPAD_PAGE_LEN);
+        *param_len = EMU_NOTEPAD_PAGE_LEN;
+        break;
+    case 0x36: // PS_CheckSensor
+    case 0x30: // PS_Cancel
+        break;
+    default:
+        code = FINGERPRINT_PACKET_ERROR;
+        break;
+    }
+    return code;
+}
+
+#if CONFIG_FINGERPRINT_SECURE_CHANNEL
+static void emu_secure_drop(fingerprint_emulator_t *emu) {
+    if (emu->secure_session) {
+        mbedtls_aes_free(&emu->secure_aes);
+        mbedtls_cipher_free(&emu->secure_cmac);
+        emu->secure_session = false;
+    }
+}
+
+// AES-CTR in place; the counter block is direction, three zero bytes, sequence number, block counter.
+static int emu_secure_crypt(fingerprint_emulator_t *emu, uint8_t dir, uint32_t seq, uint8_t *data, size_t len) {
+    uint8_t counter[16] = { dir, 0, 0, 0, seq >> 24, seq >> 16, seq >> 8, seq };
+    uint8_t stream[16];
+    size_t offset = 0;
+
+    return mbedtls_aes_crypt_ctr(&emu->secure_aes, len, &offset, counter, stream, data, data);
+}
+
+// AES-CMAC over `prefix` (a tag or nonce, or NULL), packet ID and length, and `len` bytes from the code on.
+static int emu_secure_mac(fingerprint_emulator_t *emu, const uint8_t *prefix, uint8_t packet_id, uint16_t length,
+                          const uint8_t *body, size_t len, uint8_t *tag) {
+    uint8_t head[3] = { packet_id, length >> 8, length };
+    int ret = mbedtls_cipher_cmac_reset(&emu->secure_cmac);
+
+    if (ret == 0 && prefix != NULL) {
+        ret = mbedtls_cipher_cmac_update(&emu->secure_cmac, prefix, EMU_SECURE_TAG_LEN);
+    }
+    if (ret == 0) {
+        ret = mbedtls_cipher_cmac_update(&emu->secure_cmac, head, sizeof(head));
+    }
+    if (ret == 0) {
+        ret = mbedtls_cipher_cmac_update(&emu->secure_cmac, body, len);
+    }
+    if (ret == 0) {
+        ret = mbedtls_cipher_cmac_finish(&emu->secure_cmac, tag);
+    }
+    return ret;
+}
+
+// PS_GetKeyt: derives the session keys from both nonces and proves them to the host.
+static uint8_t emu_secure_handshake(fingerprint_emulator_t *emu, uint8_t *body, size_t *param_len) {
+    const size_t label_len = sizeof(EMU_SECURE_KDF_LABEL) - 1;
+    const uint8_t *host_nonce = &emu->payload[1];
+    uint8_t *module_nonce = &body[1];
+    uint8_t material[sizeof(EMU_SECURE_KDF_LABEL) - 1 + 2 * EMU_SECURE_NONCE_LEN];
+    uint8_t keys[32];
+
+    if (emu->length - 2 != 1 + EMU_SECURE_NONCE_LEN) {
+        return FINGERPRINT_PACKET_ERROR;
+    }
+    emu_secure_drop(emu);
+    for (size_t i = 0; i < EMU_SECURE_NONCE_LEN; i++) {
+        module_nonce[i] = emu_random(emu);
+    }
+    memcpy(material, EMU_SECURE_KDF_LABEL, label_len);
+    memcpy(material + label_len, host_nonce, EMU_SECURE_NONCE_LEN);
+    memcpy(material + label_len + EMU_SECURE_NONCE_LEN, module_nonce, EMU_SECURE_NONCE_LEN);
+    mbedtls_aes_init(&emu->secure_aes);
+    mbedtls_cipher_init(&emu->secure_cmac);
+    int ret = mbedtls_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), emu->secure_key, sizeof(emu->secure_key),
+                              material, sizeof(material), keys);
+    if (ret == 0) {
+        ret = mbedtls_aes_setkey_enc(&emu->secure_aes, keys, 128);
+    }
+    if (ret == 0) {
+        ret = mbedtls_cipher_setup(&emu->secure_cmac, mbedtls_cipher_info_from_type(MBEDTLS_CIPHER_AES_128_ECB));
+    }
+    if (ret == 0) {
+        ret = mbedtls_cipher_cmac_starts(&emu->secure_cmac, &keys[16], 128);
+    }
+    mbedtls_platform_zeroize(keys, sizeof(keys));
+    emu->secure_session = true;
+    body[0] = FINGERPRINT_OK;
+    if (ret == 0) {
+        ret = emu_secure_mac(emu, host_nonce, PID_ACK, 1 + EMU_SECURE_NONCE_LEN + EMU_SECURE_TAG_LEN + 2,
+                             body, 1 + EMU_SECURE_NONCE_LEN, &body[1 + EMU_SECURE_NONCE_LEN]);
+    }
+    if (ret != 0) {
+        emu_secure_drop(emu);
+        return FINGERPRINT_PACKET_ERROR;
+    }
+    emu->secure_seq = 0;
+    emu->secure_reply_len = 0;
+    *param_len = EMU_SECURE_NONCE_LEN + EMU_SECURE_TAG_LEN;
+    return FINGERPRINT_OK;
+}
+
+/**
+ * @brief Answers PS_GetKeyt, PS_SecurityStoreChar and PS_SecuritySearch.
+ *
+ * A secure command is checked and decrypted in place in the payload buffer, then run as
+ * its plain counterpart, whose reply is encrypted and tagged against the command's tag.
+ */
+static void emu_secure_execute(fingerprint_emulator_t *emu, fingerprint_emulator_write_t write, void *user_ctx) {
+    uint8_t *p = emu->payload;
+    size_t len = emu->length - 2;
+    uint8_t body[1 + EMU_REPLY_PARAMS] = {0};  // Confirmation code, then the reply parameters
+    size_t param_len = 0;
+    uint8_t tag[EMU_SECURE_TAG_LEN];
+
+    if (emu->config.secure_key == NULL) {
+        emu_reply(emu, FINGERPRINT_PACKET_ERROR, NULL, 0, write, user_ctx);
+        return;
+    }
+    if (p[0] == EMU_SECURE_GET_KEYT) {
+        uint8_t code = emu_secure_handshake(emu, body, &param_len);
+        emu_reply(emu, code, &body[1], param_len, write, user_ctx);
+        return;
+    }
+
+    // Code, sequence number, encrypted buffer ID and page(s), tag
+    size_t cmd_params = (p[0] == EMU_SECURE_SEARCH) ? 5 : 3;
+    size_t tag_offset = 1 + EMU_SECURE_SEQ_LEN + cmd_params;
+    uint32_t seq = ((uint32_t)p[1] << 24) | (p[2] << 16) | (p[3] << 8) | p[4];
+    bool valid = emu->secure_session && len == tag_offset + EMU_SECURE_TAG_LEN &&
+                 emu_secure_mac(emu, NULL, PID_COMMAND, emu->length, p, tag_offset, tag) == 0;
+    uint8_t diff = 0;
+    for (size_t i = 0; valid && i < EMU_SECURE_TAG_LEN; i++) {
+        diff |= tag[i] ^ p[tag_offset + i];
+    }
+    if (!valid || diff != 0 || seq < emu->secure_seq || (seq == emu->secure_seq && emu->secure_reply_len == 0)) {
+        emu_reply(emu, FINGERPRINT_ENCRYPTION_MISMATCH, NULL, 0, write, user_ctx);
+        return;
+    }
+    if (seq == emu->secure_seq) {
+        // A resend of the last command: answer again without running it twice
+        emu_reply(emu, emu->secure_reply_code, emu->secure_reply, emu->secure_reply_len, write, user_ctx);
+        return;
+    }
+    emu->secure_seq = seq;
+
+    uint8_t *cmd_tag = &p[tag_offset];
+    uint8_t code = FINGERPRINT_PACKET_ERROR;
+    if (emu_secure_crypt(emu, EMU_SECURE_DIR_COMMAND, seq, &p[1 + EMU_SECURE_SEQ_LEN], cmd_params) == 0) {
+        // The plain command's code goes over the last sequence byte, right before its parameters
+        p[EMU_SECURE_SEQ_LEN] = (p[0] == EMU_SECURE_SEARCH) ? 0x04 : 0x06;
+        code = emu_run(emu, &p[EMU_SECURE_SEQ_LEN], 1 + cmd_params, &body[1], &param_len);
+    }
+    body[0] = code;
+    if (emu_secure_crypt(emu, EMU_SECURE_DIR_REPLY, seq, &body[1], param_len) != 0 ||
+        emu_secure_mac(emu, cmd_tag, PID_ACK, 1 + param_len + EMU_SECURE_TAG_LEN + 2, body, 1 + param_len, &body[1 + param_len]) != 0) {
+        emu_secure_drop(emu);
+        emu_reply(emu, FINGERPRINT_ENCRYPTION_MISMATCH, NULL, 0, write, user_ctx);
+        return;
+    }
+    param_len += EMU_SECURE_TAG_LEN;
+    emu->secure_reply_code = code;
+    memcpy(emu->secure_reply, &body[1], param_len);
+    emu->secure_reply_len = param_len;
+    emu_reply(emu, code, &body[1], param_len, write, user_ctx);
+}
+#endif
+
+// Executes one command frame (payload = command code + parameters).
+static void emu_execute(fingerprint_emulator_t *emu, fingerprint_emulator_write_t write, void *user_ctx) {
+    uint8_t params[EMU_REPLY_PARAMS] = {0};
+    size_t param_len = 0;
+
+#if CONFIG_FINGERPRINT_SECURE_CHANNEL
+    uint8_t command = emu->payload[0];
+    if (command == EMU_SECURE_GET_KEYT || command == EMU_SECURE_STORE || command == EMU_SECURE_SEARCH) {
+        emu_secure_execute(emu, write, user_ctx);
+        return;
+    }
+#endif
+    uint8_t code = emu_run(emu, emu->payload, emu->length - 2, params, &param_len);
+    emu_reply(emu, code, params, param_len, write, user_ctx);
+}
+
+esp_err_t fingerprint_emulator_feed(fingerprint_emulator_handle_t emu, const uint8_t *data, size_t len,
+                                    fingerprint_emulator_write_t write, void *user_ctx) {
+    if (emu == NULL || data == NULL || write == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    for (size_t i = 0; i < len; i++) {
+        uint8_t byte = data[i];
+
+        switch (emu->state) {
+        case EMU_STATE_HEADER_HIGH:
+            if (byte == 0xEF) {
+                emu->state = EMU_STATE_HEADER_LOW;
+            }
+            break;
+        case EMU_STATE_HEADER_LOW:
+            if (byte == 0x01) {
+                emu->state = EMU_STATE_ADDRESS;
+                emu->index = 0;
+                emu->address = 0;
+            } else if (byte != 0xEF) {
+                emu->state = EMU_STATE_HEADER_HIGH;
+            }
+            break;
+        case EMU_STATE_ADDRESS:
+            emu->address = (emu->address << 8) | byte;
+            if (++emu->index == 4) {
+                emu->state = EMU_STATE_PACKET_ID;
+            }
+            break;
+        case EMU_STATE_PACKET_ID:
+            emu->packet_id = byte;
+            emu->state = EMU_STATE_LENGTH;
+            emu->index = 0;
+            emu->length = 0;
+            break;
+        case EMU_STATE_LENGTH:
+            emu->length = (emu->length << 8) | byte;
+            if (++emu->index < 2) {
+                break;
+            }
+            if (emu->length < 3 || emu->length - 2 > EMU_MAX_PAYLOAD) {
+                emu->counters.bad_frames++;
+                emu->state = EMU_STATE_HEADER_HIGH;
+                break;
+            }
+            emu->state = EMU_STATE_PAYLOAD;
+            emu->index = 0;
+            break;
+        case EMU_STATE_PAYLOAD:
+            emu->payload[emu->index++] = byte;
+            if (emu->index == emu->length - 2) {
+                emu->state = EMU_STATE_CHECKSUM;
+                emu->index = 0;
+                emu->checksum = 0;
+            }
+            break;
+        case EMU_STATE_CHECKSUM: {
+            emu->checksum = (emu->checksum << 8) | byte;
+            if (++emu->index < 2) {
+                break;
+            }
+            emu->state = EMU_STATE_HEADER_HIGH;
+            if (emu->address != emu->config.address) {
+                break;
+            }
+            uint8_t head[3] = {emu->packet_id, emu->length >> 8, emu->length};
+            uint16_t sum = fingerprint_checksum_update(0, head, sizeof(head));
+            sum = fingerprint_checksum_update(sum, emu->payload, emu->length - 2);
+            if (sum != emu->checksum || emu->packet_id != PID_COMMAND) {
+                emu->counters.bad_frames++;
+                emu_reply(emu, FINGERPRINT_PACKET_ERROR, NULL, 0, write, user_ctx);
+                break;
+            }
+            emu->counters.frames++;
+            emu_execute(emu, write, user_ctx);
+            break;
+        }
+        }
+    }
+    return ESP_OK;
+}
+
+static void emu_uart_write(const uint8_t *data, size_t len, void *user_ctx) {
+    fingerprint_emulator_t *emu = user_ctx;
+    uart_write_bytes(emu->config.uart_port, (const char *)data, len);
+}
+
+static void emu_task(void *arg) {
+    fingerprint_emulator_t *emu = arg;
+    uint8_t buf[EMU_READ_CHUNK];
+
+    while (!emu->stop) {
+        int n = uart_read_bytes(emu->config.uart_port, buf, sizeof(buf), pdMS_TO_TICKS(EMU_READ_TIMEOUT_MS));
+        if (n <= 0) {
+            continue;
+        }
+        fingerprint_emulator_feed(emu, buf, n, emu_uart_write, emu);
+        if (emu->pending_baud != 0) {
+            // Like the module: the ACK goes out at the old rate, then the link switches
+            uart_wait_tx_done(emu->config.uart_port, portMAX_DELAY);
+            uart_set_baudrate(emu->config.uart_port, emu->pending_baud);
+            emu->pending_baud = 0;
+        }
+    }
+    xSemaphoreGive(emu->stopped);
+    vTaskDelete(NULL);
+}
+
+esp_err_t fingerprint_emulator_new(const fingerprint_emulator_config_t *config, fingerprint_emulator_handle_t *ret_handle) {
+    if (config == NULL || ret_handle == NULL || config->capacity == 0 || config->capacity > FINGERPRINT_INDEX_CAPACITY) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    fingerprint_emulator_t *emu = calloc(1, sizeof(*emu));
+    if (emu == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    emu->config = *config;
+    emu->lock = (portMUX_TYPE)portMUX_INITIALIZER_UNLOCKED;
+    emu->state = EMU_STATE_HEADER_HIGH;
+    emu->rng = config->seed != 0 ? config->seed : 1;
+    emu->baud_rate = config->baud_rate;
+    emu->packet_size_code = EMU_PACKET_SIZE_CODE;
+#if CONFIG_FINGERPRINT_SECURE_CHANNEL
+    if (config->secure_key != NULL) {
+        memcpy(emu->secure_key, config->secure_key, sizeof(emu->secure_key));
+        emu->config.secure_key = emu->secure_key;
+    }
+#endif
+
+    if (config->uart_port >= 0) {
+        uart_config_t uart_config = {
+            .baud_rate = config->baud_rate,
+            .data_bits = UART_DATA_8_BITS,
+            .parity = UART_PARITY_DISABLE,
+            .stop_bits = UART_STOP_BITS_1,
+            .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
+            .source_clk = UART_SCLK_DEFAULT,
+        };
+        esp_err_t err = uart_driver_install(config->uart_port, EMU_RX_BUF_SIZE, 0, 0, NULL, 0);
+        if (err == ESP_OK) {
+            err = uart_param_config(config->uart_port, &uart_config);
+        }
+        if (err == ESP_OK) {
+            err = uart_set_pin(config->uart_port, config->tx_pin, config->rx_pin, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE);
+        }
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to set up UART%d: %s", config->uart_port, esp_err_to_name(err));
+            if (uart_is_driver_installed(config->uart_port)) {
+                uart_driver_delete(config->uart_port);
+            }
+            free(emu);
+            return err;
+        }
+
+        emu->stopped = xSemaphoreCreateBinary();
+        if (emu->stopped == NULL ||
+            xTaskCreate(emu_task, "fp_emulator", EMU_TASK_STACK_SIZE, emu, EMU_TASK_PRIORITY, &emu->task) != pdPASS) {
+            if (emu->stopped != NULL) {
+                vSemaphoreDelete(emu->stopped);
+            }
+            uart_driver_delete(config->uart_port);
+            free(emu);
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    *ret_handle = emu;
+    return ESP_OK;
+}
+
+esp_err_t fingerprint_emulator_del(fingerprint_emulator_handle_t emu) {
+    if (emu == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (emu->task != NULL) {
+        emu->stop = true;
+        xSemaphoreTake(emu->stopped, portMAX_DELAY);
+        vSemaphoreDelete(emu->stopped);
+        uart_driver_delete(emu->config.uart_port);
+    }
+#if CONFIG_FINGERPRINT_SECURE_CHANNEL
+    emu_secure_drop(emu);
+    mbedtls_platform_zeroize(emu->secure_key, sizeof(emu->secure_key));
+#endif
+    free(emu);
+    return ESP_OK;
+}
+
+void fingerprint_emulator_set_finger(fingerprint_emulator_handle_t emu, bool present) {
+    portENTER_CRITICAL(&emu->lock);
+    emu->finger = present;
+    portEXIT_CRITICAL(&emu->lock);
+}
+
+esp_err_t fingerprint_emulator_store(fingerprint_emulator_handle_t emu, uint16_t page_id) {
+    if (emu == NULL || page_id >= emu->config.capacity) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    portENTER_CRITICAL(&emu->lock);
+    emu_page_set(emu, page_id, true);
+    portEXIT_CRITICAL(&emu->lock);
+    return ESP_OK;
+}
+
+void fingerprint_emulator_set_faults(fingerprint_emulator_handle_t emu, uint16_t drop_permille,
+                                     uint16_t corrupt_permille, uint16_t noise_permille) {
+    portENTER_CRITICAL(&emu->lock);
+    emu->config.drop_permille = drop_permille;
+    emu->config.corrupt_permille = corrupt_permille;
+    emu->config.noise_permille = noise_permille;
+    portEXIT_CRITICAL(&emu->lock);
+}
+
+esp_err_t fingerprint_emulator_get_counters(fingerprint_emulator_handle_t emu, fingerprint_emulator_counters_t *out) {
+    if (emu == NULL || out == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    portENTER_CRITICAL(&emu->lock);
+    *out = emu->counters;
+    portEXIT_CRITICAL(&emu->lock);
+    return ESP_OK;
+}
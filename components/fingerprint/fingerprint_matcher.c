@@ -0,0 +1,413 @@
+#include "fingerprint_matcher.h"
+#include "fingerprint_store.h"
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include <string.h>
+#include <stdlib.h>
+
+#define TAG "FINGERPRINT_MATCH"
+
+#define SCAN_WORKERS portNUM_PROCESSORS   // One scan task per core
+#define SCAN_TASK_STACK_SIZE 2048
+#define SCAN_TASK_PRIORITY (configMAX_PRIORITIES - 4)
+#define SCAN_PARALLEL_MIN 64              // Below this many templates the caller scans alone
+
+typedef struct {
+    const uint8_t *probe;
+    size_t begin;           // First template index of the slice
+    size_t end;             // One past the last
+    size_t best_index;
+    uint16_t best_score;
+} scan_slice_t;
+
+typedef struct {
+    uint32_t user_id;
+    uint32_t last_used;     // use_clock at the last match or promotion
+    bool valid;             // The page holds a current copy of user_id's template
+    bool pending;           // Being rewritten by a promotion
+    bool stale;             // The template changed while pending, so the copy is outdated
+} resident_t;
+
+typedef struct fingerprint_host_db_t {
+    fingerprint_host_db_config_t config;
+    uint8_t *templates;     // capacity * template_len bytes, entries [0, count) in use; NULL with a store
+    uint32_t *user_ids;     // user_ids[i] belongs to template i
+    size_t count;
+    fingerprint_store_handle_t store; // Flash store the templates are read from in place, or NULL
+    SemaphoreHandle_t lock; // Serializes changes against searches
+    resident_t *residents;  // residents[i] describes page cache_start_page + i
+    uint32_t use_clock;
+
+    TaskHandle_t workers[SCAN_WORKERS];
+    scan_slice_t slices[SCAN_WORKERS];
+    SemaphoreHandle_t slices_done; // Given once by every worker that finished its slice
+    volatile bool stop;
+} fingerprint_host_db_t;
+
+typedef struct {
+    fingerprint_host_db_t *db;
+    int index;
+} scan_worker_arg_t;
+
+// Entries to scan: dense templates, or every slot of the store including tombstones.
+static size_t host_db_entries(const fingerprint_host_db_t *db) {
+    return (db->store != NULL) ? fingerprint_store_slots(db->store) : db->count;
+}
+
+// Template of entry `index` and its ID, or NULL for a tombstoned store slot.
+static const uint8_t *host_db_entry(const fingerprint_host_db_t *db, size_t index, uint32_t *user_id) {
+    if (db->store != NULL) {
+        return fingerprint_store_slot(db->store, index, user_id);
+    }
+    *user_id = db->user_ids[index];
+    return db->templates + index * db->config.template_len;
+}
+
+static void scan_slice(const fingerprint_host_db_t *db, scan_slice_t *slice) {
+    size_t len = db->config.template_len;
+    uint32_t user_id;
+
+    slice->best_score = 0;
+    slice->best_index = SIZE_MAX;
+    for (size_t i = slice->begin; i < slice->end; i++) {
+        const uint8_t *candidate = host_db_entry(db, i, &user_id);
+        if (candidate == NULL) {
+            continue;
+        }
+        uint16_t score = db->config.score(slice->probe, candidate, len, db->config.user_ctx);
+        if (score > slice->best_score || slice->best_index == SIZE_MAX) {
+            slice->best_score = score;
+            slice->best_index = i;
+        }
+    }
+}
+
+static void scan_worker_task(void *arg) {
+    fingerprint_host_db_t *db = ((scan_worker_arg_t *)arg)->db;
+    int index = ((scan_worker_arg_t *)arg)->index;
+    free(arg);
+
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        if (db->stop) {
+            break;
+        }
+        scan_slice(db, &db->slices[index]);
+        xSemaphoreGive(db->slices_done);
+    }
+    db->workers[index] = NULL;
+    xSemaphoreGive(db->slices_done);
+    vTaskDelete(NULL);
+}
+
+static void host_db_free(fingerprint_host_db_t *db) {
+    heap_caps_free(db->templates);
+    free(db->user_ids);
+    free(db->residents);
+    if (db->lock != NULL) {
+        vSemaphoreDelete(db->lock);
+    }
+    if (db->slices_done != NULL) {
+        vSemaphoreDelete(db->slices_done);
+    }
+    free(db);
+}
+
+// Stops the workers started so far; each one gives slices_done on its way out.
+static void host_db_stop_workers(fingerprint_host_db_t *db) {
+    db->stop = true;
+    for (int i = 0; i < SCAN_WORKERS; i++) {
+        if (db->workers[i] != NULL) {
+            xTaskNotifyGive(db->workers[i]);
+            xSemaphoreTake(db->slices_done, portMAX_DELAY);
+        }
+    }
+}
+
+esp_err_t fingerprint_host_db_new(const fingerprint_host_db_config_t *config, fingerprint_host_db_handle_t *ret_handle) {
+    if (config == NULL || ret_handle == NULL || config->score == NULL || config->template_len == 0 ||
+        config->template_len > FINGERPRINT_MAX_TEMPLATE_LEN || (config->capacity == 0 && config->store == NULL)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (config->store != NULL && fingerprint_store_template_len(config->store) != config->template_len) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    fingerprint_host_db_t *db = calloc(1, sizeof(*db));
+    if (db == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    db->config = *config;
+    db->store = config->store;
+
+    if (db->store == NULL) {
+        size_t block = config->template_len * config->capacity;
+        if (config->use_psram) {
+            db->templates = heap_caps_malloc(block, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        }
+        if (db->templates == NULL) {
+            db->templates = heap_caps_malloc(block, MALLOC_CAP_8BIT);
+        }
+        db->user_ids = calloc(config->capacity, sizeof(uint32_t));
+    }
+    if (config->cache_pages > 0) {
+        db->residents = calloc(config->cache_pages, sizeof(resident_t));
+    }
+    db->lock = xSemaphoreCreateMutex();
+    db->slices_done = xSemaphoreCreateCounting(SCAN_WORKERS, 0);
+    if ((db->store == NULL && (db->templates == NULL || db->user_ids == NULL)) || db->lock == NULL || db->slices_done == NULL ||
+        (config->cache_pages > 0 && db->residents == NULL)) {
+        ESP_LOGE(TAG, "No memory for %u templates of %u bytes", (unsigned int)config->capacity, (unsigned int)config->template_len);
+        host_db_free(db);
+        return ESP_ERR_NO_MEM;
+    }
+
+    for (int i = 0; i < SCAN_WORKERS; i++) {
+        scan_worker_arg_t *arg = malloc(sizeof(*arg));
+        if (arg != NULL) {
+            *arg = (scan_worker_arg_t){ db, i };
+        }
+        if (arg == NULL || xTaskCreatePinnedToCore(scan_worker_task, "fp_scan_task", SCAN_TASK_STACK_SIZE, arg, SCAN_TASK_PRIORITY, &db->workers[i], i) != pdPASS) {
+            free(arg);
+            ESP_LOGE(TAG, "Failed to create scan task");
+            host_db_stop_workers(db);
+            host_db_free(db);
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    *ret_handle = db;
+    return ESP_OK;
+}
+
+esp_err_t fingerprint_host_db_del(fingerprint_host_db_handle_t db) {
+    if (db == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    host_db_stop_workers(db);
+    host_db_free(db);
+    return ESP_OK;
+}
+
+// Index of `user_id`, or SIZE_MAX; caller holds db->lock.
+static size_t host_db_find(const fingerprint_host_db_t *db, uint32_t user_id) {
+    size_t entries = host_db_entries(db);
+    uint32_t id;
+
+    for (size_t i = 0; i < entries; i++) {
+        if (host_db_entry(db, i, &id) != NULL && id == user_id) {
+            return i;
+        }
+    }
+    return SIZE_MAX;
+}
+
+// Forgets the hot tier copy of `user_id`, whose template changed or went away; caller holds db->lock.
+static void host_db_evict(fingerprint_host_db_t *db, uint32_t user_id) {
+    for (uint16_t i = 0; i < db->config.cache_pages; i++) {
+        if (db->residents[i].user_id == user_id) {
+            db->residents[i].valid = false;
+            db->residents[i].stale = db->residents[i].pending;
+        }
+    }
+}
+
+esp_err_t fingerprint_host_db_add(fingerprint_host_db_handle_t db, uint32_t user_id, const uint8_t *data, size_t len) {
+    esp_err_t err = ESP_OK;
+
+    if (db == NULL || data == NULL || user_id == FINGERPRINT_HOST_NO_USER) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (len != db->config.template_len) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    xSemaphoreTake(db->lock, portMAX_DELAY);
+    if (db->store != NULL) {
+        host_db_evict(db, user_id);
+        err = fingerprint_store_put(db->store, user_id, data, len);
+        xSemaphoreGive(db->lock);
+        return err;
+    }
+    size_t index = host_db_find(db, user_id);
+    if (index == SIZE_MAX) {
+        if (db->count == db->config.capacity) {
+            err = ESP_ERR_NO_MEM;
+        } else {
+            index = db->count++;
+            db->user_ids[index] = user_id;
+        }
+    } else {
+        host_db_evict(db, user_id);
+    }
+    if (err == ESP_OK) {
+        memcpy(db->templates + index * len, data, len);
+    }
+    xSemaphoreGive(db->lock);
+    return err;
+}
+
+esp_err_t fingerprint_host_db_remove(fingerprint_host_db_handle_t db, uint32_t user_id) {
+    size_t len;
+
+    if (db == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    len = db->config.template_len;
+    xSemaphoreTake(db->lock, portMAX_DELAY);
+    if (db->store != NULL) {
+        esp_err_t err = fingerprint_store_delete(db->store, user_id);
+        if (err == ESP_OK) {
+            host_db_evict(db, user_id);
+        }
+        xSemaphoreGive(db->lock);
+        return err;
+    }
+    size_t index = host_db_find(db, user_id);
+    if (index != SIZE_MAX) {
+        host_db_evict(db, user_id);
+        size_t last = --db->count;
+        if (index != last) {
+            memcpy(db->templates + index * len, db->templates + last * len, len);
+            db->user_ids[index] = db->user_ids[last];
+        }
+    }
+    xSemaphoreGive(db->lock);
+    return (index == SIZE_MAX) ? ESP_ERR_NOT_FOUND : ESP_OK;
+}
+
+size_t fingerprint_host_db_count(fingerprint_host_db_handle_t db) {
+    if (db == NULL) {
+        return 0;
+    }
+    return (db->store != NULL) ? fingerprint_store_count(db->store) : db->count;
+}
+
+size_t fingerprint_host_db_template_len(fingerprint_host_db_handle_t db) {
+    return (db != NULL) ? db->config.template_len : 0;
+}
+
+esp_err_t fingerprint_host_db_search(fingerprint_host_db_handle_t db, const uint8_t *probe, size_t len, fingerprint_host_db_match_t *match) {
+    scan_slice_t best = { .best_index = SIZE_MAX };
+
+    if (db == NULL || probe == NULL || match == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (len != db->config.template_len) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    xSemaphoreTake(db->lock, portMAX_DELAY);
+    size_t entries = host_db_entries(db);
+    if (entries < SCAN_PARALLEL_MIN) {
+        best = (scan_slice_t){ .probe = probe, .begin = 0, .end = entries };
+        scan_slice(db, &best);
+    } else {
+        // Contiguous slices, so every worker streams through its own part of the block
+        size_t per_worker = (entries + SCAN_WORKERS - 1) / SCAN_WORKERS;
+        for (int i = 0; i < SCAN_WORKERS; i++) {
+            size_t begin = i * per_worker;
+            db->slices[i] = (scan_slice_t){
+                .probe = probe,
+                .begin = begin < entries ? begin : entries,
+                .end = begin + per_worker < entries ? begin + per_worker : entries,
+            };
+            xTaskNotifyGive(db->workers[i]);
+        }
+        for (int i = 0; i < SCAN_WORKERS; i++) {
+            xSemaphoreTake(db->slices_done, portMAX_DELAY);
+        }
+        for (int i = 0; i < SCAN_WORKERS; i++) {
+            const scan_slice_t *slice = &db->slices[i];
+            if (slice->best_index != SIZE_MAX && (best.best_index == SIZE_MAX || slice->best_score > best.best_score)) {
+                best = *slice;
+            }
+        }
+    }
+
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    if (best.best_index != SIZE_MAX && best.best_score >= db->config.threshold) {
+        host_db_entry(db, best.best_index, &match->user_id);
+        match->score = best.best_score;
+        err = ESP_OK;
+    }
+    xSemaphoreGive(db->lock);
+    return err;
+}
+
+esp_err_t fingerprint_host_db_resident_user(fingerprint_host_db_handle_t db, uint16_t page_id, uint32_t *user_id) {
+    if (db == NULL || user_id == NULL || page_id < db->config.cache_start_page ||
+        page_id - db->config.cache_start_page >= db->config.cache_pages) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    xSemaphoreTake(db->lock, portMAX_DELAY);
+    resident_t *resident = &db->residents[page_id - db->config.cache_start_page];
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    if (resident->valid && !resident->pending) {
+        resident->last_used = ++db->use_clock;
+        *user_id = resident->user_id;
+        err = ESP_OK;
+    }
+    xSemaphoreGive(db->lock);
+    return err;
+}
+
+esp_err_t fingerprint_host_db_promote_begin(fingerprint_host_db_handle_t db, uint32_t user_id, uint8_t *data, uint16_t *page_id) {
+    if (db == NULL || data == NULL || page_id == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (db->config.cache_pages == 0) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    xSemaphoreTake(db->lock, portMAX_DELAY);
+    esp_err_t err = ESP_OK;
+    size_t index = host_db_find(db, user_id);
+    int victim = -1;
+    for (int i = 0; i < db->config.cache_pages && err == ESP_OK; i++) {
+        const resident_t *resident = &db->residents[i];
+        if ((resident->valid || resident->pending) && resident->user_id == user_id) {
+            err = ESP_ERR_INVALID_STATE;
+        } else if (resident->pending) {
+            continue;
+        } else if (!resident->valid) {
+            // A free page beats any occupied one; take the first
+            if (victim < 0 || db->residents[victim].valid) {
+                victim = i;
+            }
+        } else if (victim < 0 || (db->residents[victim].valid && resident->last_used < db->residents[victim].last_used)) {
+            victim = i;
+        }
+    }
+    if (err == ESP_OK && (index == SIZE_MAX || victim < 0)) {
+        err = ESP_ERR_NOT_FOUND;
+    }
+    if (err == ESP_OK) {
+        db->residents[victim] = (resident_t){
+            .user_id = user_id,
+            .last_used = ++db->use_clock,
+            .pending = true,
+        };
+        uint32_t id;
+        memcpy(data, host_db_entry(db, index, &id), db->config.template_len);
+        *page_id = db->config.cache_start_page + victim;
+    }
+    xSemaphoreGive(db->lock);
+    return err;
+}
+
+void fingerprint_host_db_promote_end(fingerprint_host_db_handle_t db, uint16_t page_id, bool stored) {
+    if (db == NULL || page_id < db->config.cache_start_page || page_id - db->config.cache_start_page >= db->config.cache_pages) {
+        return;
+    }
+
+    xSemaphoreTake(db->lock, portMAX_DELAY);
+    resident_t *resident = &db->residents[page_id - db->config.cache_start_page];
+    resident->valid = stored && resident->pending && !resident->stale;
+    resident->pending = false;
+    resident->stale = false;
+    xSemaphoreGive(db->lock);
+}
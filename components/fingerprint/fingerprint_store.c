@@ -0,0 +1,376 @@
+#include "fingerprint_store.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include <string.h>
+#include <stdlib.h>
+
+#define TAG "FINGERPRINT_STORE"
+
+#define STORE_MAGIC 0x42445046u     // "FPDB"
+#define STORE_VERSION 2
+#define STORE_SECTOR_SIZE 4096      // Header sector; the records start on a sector boundary too
+#define STORE_BANKS 2               // The partition holds two stores; compaction copies into the idle one
+#define STORE_ERASED 0xFFFFFFFFu
+
+// Entry states only ever clear bits, so each step is a plain program of erased flash
+#define ENTRY_FREE STORE_ERASED
+#define ENTRY_WRITING 0x00FFFFFFu   // ID written, record in progress (left behind by a reset)
+#define ENTRY_LIVE 0x0000FFFFu
+#define ENTRY_DELETED 0x00000000u
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t template_len;
+    uint32_t stride;        // Record size, template_len rounded up to a flash word
+    uint32_t capacity;      // Slots
+    uint32_t index_offset;  // From the start of the bank
+    uint32_t data_offset;
+    uint32_t generation;    // Bumped by every compaction; the bank with the highest one is in use
+} store_header_t;
+
+typedef struct {
+    uint32_t user_id;
+    uint32_t state;
+} store_entry_t;
+
+typedef struct fingerprint_store_t {
+    const esp_partition_t *partition;
+    esp_partition_mmap_handle_t mmap_handle;
+    const uint8_t *base;            // Whole partition, mapped
+    size_t bank_size;
+    size_t bank_offset;             // Start of the bank in use
+    store_header_t header;          // Copy of the header in use
+    const store_entry_t *index;
+    const uint8_t *records;
+    size_t used;                    // Slots before the first free one
+    SemaphoreHandle_t lock;         // Serializes writers and lookups; scans only see completed entries
+} fingerprint_store_t;
+
+// Geometry of a store of `template_len` templates in a bank of `size` bytes.
+static bool store_layout(size_t size, size_t template_len, store_header_t *header) {
+    uint32_t stride = (template_len + 3) & ~3u;
+    uint32_t capacity;
+
+    if (size < 2 * STORE_SECTOR_SIZE) {
+        return false;
+    }
+    // One sector is kept for rounding the record area up to a sector boundary
+    capacity = (size - 2 * STORE_SECTOR_SIZE) / (stride + sizeof(store_entry_t));
+    if (capacity == 0) {
+        return false;
+    }
+    *header = (store_header_t){
+        .magic = STORE_MAGIC,
+        .version = STORE_VERSION,
+        .template_len = template_len,
+        .stride = stride,
+        .capacity = capacity,
+        .index_offset = STORE_SECTOR_SIZE,
+        .data_offset = (STORE_SECTOR_SIZE + capacity * sizeof(store_entry_t) + STORE_SECTOR_SIZE - 1) & ~(STORE_SECTOR_SIZE - 1),
+    };
+    return true;
+}
+
+// True if `on_flash` is a completed header of the layout `expected` describes.
+static bool store_header_valid(const store_header_t *on_flash, const store_header_t *expected) {
+    return on_flash->magic == STORE_MAGIC && on_flash->version == STORE_VERSION &&
+           on_flash->template_len == expected->template_len && on_flash->stride == expected->stride &&
+           on_flash->capacity == expected->capacity && on_flash->index_offset == expected->index_offset &&
+           on_flash->data_offset == expected->data_offset && on_flash->generation != STORE_ERASED;
+}
+
+// Points the store at the mapped index and records described by its header.
+static void store_attach(fingerprint_store_t *store) {
+    size_t lo = 0, hi = store->header.capacity;
+
+    store->index = (const store_entry_t *)(store->base + store->bank_offset + store->header.index_offset);
+    store->records = store->base + store->bank_offset + store->header.data_offset;
+
+    // Slots are taken in order, so the used ones form a prefix of the index
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (store->index[mid].state == ENTRY_FREE && store->index[mid].user_id == STORE_ERASED) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    store->used = lo;
+}
+
+esp_err_t fingerprint_store_format(fingerprint_store_handle_t store) {
+    store_header_t header;
+    esp_err_t err;
+
+    if (store == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    header = store->header;
+    header.generation = 0;
+
+    xSemaphoreTake(store->lock, portMAX_DELAY);
+    err = esp_partition_erase_range(store->partition, 0, store->bank_size * STORE_BANKS);
+    if (err == ESP_OK) {
+        err = esp_partition_write(store->partition, 0, &header, sizeof(header));
+    }
+    if (err == ESP_OK) {
+        store->header = header;
+        store->bank_offset = 0;
+        store_attach(store);
+    } else {
+        ESP_LOGE(TAG, "Failed to format partition %s: %s", store->partition->label, esp_err_to_name(err));
+    }
+    xSemaphoreGive(store->lock);
+    return err;
+}
+
+esp_err_t fingerprint_store_open(const fingerprint_store_config_t *config, fingerprint_store_handle_t *ret_handle) {
+    esp_err_t err;
+
+    if (config == NULL || ret_handle == NULL || config->partition_label == NULL || config->template_len == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, config->partition_label);
+    if (partition == NULL) {
+        ESP_LOGE(TAG, "No data partition %s", config->partition_label);
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (partition->encrypted) {
+        ESP_LOGE(TAG, "Partition %s is encrypted; tombstones need plain flash", partition->label);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    fingerprint_store_t *store = calloc(1, sizeof(*store));
+    if (store == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    store->partition = partition;
+    store->lock = xSemaphoreCreateMutex();
+    if (store->lock == NULL) {
+        free(store);
+        return ESP_ERR_NO_MEM;
+    }
+    store->bank_size = (partition->size / STORE_BANKS) & ~(size_t)(STORE_SECTOR_SIZE - 1);
+    if (!store_layout(store->bank_size, config->template_len, &store->header)) {
+        ESP_LOGE(TAG, "Partition %s too small for a %u-byte template", partition->label, (unsigned int)config->template_len);
+        err = ESP_ERR_INVALID_SIZE;
+        goto fail;
+    }
+    err = esp_partition_mmap(partition, 0, partition->size, ESP_PARTITION_MMAP_DATA, (const void **)&store->base, &store->mmap_handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to map partition %s: %s", partition->label, esp_err_to_name(err));
+        store->base = NULL;
+        goto fail;
+    }
+
+    // A bank counts only if its header describes exactly the layout computed for this partition
+    const store_header_t *in_use = NULL;
+    bool erased = true;
+    for (int bank = 0; bank < STORE_BANKS; bank++) {
+        const store_header_t *on_flash = (const store_header_t *)(store->base + bank * store->bank_size);
+        erased = erased && on_flash->magic == STORE_ERASED;
+        if (store_header_valid(on_flash, &store->header) && (in_use == NULL || on_flash->generation > in_use->generation)) {
+            in_use = on_flash;
+            store->bank_offset = bank * store->bank_size;
+        }
+    }
+    if (in_use != NULL) {
+        store->header = *in_use;
+        store_attach(store);
+    } else if (erased || config->format_if_invalid) {
+        ESP_LOGI(TAG, "Formatting partition %s for %u templates", partition->label, (unsigned int)store->header.capacity);
+        err = fingerprint_store_format(store);
+        if (err != ESP_OK) {
+            goto fail;
+        }
+    } else {
+        ESP_LOGE(TAG, "Partition %s holds another store format", partition->label);
+        err = ESP_ERR_INVALID_VERSION;
+        goto fail;
+    }
+
+    *ret_handle = store;
+    return ESP_OK;
+
+fail:
+    fingerprint_store_close(store);
+    return err;
+}
+
+esp_err_t fingerprint_store_close(fingerprint_store_handle_t store) {
+    if (store == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (store->base != NULL) {
+        esp_partition_munmap(store->mmap_handle);
+    }
+    vSemaphoreDelete(store->lock);
+    free(store);
+    return ESP_OK;
+}
+
+// Newest live slot of `user_id`, or SIZE_MAX; a reset during a replace can leave an older one behind.
+static size_t store_find(const fingerprint_store_t *store, uint32_t user_id) {
+    for (size_t i = store->used; i-- > 0;) {
+        if (store->index[i].state == ENTRY_LIVE && store->index[i].user_id == user_id) {
+            return i;
+        }
+    }
+    return SIZE_MAX;
+}
+
+static esp_err_t store_set_state(fingerprint_store_t *store, size_t slot, uint32_t state) {
+    size_t offset = store->bank_offset + store->header.index_offset + slot * sizeof(store_entry_t) + offsetof(store_entry_t, state);
+    return esp_partition_write(store->partition, offset, &state, sizeof(state));
+}
+
+/**
+ * @brief Copies the live templates into the idle bank and switches over; caller holds the lock.
+ *
+ * The new bank's header goes last, so a reset at any point leaves one complete bank with the
+ * highest generation: the old one until the header is written, the compacted one after.
+ */
+static esp_err_t store_compact(fingerprint_store_t *store) {
+    size_t target = (store->bank_offset == 0) ? store->bank_size : 0;
+    store_header_t header = store->header;
+    size_t live = 0;
+
+    esp_err_t err = esp_partition_erase_range(store->partition, target, store->bank_size);
+    for (size_t i = 0; err == ESP_OK && i < store->used; i++) {
+        if (store->index[i].state != ENTRY_LIVE) {
+            continue;
+        }
+        store_entry_t entry = { .user_id = store->index[i].user_id, .state = ENTRY_LIVE };
+        err = esp_partition_write(store->partition, target + header.data_offset + live * header.stride,
+                                  store->records + i * header.stride, header.template_len);
+        if (err == ESP_OK) {
+            err = esp_partition_write(store->partition, target + header.index_offset + live * sizeof(entry), &entry, sizeof(entry));
+        }
+        live++;
+    }
+    header.generation++;
+    if (err == ESP_OK) {
+        err = esp_partition_write(store->partition, target, &header, sizeof(header));
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to compact partition %s: %s", store->partition->label, esp_err_to_name(err));
+        return err;
+    }
+    ESP_LOGI(TAG, "Compacted partition %s: %u of %u slots live", store->partition->label, (unsigned int)live, (unsigned int)store->used);
+    store->header = header;
+    store->bank_offset = target;
+    store_attach(store);
+    return ESP_OK;
+}
+
+esp_err_t fingerprint_store_put(fingerprint_store_handle_t store, uint32_t user_id, const uint8_t *data, size_t len) {
+    esp_err_t err;
+
+    if (store == NULL || data == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (len != store->header.template_len) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    xSemaphoreTake(store->lock, portMAX_DELAY);
+    if (store->used == store->header.capacity) {
+        // Tombstoned slots are only reclaimed here, so a full store of live templates stays full
+        err = (fingerprint_store_count(store) < store->header.capacity) ? store_compact(store) : ESP_ERR_NO_MEM;
+        if (err != ESP_OK) {
+            xSemaphoreGive(store->lock);
+            return err;
+        }
+    }
+    size_t previous = store_find(store, user_id);
+    size_t slot = store->used;
+    store_entry_t entry = { .user_id = user_id, .state = ENTRY_WRITING };
+
+    // The entry goes first, so a reset mid-record leaves a skipped slot rather than a free one with data in it
+    err = esp_partition_write(store->partition, store->bank_offset + store->header.index_offset + slot * sizeof(entry), &entry, sizeof(entry));
+    if (err == ESP_OK) {
+        store->used++;
+        err = esp_partition_write(store->partition, store->bank_offset + store->header.data_offset + slot * store->header.stride, data, len);
+    }
+    if (err == ESP_OK) {
+        err = store_set_state(store, slot, ENTRY_LIVE);
+    }
+    if (err == ESP_OK && previous != SIZE_MAX) {
+        err = store_set_state(store, previous, ENTRY_DELETED);
+    }
+    xSemaphoreGive(store->lock);
+
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to store template %u: %s", (unsigned int)user_id, esp_err_to_name(err));
+    }
+    return err;
+}
+
+esp_err_t fingerprint_store_delete(fingerprint_store_handle_t store, uint32_t user_id) {
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+
+    if (store == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    xSemaphoreTake(store->lock, portMAX_DELAY);
+    size_t slot = store_find(store, user_id);
+    if (slot != SIZE_MAX) {
+        err = store_set_state(store, slot, ENTRY_DELETED);
+    }
+    xSemaphoreGive(store->lock);
+    return err;
+}
+
+esp_err_t fingerprint_store_get(fingerprint_store_handle_t store, uint32_t user_id, const uint8_t **data) {
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+
+    if (store == NULL || data == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    // A put may compact into the other bank; index and records must come from the same one
+    xSemaphoreTake(store->lock, portMAX_DELAY);
+    size_t slot = store_find(store, user_id);
+    if (slot != SIZE_MAX) {
+        *data = store->records + slot * store->header.stride;
+        err = ESP_OK;
+    }
+    xSemaphoreGive(store->lock);
+    return err;
+}
+
+size_t fingerprint_store_slots(fingerprint_store_handle_t store) {
+    return (store != NULL) ? store->used : 0;
+}
+
+const uint8_t *fingerprint_store_slot(fingerprint_store_handle_t store, size_t index, uint32_t *user_id) {
+    if (store == NULL || index >= store->used || store->index[index].state != ENTRY_LIVE) {
+        return NULL;
+    }
+    if (user_id != NULL) {
+        *user_id = store->index[index].user_id;
+    }
+    return store->records + index * store->header.stride;
+}
+
+size_t fingerprint_store_count(fingerprint_store_handle_t store) {
+    size_t count = 0;
+
+    if (store == NULL) {
+        return 0;
+    }
+    for (size_t i = 0; i < store->used; i++) {
+        count += (store->index[i].state == ENTRY_LIVE);
+    }
+    return count;
+}
+
+size_t fingerprint_store_capacity(fingerprint_store_handle_t store) {
+    return (store != NULL) ? store->header.capacity : 0;
+}
+
+size_t fingerprint_store_template_len(fingerprint_store_handle_t store) {
+    return (store != NULL) ? store->header.template_len : 0;
+}
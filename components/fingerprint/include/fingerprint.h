@@ -82,7 +82,11 @@
 extern "C" {
 #endif
 
+#include <stdbool.h>
 #include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/uart.h"
 
 /**
  * @brief Default UART baud rate for fingerprint module.
@@ -108,11 +112,51 @@ extern "C" {
 /**
  * @brief Timeout value for UART read operations.
  *
- * Defines the maximum wait time for receiving data over UART in milliseconds.
+ * Defines the maximum wait time for receiving a complete response frame in milliseconds.
+ * Responses are handed over as soon as their last byte arrives; this is only the upper bound.
+ * Driver commands use it for replies that need no capture, extraction, search or flash
+ * write. Those operations have longer per-command timeouts.
  * Adjust this value based on the fingerprint module's response time.
  */
 #define UART_READ_TIMEOUT 100  // Adjust based on hardware response time
 
+/**
+ * @brief Maximum payload carried by a single frame (largest data packet size of the module).
+ *
+ * The payload is everything between the length field and the checksum. Frames announcing a
+ * larger payload are treated as line noise and discarded by the RX framer.
+ */
+#define FINGERPRINT_MAX_DATA_LEN 256
+
+/**
+ * @brief Bytes a frame adds around its payload: header, address, packet ID, length, checksum.
+ */
+#define FINGERPRINT_FRAME_OVERHEAD 11
+
+/**
+ * @brief Largest frame on the wire: header (2), address (4), packet ID (1), length (2),
+ *        payload (`FINGERPRINT_MAX_DATA_LEN`) and checksum (2).
+ *
+ * The driver's static TX/RX buffer pools are sized from this value.
+ */
+#define FINGERPRINT_MAX_FRAME_LEN (FINGERPRINT_MAX_DATA_LEN + FINGERPRINT_FRAME_OVERHEAD)
+
+/**
+ * @brief Largest template the driver moves between the module and a host database.
+ *
+ * Templates uploaded for a host search or downloaded into the hot tier are held in a static
+ * pool of buffers of this size (see fingerprint_matcher.h).
+ */
+#define FINGERPRINT_MAX_TEMPLATE_LEN 2048
+
+/**
+ * @brief Packet identifiers (byte following the address).
+ */
+#define FINGERPRINT_PID_COMMAND 0x01    /**< Command packet (host to module). */
+#define FINGERPRINT_PID_DATA 0x02       /**< Data packet, more data packets follow. */
+#define FINGERPRINT_PID_ACK 0x07        /**< Acknowledgement (response) packet. */
+#define FINGERPRINT_PID_END 0x08        /**< Last data packet of a transfer. */
+
 /**
  * @struct FingerprintPacket
  * @brief Structure representing a fingerprint module command packet.
@@ -179,6 +223,34 @@ extern FingerprintPacket PS_Search;
  */
 extern FingerprintPacket PS_Match;
 
+/**
+ * @brief Loads a template from the database into a CharBuffer.
+ *
+ * This packet structure should be overwritten using `fingerprint_set_command()`
+ * because its parameters (Buffer ID and Page ID) are dynamic.
+ *
+ * ### Parameters:
+ * - **Buffer ID** (1 byte): Target CharBuffer (1 or 2).
+ * - **Page ID** (2 bytes): Database page to load.
+ */
+extern FingerprintPacket PS_LoadChar;
+
+/**
+ * @brief Uploads the contents of a CharBuffer to the host as data packets.
+ *
+ * ### Parameters:
+ * - **Buffer ID** (1 byte): CharBuffer to upload (1 or 2).
+ */
+extern FingerprintPacket PS_UpChar;
+
+/**
+ * @brief Downloads a template from the host into a CharBuffer; data packets follow the ACK.
+ *
+ * ### Parameters:
+ * - **Buffer ID** (1 byte): CharBuffer to fill (1 or 2).
+ */
+extern FingerprintPacket PS_DownChar;
+
 /**
  * @brief Stores a fingerprint template into the module’s database.
  * 
@@ -205,6 +277,14 @@ extern FingerprintPacket PS_DeletChar;
  */
 extern FingerprintPacket PS_Empty;
 
+/**
+ * @brief Reads one page of the module's template index table (a 32-byte occupancy bitmap).
+ *
+ * ### Parameters:
+ * - **Index Page** (1 byte): 0-3, each page covers 256 template pages.
+ */
+extern FingerprintPacket PS_ReadIndexTable;
+
 /**
  * @brief Reads system parameters from the fingerprint module.
  */
@@ -248,6 +328,18 @@ extern FingerprintPacket PS_AutoEnroll;
  */
 extern FingerprintPacket PS_Autoldentify;
 
+/**
+ * @brief Writes a module system register.
+ *
+ * This packet structure should be overwritten using `fingerprint_set_command()`
+ * because its parameters (register number and content) are dynamic.
+ *
+ * ### Parameters:
+ * - **Register Number** (1 byte): 4 = baud rate multiplier, 5 = security level, 6 = data packet size.
+ * - **Content** (1 byte): New register value (for register 4: N, with baud rate = N × 9600).
+ */
+extern FingerprintPacket PS_WriteReg;
+
 /**
  * @brief Retrieves the key pair from the fingerprint sensor.
  *
@@ -533,7 +625,20 @@ typedef enum {
 /**
  * @brief Initializes the fingerprint scanner.
  *
- * @return ESP_OK on success, error code otherwise.
+ * Installs the UART driver with an event queue and starts the RX task. The RX task feeds
+ * received bytes into a streaming framer that resynchronizes on the 0xEF01 header, reads the
+ * length field and verifies the checksum, so replies that arrive in several bursts are
+ * reassembled into complete frames before `fingerprint_read_response()` sees them.
+ *
+ * Creates the default instance used by all functions that take no `fingerprint_handle_t`,
+ * on UART2 with the pins and baud rate set by `fingerprint_set_pins()`,
+ * `fingerprint_set_touch_pin()` and `fingerprint_set_baudrate()`. Use `fingerprint_new()`
+ * to drive further sensors.
+ *
+ * @return
+ * - ESP_OK on success
+ * - ESP_ERR_INVALID_STATE if the default instance already exists
+ * - otherwise the error from `fingerprint_new()`
  */
 esp_err_t fingerprint_init(void);
 
@@ -560,7 +665,7 @@ esp_err_t fingerprint_set_command(FingerprintPacket *cmd, uint8_t command, uint8
  * 
  * This function is primarily used for commands like `PS_WriteNotepad` (0x18), which require a 
  * page number and a data block to be stored in the fingerprint module’s internal memory. 
- * It ensures that the provided data is at most 32 bytes, padding with zeros if necessary.
+ * Shorter data is padded with zeros; longer data is truncated to 32 bytes and logged as a warning.
  * 
  * @param base_packet The base `FingerprintPacket` structure.
  * @param page_number The target page number (0-15) where data will be written.
@@ -585,12 +690,34 @@ ExtendedPacket createExtendedPacket(FingerprintPacket base_packet, uint8_t page_
 /**
  * @brief Computes the checksum for a given FingerprintPacket structure.
  *
- * The checksum is the sum of all bytes from packet_id to parameters.
+ * The checksum is the sum of the packet ID, both length bytes, the command and the parameter
+ * bytes announced by `length`. Only the bytes held in `parameters` can be covered; frames
+ * carrying more (such as an ExtendedPacket) must add their trailing data with
+ * `fingerprint_checksum_update()`.
  *
  * @param[in] cmd Pointer to the FingerprintPacket structure.
  * @return The computed checksum.
  */
-uint16_t fingerprint_calculate_checksum(FingerprintPacket *cmd);
+uint16_t fingerprint_calculate_checksum(const FingerprintPacket *cmd);
+
+/**
+ * @brief Adds `len` bytes to a running packet checksum.
+ *
+ * The checksum is a 16-bit sum of bytes, so a frame can be checksummed in pieces as it is
+ * streamed: start from the sum of the packet ID and length bytes and feed each chunk in turn.
+ * Whole words are summed per load, which keeps 128/256-byte data packets cheap.
+ *
+ * @code
+ * uint16_t sum = FINGERPRINT_PID_DATA + ((length >> 8) & 0xFF) + (length & 0xFF);
+ * sum = fingerprint_checksum_update(sum, chunk, chunk_len);
+ * @endcode
+ *
+ * @param sum Checksum of the bytes seen so far.
+ * @param data Bytes to add.
+ * @param len Number of bytes in `data`.
+ * @return The updated checksum.
+ */
+uint16_t fingerprint_checksum_update(uint16_t sum, const void *data, size_t len);
 
 /**
  * @brief Sends a fingerprint command packet to the fingerprint module.
@@ -601,9 +728,14 @@ uint16_t fingerprint_calculate_checksum(FingerprintPacket *cmd);
  * @param cmd Pointer to a FingerprintPacket structure containing the command details.
  * @param address The address of the fingerprint module. This can be configured as needed.
  * 
+ * The frame is serialized on the stack and written straight to the UART, so no heap
+ * allocation takes place.
+ *
  * @return 
  * - ESP_OK on success
- * - ESP_ERR_NO_MEM if memory allocation fails
+ * - ESP_ERR_INVALID_ARG if `cmd` is NULL
+ * - ESP_ERR_INVALID_SIZE if `cmd->length` does not describe 0-5 parameter bytes
+ * - ESP_ERR_INVALID_STATE if `fingerprint_init()` has not been called
  * - ESP_FAIL if the command could not be fully sent over UART
  */
 esp_err_t fingerprint_send_command(FingerprintPacket *cmd, uint32_t address);
@@ -612,11 +744,167 @@ esp_err_t fingerprint_send_command(FingerprintPacket *cmd, uint32_t address);
 /**
  * @brief Reads the response packet from UART and returns a dynamically allocated FingerprintPacket.
  *
+ * Waits up to `UART_READ_TIMEOUT` ms for the RX task to deliver the next complete,
+ * checksum-verified frame. The confirmation code is stored in `command` and the following
+ * payload bytes (up to 5) in `parameters`.
+ *
+ * Raw send/read pairs are not retried by the driver. After a NULL return, call
+ * `fingerprint_recover()` before resending the command.
+ *
  * @return Pointer to the received FingerprintPacket, or NULL on failure.
  *         The caller is responsible for freeing the allocated memory using `free()`.
  */
 FingerprintPacket* fingerprint_read_response(void);
 
+/**
+ * @brief Reads the next response packet into a caller-provided FingerprintPacket.
+ *
+ * Allocation-free variant of `fingerprint_read_response()`. Frames are assembled by the RX
+ * task in a static pool of buffers sized from `FINGERPRINT_MAX_FRAME_LEN`, and the pool
+ * buffer is returned before this function returns.
+ *
+ * @code
+ * FingerprintPacket response;
+ * fingerprint_send_command(&PS_GetImage, DEFAULT_FINGERPRINT_ADDRESS);
+ * if (fingerprint_read_response_into(&response, UART_READ_TIMEOUT) == ESP_OK) {
+ *     fingerprint_status_t status = fingerprint_get_status(&response);
+ * }
+ * @endcode
+ *
+ * @param[out] out Packet to fill with the response.
+ * @param[in] timeout_ms Maximum time to wait for a complete frame, in milliseconds.
+ * @return 
+ * - ESP_OK on success
+ * - ESP_ERR_INVALID_ARG if `out` is NULL
+ * - ESP_ERR_INVALID_STATE if `fingerprint_init()` has not been called
+ * - ESP_ERR_TIMEOUT if no complete frame arrived in time
+ * - ESP_ERR_INVALID_CRC if the next frame failed its checksum
+ */
+esp_err_t fingerprint_read_response_into(FingerprintPacket *out, uint32_t timeout_ms);
+
+/**
+ * @brief Brings the link to the module back into a known state.
+ *
+ * Sends `PS_Cancel` in case the module is still busy with an earlier command. Then it drops
+ * all bytes and frames received but not yet read, and restarts frame assembly, so the next
+ * reply is parsed cleanly. This takes a few milliseconds, where reinitializing takes seconds.
+ *
+ * The driver's own command functions do this automatically. A command whose reply is
+ * missing or fails its checksum is resent up to three times, with a short back-off. Call it
+ * yourself after `fingerprint_read_response()` or `fingerprint_read_response_into()` fails
+ * following `fingerprint_send_command()`.
+ *
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE if `fingerprint_init()` has not been called.
+ */
+esp_err_t fingerprint_recover(void);
+
+/**
+ * @brief Number of buckets in a `fingerprint_histogram_t`.
+ */
+#define FINGERPRINT_STATS_BUCKETS 12
+
+/**
+ * @brief Number of distinct command codes tracked by `fingerprint_stats_t`.
+ *
+ * Entries are claimed in the order commands are first sent; further codes still count
+ * towards the link-wide counters.
+ */
+#define FINGERPRINT_STATS_COMMANDS 12
+
+/**
+ * @brief Distribution of a duration.
+ *
+ * `buckets[0]` counts durations below 1 ms, `buckets[i]` those from 2^(i-1) up to 2^i ms,
+ * and the last bucket everything above.
+ */
+typedef struct {
+    uint32_t count;                                 /**< Number of samples. */
+    uint64_t total_us;                              /**< Sum of all samples in microseconds. */
+    uint32_t max_us;                                /**< Longest sample in microseconds. */
+    uint32_t buckets[FINGERPRINT_STATS_BUCKETS];    /**< Samples per log2 millisecond bucket. */
+} fingerprint_histogram_t;
+
+/**
+ * @brief Timing and error counts of one command code.
+ */
+typedef struct {
+    uint8_t command;                    /**< Command code, e.g. 0x01 for PS_GetImage. */
+    uint32_t sent;                      /**< Times the command went out, retries included. */
+    uint32_t timeouts;                  /**< Replies that did not arrive in time. */
+    uint32_t checksum_errors;           /**< Replies that failed their checksum. */
+    fingerprint_histogram_t send;       /**< First byte written until the last bit left the TX pin. */
+    fingerprint_histogram_t process;    /**< Command sent until the module started its reply. */
+    fingerprint_histogram_t rx;         /**< Start of the reply until the caller had it (wire time plus hand-over). */
+} fingerprint_command_stats_t;
+
+/**
+ * @brief Higher-level flows timed from start to finish by `fingerprint_stats_t`.
+ */
+typedef enum {
+    FINGERPRINT_FLOW_IDENTIFY,  /**< `fingerprint_identify_async()` pipeline or `fingerprint_auto_identify()`. */
+    FINGERPRINT_FLOW_ENROLL,    /**< `fingerprint_enroll()` / `fingerprint_auto_enroll()`, finger placement included. */
+    FINGERPRINT_FLOW_TRANSFER,  /**< Image upload and template export/import. */
+    FINGERPRINT_FLOW_MAX,
+} fingerprint_flow_t;
+
+/**
+ * @brief Link instrumentation of one sensor, as returned by `fingerprint_get_stats()`.
+ *
+ * High `process` times point at the sensor itself. Checksum and line errors point at the
+ * wiring. `send` and `rx` times that are large next to `process` point at the baud rate.
+ * Process/RX are split assuming the reply was sent back to back at `baud_rate`.
+ */
+typedef struct {
+    uint32_t checksum_errors;   /**< Frames that failed their checksum. */
+    uint32_t frames_dropped;    /**< Valid frames lost because no buffer or queue slot was free. */
+    uint32_t line_errors;       /**< UART framing, parity and overflow errors. */
+    uint32_t timeouts;          /**< Replies that did not arrive in time. */
+    uint32_t retries;           /**< Commands resent after a lost or corrupt reply. */
+    uint32_t resyncs;           /**< Link recoveries (PS_Cancel plus RX flush). */
+    uint64_t bytes_tx;          /**< Bytes written to the UART. */
+    uint64_t bytes_rx;          /**< Bytes read from the UART. */
+    uint32_t frames_tx;         /**< Command and data packets sent. */
+    uint32_t frames_rx;         /**< Frames received with a valid checksum. */
+    uint32_t events_dropped;    /**< Events lost to a full dispatcher ring (`CONFIG_FINGERPRINT_EVENT_DISPATCHER`). */
+    int baud_rate;              /**< Current link rate. */
+    size_t command_count;       /**< Valid entries in `commands`. */
+    fingerprint_command_stats_t commands[FINGERPRINT_STATS_COMMANDS]; /**< Per-command timing. */
+    fingerprint_histogram_t flows[FINGERPRINT_FLOW_MAX]; /**< Duration of each higher-level flow. */
+} fingerprint_stats_t;
+
+/**
+ * @brief Takes a consistent snapshot of the link instrumentation.
+ *
+ * Every command sent by the driver is timed with `esp_timer`, also through
+ * `fingerprint_send_command()` and a following `fingerprint_read_response()`.
+ *
+ * @code
+ * fingerprint_stats_t stats;
+ * fingerprint_get_stats(&stats);
+ * for (size_t i = 0; i < stats.command_count; i++) {
+ *     const fingerprint_command_stats_t *c = &stats.commands[i];
+ *     if (c->process.count > 0) {
+ *         ESP_LOGI(TAG, "cmd 0x%02X: %u sent, avg processing %u us", c->command,
+ *                  (unsigned)c->sent, (unsigned)(c->process.total_us / c->process.count));
+ *     }
+ * }
+ * @endcode
+ *
+ * @param[out] out Receives the snapshot.
+ * @return
+ * - ESP_OK on success
+ * - ESP_ERR_INVALID_ARG if `out` is NULL
+ * - ESP_ERR_INVALID_STATE if `fingerprint_init()` has not been called
+ */
+esp_err_t fingerprint_get_stats(fingerprint_stats_t *out);
+
+/**
+ * @brief Clears all counters and histograms.
+ *
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE if `fingerprint_init()` has not been called.
+ */
+esp_err_t fingerprint_reset_stats(void);
+
 /**
  * @brief Get the status of the fingerprint operation from the response packet.
  *
@@ -632,7 +920,7 @@ fingerprint_status_t fingerprint_get_status(FingerprintPacket *packet);
 /**
  * @brief Scans for a fingerprint and returns the status.
  *
- * This function sends a scan command to the fingerprint module,
+ * This function sends `PS_GetImage` to the fingerprint module,
  * waits for a response, and maps the received status code to the
  * corresponding fingerprint_status_t value.
  *
@@ -640,22 +928,227 @@ fingerprint_status_t fingerprint_get_status(FingerprintPacket *packet);
  */
 fingerprint_status_t fingerprint_scan(void);
 
+/**
+ * @brief Completion callback for asynchronous requests.
+ *
+ * Runs on the driver's worker task, so it should return quickly and must not call the
+ * blocking fingerprint APIs.
+ *
+ * @param status Confirmation code from the module, `FINGERPRINT_TIMEOUT` if no reply arrived,
+ *               or `FINGERPRINT_PACKET_ERROR` if the command could not be sent.
+ * @param response The parsed reply, or NULL if no reply was received.
+ * @param user_ctx The `user_ctx` given in the request.
+ */
+typedef void (*fingerprint_cmd_callback_t)(fingerprint_status_t status, const FingerprintPacket *response, void *user_ctx);
+
+/**
+ * @struct fingerprint_request_t
+ * @brief An asynchronous command submitted with `fingerprint_submit()`.
+ *
+ * Completion is reported through `callback`, through a task notification to `notify_task`
+ * (the notification value is the `fingerprint_status_t`), or both.
+ */
+typedef struct {
+    FingerprintPacket command;          /**< Command to send, e.g. a copy of `PS_GetImage`. */
+    uint32_t address;                   /**< Module address, usually `DEFAULT_FINGERPRINT_ADDRESS`. */
+    uint32_t timeout_ms;                /**< Reply timeout in ms (0 = the command's default). */
+    fingerprint_cmd_callback_t callback;/**< Called on completion (may be NULL). */
+    void *user_ctx;                     /**< Passed to `callback`. */
+    TaskHandle_t notify_task;           /**< Notified on completion (may be NULL). */
+} fingerprint_request_t;
+
+/**
+ * @brief Queues a command for the driver's worker task and returns immediately.
+ *
+ * The worker task sends queued commands one at a time, waits for each reply and then
+ * reports completion, so the calling task never blocks on the sensor.
+ *
+ * @code
+ * fingerprint_request_t req = {
+ *     .command = PS_GetImage,
+ *     .address = DEFAULT_FINGERPRINT_ADDRESS,
+ *     .notify_task = xTaskGetCurrentTaskHandle(),
+ * };
+ * fingerprint_submit(&req);
+ * // ... drive the relay, talk to the network ...
+ * uint32_t status;
+ * xTaskNotifyWait(0, 0, &status, portMAX_DELAY);
+ * @endcode
+ *
+ * @param[in] request The request; it is copied, so it may live on the caller's stack.
+ * @return 
+ * - ESP_OK if the request was queued
+ * - ESP_ERR_INVALID_ARG if `request` is NULL
+ * - ESP_ERR_INVALID_STATE if `fingerprint_init()` has not been called
+ * - ESP_ERR_NO_MEM if the request queue is full
+ */
+esp_err_t fingerprint_submit(const fingerprint_request_t *request);
+
+/**
+ * @struct fingerprint_match_result_t
+ * @brief Outcome of an identify operation.
+ */
+typedef struct {
+    fingerprint_status_t status;    /**< `FINGERPRINT_OK` on a match, otherwise the failing stage's status. */
+    uint16_t page_id;               /**< Matched template page (valid when `status` is `FINGERPRINT_OK`). */
+    uint16_t score;                 /**< Match score reported by the module. */
+} fingerprint_match_result_t;
+
+/**
+ * @brief Completion callback for `fingerprint_identify_async()`.
+ *
+ * Runs on the driver's worker task.
+ *
+ * @param result The identify result.
+ * @param user_ctx The `user_ctx` given in the configuration.
+ */
+typedef void (*fingerprint_identify_callback_t)(const fingerprint_match_result_t *result, void *user_ctx);
+
+/**
+ * @struct fingerprint_identify_config_t
+ * @brief Parameters of an asynchronous identify.
+ */
+typedef struct {
+    uint32_t address;                           /**< Module address, usually `DEFAULT_FINGERPRINT_ADDRESS`. */
+    uint16_t start_page;                        /**< First template page to search. */
+    uint16_t page_count;                        /**< Number of template pages to search. */
+    fingerprint_identify_callback_t callback;   /**< Called with the result (may be NULL). */
+    void *user_ctx;                             /**< Passed to `callback`. */
+    TaskHandle_t notify_task;                   /**< Notified with the final `fingerprint_status_t` (may be NULL). */
+    uint8_t capture_attempts;                   /**< Captures tried before giving up on a poor image; 0 = `CONFIG_FINGERPRINT_CAPTURE_ATTEMPTS`. */
+    uint16_t capture_budget_ms;                 /**< No capture starts after this long; 0 = `CONFIG_FINGERPRINT_CAPTURE_BUDGET_MS`. */
+} fingerprint_identify_config_t;
+
+/**
+ * @brief Runs a complete identify (`PS_GetImage` → `PS_GenChar1` → `PS_Search`) on the worker task.
+ *
+ * The stages are chained inside the driver: the next frame is sent as soon as the previous
+ * ACK has been parsed, without a round trip through the application. Events are fired as
+ * each stage completes:
+ * - `EVENT_IMAGE_CAPTURED` / `EVENT_IMAGE_FAIL` after `PS_GetImage`
+ * - `EVENT_FEATURE_EXTRACTED` / `EVENT_FEATURE_EXTRACT_FAIL` after `PS_GenChar1`
+ * - `EVENT_MATCH_SUCCESS` / `EVENT_MATCH_FAIL` after `PS_Search`
+ * - `EVENT_ERROR` if a stage gets no reply
+ *
+ * The pipeline stops at the first failing stage, except that a poor image (too dry, too wet,
+ * smudged, too small, too few features) is captured again right away, up to
+ * `capture_attempts` times within `capture_budget_ms`. Each rejected capture fires its failure
+ * event with the reason as the status, so the user can adjust the finger; the result carries
+ * the last reason if no capture was usable. When no finger is on the sensor no event is
+ * fired and the result carries `FINGERPRINT_NO_FINGER`.
+ *
+ * @param[in] config Identify parameters; copied before returning.
+ * @return 
+ * - ESP_OK if the identify was queued
+ * - ESP_ERR_INVALID_ARG if `config` is NULL
+ * - ESP_ERR_INVALID_STATE if `fingerprint_init()` has not been called
+ * - ESP_ERR_NO_MEM if the request queue is full
+ */
+esp_err_t fingerprint_identify_async(const fingerprint_identify_config_t *config);
+
+/**
+ * @brief Enrolls a fingerprint using the module's one-shot `PS_AutoEnroll` command.
+ *
+ * The module captures `entries` images, merges them and stores the template on its own;
+ * the host only reads the progress ACKs that the module sends after each stage. Each ACK is
+ * forwarded as an event as soon as it arrives (`EVENT_IMAGE_CAPTURED`,
+ * `EVENT_FEATURE_EXTRACTED`, and `EVENT_ENROLL_SUCCESS` once the template is stored). A failing
+ * stage fires the matching failure event and ends the enroll.
+ *
+ * Blocks the calling task until the module reports the final stage.
+ *
+ * @param id Template page to store the fingerprint in.
+ * @param entries Number of captures to merge (1-6 on most modules).
+ * @param flags Module-specific parameter bits (e.g. allow overwrite, require finger lift); 0 for defaults.
+ * @return The status reported by the module, or `FINGERPRINT_TIMEOUT` if it stopped answering.
+ */
+fingerprint_status_t fingerprint_auto_enroll(uint16_t id, uint8_t entries, uint16_t flags);
+
+/**
+ * @brief Identifies a fingerprint using the module's one-shot `PS_Autoldentify` command.
+ *
+ * Capture, extraction and search of the whole database run on the module. Progress ACKs are
+ * forwarded as events like in `fingerprint_auto_enroll()`, ending with `EVENT_MATCH_SUCCESS`
+ * or `EVENT_MATCH_FAIL`.
+ *
+ * @param security_level Match threshold level (module-specific, typically 1-5).
+ * @param[out] result Filled with the matched page ID and score (may be NULL).
+ * @return The status reported by the module, or `FINGERPRINT_TIMEOUT` if it stopped answering.
+ */
+fingerprint_status_t fingerprint_auto_identify(uint8_t security_level, fingerprint_match_result_t *result);
+
 /**
  * @brief Enrolls a fingerprint.
  *
+ * Uses `fingerprint_auto_enroll()` with two captures. If the module answers `PS_AutoEnroll`
+ * with `FINGERPRINT_PACKET_ERROR`, the driver remembers that and enrolls with `PS_GetImage`/
+ * `PS_GenChar1`/`PS_GenChar2`/`PS_RegModel`/`PS_StoreChar` instead, waiting for the finger to
+ * lift between the two presses. Transport errors do not trigger the fallback.
+ *
  * @param id ID of the fingerprint to enroll.
- * @return ESP_OK on success, error code otherwise.
+ * @return ESP_OK on success, ESP_ERR_TIMEOUT if no finger was presented in time, error code otherwise.
  */
 esp_err_t fingerprint_enroll(int id);
 
 /**
  * @brief Deletes a stored fingerprint.
  *
+ * Sends `PS_DeletChar` for a single page and waits for the module's acknowledgement.
+ *
  * @param id ID of the fingerprint to delete.
  * @return ESP_OK on success, error code otherwise.
  */
 esp_err_t fingerprint_delete(int id);
 
+/**
+ * @brief Clears all stored fingerprints with `PS_Empty`.
+ *
+ * @return ESP_OK on success, ESP_FAIL if the module refused, or the transport error.
+ */
+esp_err_t fingerprint_empty(void);
+
+/**
+ * @brief Reloads the host-side template index from the module's index table.
+ *
+ * Called once by `fingerprint_init()`. Afterwards the index is kept current by the driver's
+ * own store, delete and empty paths (including `fingerprint_submit()` requests), so
+ * occupancy queries never need a UART round trip. Call it again only if commands were
+ * sent with `fingerprint_send_command()` directly.
+ *
+ * @return ESP_OK on success, error code otherwise.
+ */
+esp_err_t fingerprint_index_sync(void);
+
+/**
+ * @brief Returns whether the host-side index has been loaded successfully.
+ *
+ * @return true once `fingerprint_index_sync()` has succeeded.
+ */
+bool fingerprint_index_is_valid(void);
+
+/**
+ * @brief Returns whether a template page is occupied, without talking to the module.
+ *
+ * @param page_id Template page.
+ * @return true if the page holds a template.
+ */
+bool fingerprint_index_is_used(uint16_t page_id);
+
+/**
+ * @brief Returns the number of enrolled templates, without talking to the module.
+ *
+ * @return Number of occupied template pages.
+ */
+uint16_t fingerprint_index_count(void);
+
+/**
+ * @brief Finds the first free template page, without talking to the module.
+ *
+ * @param start Page to start searching from.
+ * @return The free page, or -1 if the database is full or the index is not loaded.
+ */
+int fingerprint_index_next_free(uint16_t start);
+
 /**
  * @brief Sets the UART TX and RX pins for the fingerprint sensor.
  *
@@ -667,17 +1160,348 @@ esp_err_t fingerprint_delete(int id);
  */
 void fingerprint_set_pins(int tx, int rx);
 
+/**
+ * @brief Sets the GPIO wired to the module's touch output (TOUCHOUT).
+ *
+ * Must be called before `fingerprint_init()`. With a touch pin, `fingerprint_start_detection()`
+ * waits for a finger on an interrupt instead of polling the module over UART.
+ *
+ * @param[in] touch GPIO number of the touch output, or -1 if it is not wired (default).
+ */
+void fingerprint_set_touch_pin(int touch);
+
 /**
  * @brief Sets the baud rate for fingerprint module communication.
  *
  * This function adjusts the baud rate used for UART communication
- * with the fingerprint scanner. It should be called before `fingerprint_init()`
- * to ensure proper communication settings.
+ * with the fingerprint scanner. It should be called before `fingerprint_init()`,
+ * which opens the link at `DEFAULT_BAUD_RATE` and then raises it to this rate
+ * with `fingerprint_negotiate_baudrate()`.
  *
  * @param[in] baud The desired baud rate (e.g., 9600, 57600, 115200).
  */
 void fingerprint_set_baudrate(int baud);
 
+/**
+ * @brief Moves the module and the ESP32 UART to a new baud rate.
+ *
+ * Checks that the module answers `PS_CheckSensor` at the current rate (or, if not, whether
+ * it is already running at `target` from an earlier session), writes the baud multiplier
+ * to the module's system-parameter register with `PS_WriteReg`, switches the UART with
+ * `uart_set_baudrate()` and probes again. If the module does not answer at the new rate,
+ * both ends are moved back to the old one.
+ *
+ * @param[in] target New baud rate, a multiple of 9600 up to 115200.
+ * @return 
+ * - ESP_OK if the link runs at `target`
+ * - ESP_ERR_INVALID_ARG if `target` is not a supported rate
+ * - ESP_ERR_INVALID_STATE if `fingerprint_init()` has not been called
+ * - ESP_ERR_NOT_SUPPORTED if the module refused the register write, or the UART is shared by several modules
+ * - ESP_FAIL if the new rate failed the probe and the old rate was restored
+ * - ESP_ERR_TIMEOUT if the module answers at neither rate
+ */
+esp_err_t fingerprint_negotiate_baudrate(int target);
+
+/**
+ * @brief Callback receiving one chunk of a bulk data transfer.
+ *
+ * Called once per data packet, in order, from the task that started the transfer. The
+ * buffer is only valid during the call.
+ *
+ * @param data Packet payload.
+ * @param len Payload length (the module's data packet size, e.g. 128 bytes).
+ * @param user_ctx The `user_ctx` given to the transfer function.
+ * @return ESP_OK to continue; any other value aborts the transfer and is returned by it.
+ */
+typedef esp_err_t (*fingerprint_data_callback_t)(const uint8_t *data, size_t len, void *user_ctx);
+
+/**
+ * @brief Uploads the raw image in the module's image buffer, streaming it to `callback`.
+ *
+ * Sends `PS_Uplmage` and passes every following data packet (packet ID 0x02, last one 0x08)
+ * to `callback` as soon as its checksum has been verified. The full image is never held in
+ * RAM, so it can be written straight to an HTTP chunked upload or an SD card file. Capture
+ * an image first with `PS_GetImage`.
+ *
+ * @code
+ * static esp_err_t write_chunk(const uint8_t *data, size_t len, void *ctx) {
+ *     return fwrite(data, 1, len, (FILE *)ctx) == len ? ESP_OK : ESP_FAIL;
+ * }
+ * ...
+ * FILE *f = fopen("/sdcard/finger.raw", "wb");
+ * size_t size;
+ * fingerprint_upload_image(write_chunk, f, &size);
+ * fclose(f);
+ * @endcode
+ *
+ * @param[in] callback Receives the image chunk by chunk.
+ * @param[in] user_ctx Passed to `callback`.
+ * @param[out] total_len Number of image bytes received (may be NULL).
+ * @return 
+ * - ESP_OK on success
+ * - ESP_ERR_INVALID_ARG if `callback` is NULL
+ * - ESP_ERR_INVALID_STATE if `fingerprint_init()` has not been called
+ * - ESP_FAIL if the module refused the upload (e.g. no image captured)
+ * - ESP_ERR_TIMEOUT if the transfer stalled
+ * - ESP_ERR_INVALID_CRC if data packets were lost or failed their checksum
+ * - the callback's error if it aborted the transfer
+ */
+esp_err_t fingerprint_upload_image(fingerprint_data_callback_t callback, void *user_ctx, size_t *total_len);
+
+/**
+ * @brief Size of the record header that precedes every chunk in a template stream.
+ *
+ * A template stream, as written by `fingerprint_export_templates()` and read by
+ * `fingerprint_import_templates()`, is a sequence of records:
+ *
+ * | Page ID | Packet ID          | Length  | Payload      |
+ * |---------|--------------------|---------|--------------|
+ * | 2 bytes | 1 byte (0x02/0x08) | 2 bytes | Length bytes |
+ *
+ * All multi-byte fields are big-endian. Each record is one data packet of a template; the
+ * record with packet ID 0x08 ends that template. Importing replays the packets unchanged, so
+ * source and target modules must use the same data packet size.
+ */
+#define FINGERPRINT_TEMPLATE_RECORD_HEADER_LEN 5
+
+/**
+ * @brief Number of template pages tracked by the host-side index (4 index table pages of 256).
+ */
+#define FINGERPRINT_INDEX_CAPACITY 1024
+
+/**
+ * @brief Source callback for `fingerprint_import_templates()`, with `fread()`-like semantics.
+ *
+ * @param buf Buffer to fill.
+ * @param len Maximum number of bytes to read.
+ * @param user_ctx The `user_ctx` given to the import function.
+ * @return Number of bytes read, 0 at the end of the stream, or a negative value on error.
+ */
+typedef int (*fingerprint_stream_read_t)(uint8_t *buf, size_t len, void *user_ctx);
+
+/**
+ * @brief Exports templates from the module's database as one streamed batch.
+ *
+ * For each page, loads the template into CharBuffer 1 with `PS_LoadChar`, uploads it with
+ * `PS_UpChar` and passes the resulting record stream to `write` chunk by chunk; templates
+ * are never buffered as a whole. The UART is held for the whole batch, so syncing a full
+ * database is a single transfer. Empty pages are skipped.
+ *
+ * @param[in] page_ids Pages to export.
+ * @param[in] count Number of entries in `page_ids`.
+ * @param[in] write Receives the template stream (e.g. appends to a file on a partition or to a PSRAM buffer).
+ * @param[in] user_ctx Passed to `write`.
+ * @param[out] exported Number of templates exported (may be NULL).
+ * @return 
+ * - ESP_OK on success
+ * - ESP_ERR_INVALID_ARG if `page_ids` or `write` is NULL
+ * - ESP_ERR_INVALID_STATE if `fingerprint_init()` has not been called
+ * - ESP_ERR_TIMEOUT, ESP_ERR_INVALID_CRC or ESP_FAIL if a transfer failed
+ * - the writer's error if it aborted the export
+ */
+esp_err_t fingerprint_export_templates(const uint16_t *page_ids, size_t count, fingerprint_data_callback_t write, void *user_ctx, size_t *exported);
+
+/**
+ * @brief Imports a template stream produced by `fingerprint_export_templates()`.
+ *
+ * For each template in the stream, sends `PS_DownChar`, streams the data packets from `read`
+ * into CharBuffer 1 and stores it in its original page with `PS_StoreChar`. Payload bytes
+ * are read straight into a TX buffer, so the stream can come from flash or PSRAM without an
+ * intermediate copy.
+ *
+ * @param[in] read Source of the template stream.
+ * @param[in] user_ctx Passed to `read`.
+ * @param[out] imported Number of templates stored (may be NULL).
+ * @return 
+ * - ESP_OK on success
+ * - ESP_ERR_INVALID_ARG if `read` is NULL
+ * - ESP_ERR_INVALID_STATE if `fingerprint_init()` has not been called
+ * - ESP_ERR_INVALID_RESPONSE if the stream is malformed
+ * - ESP_ERR_INVALID_SIZE if the stream ends inside a template
+ * - ESP_FAIL if the module refused a download or store
+ */
+esp_err_t fingerprint_import_templates(fingerprint_stream_read_t read, void *user_ctx, size_t *imported);
+
+/**
+ * @brief A template for `fingerprint_batch_store()`.
+ */
+typedef struct {
+    uint16_t page_id;       /**< Page to store the template in. */
+    const uint8_t *data;    /**< Raw `PS_UpChar` data, e.g. from a host database. */
+    size_t len;             /**< Bytes in `data`. */
+} fingerprint_template_t;
+
+/**
+ * @brief Called by `fingerprint_compact()` after a template has moved to another page.
+ *
+ * @param from Page the template was in.
+ * @param to Page it is in now.
+ * @param user_ctx The `user_ctx` given to `fingerprint_compact()`.
+ */
+typedef void (*fingerprint_page_moved_t)(uint16_t from, uint16_t to, void *user_ctx);
+
+/**
+ * @brief Deletes a list of pages with as few `PS_DeletChar` commands as possible.
+ *
+ * The pages are sorted and merged into ranges (start page + count). Free pages between two
+ * requested ones join the range too, if `PS_ReadIndexTable` reports them free within the same
+ * hold of the link as the delete; the host-side index is not trusted for this. Order and
+ * duplicates do not matter. The link is taken per range, so identifies run in between; call
+ * it from a low-priority task, or use `fingerprint_batch_delete_async()`.
+ *
+ * @param[in] page_ids Pages to delete.
+ * @param[in] count Number of entries in `page_ids`.
+ * @param[out] commands Number of `PS_DeletChar` commands that succeeded (may be NULL).
+ * @return
+ * - ESP_OK on success
+ * - ESP_ERR_INVALID_ARG if `page_ids` is NULL
+ * - ESP_ERR_INVALID_STATE if `fingerprint_init()` has not been called
+ * - ESP_ERR_NO_MEM if the sorted copy could not be allocated
+ * - ESP_FAIL if the module refused a range, otherwise the transport error
+ */
+esp_err_t fingerprint_batch_delete(const uint16_t *page_ids, size_t count, size_t *commands);
+
+/**
+ * @brief Completion callback for `fingerprint_batch_delete_async()`.
+ *
+ * Runs on the driver's worker task.
+ *
+ * @param err Result as returned by `fingerprint_batch_delete()`.
+ * @param deleted Requested pages covered by ranges that were deleted (duplicates counted once).
+ * @param commands Number of `PS_DeletChar` commands that succeeded.
+ * @param user_ctx The `user_ctx` given to `fingerprint_batch_delete_async()`.
+ */
+typedef void (*fingerprint_batch_delete_callback_t)(esp_err_t err, size_t deleted, size_t commands, void *user_ctx);
+
+/**
+ * @brief Runs `fingerprint_batch_delete()` in the background on the worker task.
+ *
+ * Ranges are deleted just above idle priority, one per hold of the link. After each range the
+ * rest of the batch is queued again behind any request submitted meanwhile, so an identify
+ * waits for one range at most. Offboarding a large group therefore never blocks the door.
+ *
+ * @param[in] page_ids Pages to delete; copied before returning.
+ * @param[in] count Number of entries in `page_ids`.
+ * @param[in] callback Called once the batch is done (may be NULL).
+ * @param[in] user_ctx Passed to `callback`.
+ * @return
+ * - ESP_OK if the batch was queued
+ * - ESP_ERR_INVALID_ARG if `page_ids` is NULL or `count` is 0
+ * - ESP_ERR_INVALID_STATE if `fingerprint_init()` has not been called
+ * - ESP_ERR_NO_MEM if the sorted copy could not be allocated or the request queue is full
+ */
+esp_err_t fingerprint_batch_delete_async(const uint16_t *page_ids, size_t count, fingerprint_batch_delete_callback_t callback, void *user_ctx);
+
+/**
+ * @brief Stores a list of templates with `PS_DownChar` and `PS_StoreChar`.
+ *
+ * The link is taken per template, so identifies run in between; call it from a
+ * low-priority task. Data is sent in packets of the module's data packet size.
+ *
+ * @param[in] templates Templates to store.
+ * @param[in] count Number of entries in `templates`.
+ * @param[out] stored Number of templates stored (may be NULL).
+ * @return
+ * - ESP_OK on success
+ * - ESP_ERR_INVALID_ARG if `templates` or a template's data is NULL
+ * - ESP_ERR_INVALID_STATE if `fingerprint_init()` has not been called
+ * - ESP_ERR_NO_MEM if no TX buffer was free
+ * - ESP_FAIL if the module refused a download or store, otherwise the transport error
+ */
+esp_err_t fingerprint_batch_store(const fingerprint_template_t *templates, size_t count, size_t *stored);
+
+/**
+ * @brief Packs the templates of a page range into its lowest pages.
+ *
+ * The highest used page is moved into the lowest free one (`PS_LoadChar`, `PS_StoreChar`,
+ * `PS_DeletChar`) until the used pages are contiguous. Each move holds the link on its own,
+ * so identifies run in between; call it from a low-priority task. Both pages of a move are
+ * checked against `PS_ReadIndexTable` within that hold, so a page an enroll has taken since
+ * is never overwritten; the move is picked again instead. Leave pages whose number means
+ * something elsewhere, such as a host database's hot tier, out of the range.
+ *
+ * @param[in] start_page First page of the range.
+ * @param[in] page_count Pages in the range.
+ * @param[in] moved Told about every move, to update page mappings (may be NULL).
+ * @param[in] user_ctx Passed to `moved`.
+ * @param[out] moved_count Number of templates moved (may be NULL).
+ * @return
+ * - ESP_OK on success
+ * - ESP_ERR_INVALID_STATE if `fingerprint_init()` has not been called or the index is not loaded
+ * - ESP_FAIL if the module refused a command or its index could not be read, otherwise the
+ *   transport error
+ */
+esp_err_t fingerprint_compact(uint16_t start_page, uint16_t page_count, fingerprint_page_moved_t moved, void *user_ctx, size_t *moved_count);
+
+/**
+ * @brief Returns the baud rate the link is currently running at.
+ *
+ * @return Baud rate in bps.
+ */
+int fingerprint_get_baudrate(void);
+
+/**
+ * @brief Size of the flash information page returned by `PS_ReadINFpage`.
+ */
+#define FINGERPRINT_INFO_PAGE_LEN 512
+
+/**
+ * @brief Module parameters reported by `PS_ReadSysPara`.
+ */
+typedef struct {
+    uint16_t status_register;   /**< Module status register. */
+    uint16_t system_id;         /**< System identifier code. */
+    uint16_t library_size;      /**< Template pages in the module's database. */
+    uint16_t security_level;    /**< Match threshold level (1-5). */
+    uint32_t address;           /**< Device address. */
+    uint16_t packet_size;       /**< Data packet payload in bytes (32, 64, 128 or 256). */
+    int baud_rate;              /**< Configured baud rate (multiplier * 9600). */
+    bool info_page;             /**< The module answered `PS_ReadINFpage`; see `fingerprint_get_info_page()`. */
+} fingerprint_sys_params_t;
+
+/**
+ * @brief Reads `PS_ReadSysPara` and `PS_ReadINFpage` and caches the result.
+ *
+ * Called once by `fingerprint_init()`; call it again only after changing module settings
+ * with raw commands. The driver sizes template downloads and the search and index ranges
+ * from the cached values, and a module that rejects `PS_ReadINFpage` is not asked again.
+ *
+ * @return
+ * - ESP_OK on success
+ * - ESP_ERR_INVALID_STATE if `fingerprint_init()` has not been called
+ * - ESP_ERR_INVALID_RESPONSE if the reply is too short
+ * - ESP_FAIL if the module refused, otherwise the transport error
+ */
+esp_err_t fingerprint_read_sys_params(void);
+
+/**
+ * @brief Returns the cached module parameters, without talking to the module.
+ *
+ * @param[out] out Receives the parameters.
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG if `out` is NULL, ESP_ERR_INVALID_STATE if they have not been read.
+ */
+esp_err_t fingerprint_get_sys_params(fingerprint_sys_params_t *out);
+
+/**
+ * @brief Copies the cached flash information page, whose layout is vendor-specific.
+ *
+ * @param[out] buf Receives up to `len` bytes.
+ * @param[in] len Size of `buf`.
+ * @param[out] out_len Bytes copied (may be NULL).
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG if `buf` is NULL, ESP_ERR_NOT_SUPPORTED if the module has no information page.
+ */
+esp_err_t fingerprint_get_info_page(uint8_t *buf, size_t len, size_t *out_len);
+
+/**
+ * @brief Returns false once the module has rejected a command code.
+ *
+ * The driver records rejections of optional commands (`PS_AutoEnroll`, `PS_ReadINFpage`)
+ * and uses the fallback from then on instead of asking again.
+ *
+ * @param command Command code, e.g. 0x31 for `PS_AutoEnroll`.
+ */
+bool fingerprint_command_supported(uint8_t command);
+
 
 
 
@@ -761,7 +1585,14 @@ typedef enum {
      *
      * This event corresponds to the status `FINGERPRINT_SENSOR_OP_FAIL`.
      */
-    EVENT_SENSOR_ERROR              /**< Sensor operation failure (FINGERPRINT_SENSOR_OP_FAIL) */
+    EVENT_SENSOR_ERROR,             /**< Sensor operation failure (FINGERPRINT_SENSOR_OP_FAIL) */
+
+    /**
+     * @brief Event triggered when an enrollment has been stored.
+     *
+     * Fired by `fingerprint_enroll()` and `fingerprint_auto_enroll()` once the template is in the database.
+     */
+    EVENT_ENROLL_SUCCESS            /**< Template enrolled and stored */
 } fingerprint_event_t;
 
 /**
@@ -791,6 +1622,9 @@ extern fingerprint_event_handler_t g_fingerprint_event_handler;
  * be called when a fingerprint event is triggered. The handler will process the
  * event according to its type (e.g., finger detected, match success, etc.).
  * 
+ * The handler runs on the task that raised the event, or on the instance's dispatcher
+ * task when `CONFIG_FINGERPRINT_EVENT_DISPATCHER` is enabled.
+ *
  * @param handler The function pointer to the event handler function.
  */
 void register_fingerprint_event_handler(void (*handler)(fingerprint_event_t));
@@ -805,6 +1639,391 @@ void register_fingerprint_event_handler(void (*handler)(fingerprint_event_t));
  */
 void trigger_fingerprint_event(fingerprint_event_t event);
 
+/**
+ * @brief Handle of one fingerprint sensor instance.
+ *
+ * Every instance owns its UART port, RX and worker tasks, frame buffers, template index
+ * and event handler, so several sensors can be driven in parallel from different tasks
+ * (e.g. an entry and an exit reader). The `fingerprint_dev_*` functions behave like their
+ * handle-less counterparts, which operate on the instance created by `fingerprint_init()`.
+ * Modules with distinct addresses can also share one UART (`fingerprint_config_t::bus`).
+ */
+typedef struct fingerprint_dev_t *fingerprint_handle_t;
+
+/**
+ * @brief Modules that can join the instance owning a UART on a multi-drop bus.
+ */
+#define FINGERPRINT_BUS_MAX_MODULES 7
+
+/**
+ * @brief Configuration of a sensor instance.
+ */
+typedef struct {
+    uart_port_t uart_port;                      /**< UART port dedicated to this sensor. */
+    int tx_pin;                                 /**< GPIO for UART TX. */
+    int rx_pin;                                 /**< GPIO for UART RX. */
+    int baud_rate;                              /**< Rate negotiated after opening the link at `DEFAULT_BAUD_RATE` (0 keeps the default). */
+    uint32_t address;                           /**< Module address put into every command frame. */
+    fingerprint_event_handler_t event_handler;  /**< Event handler of this instance, may be NULL. */
+    int touch_pin;                              /**< GPIO wired to the module's touch output, or -1 if not wired. */
+    bool touch_active_low;                      /**< Touch output is low (instead of high) while a finger is present. */
+    int power_pin;                              /**< GPIO switching the module's main supply (high = on), or -1 if always powered. */
+    fingerprint_handle_t bus;                   /**< Instance whose UART this module shares, or NULL for a UART of its own. `uart_port`, the UART pins and `baud_rate` are then taken from it. */
+} fingerprint_config_t;
+
+/**
+ * @brief Default configuration: UART2 on the default pins, factory baud rate, broadcast address.
+ */
+#define FINGERPRINT_DEFAULT_CONFIG() {          \
+    .uart_port = UART_NUM_2,                    \
+    .tx_pin = DEFAULT_TX_PIN,                   \
+    .rx_pin = DEFAULT_RX_PIN,                   \
+    .baud_rate = DEFAULT_BAUD_RATE,             \
+    .address = DEFAULT_FINGERPRINT_ADDRESS,     \
+    .event_handler = NULL,                      \
+    .touch_pin = -1,                            \
+    .touch_active_low = false,                  \
+    .power_pin = -1,                            \
+    .bus = NULL,                                \
+}
+
+/**
+ * @brief Creates a sensor instance.
+ *
+ * Installs the UART driver on `config->uart_port`, starts the instance's RX and worker
+ * tasks, negotiates `config->baud_rate` and loads the template index, like `fingerprint_init()`
+ * does for the default instance.
+ *
+ * @code
+ * fingerprint_config_t config = FINGERPRINT_DEFAULT_CONFIG();
+ * config.uart_port = UART_NUM_1;
+ * config.tx_pin = 4;
+ * config.rx_pin = 5;
+ * config.event_handler = exit_reader_events;
+ * fingerprint_handle_t exit_reader;
+ * ESP_ERROR_CHECK(fingerprint_new(&config, &exit_reader));
+ * fingerprint_dev_identify_async(exit_reader, &identify_config);
+ * @endcode
+ *
+ * With `config->bus` set the module joins that instance's UART instead (a multi-drop bus).
+ * The owner's RX task routes every reply by its address field to the instance configured
+ * with that address; each instance keeps its own worker task, transaction lock, reply queue
+ * and frame buffers. So while one module works on a 300 ms `PS_GenChar`, commands to the
+ * others already go out on the shared line. The modules' TX outputs must be combined
+ * electrically (open drain with a pull-up, or RS-485 transceivers), each module must first
+ * be given its own address with `PS_SetChipAddr`, and the bus runs at the owner's baud
+ * rate, which can no longer be renegotiated. A reply garbled by two modules answering at
+ * once fails its checksum and is retried like any other.
+ *
+ * @code
+ * fingerprint_config_t config = FINGERPRINT_DEFAULT_CONFIG();
+ * config.address = 0x00000002;
+ * config.bus = entry_reader;  // Owns the UART
+ * fingerprint_handle_t side_reader;
+ * ESP_ERROR_CHECK(fingerprint_new(&config, &side_reader));
+ * @endcode
+ *
+ * @param[in] config Instance configuration.
+ * @param[out] ret_handle Receives the new handle on success.
+ * @return
+ * - ESP_OK on success
+ * - ESP_ERR_INVALID_ARG if `config` or `ret_handle` is NULL, or `address` is already used on the bus
+ * - ESP_ERR_NO_MEM if the instance, its queues or its tasks could not be allocated, or the bus is full
+ * - otherwise the error from installing or configuring the UART driver
+ */
+esp_err_t fingerprint_new(const fingerprint_config_t *config, fingerprint_handle_t *ret_handle);
+
+/**
+ * @brief Deletes a sensor instance and releases its UART port.
+ *
+ * Requests already queued with `fingerprint_dev_submit()` or `fingerprint_dev_identify_async()`
+ * are completed first. No other call on `dev` may be in progress.
+ *
+ * @param[in] dev Instance to delete; may be the default instance.
+ * @return
+ * - ESP_OK on success
+ * - ESP_ERR_INVALID_ARG if `dev` is NULL
+ * - ESP_ERR_INVALID_STATE if `dev` owns a UART other modules still share
+ */
+esp_err_t fingerprint_del(fingerprint_handle_t dev);
+
+/**
+ * @brief Sends a command frame to the module address configured for `dev`.
+ *
+ * Unlike `fingerprint_send_command()`, `cmd` is not modified: the checksum is computed into
+ * the wire buffer, so the shared `PS_*` packets may be sent from several instances at once.
+ *
+ * @return As `fingerprint_send_command()`; ESP_ERR_INVALID_STATE if `dev` is NULL.
+ */
+esp_err_t fingerprint_dev_send_command(fingerprint_handle_t dev, const FingerprintPacket *cmd);
+
+/**
+ * @brief Per-instance variants of the functions above.
+ *
+ * Each one behaves like the handle-less function of the same name on the sensor behind
+ * `dev`. Functions returning `esp_err_t` return ESP_ERR_INVALID_STATE and functions
+ * returning `fingerprint_status_t` return FINGERPRINT_PACKET_ERROR if `dev` is NULL.
+ * Requests passed to `fingerprint_dev_submit()` are still sent to `request->address`.
+ * @{
+ */
+esp_err_t fingerprint_dev_read_response_into(fingerprint_handle_t dev, FingerprintPacket *out, uint32_t timeout_ms);
+esp_err_t fingerprint_dev_recover(fingerprint_handle_t dev);
+esp_err_t fingerprint_dev_get_stats(fingerprint_handle_t dev, fingerprint_stats_t *out);
+esp_err_t fingerprint_dev_reset_stats(fingerprint_handle_t dev);
+fingerprint_status_t fingerprint_dev_scan(fingerprint_handle_t dev);
+esp_err_t fingerprint_dev_submit(fingerprint_handle_t dev, const fingerprint_request_t *request);
+esp_err_t fingerprint_dev_identify_async(fingerprint_handle_t dev, const fingerprint_identify_config_t *config);
+fingerprint_status_t fingerprint_dev_auto_enroll(fingerprint_handle_t dev, uint16_t id, uint8_t entries, uint16_t flags);
+fingerprint_status_t fingerprint_dev_auto_identify(fingerprint_handle_t dev, uint8_t security_level, fingerprint_match_result_t *result);
+esp_err_t fingerprint_dev_enroll(fingerprint_handle_t dev, int id);
+esp_err_t fingerprint_dev_delete(fingerprint_handle_t dev, int id);
+esp_err_t fingerprint_dev_empty(fingerprint_handle_t dev);
+esp_err_t fingerprint_dev_index_sync(fingerprint_handle_t dev);
+bool fingerprint_dev_index_is_valid(fingerprint_handle_t dev);
+bool fingerprint_dev_index_is_used(fingerprint_handle_t dev, uint16_t page_id);
+uint16_t fingerprint_dev_index_count(fingerprint_handle_t dev);
+int fingerprint_dev_index_next_free(fingerprint_handle_t dev, uint16_t start);
+esp_err_t fingerprint_dev_negotiate_baudrate(fingerprint_handle_t dev, int target);
+int fingerprint_dev_get_baudrate(fingerprint_handle_t dev);
+esp_err_t fingerprint_dev_read_sys_params(fingerprint_handle_t dev);
+esp_err_t fingerprint_dev_get_sys_params(fingerprint_handle_t dev, fingerprint_sys_params_t *out);
+esp_err_t fingerprint_dev_get_info_page(fingerprint_handle_t dev, uint8_t *buf, size_t len, size_t *out_len);
+bool fingerprint_dev_command_supported(fingerprint_handle_t dev, uint8_t command);
+esp_err_t fingerprint_dev_upload_image(fingerprint_handle_t dev, fingerprint_data_callback_t callback, void *user_ctx, size_t *total_len);
+esp_err_t fingerprint_dev_export_templates(fingerprint_handle_t dev, const uint16_t *page_ids, size_t count, fingerprint_data_callback_t write, void *user_ctx, size_t *exported);
+esp_err_t fingerprint_dev_import_templates(fingerprint_handle_t dev, fingerprint_stream_read_t read, void *user_ctx, size_t *imported);
+esp_err_t fingerprint_dev_batch_delete(fingerprint_handle_t dev, const uint16_t *page_ids, size_t count, size_t *commands);
+esp_err_t fingerprint_dev_batch_delete_async(fingerprint_handle_t dev, const uint16_t *page_ids, size_t count, fingerprint_batch_delete_callback_t callback, void *user_ctx);
+esp_err_t fingerprint_dev_batch_store(fingerprint_handle_t dev, const fingerprint_template_t *templates, size_t count, size_t *stored);
+esp_err_t fingerprint_dev_compact(fingerprint_handle_t dev, uint16_t start_page, uint16_t page_count, fingerprint_page_moved_t moved, void *user_ctx, size_t *moved_count);
+/** @} */
+
+/**
+ * @brief Starts raising `EVENT_FINGER_DETECTED` whenever a finger is placed on the sensor.
+ *
+ * With `touch_pin` wired, a dedicated task sleeps on a level interrupt of the touch output,
+ * so neither the CPU nor the UART does any work between touches and the touch also wakes
+ * the chip from light sleep. The event is raised once per touch, as soon as the line goes
+ * active. If `power_pin` is configured as well, the module's main supply is switched off
+ * after the finger leaves and back on when a finger arrives; any command sent meanwhile
+ * powers the module up first. TX and RX are held low while the module is off (§1.2), except
+ * on a shared bus. The touch circuit must stay on its own (always-on) supply.
+ *
+ * Without a touch line the module is polled with PS_GetImage instead. The poll interval
+ * backs off while the sensor stays empty and returns to its minimum as soon as a finger
+ * is seen, so the image of the detected finger is already in the module's image buffer.
+ *
+ * @code
+ * fingerprint_config_t config = FINGERPRINT_DEFAULT_CONFIG();
+ * config.touch_pin = 15;
+ * config.power_pin = 14;
+ * config.event_handler = locker_events;   // Starts an identify on EVENT_FINGER_DETECTED
+ * ESP_ERROR_CHECK(fingerprint_new(&config, &reader));
+ * ESP_ERROR_CHECK(fingerprint_dev_start_detection(reader));
+ * @endcode
+ *
+ * @param[in] dev Instance to watch.
+ * @return
+ * - ESP_OK on success
+ * - ESP_ERR_INVALID_STATE if `dev` is NULL or detection is already running
+ * - ESP_ERR_NO_MEM if the detection task could not be created
+ */
+esp_err_t fingerprint_dev_start_detection(fingerprint_handle_t dev);
+
+/**
+ * @brief Stops finger detection and leaves the module powered.
+ *
+ * Must not be called from the event handler of `dev`.
+ *
+ * @param[in] dev Instance to stop watching.
+ * @return ESP_OK on success (also if detection was not running), ESP_ERR_INVALID_STATE if `dev` is NULL.
+ */
+esp_err_t fingerprint_dev_stop_detection(fingerprint_handle_t dev);
+
+/**
+ * @brief `fingerprint_dev_start_detection()` on the default instance.
+ */
+esp_err_t fingerprint_start_detection(void);
+
+/**
+ * @brief `fingerprint_dev_stop_detection()` on the default instance.
+ */
+esp_err_t fingerprint_stop_detection(void);
+
+/**
+ * @brief Power/latency trade-off of one instance.
+ */
+typedef enum {
+    FINGERPRINT_PROFILE_PERFORMANCE,    /**< 115200 bps, fast detection polls, module kept powered, notepad written back after 1 s. */
+    FINGERPRINT_PROFILE_BALANCED,       /**< The configured rate and the default settings; active after creation. */
+    FINGERPRINT_PROFILE_LOW_POWER,      /**< 57600 bps, low task priorities, slow polls, module powered down between touches, notepad batched for 60 s. */
+} fingerprint_profile_t;
+
+/**
+ * @brief Switches an instance to a power/latency profile without re-creating it.
+ *
+ * Applies at once to the worker and detection task priorities, the PS_GetImage poll
+ * interval of detection without a touch line, whether a switched module is powered down
+ * between touches (`power_pin`) and the notepad write-back delay, then negotiates the link
+ * rate of the profile with `fingerprint_dev_negotiate_baudrate()`. A shared UART keeps its
+ * rate. The link is held for the whole switch, so commands queued meanwhile wait.
+ *
+ * Battery designs get the most out of `FINGERPRINT_PROFILE_LOW_POWER` with `touch_pin` and
+ * `power_pin` wired: the CPU sleeps on the touch interrupt and the module is off between
+ * touches.
+ *
+ * Must not be called from the event handler of `dev` or concurrently with
+ * `fingerprint_dev_stop_detection()`.
+ *
+ * @param[in] dev Instance.
+ * @param[in] profile Profile to apply.
+ * @return
+ * - ESP_OK on success
+ * - ESP_ERR_INVALID_ARG if `profile` is not a profile
+ * - ESP_ERR_INVALID_STATE if `dev` is NULL
+ * - otherwise the error of the rate change; everything else is applied and the link keeps running at `fingerprint_dev_get_baudrate()`
+ */
+esp_err_t fingerprint_dev_set_profile(fingerprint_handle_t dev, fingerprint_profile_t profile);
+
+/**
+ * @brief Profile last set on an instance (`FINGERPRINT_PROFILE_BALANCED` if `dev` is NULL).
+ */
+fingerprint_profile_t fingerprint_dev_get_profile(fingerprint_handle_t dev);
+
+/**
+ * @brief Variants of the functions above on the default instance.
+ * @{
+ */
+esp_err_t fingerprint_set_profile(fingerprint_profile_t profile);
+fingerprint_profile_t fingerprint_get_profile(void);
+/** @} */
+
+/**
+ * @brief Registers the event handler of one instance.
+ *
+ * Events raised by `dev` go to this handler. The default instance falls back to the
+ * handler set with `register_fingerprint_event_handler()` while it has none of its own.
+ *
+ * @param[in] dev Instance whose events are handled.
+ * @param[in] handler Handler to call, or NULL to remove it.
+ */
+void fingerprint_dev_register_event_handler(fingerprint_handle_t dev, fingerprint_event_handler_t handler);
+
+/**
+ * @brief Triggers a fingerprint event on one instance.
+ *
+ * Subscribers receive it with status `FINGERPRINT_OK` and no page.
+ *
+ * @param[in] dev Instance raising the event.
+ * @param[in] event The fingerprint event to trigger.
+ */
+void fingerprint_dev_trigger_event(fingerprint_handle_t dev, fingerprint_event_t event);
+
+/**
+ * @brief Maximum number of subscribers per instance.
+ */
+#define FINGERPRINT_MAX_SUBSCRIBERS 8
+
+/**
+ * @brief `page_id` of an event that does not refer to a template page.
+ */
+#define FINGERPRINT_NO_PAGE 0xFFFF
+
+/**
+ * @brief Subscription filter bit of one event.
+ */
+#define FINGERPRINT_EVENT_BIT(event) (1u << (event))
+
+/**
+ * @brief Subscription filter matching every event.
+ */
+#define FINGERPRINT_EVENT_ALL 0xFFFFFFFFu
+
+/**
+ * @brief esp_timer timestamps of the stages of the identify or enroll flow an event belongs to.
+ *
+ * Stages not reached (yet) are 0. Events outside a flow carry the times of the last one.
+ */
+typedef struct {
+    int64_t started_us;     /**< First command of the flow sent. */
+    int64_t captured_us;    /**< Image captured. */
+    int64_t extracted_us;   /**< Features extracted. */
+    int64_t finished_us;    /**< Search or store answered, or the flow failed. */
+} fingerprint_stage_times_t;
+
+/**
+ * @struct fingerprint_event_data_t
+ * @brief An event together with what is known about it when it is raised.
+ */
+typedef struct {
+    fingerprint_handle_t dev;           /**< Instance that raised the event. */
+    fingerprint_event_t event;          /**< The event. */
+    fingerprint_status_t status;        /**< Module status of the stage that produced it (`FINGERPRINT_OK` unless it failed). */
+    uint16_t page_id;                   /**< Matched or enrolled page, or `FINGERPRINT_NO_PAGE`. */
+    uint16_t score;                     /**< Match score (`EVENT_MATCH_SUCCESS` only). */
+    int64_t timestamp_us;               /**< esp_timer time the event was raised. */
+    fingerprint_stage_times_t stages;   /**< Stage times of the flow. */
+} fingerprint_event_data_t;
+
+/**
+ * @brief Subscriber callback.
+ *
+ * Runs where the legacy handler runs: on the task that raised the event, or on the
+ * dispatcher task with `CONFIG_FINGERPRINT_EVENT_DISPATCHER`.
+ *
+ * @param data The event and its payload; only valid during the call.
+ * @param user_ctx The `user_ctx` given to `fingerprint_dev_subscribe()`.
+ */
+typedef void (*fingerprint_subscriber_t)(const fingerprint_event_data_t *data, void *user_ctx);
+
+/**
+ * @brief Subscribes to the events of one instance.
+ *
+ * Every subscriber whose filter has the event's bit set is called, in subscription order,
+ * before the handler registered with `fingerprint_dev_register_event_handler()`.
+ *
+ * @code
+ * fingerprint_dev_subscribe(dev, FINGERPRINT_EVENT_BIT(EVENT_MATCH_SUCCESS), open_door, &relay);
+ * fingerprint_dev_subscribe(dev, FINGERPRINT_EVENT_ALL, audit_log, NULL);
+ * @endcode
+ *
+ * @param[in] dev Instance whose events are delivered.
+ * @param[in] event_mask `FINGERPRINT_EVENT_BIT()` of each wanted event, or `FINGERPRINT_EVENT_ALL`.
+ * @param[in] callback Called for each matching event.
+ * @param[in] user_ctx Passed to `callback`.
+ * @return
+ * - ESP_OK on success
+ * - ESP_ERR_INVALID_ARG if `callback` is NULL or `event_mask` is 0
+ * - ESP_ERR_INVALID_STATE if `dev` is NULL
+ * - ESP_ERR_NO_MEM if `FINGERPRINT_MAX_SUBSCRIBERS` subscriptions exist
+ */
+esp_err_t fingerprint_dev_subscribe(fingerprint_handle_t dev, uint32_t event_mask, fingerprint_subscriber_t callback, void *user_ctx);
+
+/**
+ * @brief Removes a subscription made with the same `callback` and `user_ctx`.
+ *
+ * An event already being delivered may still reach the callback once.
+ *
+ * @param[in] dev Instance.
+ * @param[in] callback Callback given to `fingerprint_dev_subscribe()`.
+ * @param[in] user_ctx Context given to `fingerprint_dev_subscribe()`.
+ * @return
+ * - ESP_OK on success
+ * - ESP_ERR_INVALID_STATE if `dev` is NULL
+ * - ESP_ERR_NOT_FOUND if there is no such subscription
+ */
+esp_err_t fingerprint_dev_unsubscribe(fingerprint_handle_t dev, fingerprint_subscriber_t callback, void *user_ctx);
+
+/**
+ * @brief `fingerprint_dev_subscribe()` on the default instance.
+ */
+esp_err_t fingerprint_subscribe(uint32_t event_mask, fingerprint_subscriber_t callback, void *user_ctx);
+
+/**
+ * @brief `fingerprint_dev_unsubscribe()` on the default instance.
+ */
+esp_err_t fingerprint_unsubscribe(fingerprint_subscriber_t callback, void *user_ctx);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,212 @@
+/**
+ * @file fingerprint_emulator.h
+ * @brief Software model of the ZW111 for running the driver without a sensor
+ *
+ * The emulator parses 0xEF01 command frames and answers the commands the driver's
+ * identify, enroll and index flows use:
+ * - `PS_GetImage` / `PS_GetEnrollImage`: succeeds while a finger is "placed"
+ * - `PS_GenChar`, `PS_RegModel`: succeed after a captured image
+ * - `PS_Search`: reports the configured match page if it is stored and in range
+ * - `PS_Store`, `PS_DeletChar`, `PS_Empty`, `PS_ReadIndexTable`, `PS_ValidTempleteNum`
+ * - `PS_WriteReg` (the baud rate register switches the emulator's UART after the ACK)
+ * - `PS_ReadSysPara`: the configured capacity and address, the current rate and packet size
+ * - `PS_WriteNotepad`, `PS_ReadNotepad` (16 pages of 32 bytes, zeroed at creation)
+ * - `PS_CheckSensor`, `PS_Cancel`
+ * - with `CONFIG_FINGERPRINT_SECURE_CHANNEL` and a `secure_key`: `PS_GetKeyt`,
+ *   `PS_SecurityStoreChar` and `PS_SecuritySearch` in the framing of fingerprint_secure.h
+ *
+ * Other commands are answered with `FINGERPRINT_PACKET_ERROR`, as are frames with a bad
+ * checksum. Frames for another address are ignored.
+ *
+ * The protocol engine works on plain byte streams (`fingerprint_emulator_feed()`), so it
+ * can sit behind any transport. `fingerprint_emulator_new()` with a valid `uart_port`
+ * binds it to a UART of its own: wire that port's TX to the driver's RX pin and its RX
+ * to the driver's TX pin, the way the example shorts RX and TX.
+ *
+ * Built only with `CONFIG_FINGERPRINT_EMULATOR`.
+ *
+ * @code
+ * fingerprint_emulator_config_t emu_config = FINGERPRINT_EMULATOR_DEFAULT_CONFIG();
+ * emu_config.uart_port = UART_NUM_1;
+ * emu_config.tx_pin = 4;   // jumper to the driver's RX pin
+ * emu_config.rx_pin = 5;   // jumper to the driver's TX pin
+ * emu_config.match_page = 3;
+ * emu_config.corrupt_permille = 10;
+ * fingerprint_emulator_handle_t emu;
+ * ESP_ERROR_CHECK(fingerprint_emulator_new(&emu_config, &emu));
+ * fingerprint_emulator_store(emu, 3);
+ * fingerprint_emulator_set_finger(emu, true);
+ * @endcode
+ */
+#ifndef FINGERPRINT_EMULATOR_H
+#define FINGERPRINT_EMULATOR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "fingerprint.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Handle of one emulated sensor.
+ */
+typedef struct fingerprint_emulator_t *fingerprint_emulator_handle_t;
+
+/**
+ * @brief Configuration of an emulated sensor.
+ *
+ * Fault rates are in events per 1000 replies and are drawn from a generator seeded
+ * with `seed`, so a failing run can be replayed.
+ */
+typedef struct {
+    int uart_port;              /**< UART the emulator owns, or -1 to drive it with `fingerprint_emulator_feed()` only. */
+    int tx_pin;                 /**< GPIO for the emulator's TX (to the driver's RX). */
+    int rx_pin;                 /**< GPIO for the emulator's RX (from the driver's TX). */
+    int baud_rate;              /**< Initial link rate. */
+    uint32_t address;           /**< Module address the emulator answers to. */
+    uint16_t capacity;          /**< Template pages in the emulated database. */
+    int match_page;             /**< Page the placed finger matches, or -1 for an unknown finger. */
+    uint16_t match_score;       /**< Score reported on a match. */
+    uint32_t image_latency_ms;  /**< Delay before answering image capture. */
+    uint32_t extract_latency_ms;/**< Delay before answering `PS_GenChar` / `PS_RegModel`. */
+    uint32_t search_latency_ms; /**< Delay before answering `PS_Search`. */
+    uint32_t flash_latency_ms;  /**< Delay before answering store, delete and register writes. */
+    uint16_t drop_permille;     /**< Replies that are never sent. */
+    uint16_t corrupt_permille;  /**< Replies with one bit flipped. */
+    uint16_t noise_permille;    /**< Replies preceded by up to 8 random bytes. */
+    uint32_t seed;              /**< Seed of the fault generator (0 is replaced by 1). */
+    const uint8_t *secure_key;  /**< Device key of the secure commands (`FINGERPRINT_SECURE_KEY_LEN` bytes, copied), or NULL to refuse them. */
+} fingerprint_emulator_config_t;
+
+/**
+ * @brief Default emulator: no UART, factory rate and address, no latency, no faults.
+ */
+#define FINGERPRINT_EMULATOR_DEFAULT_CONFIG() {     \
+    .uart_port = -1,                                \
+    .tx_pin = -1,                                   \
+    .rx_pin = -1,                                   \
+    .baud_rate = DEFAULT_BAUD_RATE,                 \
+    .address = DEFAULT_FINGERPRINT_ADDRESS,         \
+    .capacity = FINGERPRINT_INDEX_CAPACITY,         \
+    .match_page = -1,                               \
+    .match_score = 100,                             \
+    .image_latency_ms = 0,                          \
+    .extract_latency_ms = 0,                        \
+    .search_latency_ms = 0,                         \
+    .flash_latency_ms = 0,                          \
+    .drop_permille = 0,                             \
+    .corrupt_permille = 0,                          \
+    .noise_permille = 0,                            \
+    .seed = 1,                                      \
+    .secure_key = NULL,                             \
+}
+
+/**
+ * @brief What the emulator has seen and done since it was created.
+ */
+typedef struct {
+    uint32_t frames;            /**< Command frames with a valid checksum. */
+    uint32_t bad_frames;        /**< Frames rejected for their checksum. */
+    uint32_t replies;           /**< Replies written (including corrupted ones). */
+    uint32_t dropped;           /**< Replies withheld by fault injection. */
+    uint32_t corrupted;         /**< Replies corrupted by fault injection. */
+    uint32_t noise;             /**< Replies preceded by injected noise. */
+    uint32_t notepad_writes;    /**< `PS_WriteNotepad` pages written. */
+} fingerprint_emulator_counters_t;
+
+/**
+ * @brief Writes emulator output to the transport.
+ *
+ * @param data Bytes to send.
+ * @param len Number of bytes.
+ * @param user_ctx The `user_ctx` given to `fingerprint_emulator_feed()`.
+ */
+typedef void (*fingerprint_emulator_write_t)(const uint8_t *data, size_t len, void *user_ctx);
+
+/**
+ * @brief Creates an emulated sensor.
+ *
+ * With a valid `config->uart_port` the UART driver is installed on that port and a task
+ * answers the frames arriving on it.
+ *
+ * @param[in] config Emulator configuration.
+ * @param[out] ret_handle Receives the handle on success.
+ * @return
+ * - ESP_OK on success
+ * - ESP_ERR_INVALID_ARG if `config` or `ret_handle` is NULL, or `capacity` is 0 or above `FINGERPRINT_INDEX_CAPACITY`
+ * - ESP_ERR_NO_MEM if the emulator or its task could not be allocated
+ * - otherwise the error from installing or configuring the UART driver
+ */
+esp_err_t fingerprint_emulator_new(const fingerprint_emulator_config_t *config, fingerprint_emulator_handle_t *ret_handle);
+
+/**
+ * @brief Stops the emulator's task, releases its UART and frees it.
+ *
+ * @param[in] emu Emulator to delete.
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG if `emu` is NULL.
+ */
+esp_err_t fingerprint_emulator_del(fingerprint_emulator_handle_t emu);
+
+/**
+ * @brief Feeds received bytes to the protocol engine.
+ *
+ * Every complete frame is answered through `write`, after the configured latency of its
+ * command. Frames may be split across calls at any byte. Must not be mixed with an emulator
+ * that owns a UART.
+ *
+ * @param[in] emu Emulator.
+ * @param[in] data Received bytes.
+ * @param[in] len Number of bytes.
+ * @param[in] write Receives the replies.
+ * @param[in] user_ctx Passed to `write`.
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG if `emu`, `data` or `write` is NULL.
+ */
+esp_err_t fingerprint_emulator_feed(fingerprint_emulator_handle_t emu, const uint8_t *data, size_t len,
+                                    fingerprint_emulator_write_t write, void *user_ctx);
+
+/**
+ * @brief Places or lifts the emulated finger.
+ *
+ * @param[in] emu Emulator.
+ * @param[in] present true while image capture should succeed.
+ */
+void fingerprint_emulator_set_finger(fingerprint_emulator_handle_t emu, bool present);
+
+/**
+ * @brief Marks a template page as stored, as if it had been enrolled.
+ *
+ * @param[in] emu Emulator.
+ * @param[in] page_id Page to mark.
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG if `page_id` is outside the database.
+ */
+esp_err_t fingerprint_emulator_store(fingerprint_emulator_handle_t emu, uint16_t page_id);
+
+/**
+ * @brief Changes the fault rates at run time.
+ *
+ * @param[in] emu Emulator.
+ * @param[in] drop_permille Replies that are never sent.
+ * @param[in] corrupt_permille Replies with one bit flipped.
+ * @param[in] noise_permille Replies preceded by random bytes.
+ */
+void fingerprint_emulator_set_faults(fingerprint_emulator_handle_t emu, uint16_t drop_permille,
+                                     uint16_t corrupt_permille, uint16_t noise_permille);
+
+/**
+ * @brief Copies the emulator's counters.
+ *
+ * @param[in] emu Emulator.
+ * @param[out] out Receives the counters.
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG if `emu` or `out` is NULL.
+ */
+esp_err_t fingerprint_emulator_get_counters(fingerprint_emulator_handle_t emu, fingerprint_emulator_counters_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FINGERPRINT_EMULATOR_H
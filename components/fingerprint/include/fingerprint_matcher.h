@@ -0,0 +1,266 @@
+/**
+ * @file fingerprint_matcher.h
+ * @brief Host-side 1:N template matching for databases larger than the module's flash
+ *
+ * A host database keeps templates in one contiguous block (PSRAM when available), so a
+ * search streams through memory linearly. The scan is split across one task per core.
+ *
+ * The ZW111 template format is vendor-specific, so the comparison itself is supplied by
+ * the application (`fingerprint_host_db_config_t::score`), e.g. a licensed minutiae
+ * matcher. Templates are the raw `PS_UpChar` data, as exported by
+ * `fingerprint_export_templates()` after its record header.
+ *
+ * `fingerprint_dev_identify_host()` keeps the module in front: its own `PS_Search` covers
+ * the users enrolled on the sensor (the most frequent ones), and only a miss pulls the probe
+ * out of CharBuffer1 and searches the host database.
+ *
+ * Backed by a `fingerprint_store` partition instead, the database reads templates straight
+ * from the mapped flash and adds or removes them in the store; nothing is loaded at boot.
+ *
+ * With a hot tier (`cache_pages` > 0) a range of module pages holds copies of recently
+ * matched host templates. A host hit queues a promotion on the worker task: the least
+ * recently used tier page is deleted and the user's template downloaded and stored there,
+ * so the next identify of that user is answered by the module alone.
+ *
+ * @code
+ * fingerprint_host_db_config_t db_config = {
+ *     .template_len = 1536,
+ *     .capacity = 20000,
+ *     .score = vendor_match,
+ *     .threshold = 50,
+ *     .use_psram = true,
+ * };
+ * fingerprint_host_db_handle_t db;
+ * ESP_ERROR_CHECK(fingerprint_host_db_new(&db_config, &db));
+ * fingerprint_host_db_add(db, employee_id, template_data, 1536);
+ *
+ * fingerprint_host_match_t match;
+ * if (fingerprint_identify_host(db, &match) == ESP_OK) {
+ *     open_door(match.on_module ? match.page_id : match.user_id);
+ * }
+ * @endcode
+ */
+#ifndef FINGERPRINT_MATCHER_H
+#define FINGERPRINT_MATCHER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "fingerprint.h"
+#include "fingerprint_store.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Handle of a host template database.
+ */
+typedef struct fingerprint_host_db_t *fingerprint_host_db_handle_t;
+
+/**
+ * @brief Compares a probe with one stored template.
+ *
+ * Called concurrently from several cores; must not modify shared state without locking.
+ *
+ * @param probe Probe template (`template_len` bytes).
+ * @param candidate Stored template (`template_len` bytes).
+ * @param len `template_len` of the database.
+ * @param user_ctx The `user_ctx` of the database configuration.
+ * @return Similarity score; higher is more similar.
+ */
+typedef uint16_t (*fingerprint_match_score_t)(const uint8_t *probe, const uint8_t *candidate, size_t len, void *user_ctx);
+
+/**
+ * @brief Configuration of a host template database.
+ */
+typedef struct {
+    size_t template_len;                /**< Bytes per template. */
+    size_t capacity;                    /**< Templates the database can hold. */
+    fingerprint_match_score_t score;    /**< Template comparison. */
+    void *user_ctx;                     /**< Passed to `score`. */
+    uint16_t threshold;                 /**< Lowest score accepted as a match. */
+    bool use_psram;                     /**< Place the templates in PSRAM if there is any. */
+    uint16_t cache_start_page;          /**< First module page of the hot tier. */
+    uint16_t cache_pages;               /**< Module pages in the hot tier; 0 disables promotion. Keep them free of other enrollments. */
+    fingerprint_store_handle_t store;   /**< Match the templates of this flash store in place instead of a RAM block (`capacity` and `use_psram` are then unused). */
+} fingerprint_host_db_config_t;
+
+/**
+ * @brief `user_id` of a module match in a page outside the hot tier, which no host user owns.
+ */
+#define FINGERPRINT_HOST_NO_USER UINT32_MAX
+
+/**
+ * @brief Result of a host database search.
+ */
+typedef struct {
+    uint32_t user_id;   /**< ID given to `fingerprint_host_db_add()`. */
+    uint16_t score;     /**< Score of the best candidate. */
+} fingerprint_host_db_match_t;
+
+/**
+ * @brief Result of `fingerprint_dev_identify_host()`.
+ */
+typedef struct {
+    fingerprint_status_t status;    /**< `FINGERPRINT_OK` on a match, otherwise the failing stage's status. */
+    bool on_module;                 /**< Matched by the module's `PS_Search` rather than the host database. */
+    uint16_t page_id;               /**< Module page when `on_module`, otherwise `FINGERPRINT_NO_PAGE`. */
+    uint32_t user_id;               /**< Host database ID (host match, or module match in a hot tier page), otherwise `FINGERPRINT_HOST_NO_USER`. */
+    uint16_t score;                 /**< Match score. */
+} fingerprint_host_match_t;
+
+/**
+ * @brief Creates a host template database and its scan tasks.
+ *
+ * @param[in] config Database configuration.
+ * @param[out] ret_handle Receives the handle on success.
+ * @return
+ * - ESP_OK on success
+ * - ESP_ERR_INVALID_ARG if an argument is NULL, `template_len` is 0 or above `FINGERPRINT_MAX_TEMPLATE_LEN`,
+ *   or `capacity` is 0 without a store
+ * - ESP_ERR_INVALID_SIZE if the store holds templates of another length
+ * - ESP_ERR_NO_MEM if the template block or the scan tasks could not be allocated
+ */
+esp_err_t fingerprint_host_db_new(const fingerprint_host_db_config_t *config, fingerprint_host_db_handle_t *ret_handle);
+
+/**
+ * @brief Stops the scan tasks and frees the database.
+ *
+ * @param[in] db Database to delete; no search may be in progress.
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG if `db` is NULL.
+ */
+esp_err_t fingerprint_host_db_del(fingerprint_host_db_handle_t db);
+
+/**
+ * @brief Adds a template, or replaces the one stored under `user_id`.
+ *
+ * @param[in] db Database.
+ * @param[in] user_id Caller's ID for the template, anything but `FINGERPRINT_HOST_NO_USER`.
+ * @param[in] data Template data.
+ * @param[in] len Must equal `template_len`.
+ * @return
+ * - ESP_OK on success
+ * - ESP_ERR_INVALID_ARG if `db` or `data` is NULL, or `user_id` is `FINGERPRINT_HOST_NO_USER`
+ * - ESP_ERR_INVALID_SIZE if `len` differs from `template_len`
+ * - ESP_ERR_NO_MEM if the database is full
+ * - otherwise the flash error of a store-backed database
+ */
+esp_err_t fingerprint_host_db_add(fingerprint_host_db_handle_t db, uint32_t user_id, const uint8_t *data, size_t len);
+
+/**
+ * @brief Removes the template stored under `user_id`.
+ *
+ * The last template moves into the gap, so the block stays dense; a store tombstones the slot.
+ *
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG if `db` is NULL, ESP_ERR_NOT_FOUND if there is no such ID.
+ */
+esp_err_t fingerprint_host_db_remove(fingerprint_host_db_handle_t db, uint32_t user_id);
+
+/**
+ * @brief Number of templates stored.
+ */
+size_t fingerprint_host_db_count(fingerprint_host_db_handle_t db);
+
+/**
+ * @brief Finds the best-scoring template for a probe.
+ *
+ * @param[in] db Database.
+ * @param[in] probe Probe template.
+ * @param[in] len Must equal `template_len`.
+ * @param[out] match Receives the best candidate if it reaches the threshold.
+ * @return
+ * - ESP_OK on a match
+ * - ESP_ERR_NOT_FOUND if no template reaches the threshold
+ * - ESP_ERR_INVALID_ARG if an argument is NULL
+ * - ESP_ERR_INVALID_SIZE if `len` differs from `template_len`
+ */
+esp_err_t fingerprint_host_db_search(fingerprint_host_db_handle_t db, const uint8_t *probe, size_t len, fingerprint_host_db_match_t *match);
+
+/**
+ * @brief Template length configured for the database.
+ */
+size_t fingerprint_host_db_template_len(fingerprint_host_db_handle_t db);
+
+/**
+ * @brief Host user whose copy sits in a hot tier page, counted as a use of that page.
+ *
+ * @param[in] db Database.
+ * @param[in] page_id Module page reported by `PS_Search`.
+ * @param[out] user_id Receives the user.
+ * @return
+ * - ESP_OK if the page holds a current copy
+ * - ESP_ERR_INVALID_ARG if `page_id` is not a hot tier page (or an argument is NULL)
+ * - ESP_ERR_NOT_FOUND if the page is free, being rewritten, or holds a copy of a removed
+ *   or replaced template
+ */
+esp_err_t fingerprint_host_db_resident_user(fingerprint_host_db_handle_t db, uint16_t page_id, uint32_t *user_id);
+
+/**
+ * @brief Reserves a hot tier page for `user_id` and copies out its template.
+ *
+ * Takes a free page, or else the least recently used one, whose previous copy is no
+ * longer reported from then on. Finish with `fingerprint_host_db_promote_end()`.
+ *
+ * @param[in] db Database.
+ * @param[in] user_id User to promote.
+ * @param[out] data Receives the template (`template_len` bytes).
+ * @param[out] page_id Receives the reserved page.
+ * @return
+ * - ESP_OK on success
+ * - ESP_ERR_INVALID_ARG if an argument is NULL
+ * - ESP_ERR_NOT_SUPPORTED if the database has no hot tier
+ * - ESP_ERR_INVALID_STATE if the user is already resident or being promoted
+ * - ESP_ERR_NOT_FOUND if there is no such user, or every page is being rewritten
+ */
+esp_err_t fingerprint_host_db_promote_begin(fingerprint_host_db_handle_t db, uint32_t user_id, uint8_t *data, uint16_t *page_id);
+
+/**
+ * @brief Completes a promotion started with `fingerprint_host_db_promote_begin()`.
+ *
+ * @param[in] db Database.
+ * @param[in] page_id Page returned by `fingerprint_host_db_promote_begin()`.
+ * @param[in] stored Whether the template is now stored in the page.
+ */
+void fingerprint_host_db_promote_end(fingerprint_host_db_handle_t db, uint16_t page_id, bool stored);
+
+/**
+ * @brief Identifies a finger on the module first and in the host database on a miss.
+ *
+ * Runs `PS_GetImage`, `PS_GenChar1` and `PS_Search` over the module's whole database. If the
+ * module reports `FINGERPRINT_NOT_FOUND`, CharBuffer1 is uploaded and searched in `db`. The link
+ * is held from the first command to the upload. Events are raised as for `fingerprint_identify_async()`;
+ * a host match raises `EVENT_MATCH_SUCCESS` without a page.
+ *
+ * A module match in a hot tier page reports the host user (`on_module` and `user_id` both
+ * set); a tier page holding an outdated copy counts as a module miss. A module match in any
+ * other page is enrolled on the module alone and reports `user_id` `FINGERPRINT_HOST_NO_USER`.
+ * A host match queues the user's promotion into the tier, which runs after this call has
+ * returned. The probe is held in a buffer of the instance's template pool, so concurrent
+ * calls beyond the pool size wait for one another.
+ *
+ * @param[in] dev Instance.
+ * @param[in] db Host database searched on a module miss.
+ * @param[out] result Receives the outcome.
+ * @return
+ * - ESP_OK on a match (module or host)
+ * - ESP_ERR_NOT_FOUND if neither knows the finger
+ * - ESP_ERR_INVALID_ARG if `db` or `result` is NULL
+ * - ESP_ERR_INVALID_STATE if `dev` is NULL
+ * - ESP_ERR_INVALID_SIZE if the uploaded template does not have the database's `template_len`
+ * - ESP_FAIL if a stage failed (see `result->status`)
+ * - otherwise the transport error of the failing command
+ */
+esp_err_t fingerprint_dev_identify_host(fingerprint_handle_t dev, fingerprint_host_db_handle_t db, fingerprint_host_match_t *result);
+
+/**
+ * @brief `fingerprint_dev_identify_host()` on the default instance.
+ */
+esp_err_t fingerprint_identify_host(fingerprint_host_db_handle_t db, fingerprint_host_match_t *result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FINGERPRINT_MATCHER_H
@@ -0,0 +1,129 @@
+/**
+ * @file fingerprint_notepad.h
+ * @brief Counters and small records in the module's notepad, behind a write-back cache
+ *
+ * The ZW111 notepad is 16 pages of 32 bytes in the module's flash, written one whole page
+ * per `PS_WriteNotepad`. Every instance keeps a RAM copy: a page is read from the module the
+ * first time it is accessed, and updates only change the copy. Changed pages are written
+ * back by the worker task `CONFIG_FINGERPRINT_NOTEPAD_FLUSH_MS` (or the delay of the profile
+ * set with `fingerprint_set_profile()`) after the first update, before a switched module is
+ * powered down and when the instance is deleted, so a burst of updates to one page costs a
+ * single transaction and erase. Writes that do not change the copy are
+ * not counted as updates at all. Call `fingerprint_notepad_flush()` before deep sleep or a
+ * reset; updates not yet written back are lost with the RAM copy.
+ *
+ * The notepad can be addressed per byte or as `FINGERPRINT_NOTEPAD_SLOTS` 32-bit slots
+ * (slot n is bytes 4n to 4n + 3, big-endian), whose numbers the application assigns:
+ *
+ * @code
+ * #define SLOT_ACCESS_COUNT 0
+ * #define SLOT_LAST_USER 1
+ * #define SLOT_CONFIG_VERSION 2
+ *
+ * fingerprint_notepad_add_u32(SLOT_ACCESS_COUNT, 1, NULL);
+ * fingerprint_notepad_set_u32(SLOT_LAST_USER, result.page_id);
+ * @endcode
+ */
+#ifndef FINGERPRINT_NOTEPAD_H
+#define FINGERPRINT_NOTEPAD_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "fingerprint.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Notepad geometry.
+ * @{
+ */
+#define FINGERPRINT_NOTEPAD_PAGES 16
+#define FINGERPRINT_NOTEPAD_PAGE_LEN 32
+#define FINGERPRINT_NOTEPAD_LEN (FINGERPRINT_NOTEPAD_PAGES * FINGERPRINT_NOTEPAD_PAGE_LEN)
+#define FINGERPRINT_NOTEPAD_SLOTS (FINGERPRINT_NOTEPAD_LEN / 4)
+/** @} */
+
+/**
+ * @brief Reads notepad bytes, loading uncached pages from the module.
+ *
+ * @param[in] dev Instance.
+ * @param[in] offset First byte.
+ * @param[out] buf Receives `len` bytes.
+ * @param[in] len Bytes to read.
+ * @return
+ * - ESP_OK on success
+ * - ESP_ERR_INVALID_ARG if `buf` is NULL or the range exceeds `FINGERPRINT_NOTEPAD_LEN`
+ * - ESP_ERR_INVALID_STATE if `dev` is NULL
+ * - ESP_FAIL if the module refused `PS_ReadNotepad`
+ * - otherwise the transport error
+ */
+esp_err_t fingerprint_dev_notepad_read(fingerprint_handle_t dev, size_t offset, void *buf, size_t len);
+
+/**
+ * @brief Updates notepad bytes in the cache; the module is written on the next flush.
+ *
+ * @param[in] dev Instance.
+ * @param[in] offset First byte.
+ * @param[in] data `len` bytes.
+ * @param[in] len Bytes to write.
+ * @return As `fingerprint_dev_notepad_read()`; a page has to be loaded before it is changed.
+ */
+esp_err_t fingerprint_dev_notepad_write(fingerprint_handle_t dev, size_t offset, const void *data, size_t len);
+
+/**
+ * @brief Reads slot `slot`.
+ *
+ * @return As `fingerprint_dev_notepad_read()`; ESP_ERR_INVALID_ARG also covers a slot from `FINGERPRINT_NOTEPAD_SLOTS` on.
+ */
+esp_err_t fingerprint_dev_notepad_get_u32(fingerprint_handle_t dev, uint8_t slot, uint32_t *value);
+
+/**
+ * @brief Sets slot `slot` in the cache.
+ *
+ * @return As `fingerprint_dev_notepad_write()`; ESP_ERR_INVALID_ARG also covers a slot from `FINGERPRINT_NOTEPAD_SLOTS` on.
+ */
+esp_err_t fingerprint_dev_notepad_set_u32(fingerprint_handle_t dev, uint8_t slot, uint32_t value);
+
+/**
+ * @brief Adds `delta` to slot `slot` in the cache, wrapping around; atomic against other updates.
+ *
+ * @param[in] dev Instance.
+ * @param[in] slot Slot.
+ * @param[in] delta Amount to add (negative to subtract).
+ * @param[out] value Receives the new value, may be NULL.
+ * @return As `fingerprint_dev_notepad_set_u32()`.
+ */
+esp_err_t fingerprint_dev_notepad_add_u32(fingerprint_handle_t dev, uint8_t slot, int32_t delta, uint32_t *value);
+
+/**
+ * @brief Writes every changed page back to the module.
+ *
+ * @param[in] dev Instance.
+ * @return
+ * - ESP_OK once the module holds every update made before the call
+ * - ESP_ERR_INVALID_STATE if `dev` is NULL
+ * - ESP_FAIL if the module refused a `PS_WriteNotepad` (the page stays changed and is retried)
+ * - otherwise the transport error
+ */
+esp_err_t fingerprint_dev_notepad_flush(fingerprint_handle_t dev);
+
+/**
+ * @brief Variants of the functions above on the default instance.
+ * @{
+ */
+esp_err_t fingerprint_notepad_read(size_t offset, void *buf, size_t len);
+esp_err_t fingerprint_notepad_write(size_t offset, const void *data, size_t len);
+esp_err_t fingerprint_notepad_get_u32(uint8_t slot, uint32_t *value);
+esp_err_t fingerprint_notepad_set_u32(uint8_t slot, uint32_t value);
+esp_err_t fingerprint_notepad_add_u32(uint8_t slot, int32_t delta, uint32_t *value);
+esp_err_t fingerprint_notepad_flush(void);
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FINGERPRINT_NOTEPAD_H
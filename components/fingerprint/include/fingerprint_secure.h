@@ -0,0 +1,139 @@
+/**
+ * @file fingerprint_secure.h
+ * @brief Encrypted and authenticated search and store over the module's security commands
+ *
+ * `PS_SecuritySearch` and `PS_SecurityStoreChar` run over a session keyed from a device key
+ * the host shares with the module, so a device spliced into the UART can neither fake a
+ * "match" reply nor replay or alter a command. Before the first secure command the driver
+ * runs the `PS_GetKeyt` handshake; the session keys stay cached in the instance until the
+ * module reports `FINGERPRINT_ENCRYPTION_MISMATCH`, a reply fails authentication or
+ * `fingerprint_dev_secure_end()` is called, so only the first secure transaction after boot
+ * pays for the handshake.
+ *
+ * The ZW111 documentation lists these commands by code only. The framing below is this
+ * driver's own: the module firmware must implement it, as the emulator does.
+ *
+ * - `PS_GetKeyt` (0xE0) sends a 16-byte host nonce from `esp_fill_random()`. The reply is
+ *   the confirmation code, a 16-byte module nonce and a tag
+ * - session keys: HMAC-SHA256(device key, "ZW111 session" || host nonce || module nonce);
+ *   the first 16 bytes are the AES-128 encryption key, the last 16 the AES-CMAC key. The
+ *   handshake tag is CMAC(host nonce || reply packet ID, length, code and module nonce), so
+ *   the module proves it holds the device key and a recorded session cannot be replayed
+ * - secure command: code, big-endian 32-bit sequence number, AES-CTR encrypted parameters,
+ *   then CMAC(packet ID || length || code || sequence number || encrypted parameters). The
+ *   first command of a session is number 1; the module executes only numbers above the last
+ *   one and answers a repeat of the last one with the reply it already sent, so a resend is
+ *   safe and a replay changes nothing
+ * - secure reply: code, AES-CTR encrypted parameters (`PS_SecuritySearch`: page, score; on
+ *   success only), then CMAC(command tag || packet ID || length || code || encrypted
+ *   parameters), which ties the reply to exactly one command
+ * - the CTR counter block is a direction byte (1 command, 2 reply), three zero bytes, the
+ *   sequence number and a 64-bit block counter from 0
+ * - a module without a session, or one rejecting a command's tag or number, answers with a
+ *   bare `FINGERPRINT_ENCRYPTION_MISMATCH`; the driver then runs one new handshake
+ *
+ * Frames are sealed in place in the TX pool buffer and replies are checked and decrypted in
+ * place in the RX frame. HMAC-SHA256, AES and CMAC go through mbedtls, which uses the chip's
+ * SHA and AES peripherals with the default `CONFIG_MBEDTLS_HARDWARE_SHA` /
+ * `CONFIG_MBEDTLS_HARDWARE_AES`. Commands outside this header, including the captures
+ * ahead of a search, stay in the clear.
+ *
+ * Built with `CONFIG_FINGERPRINT_SECURE_CHANNEL`.
+ *
+ * @code
+ * ESP_ERROR_CHECK(fingerprint_secure_set_key(device_key));  // From eFuse or encrypted NVS
+ * fingerprint_match_result_t result;
+ * if (fingerprint_secure_identify(&result) == ESP_OK) {
+ *     open_door(result.page_id);
+ * }
+ * @endcode
+ */
+#ifndef FINGERPRINT_SECURE_H
+#define FINGERPRINT_SECURE_H
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "fingerprint.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Length of the provisioned device key.
+ */
+#define FINGERPRINT_SECURE_KEY_LEN 16
+
+/**
+ * @brief Sets the device key shared with the module and drops any running session.
+ *
+ * @param[in] dev Instance.
+ * @param[in] key `FINGERPRINT_SECURE_KEY_LEN` bytes; copied.
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG if `key` is NULL, ESP_ERR_INVALID_STATE if `dev` is NULL.
+ */
+esp_err_t fingerprint_dev_secure_set_key(fingerprint_handle_t dev, const uint8_t *key);
+
+/**
+ * @brief Drops the session; the next secure command runs the handshake again.
+ *
+ * @param[in] dev Instance.
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE if `dev` is NULL.
+ */
+esp_err_t fingerprint_dev_secure_end(fingerprint_handle_t dev);
+
+/**
+ * @brief Searches CharBuffer1 with `PS_SecuritySearch` and authenticates the result.
+ *
+ * @param[in] dev Instance.
+ * @param[in] start_page First page to search.
+ * @param[in] page_count Pages to search.
+ * @param[out] result Receives the outcome.
+ * @return
+ * - ESP_OK on an authenticated match
+ * - ESP_ERR_NOT_FOUND if the module reports no match
+ * - ESP_ERR_INVALID_ARG if `result` is NULL
+ * - ESP_ERR_INVALID_STATE if `dev` is NULL or no key is set
+ * - ESP_ERR_INVALID_RESPONSE if the handshake or the reply failed authentication (the session is dropped)
+ * - ESP_ERR_NO_MEM if no TX buffer was free
+ * - ESP_FAIL if the module refused the handshake, the session or the search (see `result->status`)
+ * - otherwise the transport error
+ */
+esp_err_t fingerprint_dev_secure_search(fingerprint_handle_t dev, uint16_t start_page, uint16_t page_count, fingerprint_match_result_t *result);
+
+/**
+ * @brief Captures a finger and searches the whole database with `PS_SecuritySearch`.
+ *
+ * Captures like `fingerprint_identify_async()` with the Kconfig attempt budget and raises
+ * the same events; the link is held throughout.
+ *
+ * @param[in] dev Instance.
+ * @param[out] result Receives the outcome.
+ * @return As `fingerprint_dev_secure_search()`; ESP_FAIL also covers a failed capture.
+ */
+esp_err_t fingerprint_dev_secure_identify(fingerprint_handle_t dev, fingerprint_match_result_t *result);
+
+/**
+ * @brief Stores CharBuffer1 in `page_id` with `PS_SecurityStoreChar` and authenticates the ACK.
+ *
+ * @param[in] dev Instance.
+ * @param[in] page_id Page to store the template in.
+ * @return ESP_OK on success; otherwise as `fingerprint_dev_secure_search()`.
+ */
+esp_err_t fingerprint_dev_secure_store(fingerprint_handle_t dev, uint16_t page_id);
+
+/**
+ * @brief Variants of the functions above on the default instance.
+ * @{
+ */
+esp_err_t fingerprint_secure_set_key(const uint8_t *key);
+esp_err_t fingerprint_secure_end(void);
+esp_err_t fingerprint_secure_search(uint16_t start_page, uint16_t page_count, fingerprint_match_result_t *result);
+esp_err_t fingerprint_secure_identify(fingerprint_match_result_t *result);
+esp_err_t fingerprint_secure_store(uint16_t page_id);
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FINGERPRINT_SECURE_H
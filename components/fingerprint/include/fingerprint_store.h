@@ -0,0 +1,159 @@
+/**
+ * @file fingerprint_store.h
+ * @brief Template database in a memory-mapped flash partition
+ *
+ * Templates stay in flash and are read through the cache with `esp_partition_mmap()`,
+ * so nothing is copied into the heap at boot and matching or export reads them in place.
+ *
+ * The partition is split into two equal banks, one of them in use. Bank layout (all offsets
+ * fixed at format time and checked against the partition size when the store is opened):
+ * - header sector: magic, version, template length, record stride, slot count, generation
+ * - index: one `{user_id, state}` entry per slot, in slot order
+ * - records: `stride`-byte template slots, record i belongs to index entry i
+ *
+ * Enrolling appends a slot and deleting tombstones one; both only clear bits in erased
+ * flash. Slots fill in order, so opening a store binary-searches the index for the first
+ * free one and takes the same time however many users are enrolled. When a put finds every
+ * slot used, the live templates are copied into the other bank, which takes over once its
+ * header (with the next generation) is written; a reset during the copy leaves the old bank
+ * in use. As tombstones need bits to be programmed twice, the partition must not be
+ * encrypted.
+ *
+ * partitions.csv:
+ * @code
+ * fp_templates, data, 0x46, , 1M,
+ * @endcode
+ */
+#ifndef FINGERPRINT_STORE_H
+#define FINGERPRINT_STORE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Handle of an opened template store.
+ */
+typedef struct fingerprint_store_t *fingerprint_store_handle_t;
+
+/**
+ * @brief Configuration of `fingerprint_store_open()`.
+ */
+typedef struct {
+    const char *partition_label;    /**< Data partition holding the store. */
+    size_t template_len;            /**< Bytes per template. */
+    bool format_if_invalid;         /**< Format a partition that holds no store, or one for another `template_len`. */
+} fingerprint_store_config_t;
+
+/**
+ * @brief Maps a template store partition.
+ *
+ * An erased partition is always formatted.
+ *
+ * @param[in] config Store configuration.
+ * @param[out] ret_handle Receives the handle on success.
+ * @return
+ * - ESP_OK on success
+ * - ESP_ERR_INVALID_ARG if an argument is NULL or `template_len` is 0
+ * - ESP_ERR_NOT_FOUND if there is no such data partition
+ * - ESP_ERR_NOT_SUPPORTED if the partition is encrypted
+ * - ESP_ERR_INVALID_SIZE if half the partition cannot hold a single template
+ * - ESP_ERR_INVALID_VERSION if the partition holds another format and `format_if_invalid` is false
+ * - ESP_ERR_NO_MEM if the handle could not be allocated
+ * - otherwise the error of the mapping or format
+ */
+esp_err_t fingerprint_store_open(const fingerprint_store_config_t *config, fingerprint_store_handle_t *ret_handle);
+
+/**
+ * @brief Unmaps the store; pointers returned by it become invalid.
+ *
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG if `store` is NULL.
+ */
+esp_err_t fingerprint_store_close(fingerprint_store_handle_t store);
+
+/**
+ * @brief Erases the partition and writes an empty store.
+ *
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG if `store` is NULL, otherwise the flash error.
+ */
+esp_err_t fingerprint_store_format(fingerprint_store_handle_t store);
+
+/**
+ * @brief Appends a template, tombstoning the one stored under `user_id` if there is one.
+ *
+ * If every slot is used, the live templates are compacted into the other bank first, which
+ * moves them: pointers and slot numbers obtained before the call become invalid.
+ *
+ * @param[in] store Store.
+ * @param[in] user_id Caller's ID for the template.
+ * @param[in] data Template data.
+ * @param[in] len Must equal `template_len`.
+ * @return
+ * - ESP_OK on success
+ * - ESP_ERR_INVALID_ARG if `store` or `data` is NULL
+ * - ESP_ERR_INVALID_SIZE if `len` differs from `template_len`
+ * - ESP_ERR_NO_MEM if every slot holds a live template
+ * - otherwise the flash error
+ */
+esp_err_t fingerprint_store_put(fingerprint_store_handle_t store, uint32_t user_id, const uint8_t *data, size_t len);
+
+/**
+ * @brief Tombstones the template stored under `user_id`.
+ *
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG if `store` is NULL, ESP_ERR_NOT_FOUND if there is no such ID, otherwise the flash error.
+ */
+esp_err_t fingerprint_store_delete(fingerprint_store_handle_t store, uint32_t user_id);
+
+/**
+ * @brief Template stored under `user_id`, read in place.
+ *
+ * @param[in] store Store.
+ * @param[in] user_id ID given to `fingerprint_store_put()`.
+ * @param[out] data Receives a pointer into the mapped partition (`template_len` bytes), valid until the next put,
+ *                  which may compact the store into the other bank.
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG if an argument is NULL, ESP_ERR_NOT_FOUND if there is no such ID.
+ */
+esp_err_t fingerprint_store_get(fingerprint_store_handle_t store, uint32_t user_id, const uint8_t **data);
+
+/**
+ * @brief Slots written since the last format or compaction, live or tombstoned.
+ */
+size_t fingerprint_store_slots(fingerprint_store_handle_t store);
+
+/**
+ * @brief Template in slot `index`, read in place.
+ *
+ * Iterating `index` over [0, `fingerprint_store_slots()`) visits every stored template.
+ *
+ * @param[in] store Store.
+ * @param[in] index Slot.
+ * @param[out] user_id Receives the template's ID.
+ * @return Pointer into the mapped partition, or NULL if the slot is free, tombstoned or out of range.
+ */
+const uint8_t *fingerprint_store_slot(fingerprint_store_handle_t store, size_t index, uint32_t *user_id);
+
+/**
+ * @brief Number of live templates; walks the index.
+ */
+size_t fingerprint_store_count(fingerprint_store_handle_t store);
+
+/**
+ * @brief Slots of one bank, i.e. the most live templates the store can hold.
+ */
+size_t fingerprint_store_capacity(fingerprint_store_handle_t store);
+
+/**
+ * @brief Template length the store was formatted for.
+ */
+size_t fingerprint_store_template_len(fingerprint_store_handle_t store);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FINGERPRINT_STORE_H
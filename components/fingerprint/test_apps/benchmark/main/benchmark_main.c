@@ -0,0 +1,229 @@
+/*
+ * Hardware-in-the-loop benchmark of the fingerprint driver.
+ *
+ * At every baud rate the module supports, runs CONFIG_BENCH_ITERATIONS identify
+ * cycles and template transfers plus one image upload, then prints the driver's
+ * own instrumentation (fingerprint_get_stats()) as "BENCH ..." key=value lines
+ * that pytest_fingerprint_benchmark.py parses. Keep a finger (or a test finger)
+ * on the sensor, and store at least one template, to exercise every stage.
+ * Identifies that stop before PS_Search (no finger, poor image) are counted
+ * apart, so the test can tell a search benchmark from a capture short-circuit.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "fingerprint.h"
+
+#define TEMPLATE_BUFFER_SIZE 8192
+#define IDENTIFY_TIMEOUT_MS 10000
+
+static const int bench_bauds[] = { 9600, 19200, 38400, 57600, 115200 };
+
+static const char *flow_names[FINGERPRINT_FLOW_MAX] = { "identify", "enroll", "transfer" };
+
+typedef struct {
+    uint8_t data[TEMPLATE_BUFFER_SIZE];
+    size_t len;
+    size_t pos;
+} template_buffer_t;
+
+static template_buffer_t template_buffer;
+
+static esp_err_t buffer_write(const uint8_t *data, size_t len, void *user_ctx) {
+    template_buffer_t *buf = user_ctx;
+    if (buf->len + len > sizeof(buf->data)) {
+        return ESP_ERR_NO_MEM;
+    }
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+    return ESP_OK;
+}
+
+static int buffer_read(uint8_t *data, size_t len, void *user_ctx) {
+    template_buffer_t *buf = user_ctx;
+    size_t n = buf->len - buf->pos;
+    if (n > len) {
+        n = len;
+    }
+    memcpy(data, buf->data + buf->pos, n);
+    buf->pos += n;
+    return (int)n;
+}
+
+static esp_err_t image_sink(const uint8_t *data, size_t len, void *user_ctx) {
+    (void)data;
+    (void)len;
+    (void)user_ctx;
+    return ESP_OK;
+}
+
+/* Percentile estimated from the log2 buckets: linear inside the bucket, capped at max_us. */
+static uint32_t histogram_percentile(const fingerprint_histogram_t *h, uint32_t pct) {
+    if (h->count == 0) {
+        return 0;
+    }
+    uint32_t rank = (uint32_t)(((uint64_t)h->count * pct + 99) / 100);
+    uint32_t seen = 0;
+    for (int b = 0; b < FINGERPRINT_STATS_BUCKETS; b++) {
+        if (h->buckets[b] == 0 || seen + h->buckets[b] < rank) {
+            seen += h->buckets[b];
+            continue;
+        }
+        uint32_t lower = b == 0 ? 0 : 1000u << (b - 1);
+        uint32_t upper = b == FINGERPRINT_STATS_BUCKETS - 1 ? h->max_us : 1000u << b;
+        if (upper > h->max_us) {
+            upper = h->max_us;
+        }
+        if (lower > upper) {
+            lower = upper;
+        }
+        return lower + (uint32_t)((uint64_t)(upper - lower) * (rank - seen) / h->buckets[b]);
+    }
+    return h->max_us;
+}
+
+static void print_histogram(int baud, const char *stage, const char *phase, const fingerprint_histogram_t *h) {
+    if (h->count == 0) {
+        return;
+    }
+    printf("BENCH baud=%d stage=%s phase=%s count=%" PRIu32 " p50_us=%" PRIu32 " p99_us=%" PRIu32 " max_us=%" PRIu32 "\n",
+           baud, stage, phase, h->count, histogram_percentile(h, 50), histogram_percentile(h, 99), h->max_us);
+}
+
+static void report(int baud, int64_t elapsed_us) {
+    static fingerprint_stats_t stats;
+    if (fingerprint_get_stats(&stats) != ESP_OK) {
+        printf("BENCH baud=%d error=stats\n", baud);
+        return;
+    }
+
+    for (size_t i = 0; i < stats.command_count; i++) {
+        const fingerprint_command_stats_t *c = &stats.commands[i];
+        char stage[8];
+        snprintf(stage, sizeof(stage), "0x%02X", c->command);
+        print_histogram(baud, stage, "send", &c->send);
+        print_histogram(baud, stage, "process", &c->process);
+        print_histogram(baud, stage, "rx", &c->rx);
+    }
+    for (int f = 0; f < FINGERPRINT_FLOW_MAX; f++) {
+        print_histogram(baud, flow_names[f], "total", &stats.flows[f]);
+    }
+
+    uint32_t frames = stats.frames_tx + stats.frames_rx;
+    double seconds = elapsed_us / 1e6;
+    printf("BENCH baud=%d summary frames=%" PRIu32 " elapsed_us=%" PRId64 " frames_per_sec=%.1f bytes_per_sec=%.0f"
+           " checksum_errors=%" PRIu32 " line_errors=%" PRIu32 " frames_dropped=%" PRIu32
+           " timeouts=%" PRIu32 " retries=%" PRIu32 " resyncs=%" PRIu32 "\n",
+           baud, frames, elapsed_us, seconds > 0 ? frames / seconds : 0.0,
+           seconds > 0 ? (double)(stats.bytes_tx + stats.bytes_rx) / seconds : 0.0,
+           stats.checksum_errors, stats.line_errors, stats.frames_dropped,
+           stats.timeouts, stats.retries, stats.resyncs);
+}
+
+static int find_stored_template(void) {
+    if (!fingerprint_index_is_valid() && fingerprint_index_sync() != ESP_OK) {
+        return -1;
+    }
+    for (int page = 0; page < FINGERPRINT_INDEX_CAPACITY; page++) {
+        if (fingerprint_index_is_used((uint16_t)page)) {
+            return page;
+        }
+    }
+    return -1;
+}
+
+typedef struct {
+    int completed;  /* Identifies that reported a result */
+    int searched;   /* Of those, the ones that reached PS_Search (match or no match) */
+    int matched;
+} identify_counts_t;
+
+static void run_identify(int iterations, identify_counts_t *counts) {
+    fingerprint_identify_config_t config = {
+        .address = DEFAULT_FINGERPRINT_ADDRESS,
+        .start_page = 0,
+        .page_count = FINGERPRINT_INDEX_CAPACITY,
+        .notify_task = xTaskGetCurrentTaskHandle(),
+    };
+    for (int i = 0; i < iterations; i++) {
+        if (fingerprint_identify_async(&config) != ESP_OK) {
+            return;
+        }
+        uint32_t status;
+        if (xTaskNotifyWait(0, 0, &status, pdMS_TO_TICKS(IDENTIFY_TIMEOUT_MS)) != pdTRUE) {
+            printf("BENCH error=identify_timeout iteration=%d\n", i);
+            return;
+        }
+        counts->completed++;
+        if (status == FINGERPRINT_OK || status == FINGERPRINT_NOT_FOUND) {
+            counts->searched++;
+        }
+        if (status == FINGERPRINT_OK) {
+            counts->matched++;
+        }
+    }
+}
+
+static void run_transfers(int iterations, uint16_t page) {
+    for (int i = 0; i < iterations; i++) {
+        size_t count = 0;
+        template_buffer.len = 0;
+        template_buffer.pos = 0;
+        if (fingerprint_export_templates(&page, 1, buffer_write, &template_buffer, &count) != ESP_OK) {
+            printf("BENCH error=export iteration=%d\n", i);
+            return;
+        }
+#if CONFIG_BENCH_IMPORT_TEMPLATES
+        if (fingerprint_import_templates(buffer_read, &template_buffer, &count) != ESP_OK) {
+            printf("BENCH error=import iteration=%d\n", i);
+            return;
+        }
+#else
+        (void)buffer_read;
+#endif
+    }
+}
+
+void app_main(void) {
+    fingerprint_set_pins(CONFIG_BENCH_UART_TXD, CONFIG_BENCH_UART_RXD);
+    if (fingerprint_init() != ESP_OK) {
+        printf("BENCH error=init\n");
+        printf("BENCH_DONE\n");
+        return;
+    }
+
+    int page = find_stored_template();
+    if (page < 0) {
+        printf("BENCH note=no_template transfers=skipped\n");
+    }
+
+    for (size_t b = 0; b < sizeof(bench_bauds) / sizeof(bench_bauds[0]); b++) {
+        int baud = bench_bauds[b];
+        if (fingerprint_negotiate_baudrate(baud) != ESP_OK) {
+            printf("BENCH baud=%d note=unsupported\n", baud);
+            continue;
+        }
+        fingerprint_reset_stats();
+        int64_t start = esp_timer_get_time();
+
+        identify_counts_t counts = { 0 };
+        run_identify(CONFIG_BENCH_ITERATIONS, &counts);
+        printf("BENCH baud=%d identify completed=%d searched=%d matched=%d\n",
+               baud, counts.completed, counts.searched, counts.matched);
+        if (page >= 0) {
+            run_transfers(CONFIG_BENCH_ITERATIONS, (uint16_t)page);
+        }
+        size_t image_len = 0;
+        if (fingerprint_upload_image(image_sink, NULL, &image_len) != ESP_OK) {
+            printf("BENCH baud=%d error=upload\n", baud);
+        }
+
+        report(baud, esp_timer_get_time() - start);
+    }
+
+    fingerprint_negotiate_baudrate(DEFAULT_BAUD_RATE);
+    printf("BENCH_DONE\n");
+}
@@ -0,0 +1,81 @@
+# SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+# SPDX-License-Identifier: CC0-1.0
+import json
+import os
+import re
+
+import pytest
+from pytest_embedded import Dut
+
+BENCH_LINE = re.compile(r'^BENCH (.*)$')
+BENCH_DONE_TIMEOUT_S = 1800
+# A p99 that grows by more than this fraction over the baseline fails the run.
+REGRESSION_TOLERANCE = 0.20
+
+
+def parse_fields(text: str) -> dict:
+    fields = {}
+    for token in text.split():
+        key, sep, value = token.partition('=')
+        if not sep:
+            fields[key] = True
+            continue
+        try:
+            fields[key] = float(value) if '.' in value else int(value)
+        except ValueError:
+            fields[key] = value
+    return fields
+
+
+def collect(dut: Dut) -> list:
+    records = []
+    while True:
+        match = dut.expect(re.compile(rb'(BENCH_DONE|BENCH [^\r\n]*)'), timeout=BENCH_DONE_TIMEOUT_S)
+        line = match.group(1).decode()
+        if line == 'BENCH_DONE':
+            return records
+        records.append(parse_fields(BENCH_LINE.match(line).group(1)))
+
+
+def p99_by_stage(records: list) -> dict:
+    return {
+        f"{r['baud']}/{r['stage']}/{r['phase']}": r['p99_us']
+        for r in records
+        if 'p99_us' in r
+    }
+
+
+@pytest.mark.supported_targets
+@pytest.mark.generic
+def test_fingerprint_benchmark(dut: Dut) -> None:
+    records = collect(dut)
+    assert not any('error' in r for r in records), [r for r in records if 'error' in r]
+
+    summaries = [r for r in records if 'summary' in r]
+    assert summaries, 'no baud rate could be negotiated'
+    for s in summaries:
+        assert s['checksum_errors'] == 0, s
+        assert s['line_errors'] == 0, s
+        assert s['frames_per_sec'] > 0, s
+
+    # Identify timings only measure the search if identifies got past the capture
+    identifies = [r for r in records if 'identify' in r]
+    assert identifies, 'no identify counts reported'
+    for r in identifies:
+        assert r['searched'] > 0, f'no identify reached PS_Search (finger on the sensor?): {r}'
+
+    results = {'summaries': summaries, 'identifies': identifies, 'p99_us': p99_by_stage(records)}
+    with open('benchmark_results.json', 'w') as f:
+        json.dump(results, f, indent=2)
+
+    baseline_path = os.environ.get('FINGERPRINT_BENCH_BASELINE')
+    if not baseline_path:
+        return
+    with open(baseline_path) as f:
+        baseline = json.load(f)['p99_us']
+    regressions = {
+        stage: (baseline[stage], p99)
+        for stage, p99 in results['p99_us'].items()
+        if stage in baseline and p99 > baseline[stage] * (1 + REGRESSION_TOLERANCE)
+    }
+    assert not regressions, f'p99 regressions over {REGRESSION_TOLERANCE:.0%}: {regressions}'
@@ -0,0 +1,10 @@
+# SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+# SPDX-License-Identifier: CC0-1.0
+
+
+def pytest_configure(config) -> None:  # type: ignore
+    # Runners carrying this marker have the driver UART (UART2) and the emulator UART (UART1)
+    # cross-wired with jumpers; the emulator stress test cannot run anywhere else.
+    config.addinivalue_line(
+        'markers', 'fingerprint_uart_loopback: UART1 and UART2 TX/RX cross-wired for the sensor emulator'
+    )
@@ -0,0 +1,98 @@
+/*
+ * Load test of the fingerprint driver against the sensor emulator.
+ *
+ * The driver runs on UART2 (fingerprint_init()), the emulator on UART1; jumper
+ * the driver's TX to the emulator's RX and back. Two passes of CONFIG_STRESS_CYCLES
+ * identify cycles run back to back, the first on a clean link, the second with
+ * the configured reply drops, bit flips and line noise. Results are printed as
+ * "STRESS ..." key=value lines for pytest_fingerprint_emulator.py.
+ */
+#include <stdio.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "fingerprint.h"
+#include "fingerprint_emulator.h"
+
+#define MATCH_PAGE 7
+#define RESULT_TIMEOUT_MS 5000  // Far above the driver's worst case with every retry used
+
+static void run_pass(const char *name, fingerprint_emulator_handle_t emu) {
+    fingerprint_identify_config_t config = {
+        .address = DEFAULT_FINGERPRINT_ADDRESS,
+        .start_page = 0,
+        .page_count = FINGERPRINT_INDEX_CAPACITY,
+        .notify_task = xTaskGetCurrentTaskHandle(),
+    };
+    static fingerprint_stats_t stats;
+    fingerprint_emulator_counters_t before, after;
+    uint32_t matched = 0, failed = 0, hung = 0;
+
+    fingerprint_reset_stats();
+    fingerprint_emulator_get_counters(emu, &before);
+    int64_t start = esp_timer_get_time();
+
+    for (int i = 0; i < CONFIG_STRESS_CYCLES; i++) {
+        uint32_t status;
+        if (fingerprint_identify_async(&config) != ESP_OK) {
+            failed++;
+            continue;
+        }
+        if (xTaskNotifyWait(0, 0, &status, pdMS_TO_TICKS(RESULT_TIMEOUT_MS)) != pdTRUE) {
+            hung++;
+            break;
+        }
+        if (status == FINGERPRINT_OK) {
+            matched++;
+        } else {
+            failed++;
+        }
+    }
+
+    int64_t elapsed_us = esp_timer_get_time() - start;
+    fingerprint_get_stats(&stats);
+    fingerprint_emulator_get_counters(emu, &after);
+    uint32_t frames = stats.frames_tx + stats.frames_rx;
+    printf("STRESS pass=%s cycles=%d matched=%" PRIu32 " failed=%" PRIu32 " hung=%" PRIu32
+           " frames=%" PRIu32 " frames_per_sec=%.1f timeouts=%" PRIu32 " checksum_errors=%" PRIu32
+           " retries=%" PRIu32 " resyncs=%" PRIu32 " emu_dropped=%" PRIu32 " emu_corrupted=%" PRIu32
+           " emu_noise=%" PRIu32 " emu_bad_frames=%" PRIu32 "\n",
+           name, CONFIG_STRESS_CYCLES, matched, failed, hung,
+           frames, elapsed_us > 0 ? frames * 1e6 / elapsed_us : 0.0,
+           stats.timeouts, stats.checksum_errors, stats.retries, stats.resyncs,
+           after.dropped - before.dropped, after.corrupted - before.corrupted,
+           after.noise - before.noise, after.bad_frames - before.bad_frames);
+}
+
+void app_main(void) {
+    fingerprint_emulator_config_t emu_config = FINGERPRINT_EMULATOR_DEFAULT_CONFIG();
+    emu_config.uart_port = UART_NUM_1;
+    emu_config.tx_pin = CONFIG_STRESS_EMULATOR_TXD;
+    emu_config.rx_pin = CONFIG_STRESS_EMULATOR_RXD;
+    emu_config.match_page = MATCH_PAGE;
+    emu_config.seed = 0x5EED;
+    fingerprint_emulator_handle_t emu;
+    if (fingerprint_emulator_new(&emu_config, &emu) != ESP_OK) {
+        printf("STRESS error=emulator\n");
+        printf("STRESS_DONE\n");
+        return;
+    }
+    fingerprint_emulator_store(emu, MATCH_PAGE);
+    fingerprint_emulator_set_finger(emu, true);
+
+    fingerprint_set_pins(CONFIG_STRESS_DRIVER_TXD, CONFIG_STRESS_DRIVER_RXD);
+    if (fingerprint_init() != ESP_OK) {
+        printf("STRESS error=init\n");
+        printf("STRESS_DONE\n");
+        return;
+    }
+
+    run_pass("clean", emu);
+    fingerprint_emulator_set_faults(emu, CONFIG_STRESS_DROP_PERMILLE, CONFIG_STRESS_CORRUPT_PERMILLE,
+                                    CONFIG_STRESS_NOISE_PERMILLE);
+    run_pass("faulty", emu);
+    fingerprint_emulator_set_faults(emu, 0, 0, 0);
+
+    printf("STRESS_DONE\n");
+}
@@ -0,0 +1,45 @@
+# SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+# SPDX-License-Identifier: CC0-1.0
+import re
+
+import pytest
+from pytest_embedded import Dut
+
+STRESS_DONE_TIMEOUT_S = 3600
+
+
+def parse_fields(text: str) -> dict:
+    fields = {}
+    for token in text.split():
+        key, _, value = token.partition('=')
+        try:
+            fields[key] = float(value) if '.' in value else int(value)
+        except ValueError:
+            fields[key] = value
+    return fields
+
+
+@pytest.mark.esp32
+@pytest.mark.esp32s3
+@pytest.mark.fingerprint_uart_loopback
+def test_fingerprint_emulator_stress(dut: Dut) -> None:
+    passes = {}
+    while True:
+        match = dut.expect(re.compile(rb'(STRESS_DONE|STRESS [^\r\n]*)'), timeout=STRESS_DONE_TIMEOUT_S)
+        line = match.group(1).decode()
+        if line == 'STRESS_DONE':
+            break
+        fields = parse_fields(line[len('STRESS '):])
+        assert 'error' not in fields, fields
+        passes[fields['pass']] = fields
+
+    clean = passes['clean']
+    assert clean['matched'] == clean['cycles'], clean
+    assert clean['timeouts'] == 0 and clean['checksum_errors'] == 0, clean
+
+    # Faults may fail individual cycles, but the driver must always come back
+    faulty = passes['faulty']
+    assert faulty['hung'] == 0, faulty
+    assert faulty['matched'] + faulty['failed'] == faulty['cycles'], faulty
+    if faulty['emu_corrupted'] or faulty['emu_dropped']:
+        assert faulty['retries'] > 0, faulty